@@ -10,6 +10,8 @@
 #include <IOKit/IOBufferMemoryDescriptor.h>
 #include <IOKit/IOLib.h>
 #include <IOKit/IOMessage.h>
+#include <libkern/OSAtomic.h>
+#include <kern/clock.h>
 
 #include <IOKit/hid/IOHIDKeys.h>
 
@@ -20,10 +22,14 @@
 #include <IOKit/usb/IOUSBLog.h>
 
 #include "XboxControllerHID.h"
+#include "XboxControllerHIDTraceClient.h"
 
 #define super IOHIDDevice
 OSDefineMetaClassAndStructors(XboxControllerHID, super)
 
+// capabilities of the report descriptors parsed so far, shared by all instances
+static XBCapabilitiesCacheEntry gCapabilitiesCache[kCapabilitiesCacheSize];
+
 
 // Do what is necessary to start device before probe is called.
 bool
@@ -37,10 +43,42 @@ XboxControllerHID::init(OSDictionary *properties)
     }
 
     _interface = NULL;
-    _buffer = 0;
+    _numReads = 0;
+    bzero(_reads, sizeof(_reads));
+    _xbReleaseBuffer = 0;
+    _lastReportSeq = 0;
+    _lastReportRepeats = 0;
+    _lastReportLength = 0;
+    _lastReportWaiters = 0;
+    _lastReportTime = 0;
+    _suppressDuplicates = false;
+    _keepaliveInterval = 0;
+    _attachTime = 0;
+    _capabilitiesCached = false;
+    
+#if ENABLE_REPORT_TRACE
+    _traceMemory = NULL;
+    bzero(&_traceProducer, sizeof(_traceProducer));
+    _traceEnabled = false;
+    _locationID = 0;
+#endif
+    resetStatistics();
+    
+    _lastReportLock = IOLockAlloc();
+    if (!_lastReportLock)
+    {
+        return false;
+    }
+    
+#if ENABLE_REPORT_TRACE
+    _traceLock = IOSimpleLockAlloc();
+    if (!_traceLock)
+    {
+        return false;
+    }
+#endif
     _retryCount = kHIDDriverRetryCount;
-    _outstandingIO = 0;
-    _needToClose = false;
+    bzero(&_outstandingIO, sizeof(_outstandingIO));
     _maxReportSize = kMaxHIDReportSize;
     _maxOutReportSize = kMaxHIDReportSize;
     _outBuffer = 0;
@@ -48,12 +86,16 @@ XboxControllerHID::init(OSDictionary *properties)
     _deviceUsagePage = 0;
 
     _xbDeviceType = 0;
+    _xbDeviceTypeID = kDeviceTypeUnknown;
+    _xbDeviceOps = &deviceOps[kDeviceTypeUnknown];
     _xbDeviceVendor = 0;
     _xbDeviceName = 0;
     _xbDeviceHIDReportDescriptor = 0;
     _xbDeviceOptionsDict = 0;
     _xbDeviceButtonMapArray = 0;
+    _xbRemoteButtonTable = 0;
     _xbLastButtonPressed = 0;
+    _xbPadTransform = 0;
     //_xbShouldGenerateTimedEvent = false;
     _xbTimedEventsInterval = 80; // milliseconds
     _xbWorkLoop = 0;
@@ -74,11 +116,12 @@ XboxControllerHID::handleStart(IOService * provider)
 {
     HIDPreparsedDataRef parseData;
     HIDCapabilities 	myHIDCaps;
-    UInt8 *         	myHIDDesc;
-    UInt32          	hidDescSize;
+    IOBufferMemoryDescriptor *myHIDDesc;
     IOReturn        	err = kIOReturnSuccess;
+    UInt64              attachStart, attachEnd;
     
     USBLog(6, "%s[%p]::handleStart", getName(), this);
+    clock_get_uptime(&attachStart);
     if( !super::handleStart(provider))
     {
         USBError(1, "%s[%p]::handleStart - super::handleStart failed", getName(), this);
@@ -106,68 +149,60 @@ XboxControllerHID::handleStart(IOService * provider)
         return false;
     }
     
+#if ENABLE_REPORT_TRACE
+    OSNumber *locationID = OSDynamicCast(OSNumber, _interface->getProperty(kUSBDevicePropertyLocationID));
+    if (locationID)
+        _locationID = locationID->unsigned32BitValue();
+#endif
+    
     if (!setupDevice()) {
         
         return false;
     }
     
-    // Get the size of the HID descriptor.
-    hidDescSize = 0;
-    err = GetHIDDescriptor(kUSBReportDesc, 0, NULL, &hidDescSize);
-    if ((err != kIOReturnSuccess) || (hidDescSize == 0))
+    // Parse the shared report descriptor in place, it is never written to
+    myHIDDesc = sharedReportDescriptor();
+    if (myHIDDesc == NULL)
     {
-        USBLog(1, "%s[%p]::handleStart : unable to get descriptor size", getName(), this);
+        USBLog(1, "%s[%p]::handleStart : unable to get report descriptor", getName(), this);
         return false;       // Won't be able to set last properties.
     }
     
-    myHIDDesc = (UInt8 *)IOMalloc(hidDescSize);
-    if (myHIDDesc == NULL)
+    // Another pad with the same descriptor has been parsed already?
+    _capabilitiesCached = findCachedCapabilities(myHIDDesc);
+    if (_capabilitiesCached)
     {
-        USBLog(1, "%s[%p]::handleStart : unable to allocate descriptor", getName(), this);
-        return false;
+        USBLog(6, "%s[%p]::handleStart - using cached capabilities", getName(), this);
     }
-    
-    // Get the real report descriptor.
-    err = GetHIDDescriptor(kUSBReportDesc, 0, myHIDDesc, &hidDescSize);
-    
-    if (err == kIOReturnSuccess)
+    else if ((err = HIDOpenReportDescriptor(myHIDDesc->getBytesNoCopy(), myHIDDesc->getLength(), &parseData, 0)) == kIOReturnSuccess)
     {
-        err = HIDOpenReportDescriptor(myHIDDesc, hidDescSize, &parseData, 0);
+        err = HIDGetCapabilities(parseData, &myHIDCaps);
         if (err == kIOReturnSuccess)
         {
-            err = HIDGetCapabilities(parseData, &myHIDCaps);
-            if (err == kIOReturnSuccess)
-            {
-                // Just get these values!
-                _deviceUsage = myHIDCaps.usage;
-                _deviceUsagePage = myHIDCaps.usagePage;
-                
-                _maxOutReportSize = myHIDCaps.outputReportByteLength;
-                _maxReportSize = (myHIDCaps.inputReportByteLength > myHIDCaps.featureReportByteLength) ?
-                myHIDCaps.inputReportByteLength : myHIDCaps.featureReportByteLength;
-            }
-            else
-            {
-                USBError(1, "%s[%p]::handleStart - failed getting capabilities", getName(), this);
-            }
+            // Just get these values!
+            _deviceUsage = myHIDCaps.usage;
+            _deviceUsagePage = myHIDCaps.usagePage;
             
-            HIDCloseReportDescriptor(parseData);
+            _maxOutReportSize = myHIDCaps.outputReportByteLength;
+            _maxReportSize = (myHIDCaps.inputReportByteLength > myHIDCaps.featureReportByteLength) ?
+            myHIDCaps.inputReportByteLength : myHIDCaps.featureReportByteLength;
+            
+            cacheCapabilities(myHIDDesc);
         }
         else
         {
-            USBError(1, "%s[%p]::handleStart - failed parsing descriptor", getName(), this);
+            USBError(1, "%s[%p]::handleStart - failed getting capabilities", getName(), this);
         }
         
+        HIDCloseReportDescriptor(parseData);
     }
     else
     {
-        USBLog(1, "%s[%p]::handleStart : error getting hid descriptor: %X", getName(), this, err);
+        USBError(1, "%s[%p]::handleStart - failed parsing descriptor", getName(), this);
     }
     
-    if (myHIDDesc)
-    {
-        IOFree(myHIDDesc, hidDescSize);
-    }
+    clock_get_uptime(&attachEnd);
+    absolutetime_to_nanoseconds(attachEnd - attachStart, &_attachTime);
     
     // Set HID Manager properties in IO registry.
     // Will now be done by IOHIDDevice::start calling newTransportString, etc.
@@ -176,6 +211,82 @@ XboxControllerHID::handleStart(IOService * provider)
 }
 
 
+//
+// Parsing a report descriptor only yields usage, usage page and the report sizes, and every pad of a type
+// has the same descriptor. So the results are kept in a small kext-global cache keyed by a hash of the
+// descriptor bytes, and only the first pad of a type pays for HIDOpenReportDescriptor().
+//
+static UInt64
+hashDescriptor(const UInt8 *bytes, UInt32 length)
+{
+    UInt64 hash = 0xCBF29CE484222325ULL;    // FNV-1a
+    
+    for (UInt32 i = 0; i < length; i++) {
+        
+        hash ^= bytes[i];
+        hash *= 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+bool
+XboxControllerHID::findCachedCapabilities(IOBufferMemoryDescriptor *desc)
+{
+    UInt32 length = desc->getLength();
+    UInt64 hash = hashDescriptor((const UInt8 *)desc->getBytesNoCopy(), length);
+    
+    for (UInt32 i = 0; i < kCapabilitiesCacheSize; i++) {
+        
+        XBCapabilitiesCacheEntry *entry = &gCapabilitiesCache[i];
+        
+        if (entry->state != kCapabilitiesCacheEntryReady)
+            continue;
+        
+        // pairs with the barrier in cacheCapabilities()
+        OSMemoryBarrier();
+        if (entry->hash != hash || entry->length != length)
+            continue;
+        
+        _deviceUsage = entry->usage;
+        _deviceUsagePage = entry->usagePage;
+        _maxReportSize = entry->maxReportSize;
+        _maxOutReportSize = entry->maxOutReportSize;
+        return true;
+    }
+    
+    return false;
+}
+
+void
+XboxControllerHID::cacheCapabilities(IOBufferMemoryDescriptor *desc)
+{
+    UInt32 length = desc->getLength();
+    UInt64 hash = hashDescriptor((const UInt8 *)desc->getBytesNoCopy(), length);
+    
+    for (UInt32 i = 0; i < kCapabilitiesCacheSize; i++) {
+        
+        XBCapabilitiesCacheEntry *entry = &gCapabilitiesCache[i];
+        
+        // claim a free entry, fill it in and only then make it visible
+        if (!OSCompareAndSwap(kCapabilitiesCacheEntryFree, kCapabilitiesCacheEntryFilling, &entry->state))
+            continue;
+        
+        entry->hash = hash;
+        entry->length = length;
+        entry->usage = _deviceUsage;
+        entry->usagePage = _deviceUsagePage;
+        entry->maxReportSize = _maxReportSize;
+        entry->maxOutReportSize = _maxOutReportSize;
+        
+        OSMemoryBarrier();
+        entry->state = kCapabilitiesCacheEntryReady;
+        return;
+    }
+    
+    // full, the next pad will just parse again
+}
+
+
 void
 XboxControllerHID::handleStop(IOService * provider)
 {
@@ -199,10 +310,20 @@ XboxControllerHID::handleStop(IOService * provider)
         _outBuffer = NULL;
     }
     
-    if (_buffer)
+    for (UInt32 i = 0; i < kMaxInterruptReads; i++)
+    {
+        if (_reads[i].buffer)
+        {
+            _reads[i].buffer->release();
+            _reads[i].buffer = NULL;
+        }
+    }
+    _numReads = 0;
+    
+    if (_xbReleaseBuffer)
     {
-        _buffer->release();
-        _buffer = NULL;
+        _xbReleaseBuffer->release();
+        _xbReleaseBuffer = NULL;
     }
     
     if (_deviceDeadCheckThread)
@@ -226,6 +347,21 @@ XboxControllerHID::free()
 {
     USBLog(6, "%s[%p]::free", getName(), this);
     
+    if (_lastReportLock)
+    {
+        IOLockFree(_lastReportLock);
+        _lastReportLock = NULL;
+    }
+    
+#if ENABLE_REPORT_TRACE
+    // the client holds the provider until it closes, so the ring is gone by now
+    if (_traceLock)
+    {
+        IOSimpleLockFree(_traceLock);
+        _traceLock = NULL;
+    }
+#endif
+    
     super::free();
 }
 
@@ -394,6 +530,28 @@ XboxControllerHID::setProperties(OSObject *properties)
     dict = OSDynamicCast(OSDictionary, properties);
     if (dict) {
         
+        // Check if client wants to start a new measurement
+        if (dict->getObject(kClientResetStatisticsKey)) {
+            
+            // inside the gate, so no completion updates a counter while it is cleared
+            if (_gate)
+                _gate->runAction(resetStatisticsAction);
+            else
+                resetStatisticsAction(this, NULL, NULL, NULL, NULL);
+            return kIOReturnSuccess;
+        }
+        
+        // Check if client wants to read the statistics
+        if (dict->getObject(kClientPublishStatisticsKey)) {
+            
+            // inside the gate, so the counters and histograms are of the same moment
+            if (_gate)
+                _gate->runAction(publishStatisticsAction);
+            else
+                publishStatistics();
+            return kIOReturnSuccess;
+        }
+        
         // Check if client wants to manipulate device options
         deviceType = OSDynamicCast(OSString, dict->getObject(kTypeKey));
         if (deviceType && _xbDeviceType->isEqualTo(deviceType)) {
@@ -401,6 +559,19 @@ XboxControllerHID::setProperties(OSObject *properties)
             USBLog(6, "%s[%p]::setProperties - change properties for a %s device",
                    getName(), this, deviceType->getCStringNoCopy());
             
+            // Check if client wants to remap the remote's buttons
+            OSArray *buttonMap = OSDynamicCast(OSArray, dict->getObject(kDeviceButtonMapKey));
+            if (buttonMap) {
+                
+                // built and swapped inside the gate, so no completion decodes a report with a half-built table
+                if (_gate)
+                    _gate->runAction(setRemoteButtonMapAction, buttonMap);
+                else
+                    setRemoteButtonMap(buttonMap);
+                
+                return kIOReturnSuccess;
+            }
+            
             OSString *optionKey = OSDynamicCast(OSString, dict->getObject(kClientOptionKeyKey));
             OSObject *optionValue = OSDynamicCast(OSObject, dict->getObject(kClientOptionValueKey));
             
@@ -437,6 +608,210 @@ XboxControllerHID::setProperties(OSObject *properties)
     return kIOReturnError;
 }
 
+// log2 histograms of nanoseconds: bucket n counts values in [2^n, 2^(n+1)),
+// bucket 0 also counts 0 and the last bucket everything beyond it
+void
+XboxControllerHID::recordHistogram(XBHistogram *histogram, UInt64 interval)
+{
+    UInt64 ns;
+    UInt32 bucket = 0;
+    
+    absolutetime_to_nanoseconds(interval, &ns);
+    
+    if (ns)
+        bucket = 63 - __builtin_clzll(ns);
+    if (bucket >= kHistogramBuckets)
+        bucket = kHistogramBuckets - 1;
+    
+    histogram->buckets[bucket]++;
+}
+
+void
+XboxControllerHID::publishHistogram(OSDictionary *stats, const char *key, const XBHistogram *histogram)
+{
+    OSArray *buckets = OSArray::withCapacity(kHistogramBuckets);
+    OSNumber *number;
+    
+    if (!buckets)
+        return;
+    
+    for (UInt32 i = 0; i < kHistogramBuckets; i++) {
+        
+        number = OSNumber::withNumber(histogram->buckets[i], 64);
+        if (number) {
+            buckets->setObject(number);
+            number->release();
+        }
+    }
+    
+    stats->setObject(key, buckets);
+    buckets->release();
+}
+
+// Statistics are kept as plain counters on the I/O path and only turned into registry
+// properties when a client asks for them
+IOReturn
+XboxControllerHID::publishStatisticsAction(OSObject *target, void *arg0, void *arg1, void *arg2, void *arg3)
+{
+    XboxControllerHID *me = OSDynamicCast(XboxControllerHID, target);
+    
+    if (me)
+        me->publishStatistics();
+    return kIOReturnSuccess;
+}
+
+// the cleared statistics replace the published ones
+IOReturn
+XboxControllerHID::resetStatisticsAction(OSObject *target, void *arg0, void *arg1, void *arg2, void *arg3)
+{
+    XboxControllerHID *me = OSDynamicCast(XboxControllerHID, target);
+    
+    if (me) {
+        me->resetStatistics();
+        me->publishStatistics();
+    }
+    return kIOReturnSuccess;
+}
+
+void
+XboxControllerHID::resetStatistics()
+{
+    _reportsDelivered = 0;
+    _reportsSuppressed = 0;
+    _lastCompletionTime = 0;
+    bzero(&_reportLatencies, sizeof(_reportLatencies));
+    bzero(&_reportIntervals, sizeof(_reportIntervals));
+    
+    for (UInt32 i = 0; i < kNumErrorCounters; i++)
+        _errorCounts[i] = 0;
+    // a recovery in progress is still timed, into the new measurement
+    if (!_haltPending)
+        _haltStartTime = 0;
+    _haltRecoveryTotal = 0;
+    bzero(&_haltRecoveryTimes, sizeof(_haltRecoveryTimes));
+    bzero(&_deadDeviceCheckTimes, sizeof(_deadDeviceCheckTimes));
+}
+
+// registry names of the XBErrorCounter entries
+static const char *gErrorCounterNames[kNumErrorCounters] = {
+    "Overrun",
+    "NotResponding",
+    "Aborted",
+    "Underrun",
+    "PipeStalled",
+    "LinkErr",
+    "NotSent2Err",
+    "NotSent1Err",
+    "BufferUnderrunErr",
+    "BufferOverrunErr",
+    "WrongPIDErr",
+    "PIDCheckErr",
+    "DataToggleErr",
+    "BitstufErr",
+    "CRCErr",
+    "TransactionReturned",
+    "Other",
+};
+
+XBErrorCounter
+XboxControllerHID::errorCounterForStatus(IOReturn status)
+{
+    switch (status)
+    {
+        case kIOReturnOverrun:          return kErrorCounterOverrun;
+        case kIOReturnNotResponding:    return kErrorCounterNotResponding;
+        case kIOReturnAborted:          return kErrorCounterAborted;
+        case kIOReturnUnderrun:         return kErrorCounterUnderrun;
+        case kIOUSBPipeStalled:         return kErrorCounterPipeStalled;
+        case kIOUSBLinkErr:             return kErrorCounterLink;
+        case kIOUSBNotSent2Err:         return kErrorCounterNotSent2;
+        case kIOUSBNotSent1Err:         return kErrorCounterNotSent1;
+        case kIOUSBBufferUnderrunErr:   return kErrorCounterBufferUnderrun;
+        case kIOUSBBufferOverrunErr:    return kErrorCounterBufferOverrun;
+        case kIOUSBWrongPIDErr:         return kErrorCounterWrongPID;
+        case kIOUSBPIDCheckErr:         return kErrorCounterPIDCheck;
+        case kIOUSBDataToggleErr:       return kErrorCounterDataToggle;
+        case kIOUSBBitstufErr:          return kErrorCounterBitstuf;
+        case kIOUSBCRCErr:              return kErrorCounterCRC;
+        case kIOUSBTransactionReturned: return kErrorCounterTransactionReturned;
+        default:                        return kErrorCounterOther;
+    }
+}
+
+void
+XboxControllerHID::publishStatistics()
+{
+    OSDictionary *stats = OSDictionary::withCapacity(10);
+    OSDictionary *errors;
+    OSNumber *number;
+    
+    if (!stats)
+        return;
+    
+#define SET_COUNTER(key, value) \
+number = OSNumber::withNumber(value, 64); \
+if (number) { \
+stats->setObject(key, number); \
+number->release(); \
+}
+    
+    SET_COUNTER(kStatReportsDeliveredKey, _reportsDelivered)
+    SET_COUNTER(kStatReportsSuppressedKey, _reportsSuppressed)
+    
+#undef SET_COUNTER
+    
+    publishHistogram(stats, kStatReportLatencyKey, &_reportLatencies);
+    publishHistogram(stats, kStatReportIntervalKey, &_reportIntervals);
+    
+    // interrupt pipe errors by status
+    errors = OSDictionary::withCapacity(kNumErrorCounters);
+    if (errors) {
+        
+        for (UInt32 i = 0; i < kNumErrorCounters; i++) {
+            
+            number = OSNumber::withNumber((UInt32)_errorCounts[i], 32);
+            if (number) {
+                errors->setObject(gErrorCounterNames[i], number);
+                number->release();
+            }
+        }
+        stats->setObject(kStatErrorsKey, errors);
+        errors->release();
+    }
+    
+    // time spent recovering, i.e. without input
+    UInt64 haltRecoveryTotal;
+    absolutetime_to_nanoseconds(_haltRecoveryTotal, &haltRecoveryTotal);
+    
+    number = OSNumber::withNumber(haltRecoveryTotal, 64);
+    if (number) {
+        stats->setObject(kStatHaltRecoveryTotalKey, number);
+        number->release();
+    }
+    publishHistogram(stats, kStatHaltRecoveryKey, &_haltRecoveryTimes);
+    publishHistogram(stats, kStatDeadDeviceCheckKey, &_deadDeviceCheckTimes);
+    
+    // how long handleStart() took, and whether it could skip the descriptor parse
+    number = OSNumber::withNumber(_attachTime, 64);
+    if (number) {
+        stats->setObject(kStatAttachTimeKey, number);
+        number->release();
+    }
+    stats->setObject(kStatCapabilitiesCachedKey, _capabilitiesCached ? kOSBooleanTrue : kOSBooleanFalse);
+    
+#if ENABLE_REPORT_TRACE
+    // records the last trace client didn't drain in time
+    number = OSNumber::withNumber(_traceProducer.dropped, 32);
+    if (number) {
+        stats->setObject(kStatTraceDroppedKey, number);
+        number->release();
+    }
+#endif
+    
+    setProperty(kStatisticsKey, stats);
+    stats->release();
+}
+
 void
 XboxControllerHID::generateTimedEvent(OSObject *object, IOTimerEventSource *tes)
 {
@@ -444,19 +819,20 @@ XboxControllerHID::generateTimedEvent(OSObject *object, IOTimerEventSource *tes)
     if (me) {
         
         //USBLog(1, "should generate event here...");
-        if (me->_xbDeviceType->isEqualTo(kDeviceTypeIRKey)) {
+        if (me->_xbDeviceOps->usesReleaseTimer) {
             
-            if (me->_buffer) {
+            // use a buffer of our own, the read buffers may be queued on the pipe
+            if (me->_xbReleaseBuffer) {
                 
                 void *bytes;
                 ByteCount  len;
                 
-                bytes = me->_buffer->getBytesNoCopy();
-                len = me->_buffer->getLength();
+                bytes = me->_xbReleaseBuffer->getBytesNoCopy();
+                len = me->_xbReleaseBuffer->getLength();
                 if (len == sizeof(XBRemoteReport)) {
                     
                     memset(bytes, 0, len);
-                    me->handleReport(me->_buffer);
+                    me->handleReport(me->_xbReleaseBuffer);
                     me->_xbLastButtonPressed = 0;
                 }
             }
@@ -467,22 +843,13 @@ XboxControllerHID::generateTimedEvent(OSObject *object, IOTimerEventSource *tes)
 void
 XboxControllerHID::setDefaultOptions()
 {
-    if (_xbDeviceType->isEqualTo(kDeviceTypePadKey)) {
+    if (_xbDeviceTypeID == kDeviceTypePad) {
         
         // fill in defaults
-        _xbDeviceOptions.pad.InvertYAxis = true;
-        _xbDeviceOptions.pad.InvertXAxis = false;
-        _xbDeviceOptions.pad.InvertRyAxis = true;
-        _xbDeviceOptions.pad.InvertRxAxis = false;
-        _xbDeviceOptions.pad.ClampButtons = true;
-        _xbDeviceOptions.pad.ClampLeftTrigger = false;
-        _xbDeviceOptions.pad.ClampRightTrigger = false;
-        //_xbDeviceOptions.pad.TriggersAreButtons = false;
-        _xbDeviceOptions.pad.LeftTriggerThreshold = 1;
-        _xbDeviceOptions.pad.RightTriggerThreshold = 1;
+        XBDefaultPadOptions(&_xbDeviceOptions.pad);
         
         // create options dict and populate it with defaults
-        _xbDeviceOptionsDict = OSDictionary::withCapacity(9);
+        _xbDeviceOptionsDict = OSDictionary::withCapacity(11);
         if (_xbDeviceOptionsDict) {
             
             OSBoolean *boolean;
@@ -502,6 +869,7 @@ boolean->release(); \
             SET_BOOLEAN(ClampButtons)
             SET_BOOLEAN(ClampLeftTrigger)
             SET_BOOLEAN(ClampRightTrigger)
+            SET_BOOLEAN(SuppressDuplicateReports)
             
             //SET_BOOLEAN(LeftTriggerIsButton)
             //SET_BOOLEAN(RightTriggerIsButton)
@@ -519,6 +887,12 @@ boolean->release(); \
                 _xbDeviceOptionsDict->setObject(kOptionRightTriggerThresholdKey, number);
                 number->release();
             }
+            
+            number = OSNumber::withNumber(_xbDeviceOptions.pad.KeepaliveInterval, 16);
+            if (number) {
+                _xbDeviceOptionsDict->setObject(kOptionKeepaliveIntervalKey, number);
+                number->release();
+            }
         }
     }
     else {
@@ -534,7 +908,7 @@ boolean->release(); \
 void
 XboxControllerHID::setDeviceOptions()
 {
-    if (_xbDeviceType->isEqualTo(kDeviceTypePadKey)) {
+    if (_xbDeviceTypeID == kDeviceTypePad) {
         
         // override defaults with xml settings
         if (_xbDeviceOptionsDict) {
@@ -552,6 +926,11 @@ number = OSDynamicCast(OSNumber, _xbDeviceOptionsDict->getObject(kOption ## fiel
 if (number) \
 _xbDeviceOptions.pad.field = number->unsigned8BitValue();
             
+#define GET_UINT16_NUMBER(field) \
+number = OSDynamicCast(OSNumber, _xbDeviceOptionsDict->getObject(kOption ## field ## Key)); \
+if (number) \
+_xbDeviceOptions.pad.field = number->unsigned16BitValue();
+            
             // axis inversion
             GET_BOOLEAN(InvertYAxis)
             GET_BOOLEAN(InvertXAxis)
@@ -569,9 +948,21 @@ _xbDeviceOptions.pad.field = number->unsigned8BitValue();
             // buttons
             GET_BOOLEAN(ClampButtons)
             
+            // report delivery
+            GET_BOOLEAN(SuppressDuplicateReports)
+            GET_UINT16_NUMBER(KeepaliveInterval)
+            
 #undef GET_BOOLEAN
 #undef GET_UINT8_NUMBER
+#undef GET_UINT16_NUMBER
         }
+        
+        // pick the report transform and duplicate suppression matching the new options, inside
+        // the gate so no completion sees the trigger tables half rebuilt or out of step with them
+        if (_gate)
+            _gate->runAction(selectPadTransformAction);
+        else
+            selectPadTransform();
     }
 }
 
@@ -618,9 +1009,11 @@ XboxControllerHID::setupDevice()
     
     // Get the button map (remote control only - can be NULL)
     _xbDeviceButtonMapArray = OSDynamicCast(OSArray, deviceDict->getObject(kDeviceButtonMapKey));
+    if (_xbDeviceButtonMapArray)
+        setRemoteButtonMap(_xbDeviceButtonMapArray);
     
     // If the device is a remote control, setup a timer for generating button-release events
-    if (_xbDeviceType->isEqualTo(kDeviceTypeIRKey)) {
+    if (_xbDeviceOps->usesReleaseTimer) {
         
         _xbWorkLoop = getWorkLoop();
         if (_xbWorkLoop) {
@@ -641,190 +1034,316 @@ XboxControllerHID::setupDevice()
     setDefaultOptions();
     
     // Build _xbDeviceOptions structure from the device's option dictionary
-    // setDeviceOptions();
+    setDeviceOptions();
     
     return true;
 }
 
 
+
+IOReturn
+XboxControllerHID::selectPadTransformAction(OSObject *target, void *arg0, void *arg1, void *arg2, void *arg3)
+{
+    XboxControllerHID *me = OSDynamicCast(XboxControllerHID, target);
+    
+    if (me)
+        me->selectPadTransform();
+    return kIOReturnSuccess;
+}
+
+void
+XboxControllerHID::selectPadTransform()
+{
+    // rebuilds the trigger tables too
+    UInt32 flags = XBPadTransformFlags(&_xbDeviceOptions.pad, _xbLeftTriggerTable, _xbRightTriggerTable);
+    UInt64 keepalive;
+    
+    _xbPadTransform = XBSelectPadTransform(flags);
+    
+    // duplicate suppression changes with the transform, so no completion sees one without the other
+    nanoseconds_to_absolutetime((UInt64)_xbDeviceOptions.pad.KeepaliveInterval * kMillisecondScale, &keepalive);
+    _keepaliveInterval = keepalive;
+    _suppressDuplicates = _xbDeviceOptions.pad.SuppressDuplicateReports;
+}
+
+IOReturn
+XboxControllerHID::setRemoteButtonMapAction(OSObject *target, void *arg0, void *arg1, void *arg2, void *arg3)
+{
+    XboxControllerHID *me = OSDynamicCast(XboxControllerHID, target);
+    OSArray *buttonMap = OSDynamicCast(OSArray, (OSObject *)arg0);
+    
+    if (me && buttonMap)
+        me->setRemoteButtonMap(buttonMap);
+    return kIOReturnSuccess;
+}
+
+void
+XboxControllerHID::setRemoteButtonMap(OSArray *buttonMap)
+{
+    // build into whichever table isn't live, then swap the pointer. Called inside the
+    // gate once the pipe is running, so completions and the release timer only ever
+    // see a finished table.
+    XBRemoteButtonTable *current = _xbRemoteButtonTable;
+    XBRemoteButtonTable *next = (current == &_xbRemoteButtonTables[0]) ?
+    &_xbRemoteButtonTables[1] : &_xbRemoteButtonTables[0];
+    int scancodes[kNumRemoteButtons];
+    
+    // scancode per XBoxRemoteKey, missing entries leave their bit untouched
+    for (int i = 0; i < kNumRemoteButtons; i++) {
+        
+        OSNumber *number = OSDynamicCast(OSNumber, buttonMap->getObject(i));
+        scancodes[i] = number ? number->unsigned8BitValue() : -1;
+    }
+    
+    XBBuildRemoteButtonTable(scancodes, next);
+    
+    _xbRemoteButtonTable = next;
+}
+
+
+// -- per device type behaviour -----------------------------
+// ----------------------------------------------------------
+
+const XboxControllerHID::DeviceOps XboxControllerHID::deviceOps[kNumDeviceTypes] =
+{
+    // reportSize,                   transform,                                    release timer, input reports
+    { 0,                             NULL,                                         false,         true  }, // unknown
+    { sizeof(XBPadReport),           &XboxControllerHID::manipulatePadReport,      false,         true  }, // pad
+    
+    // remote controls only report while a button is down - there is no last report to serve
+    { sizeof(XBActualRemoteReport),  &XboxControllerHID::manipulateRemoteReport,   true,          false }, // IR
+};
+
+XBDeviceType
+XboxControllerHID::deviceTypeForName(OSString *typeName)
+{
+    if (typeName) {
+        
+        if (typeName->isEqualTo(kDeviceTypePadKey))
+            return kDeviceTypePad;
+        
+        if (typeName->isEqualTo(kDeviceTypeIRKey))
+            return kDeviceTypeIR;
+    }
+    
+    return kDeviceTypeUnknown;
+}
+
+bool
+XboxControllerHID::manipulatePadReport(void *bytes)
+{
+    XBPadTransform transform = _xbPadTransform;
+    
+    if (transform)
+        transform((XBPadReport*)bytes, _xbLeftTriggerTable, _xbRightTriggerTable);
+    
+    return true;
+}
+
+bool
+XboxControllerHID::manipulateRemoteReport(void *bytes)
+{
+    XBRemoteButtonTable *table = _xbRemoteButtonTable;
+    
+    if (!table)
+        return true;
+    
+    // remote sends many events when holding down a button.. skip 'em
+    return XBFilterRemoteReport((XBActualRemoteReport*)bytes, table, &_xbLastButtonPressed);
+}
+
 bool
 XboxControllerHID::manipulateReport(IOBufferMemoryDescriptor *report)
 {
     // change the report before it's sent to the HID layer
     // return true if report should be sent to HID layer,
     // so that we can ignore certain reports
-    if (_xbDeviceType->isEqualTo(kDeviceTypePadKey) &&
-        report->getLength() == sizeof(XBPadReport)) {
+    const DeviceOps *ops = _xbDeviceOps;
+    
+    if (ops->transform && report->getLength() == ops->reportSize)
+        return (this->*ops->transform)(report->getBytesNoCopy());
+    
+    return true;
+}
+
+//
+// KnownDevices is flattened once per kext load into an array sorted by vendor/product id,
+// so probe is a binary search instead of formatting the ids and walking the dictionaries.
+// The table keeps the strings retained, instances point straight into it.
+//
+static XBKnownDeviceTable * volatile gKnownDevices = NULL;
+
+// GenericProperties of every device type, compiled the same way for findGenericDevice()
+static XBGenericSignatureTable * volatile gGenericSignatures = NULL;
+
+// HIDReportDescriptor of every device type, shared read-only by all instances (see sharedReportDescriptor())
+static IOBufferMemoryDescriptor * volatile gReportDescriptors[kNumDeviceTypes];
+
+static void
+freeKnownDeviceTable(XBKnownDeviceTable *table)
+{
+    for (UInt32 i = 0; i < table->count; i++) {
         
-        XBPadReport *raw = (XBPadReport*)(report->getBytesNoCopy());
+        table->devices[i].type->release();
+        if (table->devices[i].name)
+            table->devices[i].name->release();
+        if (table->devices[i].vendor)
+            table->devices[i].vendor->release();
+    }
+    
+    if (table->capacity)
+        IOFree(table->devices, table->capacity * sizeof(XBKnownDevice));
+    IOFree(table, sizeof(XBKnownDeviceTable));
+}
+
+static void
+freeGenericSignatureTable(XBGenericSignatureTable *table)
+{
+    for (UInt32 i = 0; i < table->count; i++) {
         
-#define INVERT_AXIS(name) \
-SInt16 name = (raw->name ## hi << 8) | raw->name ## lo; \
-name = -(name + 1); \
-raw->name ## hi = name >> 8; \
-raw->name ## lo = name & 0xFF;
+        table->signatures[i].type->release();
+        table->signatures[i].name->release();
+        table->signatures[i].vendor->release();
+    }
+    
+    IOFree(table, sizeof(XBGenericSignatureTable));
+}
+
+// released when the kext is unloaded, by then there are no instances left
+static class XBDeviceTablesReaper
+{
+public:
+    ~XBDeviceTablesReaper()
+    {
+        if (gKnownDevices)
+            freeKnownDeviceTable(gKnownDevices);
+        gKnownDevices = NULL;
         
-        if (_xbDeviceOptions.pad.InvertYAxis) {
-            INVERT_AXIS(ly)
-        }
+        if (gGenericSignatures)
+            freeGenericSignatureTable(gGenericSignatures);
+        gGenericSignatures = NULL;
         
-        if (_xbDeviceOptions.pad.InvertRyAxis) {
-            INVERT_AXIS(ry)
+        for (UInt32 i = 0; i < kNumDeviceTypes; i++) {
+            
+            if (gReportDescriptors[i])
+                gReportDescriptors[i]->release();
+            gReportDescriptors[i] = NULL;
         }
+    }
+} gDeviceTablesReaper;
+
+XBKnownDeviceTable *
+XboxControllerHID::buildKnownDeviceTable(OSDictionary *vendors)
+{
+    XBKnownDeviceTable *table;
+    OSCollectionIterator *vendorIter, *productIter;
+    const OSSymbol *vendorKey, *productKey;
+    UInt32 capacity = 0;
+    
+    // one pass to size the table
+    vendorIter = OSCollectionIterator::withCollection(vendors);
+    if (!vendorIter)
+        return NULL;
+    
+    while ((vendorKey = OSDynamicCast(OSSymbol, vendorIter->getNextObject()))) {
         
-        if (_xbDeviceOptions.pad.InvertXAxis) {
-            INVERT_AXIS(lx)
-        }
+        OSDictionary *vendor = OSDynamicCast(OSDictionary, vendors->getObject(vendorKey));
+        if (vendor)
+            capacity += vendor->getCount();
+    }
+    
+    table = (XBKnownDeviceTable *)IOMalloc(sizeof(XBKnownDeviceTable));
+    if (!table) {
+        vendorIter->release();
+        return NULL;
+    }
+    table->count = 0;
+    table->capacity = capacity;
+    table->devices = NULL;
+    
+    if (capacity) {
         
-        if (_xbDeviceOptions.pad.InvertRxAxis) {
-            INVERT_AXIS(rx)
+        table->devices = (XBKnownDevice *)IOMalloc(capacity * sizeof(XBKnownDevice));
+        if (!table->devices) {
+            IOFree(table, sizeof(XBKnownDeviceTable));
+            vendorIter->release();
+            return NULL;
         }
+    }
+    
+    // and one to fill it in
+    vendorIter->reset();
+    while ((vendorKey = OSDynamicCast(OSSymbol, vendorIter->getNextObject()))) {
         
-#undef INVERT_AXIS
-        
-        if (_xbDeviceOptions.pad.ClampButtons) {
-            
-            if (raw->a != 0)
-                raw->a = 1;
-            if (raw->b != 0)
-                raw->b = 1;
-            if (raw->x != 0)
-                raw->x = 1;
-            if (raw->y != 0)
-                raw->y = 1;
-            if (raw->black != 0)
-                raw->black = 1;
-            if (raw->white != 0)
-                raw->white = 1;
-        }
+        OSDictionary *vendor = OSDynamicCast(OSDictionary, vendors->getObject(vendorKey));
+        UInt16 vendorID, productID;
         
-        if (_xbDeviceOptions.pad.ClampLeftTrigger) {
-            
-            UInt8 threshold = _xbDeviceOptions.pad.LeftTriggerThreshold;
-            
-            if (raw->lt < threshold)
-                raw->lt = 0;
-            else
-                raw->lt = 1;
-        }
-        else
-            if (_xbDeviceOptions.pad.LeftTriggerThreshold > 1) {
-                
-                int threshold = _xbDeviceOptions.pad.LeftTriggerThreshold;
-                
-                if (raw->lt < threshold) {
-                    
-                    raw->lt = 0;
-                }
-                else
-                    if (threshold < 255) {
-                        
-                        // use this system of equations to scale values from 1-255
-                        // also note the divide-by-zero check caught above
-                        // 1 = a(threshold) + b
-                        // 255 = a(255) + b
-                        
-                        raw->lt = (254*raw->lt + 255*(1 - threshold)) / (255 - threshold);
-                    }
-                    else {
-                        
-                        raw->lt = 255;
-                    }
-            }
+        if (!vendor || !XBParseDeviceID(vendorKey->getCStringNoCopy(), &vendorID))
+            continue;
         
-        if (_xbDeviceOptions.pad.ClampRightTrigger) {
-            
-            UInt8 threshold = _xbDeviceOptions.pad.RightTriggerThreshold;
-            
-            if (raw->rt < threshold)
-                raw->rt = 0;
-            else
-                raw->rt = 1;
+        productIter = OSCollectionIterator::withCollection(vendor);
+        if (!productIter)
+            continue;
+        
+        while ((productKey = OSDynamicCast(OSSymbol, productIter->getNextObject()))) {
+            
+            // skips the Vendor string, which isn't a dictionary
+            OSDictionary *product = OSDynamicCast(OSDictionary, vendor->getObject(productKey));
+            if (!product || !XBParseDeviceID(productKey->getCStringNoCopy(), &productID))
+                continue;
+            
+            // without a type we can't drive it, leave it to findGenericDevice()
+            OSString *typeName = OSDynamicCast(OSString, product->getObject(kTypeKey));
+            if (!typeName || table->count == capacity)
+                continue;
+            
+            XBKnownDevice *device = XBInsertKnownDevice(table->devices, &table->count,
+                                                        XBDeviceID(vendorID, productID));
+            
+            device->type = typeName;
+            device->name = OSDynamicCast(OSString, product->getObject(kNameKey));
+            device->vendor = OSDynamicCast(OSString, vendor->getObject(kVendorKey));
+            
+            device->type->retain();
+            if (device->name)
+                device->name->retain();
+            if (device->vendor)
+                device->vendor->retain();
         }
-        else
-            if (_xbDeviceOptions.pad.RightTriggerThreshold > 1) {
-                
-                UInt8 threshold = _xbDeviceOptions.pad.RightTriggerThreshold;
-                
-                if (raw->rt < threshold) {
-                    raw->rt = 0;
-                }
-                else
-                    if (threshold < 255) {
-                        
-                        // use this system of equations to scale values from 1-255
-                        // 1 = a(threshold) + b
-                        // 255 = a(255) + b
-                        
-                        raw->rt = (254*raw->rt + 255*(1 - threshold)) / (255 - threshold);
-                    }
-                    else {
-                        
-                        raw->rt = 255;
-                    }
-            }
+        productIter->release();
     }
-    else
-        if (_xbDeviceType->isEqualTo(kDeviceTypeIRKey) &&
-            report->getLength() == sizeof(XBActualRemoteReport) &&
-            _xbDeviceButtonMapArray) {
-            
-            XBActualRemoteReport *raw = (XBActualRemoteReport*)(report->getBytesNoCopy());
-            UInt8 scancode = raw->scancode;
-            UInt8 testScancode;
-            XBRemoteReport *converted = (XBRemoteReport*)raw;
-            OSNumber *number;
-            
-            if (scancode == _xbLastButtonPressed)
-                return false; // remote sends many events when holding down a button.. skip 'em
-            else
-                _xbLastButtonPressed = scancode;
-            
-            //USBLog(6, "handle remote control: scancode=%d", scancode);
-            
-#define SET_REPORT_FIELD(field, index) \
-number = OSDynamicCast(OSNumber, _xbDeviceButtonMapArray->getObject(index)); \
-if (number) { \
-testScancode = number->unsigned8BitValue(); \
-if (scancode == testScancode) { \
-converted->field = 1; \
-} \
-else \
-converted->field = 0; \
-}
-            
-            SET_REPORT_FIELD(select, kRemoteSelect)
-            SET_REPORT_FIELD(up, kRemoteUp)
-            SET_REPORT_FIELD(down, kRemoteDown)
-            SET_REPORT_FIELD(left, kRemoteLeft)
-            SET_REPORT_FIELD(right, kRemoteRight)
-            SET_REPORT_FIELD(title, kRemoteTitle)
-            SET_REPORT_FIELD(info, kRemoteInfo)
-            SET_REPORT_FIELD(menu, kRemoteMenu)
-            SET_REPORT_FIELD(back, kRemoteBack)
-            SET_REPORT_FIELD(display, kRemoteDisplay)
-            SET_REPORT_FIELD(play, kRemotePlay)
-            SET_REPORT_FIELD(stop, kRemoteStop)
-            SET_REPORT_FIELD(pause, kRemotePause)
-            SET_REPORT_FIELD(reverse, kRemoteReverse)
-            SET_REPORT_FIELD(forward, kRemoteForward)
-            SET_REPORT_FIELD(skipBackward, kRemoteSkipBackward)
-            SET_REPORT_FIELD(skipForward, kRemoteSkipForward)
-            SET_REPORT_FIELD(kp0, kRemoteKP0)
-            SET_REPORT_FIELD(kp1, kRemoteKP1)
-            SET_REPORT_FIELD(kp2, kRemoteKP2)
-            SET_REPORT_FIELD(kp3, kRemoteKP3)
-            SET_REPORT_FIELD(kp4, kRemoteKP4)
-            SET_REPORT_FIELD(kp5, kRemoteKP5)
-            SET_REPORT_FIELD(kp6, kRemoteKP6)
-            SET_REPORT_FIELD(kp7, kRemoteKP7)
-            SET_REPORT_FIELD(kp8, kRemoteKP8)
-            SET_REPORT_FIELD(kp9, kRemoteKP9)
-            
-#undef SET_REPORT_FIELD
+    vendorIter->release();
+    
+    return table;
+}
+
+const XBKnownDevice *
+XboxControllerHID::findKnownDevice(UInt16 vendorID, UInt16 productID)
+{
+    XBKnownDeviceTable *table = gKnownDevices;
+    
+    if (!table) {
+        
+        OSDictionary *dataDict = OSDynamicCast(OSDictionary, getProperty(kDeviceDataKey));
+        if (!dataDict)
+            return NULL;
+        
+        OSDictionary *vendors = OSDynamicCast(OSDictionary, dataDict->getObject(kKnownDevicesKey));
+        if (!vendors)
+            return NULL;
+        
+        table = buildKnownDeviceTable(vendors);
+        if (!table)
+            return NULL;
+        
+        // another probe may have beaten us to it, use theirs
+        if (!OSCompareAndSwapPtr(NULL, table, (void * volatile *)&gKnownDevices)) {
+            freeKnownDeviceTable(table);
+            table = gKnownDevices;
         }
+    }
     
-    return true;
+    return XBFindKnownDevice(table->devices, table->count, XBDeviceID(vendorID, productID));
 }
 
 bool XboxControllerHID::isKnownDevice(IOService *provider)
@@ -841,45 +1360,19 @@ bool XboxControllerHID::isKnownDevice(IOService *provider)
         IOUSBDevice *device = interface->GetDevice();
         if (device) {
             
-            char productID[8], vendorID[8];
-            
-            // get product and vendor id
-            snprintf(vendorID, 8, "%d", device->GetVendorID());
-            snprintf(productID, 8, "%d", device->GetProductID());
-            
-            OSDictionary *dataDict = OSDynamicCast(OSDictionary, getProperty(kDeviceDataKey));
-            if (dataDict) {
+            const XBKnownDevice *known = findKnownDevice(device->GetVendorID(), device->GetProductID());
+            if (known) {
                 
-                OSDictionary *vendors = OSDynamicCast(OSDictionary, dataDict->getObject(kKnownDevicesKey));
-                if (vendors) {
-                    
-                    OSDictionary *vendor = OSDynamicCast(OSDictionary, vendors->getObject(vendorID));
-                    if (vendor) {
-                        
-                        OSDictionary *product = OSDynamicCast(OSDictionary, vendor->getObject(productID));
-                        if (product) {
-                            
-                            OSString *typeName, *deviceName, *vendorName;
-                            
-                            typeName = OSDynamicCast(OSString, product->getObject(kTypeKey));
-                            deviceName = OSDynamicCast(OSString, product->getObject(kNameKey));
-                            vendorName = OSDynamicCast(OSString, vendor->getObject(kVendorKey));
-                            
-                            USBLog(4,  "%s[%p]::isKnownDevice found %s %s",
-                                   getName(), this, vendorName->getCStringNoCopy(), deviceName->getCStringNoCopy());
-                            
-                            isKnown = true;
-                            
-                            if (typeName)
-                                _xbDeviceType = typeName;
-                            else
-                                isKnown = false;
-                            
-                            _xbDeviceName = deviceName;
-                            _xbDeviceVendor = vendorName;
-                        }
-                    }
-                }
+                USBLog(4,  "%s[%p]::isKnownDevice found %s %s",
+                       getName(), this,
+                       known->vendor ? known->vendor->getCStringNoCopy() : "",
+                       known->name ? known->name->getCStringNoCopy() : "");
+                
+                isKnown = true;
+                
+                _xbDeviceType = known->type;
+                _xbDeviceName = known->name;
+                _xbDeviceVendor = known->vendor;
             }
         }
     }
@@ -887,207 +1380,218 @@ bool XboxControllerHID::isKnownDevice(IOService *provider)
     return isKnown;
 }
 
+//
+// The GenericProperties trees are compiled into flat patterns: the number of interfaces and,
+// for every endpoint, the interface it is on and the values to compare. The device's endpoints
+// are gathered once, then each pattern is checked against them by XBMatchGenericPattern(),
+// rejecting on the interface and endpoint counts before comparing any endpoint.
+//
+bool
+XboxControllerHID::compileGenericPattern(OSDictionary *specificDeviceDict, XBGenericPattern *pattern)
+{
+    OSDictionary *genericPropertiesDict;
+    OSArray *genericInterfaceArray;
+    
+    genericPropertiesDict = OSDynamicCast(OSDictionary, specificDeviceDict->getObject(kDeviceGenericPropertiesKey));
+    if (!genericPropertiesDict)
+        return false;
+    
+    genericInterfaceArray = OSDynamicCast(OSArray, genericPropertiesDict->getObject(kGenericInterfacesKey));
+    if (!genericInterfaceArray || !XBInitGenericPattern(pattern, genericInterfaceArray->getCount()))
+        return false;
+    
+    for (UInt32 j = 0; j < pattern->numInterfaces; j++) {
+        
+        // interfaces without an endpoint list only have to exist
+        OSDictionary *genericInterfaceDict = OSDynamicCast(OSDictionary, genericInterfaceArray->getObject(j));
+        if (!genericInterfaceDict)
+            continue;
+        
+        OSArray *genericEndpointArray = OSDynamicCast(OSArray, genericInterfaceDict->getObject(kGenericEndpointsKey));
+        if (!genericEndpointArray)
+            continue;
+        
+        for (UInt32 k = 0; k < genericEndpointArray->getCount(); k++) {
+            
+            OSDictionary *genericEndpointDict = OSDynamicCast(OSDictionary, genericEndpointArray->getObject(k));
+            XBGenericEndpoint *endpoint;
+            OSNumber *number;
+            
+            endpoint = XBAddGenericEndpoint(pattern, j);
+            if (!endpoint)
+                return false;
+            
+            // an endpoint entry that isn't a dictionary can never match
+            if (!genericEndpointDict)
+                continue;
+            
+            number = OSDynamicCast(OSNumber, genericEndpointDict->getObject(kGenericAttributesKey));
+            endpoint->address = XBGenericEndpointAddress(number ? number->unsigned8BitValue() : 0);
+            
+            number = OSDynamicCast(OSNumber, genericEndpointDict->getObject(kGenericMaxPacketSizeKey));
+            if (number)
+                endpoint->maxPacketSize = number->unsigned16BitValue();
+            
+            number = OSDynamicCast(OSNumber, genericEndpointDict->getObject(kGenericPollingIntervalKey));
+            if (number)
+                endpoint->pollingInterval = number->unsigned8BitValue();
+        }
+    }
+    
+    return true;
+}
+
+XBGenericSignatureTable *
+XboxControllerHID::buildGenericSignatureTable(OSDictionary *deviceDataDict)
+{
+    const char *typesList[] = { kDeviceTypePadKey, kDeviceTypeIRKey, NULL };
+    XBGenericSignatureTable *table;
+    
+    table = (XBGenericSignatureTable *)IOMalloc(sizeof(XBGenericSignatureTable));
+    if (!table)
+        return NULL;
+    
+    table->count = 0;
+    table->maxInterfaces = 0;
+    
+    for (int i = 0; typesList[i] != NULL; i++) {
+        
+        OSDictionary *specificDeviceDict = OSDynamicCast(OSDictionary, deviceDataDict->getObject(typesList[i]));
+        XBGenericSignature *signature = &table->signatures[table->count];
+        
+        if (!specificDeviceDict || !compileGenericPattern(specificDeviceDict, &signature->pattern))
+            continue;
+        
+        // a match without a vendor and name is no match
+        signature->vendor = OSDynamicCast(OSString, specificDeviceDict->getObject(kVendorKey));
+        signature->name = OSDynamicCast(OSString, specificDeviceDict->getObject(kNameKey));
+        if (!signature->vendor || !signature->name)
+            continue;
+        
+        signature->type = OSString::withCString(typesList[i]);
+        if (!signature->type)
+            continue;
+        
+        signature->vendor->retain();
+        signature->name->retain();
+        
+        if (signature->pattern.numInterfaces > table->maxInterfaces)
+            table->maxInterfaces = signature->pattern.numInterfaces;
+        table->count++;
+    }
+    
+    return table;
+}
+
+void
+XboxControllerHID::gatherGenericDeviceInfo(IOUSBDevice *device, UInt32 maxInterfaces, XBGenericDeviceInfo *info)
+{
+    IOUSBFindInterfaceRequest request;
+    IOUSBInterface *foundInterface;
+    
+    info->numInterfaces = 0;
+    
+    request.bInterfaceClass = kIOUSBFindInterfaceDontCare;
+    request.bInterfaceSubClass = kIOUSBFindInterfaceDontCare;
+    request.bInterfaceProtocol = kIOUSBFindInterfaceDontCare;
+    request.bAlternateSetting = kIOUSBFindInterfaceDontCare;
+    
+    foundInterface = device->FindNextInterface(NULL, &request);
+    
+    while (foundInterface && info->numInterfaces < maxInterfaces) {
+        
+        XBGenericInterfaceInfo *interfaceInfo = &info->interfaces[info->numInterfaces++];
+        const IOUSBEndpointDescriptor *endpointDesc = NULL;
+        
+        foundInterface->retain();
+        
+        interfaceInfo->numEndpoints = foundInterface->GetNumEndpoints();
+        interfaceInfo->numGathered = 0;
+        
+        while (interfaceInfo->numGathered < kMaxGenericEndpoints &&
+               (endpointDesc = (const IOUSBEndpointDescriptor *)
+                foundInterface->FindNextAssociatedDescriptor(endpointDesc, kUSBEndpointDesc))) {
+            
+            XBGenericEndpoint *endpoint = &interfaceInfo->endpoints[interfaceInfo->numGathered++];
+            
+            endpoint->interface = info->numInterfaces - 1;
+            endpoint->address = endpointDesc->bEndpointAddress & 0x8F;
+            endpoint->maxPacketSize = USBToHostWord(endpointDesc->wMaxPacketSize);
+            endpoint->pollingInterval = endpointDesc->bInterval;
+        }
+        
+        IOUSBInterface *saveInterface = foundInterface; // save so we can call release() on it later
+        
+        request.bInterfaceClass = kIOUSBFindInterfaceDontCare;
+        request.bInterfaceSubClass = kIOUSBFindInterfaceDontCare;
+        request.bInterfaceProtocol = kIOUSBFindInterfaceDontCare;
+        request.bAlternateSetting = kIOUSBFindInterfaceDontCare;
+        
+        foundInterface = device->FindNextInterface(foundInterface, &request);
+        saveInterface->release();
+    }
+}
+
 bool XboxControllerHID::findGenericDevice(IOService *provider)
 {
-    // This attempts to identify a supported "generic" device by walking the device's property
-    // tree and comparing it to a known standard (Microsoft)
+    // This attempts to identify a supported "generic" device by comparing the device's
+    // interfaces and endpoints to a known standard (Microsoft)
     
     // Unfortunately, this doesn't always work because some devices have slightly different specs
     // than the Microsoft controllers
     
     IOUSBInterface 		*interface   = 0;
     IOUSBDevice 		*device      = 0;
-    OSDictionary 		*deviceDataDict = 0;        // root dictionary for all device types
-    OSDictionary        *specificDeviceDict = 0;    // pad, IR, wheel, etc
-    OSDictionary        *genericPropertiesDict = 0; // tree of properties that can identify device with unknown vendor/product id
-    OSArray             *genericInterfaceArray = 0; // array of interfaces
-    OSDictionary        *genericInterfaceDict = 0;  // interface
-    OSArray             *genericEndpointArray = 0;  // array of endpoints
-    OSDictionary        *genericEndpointDict = 0;   // endpoint
+    XBGenericSignatureTable *table = gGenericSignatures;
+    XBGenericDeviceInfo info;
+    
+    interface = OSDynamicCast(IOUSBInterface, provider);
+    if (!interface)
+        return false;
     
-    const char			*typesList[] = { kDeviceTypePadKey, kDeviceTypeIRKey, NULL };
+    device = interface->GetDevice();
+    if (!device)
+        return false;
     
-    bool				foundGenericDevice = false;
+    if (!table) {
+        
+        OSDictionary *deviceDataDict = OSDynamicCast(OSDictionary, getProperty(kDeviceDataKey));
+        if (!deviceDataDict)
+            return false;
+        
+        table = buildGenericSignatureTable(deviceDataDict);
+        if (!table)
+            return false;
+        
+        // another probe may have beaten us to it, use theirs
+        if (!OSCompareAndSwapPtr(NULL, table, (void * volatile *)&gGenericSignatures)) {
+            freeGenericSignatureTable(table);
+            table = gGenericSignatures;
+        }
+    }
     
-    interface = OSDynamicCast(IOUSBInterface, provider);
-    if (interface) {
+    gatherGenericDeviceInfo(device, table->maxInterfaces, &info);
+    
+    for (UInt32 i = 0; i < table->count; i++) {
         
-        device = interface->GetDevice();
-        if (device) {
+        const XBGenericSignature *signature = &table->signatures[i];
+        
+        if (XBMatchGenericPattern(&signature->pattern, &info)) {
             
-            deviceDataDict = OSDynamicCast(OSDictionary, getProperty(kDeviceDataKey));
-            if (deviceDataDict) {
-                
-                for (int i = 0; typesList[i] != NULL; i++) {
-                    
-                    specificDeviceDict = OSDynamicCast(OSDictionary, deviceDataDict->getObject(typesList[i]));
-                    if (specificDeviceDict) {
-                        
-                        genericPropertiesDict = OSDynamicCast(OSDictionary, specificDeviceDict->getObject(kDeviceGenericPropertiesKey));
-                        if (genericPropertiesDict) {
-                            
-                            genericInterfaceArray = OSDynamicCast(OSArray, genericPropertiesDict->getObject(kGenericInterfacesKey));
-                            if (genericInterfaceArray) {
-                                
-                                int numInterfaces = genericInterfaceArray->getCount();
-                                int numActualInterfaces = 0;
-                                bool allEndpointsMatched = true;
-                                IOUSBFindInterfaceRequest request;
-                                IOUSBInterface *foundInterface;
-                                
-                                request.bInterfaceClass = kIOUSBFindInterfaceDontCare;
-                                request.bInterfaceSubClass = kIOUSBFindInterfaceDontCare;
-                                request.bInterfaceProtocol = kIOUSBFindInterfaceDontCare;
-                                request.bAlternateSetting = kIOUSBFindInterfaceDontCare;
-                                
-                                foundInterface = device->FindNextInterface(NULL,&request);
-                                
-                                for (int j = 0; j < numInterfaces; j++) {
-                                    
-                                    if (foundInterface) {
-                                        
-                                        USBLog(6, "%s[%p]::findGenericDevice - checking interface: %d", getName(), this, j);
-                                        
-                                        foundInterface->retain();
-                                        numActualInterfaces++;
-                                        
-                                        genericInterfaceDict = OSDynamicCast(OSDictionary, genericInterfaceArray->getObject(j));
-                                        if (genericInterfaceDict) {
-                                            
-                                            genericEndpointArray = OSDynamicCast(OSArray,
-                                                                                 genericInterfaceDict->getObject(kGenericEndpointsKey));
-                                            if (genericEndpointArray) {
-                                                
-                                                int numEndpoints = genericEndpointArray->getCount();
-                                                int numActualEndpoints = 0;
-                                                
-                                                for (int k = 0; k < numEndpoints; k++) {
-                                                    
-                                                    bool endPointMatched = false;
-                                                    
-                                                    USBLog(6, "%s[%p]::findGenericDevice - checking endpoint: %d of %d",
-                                                           getName(), this, k, foundInterface->GetNumEndpoints());
-                                                    
-                                                    // check that index is within bounds
-                                                    if (k < foundInterface->GetNumEndpoints()) {
-                                                        
-                                                        genericEndpointDict = OSDynamicCast(OSDictionary, genericEndpointArray->getObject(k));
-                                                        if (genericEndpointDict) {
-                                                            
-                                                            UInt8 transferType = 0, pollingInterval = 0;
-                                                            UInt16 maxPacketSize = 0;
-                                                            IOReturn kr = kIOReturnError;
-                                                            
-                                                            UInt8 genericAttributes = 0;
-                                                            UInt16 genericMaxPacketSize = 0;
-                                                            UInt8 genericPollingInterval = 0;
-                                                            UInt8 genericDirection = 0;
-                                                            UInt8 genericIndex = 0;
-                                                            
-                                                            OSNumber *number;
-                                                            
-                                                            // read dictionary attributes
-                                                            number = OSDynamicCast(OSNumber,
-                                                                                   genericEndpointDict->getObject(kGenericAttributesKey));
-                                                            if (number)
-                                                                genericAttributes = number->unsigned8BitValue();
-                                                            
-                                                            number = OSDynamicCast(OSNumber,
-                                                                                   genericEndpointDict->getObject(kGenericMaxPacketSizeKey));
-                                                            if (number)
-                                                                genericMaxPacketSize = number->unsigned16BitValue();
-                                                            
-                                                            number = OSDynamicCast(OSNumber,
-                                                                                   genericEndpointDict->getObject(kGenericPollingIntervalKey));
-                                                            if (number)
-                                                                genericPollingInterval = number->unsigned8BitValue();
-                                                            
-                                                            if (genericAttributes & 0x80)
-                                                                genericDirection = kUSBIn;
-                                                            else
-                                                                genericDirection = kUSBOut;
-                                                            
-                                                            genericIndex = genericAttributes & 0xF;
-                                                            
-                                                            // read device attributes
-                                                            kr = foundInterface->GetEndpointProperties(0, genericIndex,
-                                                                                                       genericDirection, &transferType, &maxPacketSize, &pollingInterval);
-                                                            
-                                                            if (kIOReturnSuccess == kr) {
-                                                                
-                                                                numActualEndpoints++;
-                                                                
-                                                                // compare device's endpoint to dictionary entry's endpoint
-                                                                if (maxPacketSize == genericMaxPacketSize &&
-                                                                    pollingInterval == genericPollingInterval) {
-                                                                    endPointMatched = true;
-                                                                    
-                                                                    USBLog(6, "%s[%p]::findGenericDevice - endpoint %d matched mps=%d int=%d",
-                                                                           getName(), this, k, genericMaxPacketSize, genericPollingInterval);
-                                                                }
-                                                                else {
-                                                                    
-                                                                    USBLog(6, "%s[%p]::findGenericDevice - endpoint %d rejected mps=%d int=%d",
-                                                                           getName(), this, k, genericMaxPacketSize, genericPollingInterval);
-                                                                }
-                                                            }
-                                                        }
-                                                    }
-                                                    
-                                                    if (!endPointMatched)
-                                                        allEndpointsMatched = false;
-                                                }
-                                                
-                                                if (numEndpoints != numActualEndpoints)
-                                                    allEndpointsMatched = false;
-                                            }
-                                        }
-                                        
-                                        IOUSBInterface *saveInterface = foundInterface; // save so we can call release() on it later
-                                        
-                                        request.bInterfaceClass = kIOUSBFindInterfaceDontCare;
-                                        request.bInterfaceSubClass = kIOUSBFindInterfaceDontCare;
-                                        request.bInterfaceProtocol = kIOUSBFindInterfaceDontCare;
-                                        request.bAlternateSetting = kIOUSBFindInterfaceDontCare;
-                                        
-                                        foundInterface = device->FindNextInterface(foundInterface, &request);
-                                        saveInterface->release();
-                                    }
-                                }
-                                
-                                if (numInterfaces == numActualInterfaces &&
-                                    allEndpointsMatched) {
-                                    
-                                    foundGenericDevice = true;
-                                    
-                                    if (typesList[i])
-                                        _xbDeviceType = OSString::withCString(typesList[i]);
-                                    else
-                                        foundGenericDevice = false;
-                                    
-                                    _xbDeviceVendor = OSDynamicCast(OSString, specificDeviceDict->getObject(kVendorKey));
-                                    _xbDeviceName   = OSDynamicCast(OSString, specificDeviceDict->getObject(kNameKey));
-                                    if (!_xbDeviceVendor || !_xbDeviceName)
-                                        foundGenericDevice = false;
-                                    
-                                    if (foundGenericDevice) {
-                                        
-                                        USBLog(3, "%s[%p]::findGenericDevice - found %s %s", getName(), this,
-                                               _xbDeviceVendor->getCStringNoCopy(), _xbDeviceName->getCStringNoCopy());
-                                        
-                                        break; // we're done, return from for loop
-                                    }
-                                }
-                            }
-                        }
-                    }
-                    
-                }
-            }
+            _xbDeviceType   = signature->type;
+            _xbDeviceVendor = signature->vendor;
+            _xbDeviceName   = signature->name;
+            
+            USBLog(3, "%s[%p]::findGenericDevice - found %s %s", getName(), this,
+                   _xbDeviceVendor->getCStringNoCopy(), _xbDeviceName->getCStringNoCopy());
+            
+            return true;
         }
+        
+        USBLog(6, "%s[%p]::findGenericDevice - %s rejected", getName(), this, signature->type->getCStringNoCopy());
     }
     
-    return foundGenericDevice;
+    return false;
 }
 
 IOService* XboxControllerHID::probe(IOService *provider, SInt32 *score)
@@ -1123,6 +1627,10 @@ IOService* XboxControllerHID::probe(IOService *provider, SInt32 *score)
             *score += 100;
         }
     
+    // resolve the device type once, so the I/O path never compares strings
+    _xbDeviceTypeID = deviceTypeForName(_xbDeviceType);
+    _xbDeviceOps = &deviceOps[_xbDeviceTypeID];
+    
     return this;
 }
 
@@ -1132,6 +1640,118 @@ IOService* XboxControllerHID::probe(IOService *provider, SInt32 *score)
 // ************************ HID Driver Dispatch Table Functions *********************
 // **********************************************************************************
 
+// Keep a copy of the last report handed to the HID layer, so getReport() doesn't have to
+// read the interrupt pipe. The snapshot is protected by a sequence count that is odd while
+// it is being written. Completions for our pipe are serialized, so there is a single writer.
+void
+XboxControllerHID::saveLastReport(IOBufferMemoryDescriptor *report, UInt64 timeStamp)
+{
+    ByteCount length = report->getLength();
+    
+    if (length > sizeof(_lastReport))
+        length = sizeof(_lastReport);
+    
+    _lastReportSeq++;
+    OSMemoryBarrier();
+    
+    memcpy(_lastReport, report->getBytesNoCopy(), length);
+    _lastReportLength = (UInt32)length;
+    _lastReportTime = timeStamp;
+    
+    OSMemoryBarrier();
+    _lastReportSeq++;
+    OSMemoryBarrier();
+    
+    wakeLastReportWaiters();
+}
+
+// wake anyone waiting for a fresh report
+void
+XboxControllerHID::wakeLastReportWaiters()
+{
+    if (_lastReportWaiters)
+    {
+        IOLockLock(_lastReportLock);
+        IOLockWakeup(_lastReportLock, (void *)&_lastReportSeq, false);
+        IOLockUnlock(_lastReportLock);
+    }
+}
+
+// When duplicate suppression is on, pad reports that XBIsDuplicatePadReport() finds equal to the
+// last delivered one are dropped.
+bool
+XboxControllerHID::isDuplicateReport(IOBufferMemoryDescriptor *report, UInt64 timeStamp)
+{
+    if (report->getLength() != sizeof(XBPadReport) ||
+        _lastReportLength != sizeof(XBPadReport))
+        return false;
+    
+    return XBIsDuplicatePadReport((const UInt8 *)report->getBytesNoCopy(), (const UInt8 *)_lastReport,
+                                  timeStamp, _lastReportTime, _keepaliveInterval);
+}
+
+IOReturn
+XboxControllerHID::copyLastReport(IOMemoryDescriptor *report, bool fresh)
+{
+    UInt8       bytes[kMaxHIDReportSize];
+    UInt32      length;
+    UInt32      seq = _lastReportSeq;
+    UInt32      repeats = _lastReportRepeats;
+    
+    // nothing delivered yet, and the caller didn't ask to wait for a report
+    if (!fresh && seq == 0)
+        return kIOReturnNotReady;
+    
+    // wait for the next report if asked to, at most kFreshReportTimeoutMS. A pad held still
+    // has its duplicates suppressed: each one confirms the last report is still its state
+    if (fresh)
+    {
+        UInt64  deadline;
+        int     result = THREAD_AWAKENED;
+        
+        clock_interval_to_deadline(kFreshReportTimeoutMS, kMillisecondScale, &deadline);
+        
+        IOLockLock(_lastReportLock);
+        OSIncrementAtomic(&_lastReportWaiters);
+        OSMemoryBarrier();
+        
+        while (_lastReportSeq == seq && _lastReportRepeats == repeats && result == THREAD_AWAKENED)
+            result = IOLockSleepDeadline(_lastReportLock, (void *)&_lastReportSeq,
+                                         *(AbsoluteTime *)&deadline, THREAD_ABORTSAFE);
+        
+        OSDecrementAtomic(&_lastReportWaiters);
+        IOLockUnlock(_lastReportLock);
+        
+        if (result == THREAD_TIMED_OUT)
+            return kIOReturnTimeout;
+        if (result == THREAD_INTERRUPTED)
+            return kIOReturnAborted;
+    }
+    
+    // copy out a consistent snapshot
+    do
+    {
+        seq = _lastReportSeq;
+        OSMemoryBarrier();
+        
+        length = _lastReportLength;
+        if (length > sizeof(bytes))
+            length = sizeof(bytes);
+        memcpy(bytes, _lastReport, length);
+        
+        OSMemoryBarrier();
+    }
+    while ((seq & 1) || seq != _lastReportSeq);
+    
+    if (length > report->getLength())
+        length = (UInt32)report->getLength();
+    
+    report->writeBytes(0, bytes, length);
+    
+    return kIOReturnSuccess;
+}
+
+
 IOReturn
 XboxControllerHID::GetReport(UInt8 inReportType, UInt8 inReportID, UInt8 *vInBuf, UInt32 *vInSize)
 {
@@ -1163,9 +1783,9 @@ XboxControllerHID::getReport( IOMemoryDescriptor * report,
     
     if (kUSBIn == usbReportType || kUSBNone == usbReportType) {
         
-        // don't support this on remote controls - it can block indefinitely until a button is pressed
-        if (! _xbDeviceType->isEqualTo(kDeviceTypeIRKey))
-            ret = _interruptPipe->Read(report);
+        // remote controls only report while a button is down, so there is no state to serve
+        if (_xbDeviceOps->servesInputReports)
+            ret = copyLastReport(report, (options & kGetReportOptionFresh) != 0);
     }
     else {
         
@@ -1224,13 +1844,13 @@ XboxControllerHID::setReport( IOMemoryDescriptor *    report,
     // If we have an interrupt out pipe, try to use it for output type of reports.
     if ( kHIDOutputReport == usbReportType && _interruptOutPipe )
     {
-#if ENABLE_HIDREPORT_LOGGING
-        USBLog(3, "%s[%p]::setReport sending out interrupt out pipe buffer (%p,%d):", getName(), this, report, report->getLength() );
-        LogMemReport(report);
-#endif
         ret = _interruptOutPipe->Write(report);
         if (ret == kIOReturnSuccess)
         {
+#if ENABLE_REPORT_TRACE
+            if (_traceEnabled)
+                traceOutputReport(report, ret);
+#endif
             DecrementOutstandingIO();
             return ret;
         }
@@ -1243,10 +1863,6 @@ XboxControllerHID::setReport( IOMemoryDescriptor *    report,
     // If we did not succeed using the interrupt out pipe, we may still be able to use the control pipe.
     // We'll let the family check whether it's a disjoint descriptor or not (but right now it doesn't do it)
     //
-#if ENABLE_HIDREPORT_LOGGING
-    USBLog(3, "%s[%p]::SetReport sending out control pipe:", getName(), this);
-    LogMemReport( report);
-#endif
     
     //--- Fill out device request form
     requestPB.bmRequestType = USBmakebmRequestType(kUSBOut, kUSBClass, kUSBInterface);
@@ -1261,234 +1877,61 @@ XboxControllerHID::setReport( IOMemoryDescriptor *    report,
     if (ret != kIOReturnSuccess)
         USBLog(3, "%s[%p]::setReport request failed; err = 0x%x)", getName(), this, ret);
     
+#if ENABLE_REPORT_TRACE
+    if (_traceEnabled)
+        traceOutputReport(report, ret);
+#endif
+    
     DecrementOutstandingIO();
     return ret;
 }
 
 
-// HIDGetHIDDescriptor is used to get a specific HID descriptor from a HID device
-// (such as a report descriptor).
-IOReturn
-XboxControllerHID::GetHIDDescriptor(UInt8 inDescriptorType, UInt8 inDescriptorIndex, UInt8 *vOutBuf, UInt32 *vOutSize)
-{
-    //IOUSBDevRequest       requestPB;
-    IOUSBHIDDescriptor      *theHIDDesc;
-    IOUSBHIDReportDesc      *hidTypeSizePtr;    // For checking owned descriptors.
-    UInt8           *descPtr;
-    UInt32          providedBufferSize;
-    UInt16          descSize;
-    UInt8           descType;
-    UInt8           typeIndex;
-    UInt8           numberOwnedDesc;
-    IOReturn        err = kIOReturnSuccess;
-    Boolean         foundIt;
-    
-    if (!vOutSize)
-        return  kIOReturnBadArgument;
-    
-    if (!_interface)
-    {
-        USBLog(2, "%s[%p]::GetHIDDescriptor - no _interface", getName(), this);
-        return kIOReturnNotFound;
-    }
-    
-    // From the interface descriptor, get the HID descriptor.
-    // theHIDDesc = (IOUSBHIDDescriptor *)_interface->FindNextAssociatedDescriptor(NULL, kUSBHIDDesc);
-    if (!_xbDeviceHIDReportDescriptor)
-        return kIOReturnError;
-    
-    UInt16 descDataSize = _xbDeviceHIDReportDescriptor->getLength();
+//
+// The report descriptor of a device type is copied out of the personality once per kext load and
+// handed out, retained, to every instance and every newReportDescriptor() call. Nobody writes to it.
+//
+IOBufferMemoryDescriptor *
+XboxControllerHID::sharedReportDescriptor()
+{
+    IOBufferMemoryDescriptor *desc = gReportDescriptors[_xbDeviceTypeID];
     
-    IOUSBHIDDescriptor hidDescriptor =
-    {
-        sizeof(IOUSBHIDDescriptor),   // descLen
-        kUSBHIDDesc,                  // descType
-        0x0111,                       // descVersNum (1.11)
-        0,                            // hidCountryCode
-        1,                            // hidNumDescriptors
-        kUSBReportDesc,               // hidDescriptorType - Table 7.1.2
-        static_cast<UInt8>(descDataSize & 0xFF),          // hidDescriptorLengthLo
-        static_cast<UInt8>((descDataSize & 0xFF00) >> 8)  // hidDescriptorLengthHi
-    };
-    
-    theHIDDesc = (IOUSBHIDDescriptor*)&hidDescriptor;
-    
-    if (theHIDDesc == NULL)
-    {
-        USBLog(2, "%s[%p]::GetHIDDescriptor - FindNextAssociatedDescriptor(NULL, kUSBHIDDesc) failed", getName(), this);
-        return kIOReturnNotFound;
-    }
+    if (desc)
+        return desc;
     
-    //USBLog (6, "HID Descriptor: descLen=%d\n\tdescType=0x%X\n\thidCountryCode=0x%X\n\thidNumDescriptors=%d\n\thidDescriptorType=0x%X\n\thidDescriptorLengthLo=%d\n\thidDescriptorLengthHi=%d\n", theHIDDesc->descLen, theHIDDesc->descType, theHIDDesc->hidCountryCode, theHIDDesc->hidNumDescriptors, theHIDDesc->hidDescriptorType, theHIDDesc->hidDescriptorLengthLo, theHIDDesc->hidDescriptorLengthHi);
+    if (!_xbDeviceHIDReportDescriptor || _xbDeviceHIDReportDescriptor->getLength() == 0)
+        return NULL;
     
-    // Remember the provided buffer size
-    providedBufferSize = *vOutSize;
+    desc = IOBufferMemoryDescriptor::withBytes(_xbDeviceHIDReportDescriptor->getBytesNoCopy(),
+                                               _xbDeviceHIDReportDescriptor->getLength(), kIODirectionOut);
+    if (!desc)
+        return NULL;
     
-    // Are we looking for just the main HID descriptor?
-    if (inDescriptorType == kUSBHIDDesc || (inDescriptorType == 0 && inDescriptorIndex == 0))
-    {
-        descSize = theHIDDesc->descLen;
-        descPtr = (UInt8*)theHIDDesc;
-        
-        // No matter what, set the return size to the actual size of the data.
-        *vOutSize = descSize;
-        
-        // If the provided size is 0, they are just asking for the size, so don't return an error.
-        if (providedBufferSize == 0)
-            err = kIOReturnSuccess;
-        // Otherwise, if the buffer too small, return buffer too small error.
-        else if (descSize > providedBufferSize)
-            err = kIOReturnNoSpace;
-        // Otherwise, if the buffer nil, return that error.
-        else if (vOutBuf == NULL)
-            err = kIOReturnBadArgument;
-        // Otherwise, looks good, so copy the deiscriptor.
-        else
-        {
-            //IOLog("  Copying HIDDesc w/ vOutBuf = 0x%x, descPtr = 0x%x, and descSize = 0x%x.\n", vOutBuf, descPtr, descSize);
-            memcpy(vOutBuf, descPtr, descSize);
-        }
-    }
-    else
-    {
-        // Looking for a particular type of descriptor.
-        // The HID descriptor tells how many endpoint and report descriptors it contains.
-        numberOwnedDesc = ((IOUSBHIDDescriptor *)theHIDDesc)->hidNumDescriptors;
-        hidTypeSizePtr = (IOUSBHIDReportDesc *)&((IOUSBHIDDescriptor *)theHIDDesc)->hidDescriptorType;
-        //USBLog (6, "     %d owned descriptors start at %08x\n", numberOwnedDesc, (unsigned int)hidTypeSizePtr);
-        
-        typeIndex = 0;
-        foundIt = false;
-        err = kIOReturnNotFound;
-        for (UInt8 i = 0; i < numberOwnedDesc; i++)
-        {
-            descType = hidTypeSizePtr->hidDescriptorType;
-            
-            //USBLog (6, "descType=0x%X lengthhi=%d lengthlo=%d", descType,
-            //    hidTypeSizePtr->hidDescriptorLengthHi, hidTypeSizePtr->hidDescriptorLengthLo);
-            
-            // Are we indexing for a specific type?
-            if (inDescriptorType != 0)
-            {
-                if (inDescriptorType == descType)
-                {
-                    if (inDescriptorIndex == typeIndex)
-                    {
-                        foundIt = true;
-                        //USBLog (6, "found it!", descType);
-                    }
-                    else
-                    {
-                        typeIndex++;
-                    }
-                }
-            }
-            
-            // Otherwise indexing across descriptors in general.
-            // (If looking for any type, index must be 1 based or we'll get HID descriptor.)
-            else if (inDescriptorIndex == i + 1)
-            {
-                //IOLog("  said we found it because inDescriptorIndex = 0x%x.\n", inDescriptorIndex);
-                typeIndex = i;
-                foundIt = true;
-            }
-            
-            if (foundIt)
-            {
-                err = kIOReturnSuccess;     // Maybe
-                //IOLog("     Found the requested owned descriptor, %d.\n", i);
-                descSize = (hidTypeSizePtr->hidDescriptorLengthHi << 8) + hidTypeSizePtr->hidDescriptorLengthLo;
-                
-                //USBLog (6, "descSize=%d", descSize);
-                
-                // Did we just want the size or the whole descriptor?
-                // No matter what, set the return size to the actual size of the data.
-                *vOutSize = descSize;   // OSX: Won't get back if we return an error!
-                
-                // If the provided size is 0, they are just asking for the size, so don't return an error.
-                if (providedBufferSize == 0)
-                    err = kIOReturnSuccess;
-                // Otherwise, if the buffer too small, return buffer too small error.
-                else if (descSize > providedBufferSize)
-                    err = kIOReturnNoSpace;
-                // Otherwise, if the buffer nil, return that error.
-                else if (vOutBuf == NULL)
-                    err = kIOReturnBadArgument;
-                // Otherwise, looks good, so copy the descriptor.
-                else
-                {
-                    if (!_device)
-                    {
-                        USBLog(2, "%s[%p]::GetHIDDescriptor - no _device", getName(), this);
-                        return kIOReturnNotFound;
-                    }
-                    
-                    if (descSize == _xbDeviceHIDReportDescriptor->getLength() &&
-                        _xbDeviceHIDReportDescriptor->getBytesNoCopy()) {
-                        
-                        memcpy(vOutBuf, _xbDeviceHIDReportDescriptor->getBytesNoCopy(), descSize);
-                    }
-                    else {
-                        
-                        USBLog(2, "%s[%p]::GetHIDDescriptor - hid report desc wrong size", getName(), this);
-                        return kIOReturnError;
-                    }
-                    
-                    //IOLog("  Requesting new desscriptor.\n");
-                    /*
-                     requestPB.bmRequestType = USBmakebmRequestType(kUSBIn, kUSBStandard, kUSBInterface);
-                     requestPB.bRequest = kUSBRqGetDescriptor;
-                     requestPB.wValue = (inDescriptorType << 8) + typeIndex;     // type and index
-                     requestPB.wIndex = _interface->GetInterfaceNumber();
-                     requestPB.wLength = descSize;
-                     requestPB.pData = vOutBuf;                      // So we don't have to do any allocation here.
-                     err = _device->DeviceRequest(&requestPB, 5000, 0);
-                     if (err != kIOReturnSuccess)
-                     {
-                     USBLog(3, "%s[%p]::GetHIDDescriptor Final request failed; err = 0x%x", getName(), this, err);
-                     return err;
-                     }
-                     */
-                }
-                break;  // out of for i loop.
-            }
-            // Make sure we add 3 bytes not 4 regardless of struct alignment.
-            hidTypeSizePtr = (IOUSBHIDReportDesc *)(((UInt8 *)hidTypeSizePtr) + 3);
-        }
+    // another instance may have beaten us to it, use theirs
+    if (!OSCompareAndSwapPtr(NULL, desc, (void * volatile *)&gReportDescriptors[_xbDeviceTypeID])) {
+        desc->release();
+        desc = gReportDescriptors[_xbDeviceTypeID];
     }
-    return err;
+    
+    return desc;
 }
 
 IOReturn
 XboxControllerHID::newReportDescriptor(IOMemoryDescriptor ** desc) const
 {
-    IOBufferMemoryDescriptor * bufferDesc = NULL;
-    IOReturn ret = kIOReturnNoMemory;
     XboxControllerHID * me = (XboxControllerHID *) this;
+    IOBufferMemoryDescriptor * bufferDesc = me->sharedReportDescriptor();
     
-    // Get the proper HID report descriptor size.
-    UInt32 inOutSize = 0;
-    ret = me->GetHIDDescriptor(kUSBReportDesc, 0, NULL, &inOutSize);
-    
-    if ( ret == kIOReturnSuccess &&  inOutSize != 0)
-    {
-        bufferDesc = IOBufferMemoryDescriptor::withCapacity(inOutSize, kIODirectionOutIn);
-    }
-    
-    if (bufferDesc)
+    if (!bufferDesc)
     {
-        ret = me->GetHIDDescriptor(kUSBReportDesc, 0, (UInt8 *)bufferDesc->getBytesNoCopy(), &inOutSize);
-        
-        if ( ret != kIOReturnSuccess )
-        {
-            bufferDesc->release();
-            bufferDesc = NULL;
-        }
+        *desc = NULL;
+        return kIOReturnNoMemory;
     }
     
+    bufferDesc->retain();
     *desc = bufferDesc;
     
-    return ret;
+    return kIOReturnSuccess;
 }
 
 
@@ -1742,11 +2185,9 @@ XboxControllerHID::message( UInt32 type, IOService * provider,  void * argument
             _deviceIsDead = FALSE;
             _deviceHasBeenDisconnected = FALSE;
             
-            IncrementOutstandingIO();
-            err = _interruptPipe->Read(_buffer, &_completion);
+            err = QueueInterruptReads();
             if (err != kIOReturnSuccess)
             {
-                DecrementOutstandingIO();
                 USBLog(3, "%s[%p]::message - err (%x) in interrupt read", getName(), this, err);
                 // _interface->close(this); will be done in didTerminate
             }
@@ -1782,11 +2223,9 @@ XboxControllerHID::didTerminate( IOService * provider, IOOptionBits options, boo
     // this method comes at the end of the termination sequence. Hopefully, all of our outstanding IO is complete
     // in which case we can just close our provider and IOKit will take care of the rest. Otherwise, we need to
     // hold on to the device and IOKit will terminate us when we close it later
-    USBLog(3, "%s[%p]::didTerminate isInactive = %d, outstandingIO = %u", getName(), this, isInactive(), _outstandingIO);
-    if (!_outstandingIO)
-        _interface->close(this);
-    else
-        _needToClose = true;
+    USBLog(3, "%s[%p]::didTerminate isInactive = %d, outstandingIO = %d", getName(), this, isInactive(), (int)_outstandingIO.count);
+    if (XBRequestClose(&_outstandingIO))
+        CloseProvider();
     return super::didTerminate(provider, options, defer);
 }
 
@@ -1854,12 +2293,40 @@ XboxControllerHID::start(IOService *provider)
             _maxReportSize = getMaxReportSize();
             if (_maxReportSize)
             {
-                _buffer = IOBufferMemoryDescriptor::withCapacity(_maxReportSize, kIODirectionIn);
-                if ( !_buffer )
+                // one buffer per interrupt read we keep queued on the pipe
+                OSNumber *readCount = OSDynamicCast(OSNumber, getProperty(kInterruptReadsKey));
+                
+                _numReads = readCount ? readCount->unsigned32BitValue() : kDefaultInterruptReads;
+                if (_numReads < 1)
+                    _numReads = 1;
+                if (_numReads > kMaxInterruptReads)
+                    _numReads = kMaxInterruptReads;
+                
+                setProperty(kInterruptReadsKey, _numReads, 32);
+                
+                UInt32 i;
+                for (i = 0; i < _numReads; i++)
+                {
+                    _reads[i].buffer = IOBufferMemoryDescriptor::withCapacity(_maxReportSize, kIODirectionIn);
+                    if ( !_reads[i].buffer )
+                        break;
+                }
+                
+                if ( i < _numReads )
                 {
                     USBError(1, "%s[%p]::start - unable to get create buffer", getName(), this);
                     break;
                 }
+                
+                if (_xbDeviceOps->usesReleaseTimer)
+                {
+                    _xbReleaseBuffer = IOBufferMemoryDescriptor::withCapacity(_maxReportSize, kIODirectionIn);
+                    if ( !_xbReleaseBuffer )
+                    {
+                        USBError(1, "%s[%p]::start - unable to get create buffer", getName(), this);
+                        break;
+                    }
+                }
             }
             
             
@@ -1919,23 +2386,43 @@ XboxControllerHID::start(IOService *provider)
 //=============================================================================================
 //
 void
-XboxControllerHID::InterruptReadHandlerEntry(OSObject *target, void *param, IOReturn status, UInt32 bufferSizeRemaining)
+XboxControllerHID::InterruptReadHandlerEntry(OSObject *target, void *param, IOReturn status, UInt32 bufferSizeRemaining, AbsoluteTime timeStamp)
 {
     XboxControllerHID *   me = OSDynamicCast(XboxControllerHID, target);
+    InterruptRead *       read = (InterruptRead *)param;
     
-    if (!me)
+    if (!me || !read)
         return;
     
-    me->InterruptReadHandler(status, bufferSizeRemaining);
+    // the read stays marked as queued while its buffer is processed, so nobody
+    // else can put it back on the pipe until we are done with it
+    me->ReleaseInterruptRead(read, me->InterruptReadHandler(read, status, bufferSizeRemaining, timeStamp));
     me->DecrementOutstandingIO();
 }
 
 
-void
-XboxControllerHID::InterruptReadHandler(IOReturn status, UInt32 bufferSizeRemaining)
+XboxControllerHID::ReadDisposition
+XboxControllerHID::InterruptReadHandler(InterruptRead *read, IOReturn status, UInt32 bufferSizeRemaining, AbsoluteTime timeStamp)
 {
-    bool        queueAnother = true;
-    IOReturn        err = kIOReturnSuccess;
+    ReadDisposition disposition = kReadRequeue;
+    
+    if (status != kIOReturnSuccess)
+        OSIncrementAtomic(&_errorCounts[errorCounterForStatus(status)]);
+    
+#if ENABLE_REPORT_TRACE
+    UInt8           traceFlags = 0;
+    bool            tracing = _traceEnabled;
+    XBTraceRecord   traceRecord;
+    
+    if (tracing)
+    {
+        UInt32 length = 0;
+        
+        if (status == kIOReturnSuccess || status == kIOReturnOverrun)
+            length = read->buffer->getLength() - bufferSizeRemaining;
+        traceBegin(&traceRecord, status, timeStamp, read->buffer, length);
+    }
+#endif
     
     switch (status)
     {
@@ -1947,18 +2434,8 @@ XboxControllerHID::InterruptReadHandler(IOReturn status, UInt32 bufferSizeRemain
             // fall through to the kIOReturnSuccess case.
             // 01-18-02 JRH If we are inactive, then ignore this
             if (!isInactive())
-            {
-                //
-                // First, clear the halted bit in the controller
-                //
-                _interruptPipe->ClearStall();
-                
-                // And call the device to reset the endpoint as well
-                //
-                IncrementOutstandingIO();
-                thread_call_enter(_clearFeatureEndpointHaltThread);
-            }
-            queueAnother = false;
+                StartClearFeatureEndpointHalt(timeStamp);
+            disposition = kReadRecover;
             
             // Fall through to process the data.
             
@@ -1967,23 +2444,62 @@ XboxControllerHID::InterruptReadHandler(IOReturn status, UInt32 bufferSizeRemain
             //
             _retryCount = kHIDDriverRetryCount;
             
+            // first report since a halt: how long we were without input
+            if (_haltStartTime && !_haltPending)
+            {
+                UInt64 elapsed = AbsoluteTime_to_scalar(&timeStamp) - _haltStartTime;
+                
+                _haltStartTime = 0;
+                _haltRecoveryTotal += elapsed;
+                recordHistogram(&_haltRecoveryTimes, elapsed);
+            }
+            
             // Handle the data
             //
-#if ENABLE_HIDREPORT_LOGGING
-            USBLog(6, "%s[%p]::InterruptReadHandler report came in:", getName(), this);
-            LogMemReport(_buffer);
+            // time between completions, to see the polling jitter
+            if (_lastCompletionTime)
+                recordHistogram(&_reportIntervals, AbsoluteTime_to_scalar(&timeStamp) - _lastCompletionTime);
+            _lastCompletionTime = AbsoluteTime_to_scalar(&timeStamp);
+            
+            if (manipulateReport(read->buffer))
+            {
+                if (_suppressDuplicates && isDuplicateReport(read->buffer, AbsoluteTime_to_scalar(&timeStamp)))
+                {
+                    _reportsSuppressed++;
+                    _lastReportRepeats++;
+                    OSMemoryBarrier();
+                    wakeLastReportWaiters();
+#if ENABLE_REPORT_TRACE
+                    traceFlags |= kTraceRecordSuppressed;
+#endif
+                }
+                else
+                {
+                    UInt64 now;
+                    
+                    // stamp the event with the time the controller completed the transfer,
+                    // not the time we got around to processing it
+                    saveLastReport(read->buffer, AbsoluteTime_to_scalar(&timeStamp));
+                    handleReportWithTime(timeStamp, read->buffer);
+                    _reportsDelivered++;
+#if ENABLE_REPORT_TRACE
+                    traceFlags |= kTraceRecordDelivered;
 #endif
-            if (manipulateReport(_buffer))
-                handleReport(_buffer);
+                    
+                    // time from USB completion until the HID layer is done with the report
+                    clock_get_uptime(&now);
+                    recordHistogram(&_reportLatencies, now - AbsoluteTime_to_scalar(&timeStamp));
+                }
+            }
             
-            if (_xbDeviceType->isEqualTo(kDeviceTypeIRKey))
+            if (_xbDeviceOps->usesReleaseTimer)
                 if (_xbTimerEventSource) {
                     _xbTimerEventSource->cancelTimeout();
                     _xbTimerEventSource->setTimeoutMS(_xbTimedEventsInterval);
                 }
             
             if (isInactive())
-                queueAnother = false;
+                disposition = kReadStop;
             
             break;
             
@@ -1996,13 +2512,14 @@ XboxControllerHID::InterruptReadHandler(IOReturn status, UInt32 bufferSizeRemain
             //
             if ( _deviceHasBeenDisconnected || isInactive() )
             {
-                queueAnother = false;
+                disposition = kReadStop;
             }
             else
             {
                 USBLog(3, "%s[%p]::InterruptReadHandler Checking to see if HID device is still connected", getName(), this);
                 IncrementOutstandingIO();
-                thread_call_enter(_deviceDeadCheckThread);
+                if (thread_call_enter(_deviceDeadCheckThread))
+                    DecrementOutstandingIO();   // already pending for another read of the ring
                 
                 // Before requeueing, we need to clear the stall
                 //
@@ -2017,7 +2534,7 @@ XboxControllerHID::InterruptReadHandler(IOReturn status, UInt32 bufferSizeRemain
             if (isInactive() || _deviceIsDead )
             {
                 USBLog(3, "%s[%p]::InterruptReadHandler error kIOReturnAborted (expected)", getName(), this);
-                queueAnother = false;
+                disposition = kReadStop;
             }
             else
             {
@@ -2044,42 +2561,69 @@ XboxControllerHID::InterruptReadHandler(IOReturn status, UInt32 bufferSizeRemain
             USBLog(3, "%s[%p]::InterruptReadHandler OHCI error (0x%x) reading interrupt pipe", getName(), this, status);
             // 01-18-02 JRH If we are inactive, then ignore this
             if (!isInactive())
-            {
-                // First, clear the halted bit in the controller
-                //
-                _interruptPipe->ClearStall();
-                
-                // And call the device to reset the endpoint as well
-                //
-                IncrementOutstandingIO();
-                thread_call_enter(_clearFeatureEndpointHaltThread);
-            }
+                StartClearFeatureEndpointHalt(timeStamp);
+            
             // We don't want to requeue the read here, AND we don't want to indicate that we are done
             //
-            queueAnother = false;
+            disposition = kReadRecover;
+            break;
+            
+        case kIOUSBTransactionReturned:
+            // ClearStall() hands back every other read of the ring that was still on the pipe. If a halt
+            // is being recovered, the endpoint is not cleared at the device yet, so leave the read for
+            // ClearFeatureEndpointHalt to queue instead of putting it straight back on the pipe.
+            USBLog(5, "%s[%p]::InterruptReadHandler read returned by ClearStall", getName(), this);
+            disposition = kReadRecover;
             break;
+            
         default:
             // We should handle other errors more intelligently, but
             // for now just return and assume the error is recoverable.
             USBLog(3, "%s[%p]::InterruptReadHandler error (0x%x) reading interrupt pipe", getName(), this, status);
             if (isInactive())
-                queueAnother = false;
+                disposition = kReadStop;
             
             break;
     }
     
-    if ( queueAnother )
+#if ENABLE_REPORT_TRACE
+    if (tracing)
+        traceCommit(&traceRecord, read->buffer, traceFlags);
+#endif
+    
+    return disposition;
+}
+
+
+//
+// ReleaseInterruptRead
+//
+// Called once the completion handler is done with the read's buffer. Only now is the read marked
+// as idle, so QueueInterruptReads() from the halt recovery or a port reset can't queue a buffer
+// that is still being processed. A read left for the halt recovery is queued here if the recovery
+// has already run while we were busy with it, because its QueueInterruptReads() skipped this read.
+//
+void
+XboxControllerHID::ReleaseInterruptRead(InterruptRead *read, ReadDisposition disposition)
+{
+    IOReturn    err;
+    
+    read->queued = 0;
+    
+    // pairs with the barrier in ClearFeatureEndpointHalt, so one of us sees the read as idle
+    OSMemoryBarrier();
+    if (disposition == kReadStop)
+        return;
+    if (disposition == kReadRecover && (_haltPending || isInactive()))
+        return;
+    
+    // Queue up another one before we leave.
+    //
+    err = QueueInterruptRead(read);
+    if ( err != kIOReturnSuccess)
     {
-        // Queue up another one before we leave.
-        //
-        IncrementOutstandingIO();
-        err = _interruptPipe->Read(_buffer, &_completion);
-        if ( err != kIOReturnSuccess)
-        {
-            // This is bad.  We probably shouldn't continue on from here.
-            USBError(1, "%s[%p]::InterruptReadHandler immediate error 0x%x queueing read\n", getName(), this, err);
-            DecrementOutstandingIO();
-        }
+        // This is bad.  We probably shouldn't continue on from here.
+        USBError(1, "%s[%p]::InterruptReadHandler immediate error 0x%x queueing read\n", getName(), this, err);
     }
 }
 
@@ -2112,6 +2656,7 @@ void
 XboxControllerHID::CheckForDeadDevice()
 {
     IOReturn            err = kIOReturnSuccess;
+    UInt64              start, now;
     
     // Are we still connected?  Don't check again if we're already
     // checking
@@ -2119,6 +2664,7 @@ XboxControllerHID::CheckForDeadDevice()
     if ( _interface && _device && !_deviceDeadThreadActive)
     {
         _deviceDeadThreadActive = TRUE;
+        clock_get_uptime(&start);
         
         err = _device->message(kIOUSBMessageHubIsDeviceConnected, NULL, 0);
         
@@ -2147,11 +2693,45 @@ XboxControllerHID::CheckForDeadDevice()
             _deviceHasBeenDisconnected = TRUE;
             USBLog(5, "%s[%p]: CheckForDeadDevice: device has been unplugged", getName(), this);
         }
+        
+        clock_get_uptime(&now);
+        recordHistogram(&_deadDeviceCheckTimes, now - start);
         _deviceDeadThreadActive = FALSE;
     }
 }
 
 
+//=============================================================================================
+//
+//  StartClearFeatureEndpointHalt clears the halted bit in the controller, schedules
+//  ClearFeatureEndpointHalt and remembers when the pipe stopped delivering, so the time until
+//  the next report arrives can be measured. Several reads of the ring may fail with the
+//  same halt; they share one recovery.
+//
+//=============================================================================================
+//
+void
+XboxControllerHID::StartClearFeatureEndpointHalt(AbsoluteTime timeStamp)
+{
+    if (!_haltStartTime)
+        _haltStartTime = AbsoluteTime_to_scalar(&timeStamp);
+    
+    // set before ClearStall(), which returns the other reads of the ring to us
+    _haltPending = 1;
+    OSMemoryBarrier();
+    
+    // First, clear the halted bit in the controller
+    //
+    _interruptPipe->ClearStall();
+    
+    // And call the device to reset the endpoint as well
+    //
+    IncrementOutstandingIO();
+    if (thread_call_enter(_clearFeatureEndpointHaltThread))
+        DecrementOutstandingIO();   // already pending for another read of the ring
+}
+
+
 //=============================================================================================
 //
 //  ClearFeatureEndpointHaltEntry is called when we get an OHCI error from our interrupt read
@@ -2201,81 +2781,121 @@ XboxControllerHID::ClearFeatureEndpointHalt( )
         USBLog(3, "%s[%p]::ClearFeatureEndpointHalt -  DeviceRequest returned: 0x%x", getName(), this, status);
     }
     
-    // Now that we've sent the ENDPOINT_HALT clear feature, we need to requeue the interrupt read.  Note
-    // that we are doing this even if we get an error from the DeviceRequest.
+    // Now that we've sent the ENDPOINT_HALT clear feature, we need to requeue the interrupt reads.  Note
+    // that we are doing this even if we get an error from the DeviceRequest. Reads that are still being
+    // processed are skipped here; they see _haltPending cleared and queue themselves when done.
     //
-    IncrementOutstandingIO();
-    status = _interruptPipe->Read(_buffer, &_completion);
+    _haltPending = 0;
+    OSMemoryBarrier();
+    status = QueueInterruptReads();
     if ( status != kIOReturnSuccess)
     {
         // This is bad.  We probably shouldn't continue on from here.
         USBLog(3, "%s[%p]::ClearFeatureEndpointHalt -  immediate error %d queueing read", getName(), this, status);
-        DecrementOutstandingIO();
         // _interface->close(this); this will be done in didTerminate
     }
 }
 
 
 
+//
+// Outstanding I/O is counted with atomics (XBOutstandingIO), so the completion path never has to take the
+// gate. When the count drops to zero after didTerminate has asked for it, the provider is closed from inside
+// the gate. XBClaimClose() makes sure only one of the racing paths (didTerminate or the last completion) closes it.
+//
 IOReturn
-XboxControllerHID::ChangeOutstandingIO(OSObject *target, void *param1, void *param2, void *param3, void *param4)
+XboxControllerHID::CloseProviderAction(OSObject *target, void *param1, void *param2, void *param3, void *param4)
 {
     XboxControllerHID *me = OSDynamicCast(XboxControllerHID, target);
-    UInt64  direction = (UInt64)param1;
     
     if (!me)
     {
-        USBLog(1, "XboxControllerHID::ChangeOutstandingIO - invalid target");
+        USBLog(1, "XboxControllerHID::CloseProviderAction - invalid target");
         return kIOReturnSuccess;
     }
-    switch (direction)
-    {
-        case 1:
-            me->_outstandingIO++;
-            break;
-            
-        case -1:
-            if (!--me->_outstandingIO && me->_needToClose)
-            {
-                USBLog(3, "%s[%p]::ChangeOutstandingIO isInactive = %d, outstandingIO = %u - closing device",
-                       me->getName(), me, me->isInactive(), me->_outstandingIO);
-                me->_interface->close(me);
-            }
-            break;
-            
-        default:
-            USBLog(1, "%s[%p]::ChangeOutstandingIO - invalid direction", me->getName(), me);
-    }
+    
+    me->CloseProvider();
     return kIOReturnSuccess;
 }
 
 
+void
+XboxControllerHID::CloseProvider(void)
+{
+    if (!XBClaimClose(&_outstandingIO))
+        return;
+    
+    USBLog(3, "%s[%p]::CloseProvider isInactive = %d, outstandingIO = %d - closing device",
+           getName(), this, isInactive(), (int)_outstandingIO.count);
+    _interface->close(this);
+}
+
+
 void
 XboxControllerHID::DecrementOutstandingIO(void)
 {
-    if (!_gate)
-    {
-        if (!--_outstandingIO && _needToClose)
-        {
-            USBLog(3, "%s[%p]::DecrementOutstandingIO isInactive = %d, outstandingIO = %u - closing device",
-                   getName(), this, isInactive(), _outstandingIO);
-            _interface->close(this);
-        }
+    if (!XBEndIO(&_outstandingIO))
         return;
-    }
-    _gate->runAction(ChangeOutstandingIO, (void*)-1);
+    
+    if (_gate)
+        _gate->runAction(CloseProviderAction);
+    else
+        CloseProvider();
 }
 
 
 void
 XboxControllerHID::IncrementOutstandingIO(void)
 {
-    if (!_gate)
+    XBBeginIO(&_outstandingIO);
+}
+
+
+//
+// QueueInterruptRead
+//
+// Queue one read of the ring on the interrupt pipe, unless it is already queued. Each read
+// has its own buffer and completion, so the pipe always has the next transfers lined up
+// while we are still processing a report.
+//
+IOReturn
+XboxControllerHID::QueueInterruptRead(InterruptRead *read)
+{
+    IOReturn    err;
+    
+    if (!OSCompareAndSwap(0, 1, &read->queued))
+        return kIOReturnSuccess;
+    
+    IncrementOutstandingIO();
+    err = _interruptPipe->Read(read->buffer, 0, 0, read->buffer->getLength(), &read->completion);
+    if (err != kIOReturnSuccess)
     {
-        _outstandingIO++;
-        return;
+        read->queued = 0;
+        DecrementOutstandingIO();
+    }
+    return err;
+}
+
+
+//
+// QueueInterruptReads
+//
+// Queue every read of the ring that isn't on the pipe already. Succeeds if at least one read is
+// queued, otherwise returns the last error.
+//
+IOReturn
+XboxControllerHID::QueueInterruptReads(void)
+{
+    IOReturn    err = kIOReturnNotReady;
+    bool        anyQueued = false;
+    
+    for (UInt32 i = 0; i < _numReads; i++)
+    {
+        err = QueueInterruptRead(&_reads[i]);
+        if (err == kIOReturnSuccess)
+            anyQueued = true;
     }
-    _gate->runAction(ChangeOutstandingIO, (void*)1);
+    return anyQueued ? kIOReturnSuccess : err;
 }
 
 
@@ -2292,15 +2912,18 @@ XboxControllerHID::StartFinalProcessing(void)
 {
     IOReturn    err = kIOReturnSuccess;
     
-    _completion.target = (void *)this;
-    _completion.action = (IOUSBCompletionAction) &XboxControllerHID::InterruptReadHandlerEntry;
-    _completion.parameter = (void *)0;
+    for (UInt32 i = 0; i < _numReads; i++)
+    {
+        _reads[i].completion.target = (void *)this;
+        _reads[i].completion.action = (IOUSBCompletionActionWithTimeStamp) &XboxControllerHID::InterruptReadHandlerEntry;
+        _reads[i].completion.parameter = (void *)&_reads[i];
+        _reads[i].queued = 0;
+    }
+    _haltPending = 0;
     
-    IncrementOutstandingIO();
-    err = _interruptPipe->Read(_buffer, &_completion);
+    err = QueueInterruptReads();
     if (err != kIOReturnSuccess)
     {
-        DecrementOutstandingIO();
         USBError(1, "%s[%p]::StartFinalProcessing - err (%x) in interrupt read, retain count %d after release",
                  getName(), this, err, getRetainCount());
     }
@@ -2332,43 +2955,172 @@ XboxControllerHID::SetIdleMillisecs(UInt16 msecs)
 }
 
 
-#if ENABLE_HIDREPORT_LOGGING
+#if ENABLE_REPORT_TRACE
+//
+// Report trace. Records are built on the stack and copied into the ring shared with the trace
+// client (see XBTraceRingPush()), so the client never sees a half-written one. Read completions
+// and setReport() both record, and _traceLock keeps their pushes apart; it is only held for the
+// copy. The client is the ring's only consumer and drains it through its own mapping.
+//
+IOReturn
+XboxControllerHID::openTrace(IOMemoryDescriptor **memory)
+{
+    IOBufferMemoryDescriptor *buffer;
+    
+    buffer = IOBufferMemoryDescriptor::inTaskWithOptions(kernel_task, kIODirectionInOut | kIOMemoryKernelUserShared,
+                                                         XBTraceRingSize(kTraceRecords), page_size);
+    if (!buffer)
+        return kIOReturnNoMemory;
+    
+    if (!OSCompareAndSwapPtr(NULL, buffer, (void * volatile *)&_traceMemory))
+    {
+        buffer->release();
+        return kIOReturnExclusiveAccess;
+    }
+    
+    bzero(buffer->getBytesNoCopy(), buffer->getLength());
+    
+    IOSimpleLockLock(_traceLock);
+    XBInitTraceRing(&_traceProducer, (XBTraceRing *)buffer->getBytesNoCopy(), kTraceRecords);
+    _traceEnabled = true;
+    IOSimpleLockUnlock(_traceLock);
+    
+    USBLog(3, "%s[%p]::openTrace %d records", getName(), this, kTraceRecords);
+    
+    buffer->retain();
+    *memory = buffer;
+    return kIOReturnSuccess;
+}
+
 void
-XboxControllerHID::LogMemReport(IOMemoryDescriptor * reportBuffer)
+XboxControllerHID::closeTrace()
 {
-    IOByteCount reportSize;
-    char outBuffer[1024];
-    char in[1024];
-    char *out;
-    char inChar;
+    IOBufferMemoryDescriptor *buffer = _traceMemory;
+    
+    if (!buffer)
+        return;
+    
+    // once the lock is dropped no push can be in the ring, the dropped count stays for Statistics
+    IOSimpleLockLock(_traceLock);
+    _traceEnabled = false;
+    _traceProducer.ring = NULL;
+    IOSimpleLockUnlock(_traceLock);
+    
+    if (OSCompareAndSwapPtr(buffer, NULL, (void * volatile *)&_traceMemory))
+        buffer->release();
     
-    out = (char *)&outBuffer;
-    reportSize = reportBuffer->getLength();
-    reportBuffer->readBytes(0, in, reportSize );
-    if (reportSize > 256) reportSize = 256;
+    USBLog(3, "%s[%p]::closeTrace %d dropped", getName(), this, (int)_traceProducer.dropped);
+}
+
+void
+XboxControllerHID::traceBegin(XBTraceRecord *record, IOReturn status, AbsoluteTime timeStamp, IOBufferMemoryDescriptor *report, UInt32 length)
+{
+    bzero(record, sizeof(XBTraceRecord));
+    record->timeStamp = AbsoluteTime_to_scalar(&timeStamp);
+    record->locationID = _locationID;
+    record->status = status;
+    record->version = kTraceFormatVersion;
     
-    for (unsigned int i = 0; i < reportSize; i++)
+    if (length > kTraceReportBytes)
     {
-        inChar = in[i];
-        *out++ = ' ';
-        *out++ = GetHexChar(inChar >> 4);
-        *out++ = GetHexChar(inChar & 0x0F);
+        length = kTraceReportBytes;
+        record->flags |= kTraceRecordTruncated;
     }
+    record->length = length;
+    
+    if (length)
+        memcpy(record->raw, report->getBytesNoCopy(), length);
+}
+
+void
+XboxControllerHID::traceCommit(XBTraceRecord *record, IOBufferMemoryDescriptor *report, UInt8 flags)
+{
+    record->flags |= flags;
+    if (record->length)
+        memcpy(record->transformed, report->getBytesNoCopy(), record->length);
     
-    *out = 0;
+    absolutetime_to_nanoseconds(record->timeStamp, &record->timeStamp);
     
-    USBLog(6, outBuffer);
+    IOSimpleLockLock(_traceLock);
+    if (_traceProducer.ring)
+        XBTraceRingPush(&_traceProducer, record);
+    IOSimpleLockUnlock(_traceLock);
 }
 
-char
-XboxControllerHID::GetHexChar(char hexChar)
+// output reports are recorded once sent, or once both pipes failed
+void
+XboxControllerHID::traceOutputReport(IOMemoryDescriptor *report, IOReturn status)
 {
-    char hexChars[] = {'0','1','2','3','4','5','6','7','8','9','A','B','C','D','E','F'};
-    return hexChars[0x0F & hexChar];
+    XBTraceRecord record;
+    UInt64 now;
+    IOByteCount length = report->getLength();
+    
+    bzero(&record, sizeof(record));
+    clock_get_uptime(&now);
+    absolutetime_to_nanoseconds(now, &record.timeStamp);
+    record.locationID = _locationID;
+    record.status = status;
+    record.version = kTraceFormatVersion;
+    record.flags = kTraceRecordOutput;
+    if (status == kIOReturnSuccess)
+        record.flags |= kTraceRecordDelivered;
+    
+    if (length > kTraceReportBytes)
+    {
+        length = kTraceReportBytes;
+        record.flags |= kTraceRecordTruncated;
+    }
+    record.length = report->readBytes(0, record.raw, length);
+    
+    IOSimpleLockLock(_traceLock);
+    if (_traceProducer.ring)
+        XBTraceRingPush(&_traceProducer, &record);
+    IOSimpleLockUnlock(_traceLock);
 }
 #endif
 
 
+IOReturn
+XboxControllerHID::newUserClient(task_t owningTask, void *securityID, UInt32 type,
+                                 OSDictionary *properties, IOUserClient **handler)
+{
+#if ENABLE_REPORT_TRACE
+    if (type == kTraceClientType)
+    {
+        XboxControllerHIDTraceClient *client;
+        IOReturn err;
+        
+        // the trace holds every report, keystrokes of the remote included
+        err = IOUserClient::clientHasPrivilege(securityID, kIOClientPrivilegeAdministrator);
+        if (err != kIOReturnSuccess)
+            return err;
+        
+        client = new XboxControllerHIDTraceClient;
+        if (!client)
+            return kIOReturnNoMemory;
+        
+        if (!client->initWithTask(owningTask, securityID, type, properties) || !client->attach(this))
+        {
+            client->release();
+            return kIOReturnError;
+        }
+        
+        if (!client->start(this))
+        {
+            client->detach(this);
+            client->release();
+            return kIOReturnExclusiveAccess;
+        }
+        
+        *handler = client;
+        return kIOReturnSuccess;
+    }
+#endif
+    
+    return super::newUserClient(owningTask, securityID, type, properties, handler);
+}
+
+
 OSMetaClassDefineReservedUnused(XboxControllerHID,  0);
 OSMetaClassDefineReservedUnused(XboxControllerHID,  1);
 OSMetaClassDefineReservedUnused(XboxControllerHID,  2);
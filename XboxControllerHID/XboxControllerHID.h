@@ -19,127 +19,116 @@
 #include <IOKit/usb/USB.h>
 
 #include "XboxControllerHIDKeys.h"
+#include "XboxControllerHIDCore.h"
 
-// remote control keys (index into ButtonMapping table which is generated
-// and stored in the driver's property list)
+// an entry of the KnownDevices dictionary, see isKnownDevice()
+typedef struct {
+    
+    UInt32      deviceID;   // vendor id << 16 | product id, the table is sorted by it
+    OSString *  type;
+    OSString *  name;
+    OSString *  vendor;
+    
+} XBKnownDevice;
+
+typedef struct {
+    
+    UInt32          count;
+    UInt32          capacity;
+    XBKnownDevice * devices;
+    
+} XBKnownDeviceTable;
+
+// device types, resolved from the Type string at probe time
 typedef enum {
     
-    kRemoteDisplay = 0,
-    kRemoteReverse,
-    kRemotePlay,
-    kRemoteForward,
-    kRemoteSkipBackward,
-    kRemoteStop,
-    kRemotePause,
-    kRemoteSkipForward,
-    kRemoteTitle,
-    kRemoteUp,
-    kRemoteInfo,
-    kRemoteLeft,
-    kRemoteSelect,
-    kRemoteRight,
-    kRemoteMenu,
-    kRemoteDown,
-    kRemoteBack,
-    kRemoteKP1,
-    kRemoteKP2,
-    kRemoteKP3,
-    kRemoteKP4,
-    kRemoteKP5,
-    kRemoteKP6,
-    kRemoteKP7,
-    kRemoteKP8,
-    kRemoteKP9,
-    kRemoteKP0,
-    kNumRemoteButtons
-} XBoxRemoteKey;
+    kDeviceTypeUnknown = 0,
+    kDeviceTypePad,
+    kDeviceTypeIR,
+    kNumDeviceTypes
+} XBDeviceType;
 
-// this structure describes the (fabricated) remote report
-// that is passed up to the hid layer
+// a GenericProperties tree compiled for findGenericDevice(), the
+// endpoints to match are an XBGenericPattern (see XboxControllerHIDCore.h)
 typedef struct {
     
-    // note: fields within byte are in reverse order
-    // first byte
-    UInt8 menu:1;
-    UInt8 info:1;
-    UInt8 title:1;
-    UInt8 right:1;
-    UInt8 left:1;
-    UInt8 down:1;
-    UInt8 up:1;
-    UInt8 select:1;
-    
-    // second byte
-    UInt8 skipBackward:1;
-    UInt8 forward:1;
-    UInt8 reverse:1;
-    UInt8 pause:1;
-    UInt8 stop:1;
-    UInt8 play:1;
-    UInt8 display:1;
-    UInt8 back:1;
-    
-    // third byte
-    UInt8 kp6:1;
-    UInt8 kp5:1;
-    UInt8 kp4:1;
-    UInt8 kp3:1;
-    UInt8 kp2:1;
-    UInt8 kp1:1;
-    UInt8 kp0:1;
-    UInt8 skipForward:1;
-    
-    // fourth byte
-    UInt8 r1:5; // constant
-    UInt8 kp9:1;
-    UInt8 kp8:1;
-    UInt8 kp7:1;
-    
-    // constant
-    UInt8 r2;
-    UInt8 r3;
-    
-} XBRemoteReport;
+    OSString *          type;
+    OSString *          name;
+    OSString *          vendor;
+    XBGenericPattern    pattern;
+    
+} XBGenericSignature;
 
-// this describes the actual hid report that we have to parse
-typedef struct
-{
-    UInt8 r1, r2;
-    UInt8 scancode;
-    UInt8 r3, r4, r5;
+typedef struct {
+    
+    UInt32              count;
+    UInt32              maxInterfaces;      // most interfaces any signature looks at
+    XBGenericSignature  signatures[kNumDeviceTypes];
     
-} XBActualRemoteReport;
+} XBGenericSignatureTable;
 
-// this checks that the structures are of the same size
-typedef int _sizeCheck[ (sizeof(XBRemoteReport) == sizeof(XBActualRemoteReport)) * 2 - 1];
+// log2 histogram of nanoseconds, bucket n counts values in [2^n, 2^(n+1))
+#define kHistogramBuckets   32
+
+typedef struct {
+    
+    UInt64 buckets[kHistogramBuckets];
+    
+} XBHistogram;
+
+// interrupt pipe completion statuses we keep a count of
+typedef enum {
+    
+    kErrorCounterOverrun = 0,
+    kErrorCounterNotResponding,
+    kErrorCounterAborted,
+    kErrorCounterUnderrun,
+    kErrorCounterPipeStalled,
+    kErrorCounterLink,
+    kErrorCounterNotSent2,
+    kErrorCounterNotSent1,
+    kErrorCounterBufferUnderrun,
+    kErrorCounterBufferOverrun,
+    kErrorCounterWrongPID,
+    kErrorCounterPIDCheck,
+    kErrorCounterDataToggle,
+    kErrorCounterBitstuf,
+    kErrorCounterCRC,
+    kErrorCounterTransactionReturned,   // not an error: reads handed back by ClearStall()
+    kErrorCounterOther,
+    
+    kNumErrorCounters
+    
+} XBErrorCounter;
+
+// parsed report descriptor capabilities, see findCachedCapabilities()
+#define kCapabilitiesCacheSize  8
+
+enum {
+    
+    kCapabilitiesCacheEntryFree = 0,
+    kCapabilitiesCacheEntryFilling,
+    kCapabilitiesCacheEntryReady
+};
 
-// this structure represents the gampad's raw report
 typedef struct {
     
-    UInt8
-    r1,      // reserved
-    r2,      // report length (useless)
-    buttons, // up, down, left, right, start, back, left-click, right-click
-    r3,      // reserved
-    a,
-    b,
-    x,
-    y,
-    black,
-    white,
-    lt,     // left trigger
-    rt;     // right trigger
-    
-    // lo/hi bits of signed 16-bit axes
-    UInt8
-    lxlo, lxhi,
-    lylo, lyhi,
-    rxlo, rxhi,
-    rylo, ryhi;
-    
-} XBPadReport;
+    volatile UInt32 state;
+    UInt32          length;         // of the descriptor
+    UInt64          hash;           // of the descriptor bytes
+    UInt32          usage;
+    UInt32          usagePage;
+    UInt32          maxReportSize;
+    UInt32          maxOutReportSize;
+    
+} XBCapabilitiesCacheEntry;
+
+// Compiles in the report trace, which is still off until a client opens the
+// trace user client (XboxControllerHIDTraceClient). Reports are recorded raw and
+// transformed into a ring of XBTraceRecord that the client maps and drains.
+#define ENABLE_REPORT_TRACE     1
 
-#define ENABLE_HIDREPORT_LOGGING    0
+#define kTraceRecords           4096    // ring size, power of 2
 
 // Report types from low level USB:
 //  from USBSpec.h:
@@ -180,6 +169,15 @@ typedef struct {
 #define kMaxHIDReportSize 256           // Max packet size = 8 for low speed & 64 for high speed.
 #define kHIDDriverRetryCount    3
 
+// interrupt reads kept queued on the pipe (overridden by the InterruptReads personality key)
+#define kDefaultInterruptReads  2
+#define kMaxInterruptReads      8
+
+// getReport() option: wait for the next input report instead of returning the last one; a
+// suppressed duplicate of the last one counts as the next
+#define kGetReportOptionFresh   0x00010000
+#define kFreshReportTimeoutMS   1000
+
 
 class XboxControllerHID : public IOHIDDevice
 {
@@ -189,16 +187,74 @@ class XboxControllerHID : public IOHIDDevice
     IOUSBDevice *       _device;
     IOUSBPipe *         _interruptPipe;
     ByteCount          _maxReportSize;
-    IOBufferMemoryDescriptor *  _buffer;
-    IOUSBCompletion     _completion;
+    
+    // ring of interrupt reads, each with its own buffer and completion
+    struct InterruptRead
+    {
+        IOBufferMemoryDescriptor *      buffer;
+        IOUSBCompletionWithTimeStamp    completion; // stamped by the controller on completion
+        volatile UInt32                 queued;     // 1 from queueing until its completion is processed
+    };
+    InterruptRead       _reads[kMaxInterruptReads];
+    UInt32              _numReads;
+    volatile UInt32     _haltPending;       // 1 until ClearFeatureEndpointHalt has run
+    
+    // what the completion handler wants done with its read
+    typedef enum
+    {
+        kReadRequeue,       // put it back on the pipe
+        kReadRecover,       // left for ClearFeatureEndpointHalt to queue
+        kReadStop           // we are going away
+    } ReadDisposition;
+    
+    // last report handed to the HID layer, served by getReport()
+    // (UInt64 to keep it aligned like the read buffers)
+    UInt64              _lastReport[kMaxHIDReportSize / sizeof(UInt64)];
+    UInt32              _lastReportLength;
+    UInt64              _lastReportTime;         // bus completion time
+    volatile UInt32     _lastReportSeq;         // odd while being written
+    volatile UInt32     _lastReportRepeats;     // duplicates of it suppressed, also wake waiters
+    volatile SInt32     _lastReportWaiters;
+    IOLock *            _lastReportLock;
+    
+    // duplicate report suppression (pad option)
+    bool                _suppressDuplicates;
+    UInt64              _keepaliveInterval;     // absolute time, 0 = never resend
+    UInt64              _reportsDelivered;
+    UInt64              _reportsSuppressed;
+    
+    // report timing, published with the statistics
+    XBHistogram         _reportLatencies;       // completion until handleReport() returns
+    XBHistogram         _reportIntervals;       // between successive completions
+    UInt64              _lastCompletionTime;
+    
+    // interrupt pipe errors and the time it takes to recover from them
+    volatile SInt32     _errorCounts[kNumErrorCounters];
+    UInt64              _haltStartTime;         // completion time of the read that halted the pipe
+    UInt64              _haltRecoveryTotal;     // sum of all halt recoveries, absolute time
+    XBHistogram         _haltRecoveryTimes;     // halted read until the next report arrives
+    XBHistogram         _deadDeviceCheckTimes;  // duration of CheckForDeadDevice()
+    
+    UInt64              _attachTime;            // duration of handleStart(), ns
+    bool                _capabilitiesCached;    // handleStart() found the descriptor in the cache
+    
+#if ENABLE_REPORT_TRACE
+    // the ring shared with the trace client; completions and setReport() both
+    // record, so pushes are serialized by _traceLock
+    IOSimpleLock *              _traceLock;
+    IOBufferMemoryDescriptor *  _traceMemory;
+    XBTraceProducer             _traceProducer;
+    volatile bool               _traceEnabled;
+    UInt32                      _locationID;
+#endif
+    
     UInt32          _retryCount;
     thread_call_t       _deviceDeadCheckThread;
     thread_call_t       _clearFeatureEndpointHaltThread;
     bool            _deviceDeadThreadActive;
     bool            _deviceIsDead;
     bool            _deviceHasBeenDisconnected;
-    bool            _needToClose;
-    UInt32          _outstandingIO;
+    XBOutstandingIO     _outstandingIO;
     IOCommandGate *     _gate;
     IOUSBPipe *         _interruptOutPipe;
     ByteCount          _maxOutReportSize;
@@ -207,7 +263,8 @@ class XboxControllerHID : public IOHIDDevice
     UInt32          _deviceUsagePage;
     
     // xbox additions
-    OSString *      _xbDeviceType;
+    OSString *      _xbDeviceType;      // only for the registry/clients, use _xbDeviceTypeID
+    XBDeviceType    _xbDeviceTypeID;
     OSString *      _xbDeviceVendor;
     OSString *      _xbDeviceName;
     OSData *        _xbDeviceHIDReportDescriptor;
@@ -215,42 +272,65 @@ class XboxControllerHID : public IOHIDDevice
     OSArray *       _xbDeviceButtonMapArray;
     UInt8           _xbLastButtonPressed;
     
+    // compiled button map, double-buffered and swapped inside the gate at runtime
+    XBRemoteButtonTable             _xbRemoteButtonTables[2];
+    XBRemoteButtonTable *           _xbRemoteButtonTable;
+    
     // timing stuff (for synthesizing events - currently only for remote control)
     //bool            _xbShouldGenerateTimedEvent;
     UInt16          _xbTimedEventsInterval;
+    IOBufferMemoryDescriptor * _xbReleaseBuffer;
     IOWorkLoop *    _xbWorkLoop;
     IOTimerEventSource * _xbTimerEventSource;
     
     // xbox device options
     union {
-        struct {
-            bool InvertYAxis;        // invert sticks (default = true for Y, false for X)
-            bool InvertXAxis;
-            bool InvertRyAxis;
-            bool InvertRxAxis;
-            bool ClampButtons;       // clamp face buttons to 0-1 (default = true)
-            bool ClampLeftTrigger;      // clamp triggers to 0-1 (default = false)
-            bool ClampRightTrigger;
-            
-            //bool LeftTriggerIsButton; // triggers are mapped to buttons, not axis (default = false)
-            //bool RightTriggerIsButton;
-            
-            UInt8 LeftTriggerThreshold;  // point at which trigger press is realized (default = 1)
-            UInt8 RightTriggerThreshold;
-        } pad;
+        XBPadOptions pad;
         // add more devices here...
     } _xbDeviceOptions;
     
+    // report transform for the current pad options
+    XBPadTransform  _xbPadTransform;
+    
+    // trigger clamp/threshold lookup tables, rebuilt with the transform inside the gate
+    UInt8           _xbLeftTriggerTable[256];
+    UInt8           _xbRightTriggerTable[256];
+    
+    // per device type behaviour, selected in probe()
+    struct DeviceOps
+    {
+        UInt32  reportSize;                 // raw report size the transform handles
+        bool    (XboxControllerHID::*transform)(void *report);
+        bool    usesReleaseTimer;           // synthesize button release events
+        bool    servesInputReports;         // getReport(input) returns the last report
+    };
+    static const DeviceOps  deviceOps[kNumDeviceTypes];
+    const DeviceOps *       _xbDeviceOps;
+    
     struct ExpansionData
     {
     };
     ExpansionData *_expansionData;
-    static void         InterruptReadHandlerEntry(OSObject *target, void *param, IOReturn status, UInt32 bufferSizeRemaining);
-    void            InterruptReadHandler(IOReturn status, UInt32 bufferSizeRemaining);
+    static void         InterruptReadHandlerEntry(OSObject *target, void *param, IOReturn status, UInt32 bufferSizeRemaining, AbsoluteTime timeStamp);
+    ReadDisposition InterruptReadHandler(InterruptRead *read, IOReturn status, UInt32 bufferSizeRemaining, AbsoluteTime timeStamp);
+    void            ReleaseInterruptRead(InterruptRead *read, ReadDisposition disposition);
+    
+    IOReturn        QueueInterruptRead(InterruptRead *read);
+    IOReturn        QueueInterruptReads(void);
+    
+    void            saveLastReport(IOBufferMemoryDescriptor *report, UInt64 timeStamp);
+    void            wakeLastReportWaiters();
+    bool            isDuplicateReport(IOBufferMemoryDescriptor *report, UInt64 timeStamp);
+    IOReturn        copyLastReport(IOMemoryDescriptor *report, bool fresh);
+    
+    static void     recordHistogram(XBHistogram *histogram, UInt64 interval);
+    static void     publishHistogram(OSDictionary *stats, const char *key, const XBHistogram *histogram);
+    static XBErrorCounter errorCounterForStatus(IOReturn status);
     
     static void         CheckForDeadDeviceEntry(OSObject *target);
     void            CheckForDeadDevice();
     
+    void                StartClearFeatureEndpointHalt(AbsoluteTime timeStamp);
     static void         ClearFeatureEndpointHaltEntry(OSObject *target);
     void            ClearFeatureEndpointHalt(void);
     
@@ -258,7 +338,8 @@ class XboxControllerHID : public IOHIDDevice
     
     virtual void free();
     
-    static IOReturn ChangeOutstandingIO(OSObject *target, void *arg0, void *arg1, void *arg2, void *arg3);
+    static IOReturn CloseProviderAction(OSObject *target, void *arg0, void *arg1, void *arg2, void *arg3);
+    void            CloseProvider(void);
     
 public:
     // IOService methods
@@ -335,6 +416,23 @@ public:
     
     virtual IOReturn setProperties( OSObject * properties );
     
+    virtual void publishStatistics();
+    virtual void resetStatistics();
+    static IOReturn publishStatisticsAction(OSObject *target, void *arg0, void *arg1, void *arg2, void *arg3);
+    static IOReturn resetStatisticsAction(OSObject *target, void *arg0, void *arg1, void *arg2, void *arg3);
+    
+    // kTraceClientType opens the trace client, everything else goes to IOHIDDevice
+    using IOHIDDevice::newUserClient;
+    virtual IOReturn newUserClient( task_t owningTask, void * securityID, UInt32 type,
+                                   OSDictionary * properties, IOUserClient ** handler );
+    
+#if ENABLE_REPORT_TRACE
+    // start recording into a new ring for the trace client, which gets the
+    // ring's memory retained; one client at a time
+    IOReturn openTrace(IOMemoryDescriptor **memory);
+    void closeTrace();
+#endif
+    
     // create and publish default option settings
     virtual void setDefaultOptions();
     
@@ -353,15 +451,30 @@ public:
      */
     
 private:    // Should these be protected or virtual?
-    IOReturn GetHIDDescriptor(UInt8 inDescriptorType, UInt8 inDescriptorIndex, UInt8 *vOutBuf, UInt32 *vOutSize);
+    static XBDeviceType deviceTypeForName(OSString *typeName);
+    static XBKnownDeviceTable *buildKnownDeviceTable(OSDictionary *vendors);
+    const XBKnownDevice *findKnownDevice(UInt16 vendorID, UInt16 productID);
+    static bool compileGenericPattern(OSDictionary *specificDeviceDict, XBGenericPattern *pattern);
+    static XBGenericSignatureTable *buildGenericSignatureTable(OSDictionary *deviceDataDict);
+    static void gatherGenericDeviceInfo(IOUSBDevice *device, UInt32 maxInterfaces, XBGenericDeviceInfo *info);
+    IOBufferMemoryDescriptor *sharedReportDescriptor();
+    bool findCachedCapabilities(IOBufferMemoryDescriptor *desc);
+    void cacheCapabilities(IOBufferMemoryDescriptor *desc);
+    bool manipulatePadReport(void *report);
+    bool manipulateRemoteReport(void *report);
+    static IOReturn selectPadTransformAction(OSObject *target, void *arg0, void *arg1, void *arg2, void *arg3);
+    void selectPadTransform();
+    static IOReturn setRemoteButtonMapAction(OSObject *target, void *arg0, void *arg1, void *arg2, void *arg3);
+    void setRemoteButtonMap(OSArray *buttonMap);
+    
     IOReturn GetReport(UInt8 inReportType, UInt8 inReportID, UInt8 *vInBuf, UInt32 *vInSize);
     IOReturn SetReport(UInt8 outReportType, UInt8 outReportID, UInt8 *vOutBuf, UInt32 vOutSize);
     IOReturn GetIndexedString(UInt8 index, UInt8 *vOutBuf, UInt32 *vOutSize, UInt16 lang = 0x409) const;
     
-#if ENABLE_HIDREPORT_LOGGING
-    void LogBufferReport(char *report, UInt32 len);
-    void LogMemReport(IOMemoryDescriptor * reportBuffer);
-    char GetHexChar(char hexChar);
+#if ENABLE_REPORT_TRACE
+    void traceBegin(XBTraceRecord *record, IOReturn status, AbsoluteTime timeStamp, IOBufferMemoryDescriptor *report, UInt32 length);
+    void traceCommit(XBTraceRecord *record, IOBufferMemoryDescriptor *report, UInt8 flags);
+    void traceOutputReport(IOMemoryDescriptor *report, IOReturn status);
 #endif
     
 public:
@@ -0,0 +1,745 @@
+//
+//  XboxControllerHIDCore.cpp
+//  XboxControllerHID
+//
+//  Report transforms, free of IOKit (see XboxControllerHIDCore.h)
+//
+
+#include "XboxControllerHIDCore.h"
+
+#ifndef KERNEL
+#include <stddef.h>
+#if defined(__x86_64__) || defined(__i386__)
+#define XB_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define XB_NEON_KERNEL 1
+#include <arm_neon.h>
+#endif
+#endif
+
+// -- specialized pad report transforms ---------------------
+// ----------------------------------------------------------
+
+// One transform is instantiated for every combination of pad options, so
+// the per-report path never tests an option that is turned off. The
+// Flags argument is a mask of kPadTransform* bits (see XboxControllerHIDCore.h)
+template <UInt32 Flags>
+static void
+padTransform(XBPadReport *raw, const UInt8 *leftTriggerTable, const UInt8 *rightTriggerTable)
+{
+#define INVERT_AXIS(name) \
+SInt16 name = (raw->name ## hi << 8) | raw->name ## lo; \
+name = -(name + 1); \
+raw->name ## hi = name >> 8; \
+raw->name ## lo = name & 0xFF;
+    
+    if (Flags & kPadTransformInvertY) {
+        INVERT_AXIS(ly)
+    }
+    
+    if (Flags & kPadTransformInvertRy) {
+        INVERT_AXIS(ry)
+    }
+    
+    if (Flags & kPadTransformInvertX) {
+        INVERT_AXIS(lx)
+    }
+    
+    if (Flags & kPadTransformInvertRx) {
+        INVERT_AXIS(rx)
+    }
+    
+#undef INVERT_AXIS
+    
+    if (Flags & kPadTransformClampButtons) {
+        
+        raw->a = (raw->a != 0);
+        raw->b = (raw->b != 0);
+        raw->x = (raw->x != 0);
+        raw->y = (raw->y != 0);
+        raw->black = (raw->black != 0);
+        raw->white = (raw->white != 0);
+    }
+    
+    // triggers go through the lookup tables built by XBBuildTriggerTable()
+    if (Flags & kPadTransformLeftTrigger)
+        raw->lt = leftTriggerTable[raw->lt];
+    
+    if (Flags & kPadTransformRightTrigger)
+        raw->rt = rightTriggerTable[raw->rt];
+}
+
+// The batch version runs the same specialization over an array, so the
+// option tests are gone from the loop as well and it can be unrolled
+template <UInt32 Flags>
+static void
+padBatchTransform(XBPadReport *reports, UInt32 count, const UInt8 *leftTriggerTable, const UInt8 *rightTriggerTable)
+{
+    for (UInt32 i = 0; i < count; i++)
+        padTransform<Flags>(&reports[i], leftTriggerTable, rightTriggerTable);
+}
+
+// tables of every specialization, indexed by option mask
+#define PAD_TRANSFORM_1(f, n)   &f<(n)>,
+#define PAD_TRANSFORM_2(f, n)   PAD_TRANSFORM_1(f, n)   PAD_TRANSFORM_1(f, (n) + 1)
+#define PAD_TRANSFORM_4(f, n)   PAD_TRANSFORM_2(f, n)   PAD_TRANSFORM_2(f, (n) + 2)
+#define PAD_TRANSFORM_8(f, n)   PAD_TRANSFORM_4(f, n)   PAD_TRANSFORM_4(f, (n) + 4)
+#define PAD_TRANSFORM_16(f, n)  PAD_TRANSFORM_8(f, n)   PAD_TRANSFORM_8(f, (n) + 8)
+#define PAD_TRANSFORM_32(f, n)  PAD_TRANSFORM_16(f, n)  PAD_TRANSFORM_16(f, (n) + 16)
+#define PAD_TRANSFORM_64(f, n)  PAD_TRANSFORM_32(f, n)  PAD_TRANSFORM_32(f, (n) + 32)
+#define PAD_TRANSFORM_128(f, n) PAD_TRANSFORM_64(f, n)  PAD_TRANSFORM_64(f, (n) + 64)
+
+static const XBPadTransform gPadTransforms[kNumPadTransforms] = {
+    PAD_TRANSFORM_128(padTransform, 0)
+};
+
+static const XBPadBatchTransform gPadBatchTransforms[kNumPadTransforms] = {
+    PAD_TRANSFORM_128(padBatchTransform, 0)
+};
+
+#undef PAD_TRANSFORM_1
+#undef PAD_TRANSFORM_2
+#undef PAD_TRANSFORM_4
+#undef PAD_TRANSFORM_8
+#undef PAD_TRANSFORM_16
+#undef PAD_TRANSFORM_32
+#undef PAD_TRANSFORM_64
+#undef PAD_TRANSFORM_128
+
+XBPadTransform
+XBSelectPadTransform(UInt32 flags)
+{
+    return gPadTransforms[flags & (kNumPadTransforms - 1)];
+}
+
+XBPadBatchTransform
+XBSelectPadBatchTransform(UInt32 flags)
+{
+    return gPadBatchTransforms[flags & (kNumPadTransforms - 1)];
+}
+
+bool
+XBBuildTriggerTable(UInt8 *table, bool clamp, UInt8 threshold)
+{
+    if (!clamp && threshold <= 1)
+        return false;
+    
+    for (int value = 0; value < 256; value++) {
+        
+        if (value < threshold)
+            table[value] = 0;
+        else
+            if (clamp)
+                table[value] = 1;
+            else
+                if (threshold < 255) {
+                    
+                    // use this system of equations to scale values from 1-255
+                    // 1 = a(threshold) + b
+                    // 255 = a(255) + b
+                    table[value] = (254*value + 255*(1 - threshold)) / (255 - threshold);
+                }
+                else {
+                    
+                    table[value] = 255;
+                }
+    }
+    
+    return true;
+}
+
+// -- remote reports ----------------------------------------
+// ----------------------------------------------------------
+
+static void
+clearReport(XBRemoteReport *report)
+{
+    UInt8 *bytes = (UInt8 *)report;
+    
+    for (unsigned i = 0; i < sizeof(XBRemoteReport); i++)
+        bytes[i] = 0;
+}
+
+// Unmapped buttons leave their bit of the raw report untouched
+void
+XBBuildRemoteButtonTable(const int scancodes[kNumRemoteButtons], XBRemoteButtonTable *table)
+{
+    XBRemoteReport report;
+    UInt32 bit;
+    
+    table->mask = 0;
+    for (int i = 0; i < 256; i++)
+        table->buttons[i] = 0;
+    
+#define SET_BUTTON_BIT(field, index) \
+if (scancodes[index] >= 0) { \
+clearReport(&report); \
+report.field = 1; \
+bit = *(UInt32*)&report; \
+table->mask |= bit; \
+table->buttons[scancodes[index] & 0xFF] |= bit; \
+}
+    
+    SET_BUTTON_BIT(select, kRemoteSelect)
+    SET_BUTTON_BIT(up, kRemoteUp)
+    SET_BUTTON_BIT(down, kRemoteDown)
+    SET_BUTTON_BIT(left, kRemoteLeft)
+    SET_BUTTON_BIT(right, kRemoteRight)
+    SET_BUTTON_BIT(title, kRemoteTitle)
+    SET_BUTTON_BIT(info, kRemoteInfo)
+    SET_BUTTON_BIT(menu, kRemoteMenu)
+    SET_BUTTON_BIT(back, kRemoteBack)
+    SET_BUTTON_BIT(display, kRemoteDisplay)
+    SET_BUTTON_BIT(play, kRemotePlay)
+    SET_BUTTON_BIT(stop, kRemoteStop)
+    SET_BUTTON_BIT(pause, kRemotePause)
+    SET_BUTTON_BIT(reverse, kRemoteReverse)
+    SET_BUTTON_BIT(forward, kRemoteForward)
+    SET_BUTTON_BIT(skipBackward, kRemoteSkipBackward)
+    SET_BUTTON_BIT(skipForward, kRemoteSkipForward)
+    SET_BUTTON_BIT(kp0, kRemoteKP0)
+    SET_BUTTON_BIT(kp1, kRemoteKP1)
+    SET_BUTTON_BIT(kp2, kRemoteKP2)
+    SET_BUTTON_BIT(kp3, kRemoteKP3)
+    SET_BUTTON_BIT(kp4, kRemoteKP4)
+    SET_BUTTON_BIT(kp5, kRemoteKP5)
+    SET_BUTTON_BIT(kp6, kRemoteKP6)
+    SET_BUTTON_BIT(kp7, kRemoteKP7)
+    SET_BUTTON_BIT(kp8, kRemoteKP8)
+    SET_BUTTON_BIT(kp9, kRemoteKP9)
+    
+#undef SET_BUTTON_BIT
+}
+
+void
+XBConvertRemoteReport(XBActualRemoteReport *raw, const XBRemoteButtonTable *table)
+{
+    UInt32 *converted = (UInt32*)raw;
+    
+    // bits the button map doesn't cover keep their raw value
+    *converted = (*converted & ~table->mask) | table->buttons[raw->scancode];
+}
+
+// -- report pipeline ---------------------------------------
+// ----------------------------------------------------------
+
+void
+XBDefaultPadOptions(XBPadOptions *options)
+{
+    options->InvertYAxis = true;
+    options->InvertXAxis = false;
+    options->InvertRyAxis = true;
+    options->InvertRxAxis = false;
+    options->ClampButtons = true;
+    options->ClampLeftTrigger = false;
+    options->ClampRightTrigger = false;
+    options->LeftTriggerThreshold = 1;
+    options->RightTriggerThreshold = 1;
+    options->SuppressDuplicateReports = false;
+    options->KeepaliveInterval = 1000;
+}
+
+UInt32
+XBPadTransformFlags(const XBPadOptions *options, UInt8 *leftTriggerTable, UInt8 *rightTriggerTable)
+{
+    UInt32 flags = 0;
+    
+    if (options->InvertYAxis)
+        flags |= kPadTransformInvertY;
+    if (options->InvertXAxis)
+        flags |= kPadTransformInvertX;
+    if (options->InvertRyAxis)
+        flags |= kPadTransformInvertRy;
+    if (options->InvertRxAxis)
+        flags |= kPadTransformInvertRx;
+    if (options->ClampButtons)
+        flags |= kPadTransformClampButtons;
+    
+    // a threshold of 0 or 1 without clamping is a no-op
+    if (XBBuildTriggerTable(leftTriggerTable, options->ClampLeftTrigger, options->LeftTriggerThreshold))
+        flags |= kPadTransformLeftTrigger;
+    if (XBBuildTriggerTable(rightTriggerTable, options->ClampRightTrigger, options->RightTriggerThreshold))
+        flags |= kPadTransformRightTrigger;
+    
+    return flags;
+}
+
+bool
+XBFilterRemoteReport(XBActualRemoteReport *raw, const XBRemoteButtonTable *table, UInt8 *lastScancode)
+{
+    if (raw->scancode == *lastScancode)
+        return false;
+    
+    *lastScancode = raw->scancode;
+    XBConvertRemoteReport(raw, table);
+    return true;
+}
+
+#ifndef KERNEL
+
+// -- batch kernels -----------------------------------------
+// ----------------------------------------------------------
+
+// Inverting an axis is -(v + 1), which in two's complement is ~v, so it is an
+// XOR of both of its bytes with 0xFF. The button clamp turns each non-zero
+// button byte into 1. Both are byte-wise, so the kernels run them over blocks
+// of 8 reports (160 bytes, a whole number of vectors for every kernel) with
+// masks that pick the bytes for the flags. The triggers are looked up in their
+// tables afterwards, and reports past the last whole block go through the
+// scalar transform.
+#define kPadBatchReports    8
+#define kPadBatchBytes      (kPadBatchReports * sizeof(XBPadReport))
+
+typedef struct {
+    
+    UInt8   invert[kPadBatchBytes];     // 0xFF on the axis bytes to invert
+    UInt8   clamp[kPadBatchBytes];      // 0xFF on the buttons to clamp
+    
+} XBPadBatchMasks;
+
+// the flags the vector pass handles, the low bits of the mask
+#define kPadBatchVectorFlags    (kPadTransformInvertY | kPadTransformInvertX | kPadTransformInvertRy | \
+                                 kPadTransformInvertRx | kPadTransformClampButtons)
+
+static void
+buildPadBatchMasks(UInt32 flags, XBPadBatchMasks *masks)
+{
+    UInt8 invert[sizeof(XBPadReport)], clamp[sizeof(XBPadReport)];
+    
+    for (unsigned i = 0; i < sizeof(XBPadReport); i++)
+        invert[i] = clamp[i] = 0;
+    
+#define SET_AXIS_MASK(flag, name) \
+if (flags & flag) \
+invert[offsetof(XBPadReport, name ## lo)] = invert[offsetof(XBPadReport, name ## hi)] = 0xFF;
+    
+    SET_AXIS_MASK(kPadTransformInvertY, ly)
+    SET_AXIS_MASK(kPadTransformInvertX, lx)
+    SET_AXIS_MASK(kPadTransformInvertRy, ry)
+    SET_AXIS_MASK(kPadTransformInvertRx, rx)
+    
+#undef SET_AXIS_MASK
+    
+    // a, b, x, y, black and white are consecutive
+    if (flags & kPadTransformClampButtons)
+        for (unsigned i = offsetof(XBPadReport, a); i <= offsetof(XBPadReport, white); i++)
+            clamp[i] = 0xFF;
+    
+    for (unsigned i = 0; i < kPadBatchBytes; i++) {
+        masks->invert[i] = invert[i % sizeof(XBPadReport)];
+        masks->clamp[i] = clamp[i % sizeof(XBPadReport)];
+    }
+}
+
+// masks for every combination of the vector flags, built once at load time
+static XBPadBatchMasks gPadBatchMasks[kPadBatchVectorFlags + 1];
+
+static class XBPadBatchMaskBuilder
+{
+public:
+    XBPadBatchMaskBuilder()
+    {
+        for (UInt32 flags = 0; flags <= kPadBatchVectorFlags; flags++)
+            buildPadBatchMasks(flags, &gPadBatchMasks[flags]);
+    }
+} gPadBatchMaskBuilder;
+
+static inline void
+padBatchTriggers(UInt32 flags, XBPadReport *reports, UInt32 count, const UInt8 *leftTriggerTable, const UInt8 *rightTriggerTable)
+{
+    if (flags & kPadTransformLeftTrigger)
+        for (UInt32 i = 0; i < count; i++)
+            reports[i].lt = leftTriggerTable[reports[i].lt];
+    
+    if (flags & kPadTransformRightTrigger)
+        for (UInt32 i = 0; i < count; i++)
+            reports[i].rt = rightTriggerTable[reports[i].rt];
+}
+
+#ifdef XB_X86_KERNELS
+
+__attribute__((target("sse2")))
+static UInt32
+padBatchSSE2(const XBPadBatchMasks *masks, XBPadReport *reports, UInt32 count)
+{
+    UInt8 *bytes = (UInt8 *)reports;
+    UInt32 blocks = count / kPadBatchReports;
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i one = _mm_set1_epi8(1);
+    
+    for (UInt32 b = 0; b < blocks; b++, bytes += kPadBatchBytes) {
+        
+        for (unsigned v = 0; v < kPadBatchBytes; v += sizeof(__m128i)) {
+            
+            __m128i x = _mm_loadu_si128((const __m128i *)(bytes + v));
+            __m128i invert = _mm_loadu_si128((const __m128i *)(masks->invert + v));
+            __m128i clamp = _mm_loadu_si128((const __m128i *)(masks->clamp + v));
+            __m128i nonzero = _mm_andnot_si128(_mm_cmpeq_epi8(x, zero), one);
+            
+            x = _mm_xor_si128(x, invert);
+            x = _mm_or_si128(_mm_andnot_si128(clamp, x), _mm_and_si128(clamp, nonzero));
+            _mm_storeu_si128((__m128i *)(bytes + v), x);
+        }
+    }
+    
+    return blocks * kPadBatchReports;
+}
+
+__attribute__((target("avx2")))
+static UInt32
+padBatchAVX2(const XBPadBatchMasks *masks, XBPadReport *reports, UInt32 count)
+{
+    UInt8 *bytes = (UInt8 *)reports;
+    UInt32 blocks = count / kPadBatchReports;
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i one = _mm256_set1_epi8(1);
+    
+    for (UInt32 b = 0; b < blocks; b++, bytes += kPadBatchBytes) {
+        
+        for (unsigned v = 0; v < kPadBatchBytes; v += sizeof(__m256i)) {
+            
+            __m256i x = _mm256_loadu_si256((const __m256i *)(bytes + v));
+            __m256i invert = _mm256_loadu_si256((const __m256i *)(masks->invert + v));
+            __m256i clamp = _mm256_loadu_si256((const __m256i *)(masks->clamp + v));
+            __m256i nonzero = _mm256_andnot_si256(_mm256_cmpeq_epi8(x, zero), one);
+            
+            x = _mm256_xor_si256(x, invert);
+            x = _mm256_or_si256(_mm256_andnot_si256(clamp, x), _mm256_and_si256(clamp, nonzero));
+            _mm256_storeu_si256((__m256i *)(bytes + v), x);
+        }
+    }
+    
+    return blocks * kPadBatchReports;
+}
+
+#endif
+
+#ifdef XB_NEON_KERNEL
+
+static UInt32
+padBatchNEON(const XBPadBatchMasks *masks, XBPadReport *reports, UInt32 count)
+{
+    UInt8 *bytes = (UInt8 *)reports;
+    UInt32 blocks = count / kPadBatchReports;
+    const uint8x16_t one = vdupq_n_u8(1);
+    
+    for (UInt32 b = 0; b < blocks; b++, bytes += kPadBatchBytes) {
+        
+        for (unsigned v = 0; v < kPadBatchBytes; v += sizeof(uint8x16_t)) {
+            
+            uint8x16_t x = vld1q_u8(bytes + v);
+            uint8x16_t invert = vld1q_u8(masks->invert + v);
+            uint8x16_t clamp = vld1q_u8(masks->clamp + v);
+            uint8x16_t nonzero = vandq_u8(vtstq_u8(x, x), one);
+            
+            x = veorq_u8(x, invert);
+            x = vbslq_u8(clamp, nonzero, x);
+            vst1q_u8(bytes + v, x);
+        }
+    }
+    
+    return blocks * kPadBatchReports;
+}
+
+#endif
+
+bool
+XBPadBatchKernelSupported(XBPadBatchKernel kernel)
+{
+    switch (kernel) {
+            
+        case kPadBatchScalar:
+            return true;
+            
+#ifdef XB_X86_KERNELS
+        case kPadBatchSSE2:
+            return __builtin_cpu_supports("sse2");
+            
+        case kPadBatchAVX2:
+            return __builtin_cpu_supports("avx2");
+#endif
+            
+#ifdef XB_NEON_KERNEL
+        case kPadBatchNEON:
+            return true;
+#endif
+            
+        default:
+            return false;
+    }
+}
+
+const char *
+XBPadBatchKernelName(XBPadBatchKernel kernel)
+{
+    static const char *names[kNumPadBatchKernels] = { "scalar", "sse2", "avx2", "neon" };
+    
+    return (unsigned)kernel < kNumPadBatchKernels ? names[kernel] : "unknown";
+}
+
+XBPadBatchKernel
+XBBestPadBatchKernel()
+{
+    static const XBPadBatchKernel preferred[] = { kPadBatchAVX2, kPadBatchSSE2, kPadBatchNEON };
+    
+    for (unsigned i = 0; i < sizeof(preferred) / sizeof(preferred[0]); i++)
+        if (XBPadBatchKernelSupported(preferred[i]))
+            return preferred[i];
+    
+    return kPadBatchScalar;
+}
+
+// reports per kernel call, so the trigger pass finds them still in the cache
+#define kPadBatchChunkReports   512
+
+void
+XBTransformPadReports(XBPadBatchKernel kernel, UInt32 flags, XBPadReport *reports, UInt32 count,
+                      const UInt8 *leftTriggerTable, const UInt8 *rightTriggerTable)
+{
+    UInt32 (*vectorPass)(const XBPadBatchMasks *masks, XBPadReport *reports, UInt32 count) = 0;
+    UInt32 done = 0;
+    
+    flags &= kNumPadTransforms - 1;
+    
+    if ((flags & kPadBatchVectorFlags) && count >= kPadBatchReports && XBPadBatchKernelSupported(kernel)) {
+        
+        switch (kernel) {
+                
+#ifdef XB_X86_KERNELS
+            case kPadBatchSSE2:
+                vectorPass = padBatchSSE2;
+                break;
+                
+            case kPadBatchAVX2:
+                vectorPass = padBatchAVX2;
+                break;
+#endif
+                
+#ifdef XB_NEON_KERNEL
+            case kPadBatchNEON:
+                vectorPass = padBatchNEON;
+                break;
+#endif
+                
+            default:
+                break;
+        }
+    }
+    
+    if (vectorPass) {
+        
+        const XBPadBatchMasks *masks = &gPadBatchMasks[flags & kPadBatchVectorFlags];
+        
+        while (count - done >= kPadBatchReports) {
+            
+            UInt32 chunk = count - done < kPadBatchChunkReports ? count - done : kPadBatchChunkReports;
+            
+            chunk = vectorPass(masks, reports + done, chunk);
+            padBatchTriggers(flags, reports + done, chunk, leftTriggerTable, rightTriggerTable);
+            done += chunk;
+        }
+    }
+    
+    if (done < count)
+        gPadBatchTransforms[flags](reports + done, count - done, leftTriggerTable, rightTriggerTable);
+}
+
+#endif
+
+// -- known devices -----------------------------------------
+// ----------------------------------------------------------
+
+bool
+XBParseDeviceID(const char *string, UInt16 *id)
+{
+    UInt32 value = 0;
+    
+    if (!*string)
+        return false;
+    
+    for (; *string; string++) {
+        
+        if (*string < '0' || *string > '9')
+            return false;
+        
+        value = value * 10 + (*string - '0');
+        if (value > 0xFFFF)
+            return false;
+    }
+    
+    *id = (UInt16)value;
+    return true;
+}
+
+// -- generic devices ---------------------------------------
+// ----------------------------------------------------------
+
+bool
+XBInitGenericPattern(XBGenericPattern *pattern, UInt32 numInterfaces)
+{
+    if (numInterfaces > kMaxGenericInterfaces)
+        return false;
+    
+    pattern->numInterfaces = numInterfaces;
+    pattern->numEndpoints = 0;
+    for (UInt32 j = 0; j < kMaxGenericInterfaces; j++)
+        pattern->interfaceEndpoints[j] = 0;
+    
+    return true;
+}
+
+XBGenericEndpoint *
+XBAddGenericEndpoint(XBGenericPattern *pattern, UInt32 interface)
+{
+    XBGenericEndpoint *endpoint;
+    
+    if (interface >= pattern->numInterfaces || pattern->numEndpoints == kMaxGenericEndpoints)
+        return 0;
+    
+    pattern->interfaceEndpoints[interface]++;
+    
+    endpoint = &pattern->endpoints[pattern->numEndpoints++];
+    endpoint->interface = interface;
+    endpoint->address = kGenericEndpointInvalid;
+    endpoint->pollingInterval = 0;
+    endpoint->maxPacketSize = 0;
+    
+    return endpoint;
+}
+
+bool
+XBMatchGenericPattern(const XBGenericPattern *pattern, const XBGenericDeviceInfo *info)
+{
+    // cheap rejections first
+    if (info->numInterfaces < pattern->numInterfaces)
+        return false;
+    
+    for (UInt32 j = 0; j < pattern->numInterfaces; j++)
+        if (info->interfaces[j].numEndpoints < pattern->interfaceEndpoints[j])
+            return false;
+    
+    for (UInt32 k = 0; k < pattern->numEndpoints; k++) {
+        
+        const XBGenericEndpoint *wanted = &pattern->endpoints[k];
+        const XBGenericInterfaceInfo *interfaceInfo = &info->interfaces[wanted->interface];
+        bool endpointMatched = false;
+        
+        for (UInt32 e = 0; e < interfaceInfo->numGathered; e++) {
+            
+            const XBGenericEndpoint *actual = &interfaceInfo->endpoints[e];
+            
+            if (actual->address == wanted->address) {
+                endpointMatched = (actual->maxPacketSize == wanted->maxPacketSize &&
+                                   actual->pollingInterval == wanted->pollingInterval);
+                break;
+            }
+        }
+        
+        if (!endpointMatched)
+            return false;
+    }
+    
+    return true;
+}
+
+// -- outstanding I/O ---------------------------------------
+// ----------------------------------------------------------
+
+// The __sync builtins are full barriers, so XBEndIO() and XBRequestClose()
+// each see the other's update: whichever runs second closes the provider.
+
+void
+XBBeginIO(XBOutstandingIO *io)
+{
+    __sync_fetch_and_add(&io->count, 1);
+}
+
+bool
+XBEndIO(XBOutstandingIO *io)
+{
+    if (__sync_sub_and_fetch(&io->count, 1) != 0)
+        return false;
+    
+    __sync_synchronize();
+    return io->needToClose != 0;
+}
+
+bool
+XBRequestClose(XBOutstandingIO *io)
+{
+    io->needToClose = 1;
+    __sync_synchronize();
+    return io->count == 0;
+}
+
+bool
+XBClaimClose(XBOutstandingIO *io)
+{
+    return __sync_bool_compare_and_swap(&io->closed, 0, 1);
+}
+
+// -- report trace ------------------------------------------
+// ----------------------------------------------------------
+
+// The __sync_synchronize() on either side orders the record copy against the
+// index that hands it over: a record is complete before head moves past it,
+// and read out before tail moves past it.
+
+void
+XBInitTraceRing(XBTraceProducer *producer, XBTraceRing *ring, UInt32 capacity)
+{
+    ring->version = kTraceFormatVersion;
+    ring->capacity = capacity;
+    ring->head = 0;
+    ring->tail = 0;
+    ring->dropped = 0;
+    for (int i = 0; i < 3; i++)
+        ring->reserved[i] = 0;
+    
+    producer->ring = ring;
+    producer->capacity = capacity;
+    producer->head = 0;
+    producer->dropped = 0;
+}
+
+bool
+XBTraceRingPush(XBTraceProducer *producer, const XBTraceRecord *record)
+{
+    XBTraceRing *ring = producer->ring;
+    UInt32 head = producer->head;
+    
+    if (head - ring->tail >= producer->capacity) {
+        ring->dropped = ++producer->dropped;
+        return false;
+    }
+    
+    __sync_synchronize();
+    XBTraceRingRecords(ring)[head & (producer->capacity - 1)] = *record;
+    __sync_synchronize();
+    
+    producer->head = ring->head = head + 1;
+    return true;
+}
+
+UInt32
+XBTraceRingPop(XBTraceRing *ring, XBTraceRecord *records, UInt32 count)
+{
+    UInt32 tail = ring->tail;
+    UInt32 available = ring->head - tail;
+    UInt32 n;
+    
+    if (available > ring->capacity)
+        available = ring->capacity;
+    if (count > available)
+        count = available;
+    
+    __sync_synchronize();
+    for (n = 0; n < count; n++)
+        records[n] = XBTraceRingRecords(ring)[(tail + n) & (ring->capacity - 1)];
+    __sync_synchronize();
+    
+    ring->tail = tail + count;
+    return count;
+}
@@ -0,0 +1,512 @@
+//
+//  XboxControllerHIDCore.h
+//  XboxControllerHID
+//
+//  Report formats and the report transforms. Nothing in here depends on IOKit,
+//  so it builds outside the kernel as well.
+//
+
+#ifndef XboxControllerHID_XboxControllerHIDCore_h
+#define XboxControllerHID_XboxControllerHIDCore_h
+
+#ifdef __APPLE__
+#include <libkern/OSTypes.h>
+#else
+#include <stdint.h>
+typedef uint8_t     UInt8;
+typedef uint16_t    UInt16;
+typedef uint32_t    UInt32;
+typedef uint64_t    UInt64;
+typedef int16_t     SInt16;
+typedef int32_t     SInt32;
+#endif
+#include <string.h>
+
+// remote control keys (index into ButtonMapping table which is generated
+// and stored in the driver's property list)
+typedef enum {
+    
+    kRemoteDisplay = 0,
+    kRemoteReverse,
+    kRemotePlay,
+    kRemoteForward,
+    kRemoteSkipBackward,
+    kRemoteStop,
+    kRemotePause,
+    kRemoteSkipForward,
+    kRemoteTitle,
+    kRemoteUp,
+    kRemoteInfo,
+    kRemoteLeft,
+    kRemoteSelect,
+    kRemoteRight,
+    kRemoteMenu,
+    kRemoteDown,
+    kRemoteBack,
+    kRemoteKP1,
+    kRemoteKP2,
+    kRemoteKP3,
+    kRemoteKP4,
+    kRemoteKP5,
+    kRemoteKP6,
+    kRemoteKP7,
+    kRemoteKP8,
+    kRemoteKP9,
+    kRemoteKP0,
+    kNumRemoteButtons
+} XBoxRemoteKey;
+
+// this structure describes the (fabricated) remote report
+// that is passed up to the hid layer
+typedef struct {
+    
+    // note: fields within byte are in reverse order
+    // first byte
+    UInt8 menu:1;
+    UInt8 info:1;
+    UInt8 title:1;
+    UInt8 right:1;
+    UInt8 left:1;
+    UInt8 down:1;
+    UInt8 up:1;
+    UInt8 select:1;
+    
+    // second byte
+    UInt8 skipBackward:1;
+    UInt8 forward:1;
+    UInt8 reverse:1;
+    UInt8 pause:1;
+    UInt8 stop:1;
+    UInt8 play:1;
+    UInt8 display:1;
+    UInt8 back:1;
+    
+    // third byte
+    UInt8 kp6:1;
+    UInt8 kp5:1;
+    UInt8 kp4:1;
+    UInt8 kp3:1;
+    UInt8 kp2:1;
+    UInt8 kp1:1;
+    UInt8 kp0:1;
+    UInt8 skipForward:1;
+    
+    // fourth byte
+    UInt8 r1:5; // constant
+    UInt8 kp9:1;
+    UInt8 kp8:1;
+    UInt8 kp7:1;
+    
+    // constant
+    UInt8 r2;
+    UInt8 r3;
+    
+} XBRemoteReport;
+
+// this describes the actual hid report that we have to parse
+typedef struct
+{
+    UInt8 r1, r2;
+    UInt8 scancode;
+    UInt8 r3, r4, r5;
+    
+} XBActualRemoteReport;
+
+// scancode -> remote report lookup, compiled from the ButtonMap array.
+// Holds the first 4 bytes of an XBRemoteReport, where all the buttons live
+typedef struct {
+    
+    UInt32 mask;         // report bits covered by the button map
+    UInt32 buttons[256]; // report bits to set for each scancode
+    
+} XBRemoteButtonTable;
+
+// this checks that the structures are of the same size
+typedef int _sizeCheck[ (sizeof(XBRemoteReport) == sizeof(XBActualRemoteReport)) * 2 - 1];
+
+// this structure represents the gampad's raw report
+typedef struct {
+    
+    UInt8
+    r1,      // reserved
+    r2,      // report length (useless)
+    buttons, // up, down, left, right, start, back, left-click, right-click
+    r3,      // reserved
+    a,
+    b,
+    x,
+    y,
+    black,
+    white,
+    lt,     // left trigger
+    rt;     // right trigger
+    
+    // lo/hi bits of signed 16-bit axes
+    UInt8
+    lxlo, lxhi,
+    lylo, lyhi,
+    rxlo, rxhi,
+    rylo, ryhi;
+    
+} XBPadReport;
+
+// pad options as seen by the report transforms; every combination
+// has its own specialized transform (see XBSelectPadTransform())
+enum {
+    
+    kPadTransformInvertY            = 1 << 0,
+    kPadTransformInvertX            = 1 << 1,
+    kPadTransformInvertRy           = 1 << 2,
+    kPadTransformInvertRx           = 1 << 3,
+    kPadTransformClampButtons       = 1 << 4,
+    kPadTransformLeftTrigger        = 1 << 5, // clamped or threshold > 1
+    kPadTransformRightTrigger       = 1 << 6,
+    kNumPadTransforms               = 1 << 7
+};
+
+typedef void (*XBPadTransform)(XBPadReport *raw, const UInt8 *leftTriggerTable, const UInt8 *rightTriggerTable);
+
+// the same transform over count consecutive reports
+typedef void (*XBPadBatchTransform)(XBPadReport *reports, UInt32 count, const UInt8 *leftTriggerTable, const UInt8 *rightTriggerTable);
+
+// -- report transforms -------------------------------------
+// ----------------------------------------------------------
+
+// transform for a mask of kPadTransform* bits
+XBPadTransform XBSelectPadTransform(UInt32 flags);
+XBPadBatchTransform XBSelectPadBatchTransform(UInt32 flags);
+
+// Fill a trigger lookup table, so that the per-report trigger clamp or
+// rescale is a single load. Returns false if the table is the identity
+bool XBBuildTriggerTable(UInt8 *table, bool clamp, UInt8 threshold);
+
+// Compile the button map (scancode per XBoxRemoteKey, negative if unmapped)
+// into a scancode -> report bits table
+void XBBuildRemoteButtonTable(const int scancodes[kNumRemoteButtons], XBRemoteButtonTable *table);
+
+// turn an XBActualRemoteReport into an XBRemoteReport in place
+void XBConvertRemoteReport(XBActualRemoteReport *raw, const XBRemoteButtonTable *table);
+
+// -- report pipeline ---------------------------------------
+// ----------------------------------------------------------
+
+// The steps manipulateReport() and the duplicate suppression take with each
+// report, so tools can run recorded reports exactly as the driver does.
+
+// pad options, as set in the DeviceOptions dictionary (named after its keys)
+typedef struct {
+    
+    bool    InvertYAxis;                // invert sticks (default = true for Y, false for X)
+    bool    InvertXAxis;
+    bool    InvertRyAxis;
+    bool    InvertRxAxis;
+    bool    ClampButtons;               // clamp face buttons to 0-1 (default = true)
+    bool    ClampLeftTrigger;           // clamp triggers to 0-1 (default = false)
+    bool    ClampRightTrigger;
+    
+    //bool LeftTriggerIsButton;         // triggers are mapped to buttons, not axis (default = false)
+    //bool RightTriggerIsButton;
+    
+    UInt8   LeftTriggerThreshold;       // point at which trigger press is realized (default = 1)
+    UInt8   RightTriggerThreshold;
+    
+    bool    SuppressDuplicateReports;   // drop reports equal to the last one (default = false)
+    UInt16  KeepaliveInterval;          // ms after which a duplicate is sent anyway (default = 1000)
+    
+} XBPadOptions;
+
+// the driver's defaults
+void XBDefaultPadOptions(XBPadOptions *options);
+
+// Build the trigger tables for options and return the kPadTransform* mask
+// of the transform to run (see XBSelectPadTransform())
+UInt32 XBPadTransformFlags(const XBPadOptions *options, UInt8 *leftTriggerTable, UInt8 *rightTriggerTable);
+
+// A remote repeats its report for as long as a button is held. Returns false
+// for a repeat of *lastScancode, otherwise converts the report in place and
+// remembers its scancode. The release timer sets *lastScancode back to 0
+bool XBFilterRemoteReport(XBActualRemoteReport *raw, const XBRemoteButtonTable *table, UInt8 *lastScancode);
+
+// An idle pad keeps sending the same report every polling interval. A pad
+// report equal to the last delivered one is a duplicate, unless keepalive
+// (0 = never) has passed since that one was delivered. The 20 bytes are
+// compared as two 64-bit and one 32-bit word, loaded with memcpy() since
+// the reports needn't be aligned
+static inline bool
+XBIsDuplicatePadReport(const UInt8 *report, const UInt8 *last, UInt64 timeStamp, UInt64 lastTime, UInt64 keepalive)
+{
+    UInt64 report0, report1, last0, last1;
+    UInt32 report2, last2;
+    
+    memcpy(&report0, report, 8);
+    memcpy(&report1, report + 8, 8);
+    memcpy(&report2, report + 16, 4);
+    memcpy(&last0, last, 8);
+    memcpy(&last1, last + 8, 8);
+    memcpy(&last2, last + 16, 4);
+    
+    if ((report0 ^ last0) | (report1 ^ last1) | (report2 ^ last2))
+        return false;
+    
+    return !keepalive || timeStamp - lastTime < keepalive;
+}
+
+#ifndef KERNEL
+
+// -- batch kernels -----------------------------------------
+// ----------------------------------------------------------
+
+// Vector versions of the batch transform, for tools that run many reports at
+// once. Host only, the kext doesn't touch vector registers. Every kernel gives
+// the same bytes as the transform XBSelectPadTransform() picks for the flags.
+typedef enum {
+    
+    kPadBatchScalar = 0,    // XBSelectPadBatchTransform(), always there
+    kPadBatchSSE2,
+    kPadBatchAVX2,
+    kPadBatchNEON,
+    kNumPadBatchKernels
+} XBPadBatchKernel;
+
+// built in and usable on this CPU
+bool XBPadBatchKernelSupported(XBPadBatchKernel kernel);
+const char *XBPadBatchKernelName(XBPadBatchKernel kernel);
+
+// fastest supported kernel
+XBPadBatchKernel XBBestPadBatchKernel();
+
+// Transform count reports with a mask of kPadTransform* bits. An unsupported
+// kernel falls back to the scalar one
+void XBTransformPadReports(XBPadBatchKernel kernel, UInt32 flags, XBPadReport *reports, UInt32 count,
+                           const UInt8 *leftTriggerTable, const UInt8 *rightTriggerTable);
+
+#endif
+
+// -- known devices -----------------------------------------
+// ----------------------------------------------------------
+
+// key of the known device tables
+static inline UInt32
+XBDeviceID(UInt16 vendorID, UInt16 productID)
+{
+    return ((UInt32)vendorID << 16) | productID;
+}
+
+// parse a decimal vendor or product id, as used by the KnownDevices keys
+bool XBParseDeviceID(const char *string, UInt16 *id);
+
+// A known device table is an array of any entry type with a UInt32 deviceID,
+// kept sorted by it so a lookup is a binary search.
+//
+// Make room for deviceID in devices[0..*count), which must have space for one
+// more entry, and return the new entry with only its deviceID set. Entries with
+// the same ID keep their insertion order.
+template <class Entry>
+Entry *
+XBInsertKnownDevice(Entry *devices, UInt32 *count, UInt32 deviceID)
+{
+    UInt32 i = (*count)++;
+    
+    // insertion sort, the table is small and built once
+    while (i > 0 && devices[i - 1].deviceID > deviceID) {
+        devices[i] = devices[i - 1];
+        i--;
+    }
+    
+    devices[i].deviceID = deviceID;
+    return &devices[i];
+}
+
+// first entry for deviceID, or NULL
+template <class Entry>
+const Entry *
+XBFindKnownDevice(const Entry *devices, UInt32 count, UInt32 deviceID)
+{
+    UInt32 low = 0, high = count;
+    
+    while (low < high) {
+        
+        UInt32 mid = (low + high) / 2;
+        
+        if (devices[mid].deviceID < deviceID)
+            low = mid + 1;
+        else
+            high = mid;
+    }
+    
+    if (low < count && devices[low].deviceID == deviceID)
+        return &devices[low];
+    
+    return 0;
+}
+
+// -- generic devices ---------------------------------------
+// ----------------------------------------------------------
+
+#define kMaxGenericInterfaces       4
+#define kMaxGenericEndpoints        16
+#define kGenericEndpointInvalid     0xFF    // address that no endpoint has
+
+typedef struct {
+    
+    UInt8       interface;          // index of the interface the endpoint is on
+    UInt8       address;            // endpoint number | direction bit
+    UInt8       pollingInterval;
+    UInt16      maxPacketSize;
+    
+} XBGenericEndpoint;
+
+// the endpoints a GenericProperties tree asks for
+typedef struct {
+    
+    UInt32              numInterfaces;
+    UInt8               interfaceEndpoints[kMaxGenericInterfaces];  // endpoints listed per interface
+    UInt32              numEndpoints;
+    XBGenericEndpoint   endpoints[kMaxGenericEndpoints];
+    
+} XBGenericPattern;
+
+// what a device actually has, gathered once per probe
+typedef struct {
+    
+    UInt32              numEndpoints;       // as reported by the interface
+    UInt32              numGathered;
+    XBGenericEndpoint   endpoints[kMaxGenericEndpoints];
+    
+} XBGenericInterfaceInfo;
+
+typedef struct {
+    
+    UInt32                  numInterfaces;
+    XBGenericInterfaceInfo  interfaces[kMaxGenericInterfaces];
+    
+} XBGenericDeviceInfo;
+
+// endpoint address from the Attributes of a GenericProperties endpoint
+static inline UInt8
+XBGenericEndpointAddress(UInt8 attributes)
+{
+    return attributes & 0x8F;   // direction and endpoint number
+}
+
+// Start a pattern with numInterfaces interfaces and no endpoints.
+// Returns false if there are more interfaces than a pattern holds
+bool XBInitGenericPattern(XBGenericPattern *pattern, UInt32 numInterfaces);
+
+// List an endpoint on interface, and return it for the caller to fill in,
+// or NULL if the pattern is full. Its address is kGenericEndpointInvalid
+// until set, so an entry that is never filled in can't match
+XBGenericEndpoint *XBAddGenericEndpoint(XBGenericPattern *pattern, UInt32 interface);
+
+// A device matches a pattern like the GenericProperties tree walk always did: it has at least
+// as many interfaces as listed, each interface has at least as many endpoints as listed for it,
+// and each listed endpoint (by address) has the listed max packet size and polling interval.
+bool XBMatchGenericPattern(const XBGenericPattern *pattern, const XBGenericDeviceInfo *info);
+
+// -- outstanding I/O ---------------------------------------
+// ----------------------------------------------------------
+
+// I/O in flight, and the handoff of the provider close between didTerminate
+// and the last completion. All of it is lock-free, so completions never wait.
+typedef struct {
+    
+    volatile SInt32 count;          // I/O in flight
+    volatile UInt32 needToClose;    // set once by XBRequestClose()
+    volatile UInt32 closed;         // set once by XBClaimClose()
+    
+} XBOutstandingIO;
+
+void XBBeginIO(XBOutstandingIO *io);
+
+// Returns true if the caller ended the last I/O after a close was requested,
+// and so has to close the provider
+bool XBEndIO(XBOutstandingIO *io);
+
+// Asks for the provider to be closed once no I/O is left. Returns true if
+// there is none left now, and the caller has to close it
+bool XBRequestClose(XBOutstandingIO *io);
+
+// Both paths above may race to the close; true for exactly one caller
+bool XBClaimClose(XBOutstandingIO *io);
+
+// -- report trace ------------------------------------------
+// ----------------------------------------------------------
+
+#define kTraceFormatVersion     1           // bump when XBTraceRecord changes (see README.md)
+#define kTraceReportBytes       32          // longer reports are truncated
+
+// IOServiceOpen() type of the trace user client, and its memory type for
+// IOConnectMapMemory(): the ring, an XBTraceRing followed by its records
+#define kTraceClientType        0x58427472  // 'XBtr'
+#define kTraceMemoryRing        0
+
+enum {
+    
+    kTraceRecordDelivered   = 1 << 0,   // handed to the HID layer, or sent for output reports
+    kTraceRecordSuppressed  = 1 << 1,   // dropped as a duplicate
+    kTraceRecordTruncated   = 1 << 2,   // report longer than kTraceReportBytes
+    kTraceRecordOutput      = 1 << 3    // output report from setReport()
+};
+
+typedef struct {
+    
+    UInt64  timeStamp;                  // ns since boot
+    UInt32  locationID;                 // of the device
+    SInt32  status;                     // of the interrupt read or setReport()
+    UInt8   length;                     // report bytes, 0 for failed reads
+    UInt8   flags;                      // kTraceRecord*
+    UInt8   version;                    // kTraceFormatVersion
+    UInt8   reserved[5];
+    UInt8   raw[kTraceReportBytes];     // as read from the pipe, or as sent
+    UInt8   transformed[kTraceReportBytes]; // after manipulateReport(), zero for output reports
+    
+} XBTraceRecord;
+
+// The ring header, shared with the client. The driver is the only producer
+// and only moves head, the client is the only consumer and only moves tail.
+// Records that find the ring full are dropped and counted.
+typedef struct {
+    
+    UInt32          version;            // kTraceFormatVersion
+    UInt32          capacity;           // records, power of 2
+    volatile UInt32 head;               // next record to write
+    volatile UInt32 tail;               // next record to read
+    volatile UInt32 dropped;
+    UInt32          reserved[3];
+    
+} XBTraceRing;
+
+static inline XBTraceRecord *
+XBTraceRingRecords(XBTraceRing *ring)
+{
+    return (XBTraceRecord *)(ring + 1);
+}
+
+static inline UInt32
+XBTraceRingSize(UInt32 capacity)
+{
+    return sizeof(XBTraceRing) + capacity * sizeof(XBTraceRecord);
+}
+
+// The producer side keeps its own copy of everything it depends on, so a
+// client scribbling over the shared header can lose records but can't make
+// the producer write outside the ring.
+typedef struct {
+    
+    XBTraceRing *   ring;
+    UInt32          capacity;
+    UInt32          head;
+    UInt32          dropped;
+    
+} XBTraceProducer;
+
+// Set up the ring in XBTraceRingSize(capacity) bytes, and its producer
+void XBInitTraceRing(XBTraceProducer *producer, XBTraceRing *ring, UInt32 capacity);
+
+// Copy a record into the ring. Returns false if it was full and the record dropped
+bool XBTraceRingPush(XBTraceProducer *producer, const XBTraceRecord *record);
+
+// Copy out up to count records, oldest first, and return how many
+UInt32 XBTraceRingPop(XBTraceRing *ring, XBTraceRecord *records, UInt32 count);
+
+#endif
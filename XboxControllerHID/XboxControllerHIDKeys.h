@@ -42,6 +42,8 @@
 #define kClientOptionKeyKey   "OptionKey"
 #define kClientOptionValueKey "OptionValue"
 #define kClientOptionSetElementsKey "Elements"
+#define kClientResetStatisticsKey "ResetStatistics"
+#define kClientPublishStatisticsKey "PublishStatistics"
 
 // -- keys for XML configuration ----------------------------
 // ----------------------------------------------------------
@@ -50,6 +52,9 @@
 
 #define kKnownDevicesKey "KnownDevices"
 
+// number of interrupt reads to keep queued
+#define kInterruptReadsKey "InterruptReads"
+
 // device types
 #define kDeviceTypePadKey "Pad"
 #define kDeviceTypeIRKey  "IR"
@@ -82,6 +87,10 @@
 #define kOptionRightTriggerIsButtonKey        "RightTriggerIsButton"
 #define kOptionRightTriggerThresholdKey "RightTriggerThreshold"
 
+// report delivery
+#define kOptionSuppressDuplicateReportsKey    "SuppressDuplicateReports"
+#define kOptionKeepaliveIntervalKey           "KeepaliveInterval"
+
 // generic device properties
 #define kGenericInterfacesKey      "Interfaces"
 #define kGenericEndpointsKey       "Endpoints"
@@ -89,6 +98,20 @@
 #define kGenericPollingIntervalKey "PollingInterval"
 #define kGenericAttributesKey      "Attributes"
 
+// statistics (published on kClientPublishStatisticsKey and kClientResetStatisticsKey)
+#define kStatisticsKey             "Statistics"
+#define kStatReportsDeliveredKey   "ReportsDelivered"
+#define kStatReportsSuppressedKey  "ReportsSuppressed"
+#define kStatReportLatencyKey      "ReportLatency"     // log2 ns histogram
+#define kStatReportIntervalKey     "ReportInterval"    // log2 ns histogram
+#define kStatErrorsKey             "Errors"            // count per interrupt pipe status
+#define kStatHaltRecoveryKey       "HaltRecovery"      // log2 ns histogram
+#define kStatHaltRecoveryTotalKey  "HaltRecoveryTotal" // ns
+#define kStatDeadDeviceCheckKey    "DeadDeviceCheck"   // log2 ns histogram
+#define kStatAttachTimeKey         "AttachTime"        // ns
+#define kStatCapabilitiesCachedKey "CapabilitiesCached"
+#define kStatTraceDroppedKey       "TraceDropped"
+
 // general usage keys
 #define kVendorKey  "Vendor"
 #define kNameKey    "Name"
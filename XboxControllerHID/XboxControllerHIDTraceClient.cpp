@@ -0,0 +1,85 @@
+//
+//  XboxControllerHIDTraceClient.cpp
+//  XboxControllerHID
+//
+//  User client of the report trace, see XboxControllerHIDTraceClient.h.
+//
+
+#include <libkern/OSAtomic.h>
+#include <IOKit/usb/IOUSBLog.h>
+
+#include "XboxControllerHID.h"
+#include "XboxControllerHIDTraceClient.h"
+
+#define super IOUserClient
+
+OSDefineMetaClassAndStructors(XboxControllerHIDTraceClient, IOUserClient)
+
+bool
+XboxControllerHIDTraceClient::start(IOService *provider)
+{
+    if (!super::start(provider))
+        return false;
+    
+    _provider = OSDynamicCast(XboxControllerHID, provider);
+    if (!_provider)
+        return false;
+    
+    // only one client at a time, the ring has a single consumer
+    if (_provider->openTrace(&_traceMemory) != kIOReturnSuccess)
+    {
+        USBLog(3, "%s[%p]::start trace already open", getName(), this);
+        super::stop(provider);
+        return false;
+    }
+    
+    return true;
+}
+
+void
+XboxControllerHIDTraceClient::closeTrace()
+{
+    IOMemoryDescriptor *memory = _traceMemory;
+    
+    // clientClose() and stop() can race, whoever takes the memory closes
+    if (!memory || !OSCompareAndSwapPtr(memory, NULL, (void * volatile *)&_traceMemory))
+        return;
+    
+    _provider->closeTrace();
+    memory->release();
+}
+
+void
+XboxControllerHIDTraceClient::stop(IOService *provider)
+{
+    // the device went away with the client still open
+    closeTrace();
+    super::stop(provider);
+}
+
+IOReturn
+XboxControllerHIDTraceClient::clientClose()
+{
+    closeTrace();
+    terminate();
+    return kIOReturnSuccess;
+}
+
+IOReturn
+XboxControllerHIDTraceClient::clientDied()
+{
+    return clientClose();
+}
+
+IOReturn
+XboxControllerHIDTraceClient::clientMemoryForType(UInt32 type, IOOptionBits *options, IOMemoryDescriptor **memory)
+{
+    if (type != kTraceMemoryRing || !_traceMemory)
+        return kIOReturnBadArgument;
+    
+    // the client advances tail, so the mapping has to stay writable
+    _traceMemory->retain();
+    *options = 0;
+    *memory = _traceMemory;
+    return kIOReturnSuccess;
+}
@@ -0,0 +1,34 @@
+//
+//  XboxControllerHIDTraceClient.h
+//  XboxControllerHID
+//
+//  User client of the report trace. Opening it (type kTraceClientType) starts
+//  recording, mapping its memory (kTraceMemoryRing) gives the ring to drain,
+//  and closing it stops recording again. See README.md for the ring layout.
+//
+
+#ifndef XboxControllerHID_XboxControllerHIDTraceClient_h
+#define XboxControllerHID_XboxControllerHIDTraceClient_h
+
+#include <IOKit/IOUserClient.h>
+
+class XboxControllerHID;
+
+class XboxControllerHIDTraceClient : public IOUserClient
+{
+    OSDeclareDefaultStructors(XboxControllerHIDTraceClient)
+    
+    XboxControllerHID *     _provider;
+    IOMemoryDescriptor *    _traceMemory;
+    
+    void closeTrace();
+    
+public:
+    virtual bool start(IOService *provider);
+    virtual void stop(IOService *provider);
+    virtual IOReturn clientClose();
+    virtual IOReturn clientDied();
+    virtual IOReturn clientMemoryForType(UInt32 type, IOOptionBits *options, IOMemoryDescriptor **memory);
+};
+
+#endif
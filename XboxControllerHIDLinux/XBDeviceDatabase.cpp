@@ -0,0 +1,246 @@
+//
+//  XBDeviceDatabase.cpp
+//  XboxControllerHIDLinux
+//
+//  The driver's device tables from its Info.plist, see XBDeviceDatabase.h.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "XboxControllerHIDKeys.h"
+#include "XBDeviceDatabase.h"
+#include "XBPlist.h"
+
+static UInt8
+deviceType(const char *name)
+{
+    if (!strcmp(name, kDeviceTypePadKey))
+        return kLinuxDevicePad;
+    if (!strcmp(name, kDeviceTypeIRKey))
+        return kLinuxDeviceRemote;
+    return kLinuxDeviceUnknown;
+}
+
+static void
+copyName(char *name, const XBPlistNode *string)
+{
+    name[0] = '\0';
+    if (string)
+        strncat(name, string->string, kMaxDeviceNameLength - 1);
+}
+
+// KnownDevices: vendor id -> { product id -> { Type, Name }, Vendor }, as buildKnownDeviceTable() reads it
+static bool
+loadKnownDevices(XBDeviceDatabase *database, const XBPlistNode *vendors)
+{
+    UInt32 capacity = 0;
+    
+    for (const XBPlistNode *vendor = vendors->children; vendor; vendor = vendor->next)
+        if (vendor->type == kPlistDictionary)
+            for (const XBPlistNode *product = vendor->children; product; product = product->next)
+                capacity++;
+    
+    database->devices = (XBLinuxKnownDevice *)calloc(capacity ? capacity : 1, sizeof(XBLinuxKnownDevice));
+    if (!database->devices)
+        return false;
+    
+    for (const XBPlistNode *vendor = vendors->children; vendor; vendor = vendor->next) {
+        
+        UInt16 vendorID, productID;
+        
+        if (vendor->type != kPlistDictionary || !XBParseDeviceID(vendor->key, &vendorID))
+            continue;
+        
+        for (const XBPlistNode *product = vendor->children; product; product = product->next) {
+            
+            const XBPlistNode *typeName = XBPlistGet(product, kTypeKey, kPlistString);
+            XBLinuxKnownDevice *device;
+            
+            // skips the Vendor string, and entries without a type are left to the generic match
+            if (product->type != kPlistDictionary || !XBParseDeviceID(product->key, &productID) || !typeName ||
+                deviceType(typeName->string) == kLinuxDeviceUnknown)
+                continue;
+            
+            device = XBInsertKnownDevice(database->devices, &database->numDevices, XBDeviceID(vendorID, productID));
+            device->type = deviceType(typeName->string);
+            copyName(device->name, XBPlistGet(product, kNameKey, kPlistString));
+            copyName(device->vendor, XBPlistGet(vendor, kVendorKey, kPlistString));
+        }
+    }
+    return true;
+}
+
+static UInt32
+childCount(const XBPlistNode *node)
+{
+    UInt32 count = 0;
+    
+    for (const XBPlistNode *child = node->children; child; child = child->next)
+        count++;
+    return count;
+}
+
+// GenericProperties, compiled like compileGenericPattern() compiles it
+static bool
+compilePattern(const XBPlistNode *properties, XBGenericPattern *pattern)
+{
+    const XBPlistNode *interfaces = XBPlistGet(properties, kGenericInterfacesKey, kPlistArray);
+    const XBPlistNode *interface;
+    UInt32 index = 0;
+    
+    if (!interfaces || !XBInitGenericPattern(pattern, childCount(interfaces)))
+        return false;
+    
+    for (interface = interfaces->children; interface; interface = interface->next, index++) {
+        
+        const XBPlistNode *endpoints = XBPlistGet(interface, kGenericEndpointsKey, kPlistArray);
+        
+        // interfaces without an endpoint list only have to exist
+        if (!endpoints)
+            continue;
+        
+        for (const XBPlistNode *entry = endpoints->children; entry; entry = entry->next) {
+            
+            XBGenericEndpoint *endpoint = XBAddGenericEndpoint(pattern, index);
+            const XBPlistNode *number;
+            
+            if (!endpoint)
+                return false;
+            
+            // an endpoint entry that isn't a dictionary can never match
+            if (entry->type != kPlistDictionary)
+                continue;
+            
+            number = XBPlistGet(entry, kGenericAttributesKey, kPlistInteger);
+            endpoint->address = XBGenericEndpointAddress(number ? (UInt8)number->integer : 0);
+            
+            number = XBPlistGet(entry, kGenericMaxPacketSizeKey, kPlistInteger);
+            if (number)
+                endpoint->maxPacketSize = (UInt16)number->integer;
+            
+            number = XBPlistGet(entry, kGenericPollingIntervalKey, kPlistInteger);
+            if (number)
+                endpoint->pollingInterval = (UInt8)number->integer;
+        }
+    }
+    return true;
+}
+
+static void
+loadSignatures(XBDeviceDatabase *database, const XBPlistNode *deviceData)
+{
+    const char *types[] = { kDeviceTypePadKey, kDeviceTypeIRKey };
+    
+    for (UInt32 i = 0; i < sizeof(types) / sizeof(types[0]); i++) {
+        
+        const XBPlistNode *specific = XBPlistGet(deviceData, types[i], kPlistDictionary);
+        XBLinuxGenericSignature *signature = &database->signatures[database->numSignatures];
+        const XBPlistNode *properties, *name, *vendor;
+        
+        if (!specific)
+            continue;
+        
+        properties = XBPlistGet(specific, kDeviceGenericPropertiesKey, kPlistDictionary);
+        name = XBPlistGet(specific, kNameKey, kPlistString);
+        vendor = XBPlistGet(specific, kVendorKey, kPlistString);
+        
+        // a match without a vendor and name is no match
+        if (!properties || !name || !vendor || !compilePattern(properties, &signature->pattern))
+            continue;
+        
+        signature->type = deviceType(types[i]);
+        copyName(signature->name, name);
+        copyName(signature->vendor, vendor);
+        
+        if (signature->pattern.numInterfaces > database->maxInterfaces)
+            database->maxInterfaces = signature->pattern.numInterfaces;
+        database->numSignatures++;
+    }
+}
+
+static void
+loadButtonMap(XBDeviceDatabase *database, const XBPlistNode *deviceData)
+{
+    const XBPlistNode *map = XBPlistGet(XBPlistGet(deviceData, kDeviceTypeIRKey, kPlistDictionary),
+                                        kDeviceButtonMapKey, kPlistArray);
+    const XBPlistNode *entry = map ? map->children : NULL;
+    
+    // buttons the map leaves out are unmapped, as in setRemoteButtonMap()
+    for (UInt32 i = 0; i < kNumRemoteButtons; i++) {
+        database->buttonMap[i] = entry && entry->type == kPlistInteger ? (UInt8)entry->integer : -1;
+        if (entry)
+            entry = entry->next;
+    }
+}
+
+bool
+XBLoadDeviceDatabase(XBDeviceDatabase *database, const char *path, const char *personality)
+{
+    XBPlistNode *plist = XBReadPlist(path);
+    const XBPlistNode *properties, *deviceData, *vendors, *reads;
+    bool loaded = false;
+    
+    memset(database, 0, sizeof(XBDeviceDatabase));
+    if (!plist)
+        return false;
+    
+    properties = XBPlistGet(XBPlistGet(plist, "IOKitPersonalities", kPlistDictionary), personality, kPlistDictionary);
+    deviceData = XBPlistGet(properties, kDeviceDataKey, kPlistDictionary);
+    
+    if (deviceData) {
+        
+        vendors = XBPlistGet(deviceData, kKnownDevicesKey, kPlistDictionary);
+        loaded = !vendors || loadKnownDevices(database, vendors);
+        
+        loadSignatures(database, deviceData);
+        loadButtonMap(database, deviceData);
+        
+        reads = XBPlistGet(properties, kInterruptReadsKey, kPlistInteger);
+        database->interruptReads = reads ? (UInt32)reads->integer : 1;
+        
+        loaded = loaded && (database->numDevices || database->numSignatures);
+    }
+    
+    XBFreePlist(plist);
+    if (!loaded)
+        XBFreeDeviceDatabase(database);
+    return loaded;
+}
+
+void
+XBFreeDeviceDatabase(XBDeviceDatabase *database)
+{
+    free(database->devices);
+    memset(database, 0, sizeof(XBDeviceDatabase));
+}
+
+bool
+XBMatchDevice(const XBDeviceDatabase *database, UInt16 vendorID, UInt16 productID,
+              const XBGenericDeviceInfo *info, XBDeviceMatch *match)
+{
+    const XBLinuxKnownDevice *known;
+    
+    known = XBFindKnownDevice(database->devices, database->numDevices, XBDeviceID(vendorID, productID));
+    if (known) {
+        match->type = known->type;
+        match->known = true;
+        match->name = known->name;
+        match->vendor = known->vendor;
+        return true;
+    }
+    
+    for (UInt32 i = 0; i < database->numSignatures; i++) {
+        
+        const XBLinuxGenericSignature *signature = &database->signatures[i];
+        
+        if (XBMatchGenericPattern(&signature->pattern, info)) {
+            match->type = signature->type;
+            match->known = false;
+            match->name = signature->name;
+            match->vendor = signature->vendor;
+            return true;
+        }
+    }
+    return false;
+}
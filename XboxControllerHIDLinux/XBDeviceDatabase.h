@@ -0,0 +1,78 @@
+//
+//  XBDeviceDatabase.h
+//  XboxControllerHIDLinux
+//
+//  The devices the driver takes, read from the DeviceData of its personality
+//  in XboxControllerHID-Info.plist, and matched the way probe() matches them:
+//  first by vendor and product id in KnownDevices (isKnownDevice()), then by
+//  the interfaces and endpoints of the GenericProperties of each device type
+//  (findGenericDevice()). The kext's last resort, taking an unknown device
+//  as a pad, is left out: on Linux it would claim any USB device at all.
+//
+
+#ifndef XboxControllerHIDLinux_XBDeviceDatabase_h
+#define XboxControllerHIDLinux_XBDeviceDatabase_h
+
+#include "XboxControllerHIDCore.h"
+
+#define kMaxDeviceNameLength    64
+#define kMaxGenericSignatures   2           // one per device type
+
+typedef enum {
+    
+    kLinuxDeviceUnknown = 0,
+    kLinuxDevicePad,
+    kLinuxDeviceRemote
+} XBLinuxDeviceType;
+
+typedef struct {
+    
+    UInt32      deviceID;                   // XBDeviceID(), the table is sorted by it
+    UInt8       type;                       // XBLinuxDeviceType
+    char        name[kMaxDeviceNameLength];
+    char        vendor[kMaxDeviceNameLength];
+    
+} XBLinuxKnownDevice;
+
+typedef struct {
+    
+    UInt8               type;
+    XBGenericPattern    pattern;
+    char                name[kMaxDeviceNameLength];
+    char                vendor[kMaxDeviceNameLength];
+    
+} XBLinuxGenericSignature;
+
+typedef struct {
+    
+    XBLinuxKnownDevice *    devices;
+    UInt32                  numDevices;
+    XBLinuxGenericSignature signatures[kMaxGenericSignatures];
+    UInt32                  numSignatures;
+    UInt32                  maxInterfaces;  // of any signature, the interfaces worth gathering
+    int                     buttonMap[kNumRemoteButtons];   // the IR ButtonMap
+    UInt32                  interruptReads; // InterruptReads of the personality
+    
+} XBDeviceDatabase;
+
+// what a device was matched as
+typedef struct {
+    
+    UInt8       type;                       // XBLinuxDeviceType
+    bool        known;                      // by its ids, otherwise by its endpoints
+    const char *name;
+    const char *vendor;
+    
+} XBDeviceMatch;
+
+// Loads the personality named personality from the Info.plist at path. False
+// if it isn't there or lists no device at all
+bool XBLoadDeviceDatabase(XBDeviceDatabase *database, const char *path, const char *personality);
+void XBFreeDeviceDatabase(XBDeviceDatabase *database);
+
+// False if the driver wouldn't take the device. info has the device's first
+// database->maxInterfaces interfaces, as gatherGenericDeviceInfo() gathers them
+bool XBMatchDevice(const XBDeviceDatabase *database, UInt16 vendorID, UInt16 productID,
+                   const XBGenericDeviceInfo *info, XBDeviceMatch *match);
+
+#endif
@@ -0,0 +1,256 @@
+//
+//  XBEventLoop.cpp
+//  XboxControllerHIDLinux
+//
+//  The daemon's epoll loop, see XBEventLoop.h.
+//
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "XBEventLoop.h"
+
+bool
+XBInitEventLoop(XBEventLoop *loop)
+{
+    memset(loop, 0, sizeof(XBEventLoop));
+    loop->epollFd = epoll_create1(EPOLL_CLOEXEC);
+    return loop->epollFd >= 0;
+}
+
+void
+XBFreeEventLoop(XBEventLoop *loop)
+{
+    close(loop->epollFd);
+}
+
+static bool
+controlSource(XBEventLoop *loop, int operation, XBEventSource *source, UInt32 events)
+{
+    struct epoll_event event;
+    
+    memset(&event, 0, sizeof(event));
+    event.events = events;
+    event.data.ptr = source;
+    return epoll_ctl(loop->epollFd, operation, source->fd, &event) == 0;
+}
+
+bool
+XBAddEventSource(XBEventLoop *loop, XBEventSource *source, UInt32 events)
+{
+    return controlSource(loop, EPOLL_CTL_ADD, source, events);
+}
+
+bool
+XBModifyEventSource(XBEventLoop *loop, XBEventSource *source, UInt32 events)
+{
+    return controlSource(loop, EPOLL_CTL_MOD, source, events);
+}
+
+void
+XBRemoveEventSource(XBEventLoop *loop, XBEventSource *source)
+{
+    epoll_ctl(loop->epollFd, EPOLL_CTL_DEL, source->fd, NULL);
+}
+
+// the timer fired: what is due is done when the device is serviced
+static void
+deviceTimerFired(void *target, UInt32 events)
+{
+    XBLoopDevice *loopDevice = (XBLoopDevice *)target;
+    UInt64 expirations;
+    (void)events;
+    
+    if (read(loopDevice->timer.fd, &expirations, sizeof(expirations)) == sizeof(expirations))
+        loopDevice->armed = 0;
+    XBTouchLoopDevice(loopDevice->loop, loopDevice);
+}
+
+// the device's output can take more
+static void
+deviceWritable(void *target, UInt32 events)
+{
+    XBLoopDevice *loopDevice = (XBLoopDevice *)target;
+    (void)events;
+    
+    // serviced to stop watching once all of it is out
+    XBFlushLinuxDeviceOutput(loopDevice->device);
+    XBTouchLoopDevice(loopDevice->loop, loopDevice);
+}
+
+static void
+armTimer(XBLoopDevice *loopDevice, UInt64 deadline)
+{
+    struct itimerspec spec;
+    
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = deadline / 1000000000;
+    spec.it_value.tv_nsec = deadline % 1000000000;
+    if (timerfd_settime(loopDevice->timer.fd, TFD_TIMER_ABSTIME, &spec, NULL) == 0)
+        loopDevice->armed = deadline;
+}
+
+static void
+removeDevice(XBEventLoop *loop, XBLoopDevice *loopDevice)
+{
+    if (loopDevice->watchingOutput)
+        XBRemoveEventSource(loop, &loopDevice->output);
+    loopDevice->watchingOutput = false;
+    
+    if (loopDevice->timer.fd >= 0) {
+        XBRemoveEventSource(loop, &loopDevice->timer);
+        close(loopDevice->timer.fd);
+        loopDevice->timer.fd = -1;
+    }
+}
+
+// Services a device after its completions, timer or output, and sets the loop
+// up for what it waits for next. False if it still has work to do right away
+static bool
+serviceDevice(XBEventLoop *loop, XBLoopDevice *loopDevice, UInt64 now)
+{
+    XBLinuxDevice *device = loopDevice->device;
+    bool pending;
+    UInt64 deadline;
+    
+    XBServiceLinuxDevice(device, now);
+    
+    if (XBLinuxDeviceGone(device)) {
+        removeDevice(loop, loopDevice);
+        if (loopDevice->gone)
+            loopDevice->gone(loopDevice);
+        return true;
+    }
+    if (loopDevice->serviced)
+        loopDevice->serviced(loopDevice);
+    
+    // a deadline that moved later is left to the timer, which fires early once
+    deadline = XBLinuxDeviceDeadline(device);
+    if (deadline == kLinuxServiceNow)
+        return false;
+    if (deadline && (!loopDevice->armed || deadline < loopDevice->armed))
+        armTimer(loopDevice, deadline);
+    
+    // epoll doesn't watch regular files, or an fd twice: that output is retried when the device is next serviced
+    pending = XBLinuxDeviceOutputPending(device) && !XBFlushLinuxDeviceOutput(device);
+    if (pending && !loopDevice->watchingOutput)
+        loopDevice->watchingOutput = XBAddEventSource(loop, &loopDevice->output, EPOLLOUT);
+    else if (!pending && loopDevice->watchingOutput) {
+        XBRemoveEventSource(loop, &loopDevice->output);
+        loopDevice->watchingOutput = false;
+    }
+    return true;
+}
+
+UInt32
+XBRunEventLoop(XBEventLoop *loop, UInt64 timeout)
+{
+    struct epoll_event events[kMaxLoopEvents];
+    XBLoopDevice *touched, *again = NULL;
+    UInt64 now;
+    int count, wait;
+    
+    // devices left with work to do don't wait
+    if (loop->touched)
+        wait = 0;
+    else if (timeout == ~0ULL)
+        wait = -1;
+    else
+        wait = (int)((timeout + 999999) / 1000000);
+    
+    count = epoll_wait(loop->epollFd, events, kMaxLoopEvents, wait);
+    if (count < 0)
+        count = 0;
+    if (count)
+        loop->passes++;
+    
+    for (int i = 0; i < count; i++) {
+        
+        XBEventSource *source = (XBEventSource *)events[i].data.ptr;
+        
+        source->handler(source->target, events[i].events);
+        loop->dispatched++;
+    }
+    
+    now = XBLinuxTime();
+    touched = loop->touched;
+    loop->touched = NULL;
+    
+    while (touched) {
+        
+        XBLoopDevice *loopDevice = touched;
+        
+        touched = loopDevice->nextTouched;
+        loopDevice->touched = false;
+        
+        if (!serviceDevice(loop, loopDevice, now)) {
+            loopDevice->touched = true;
+            loopDevice->nextTouched = again;
+            again = loopDevice;
+        }
+    }
+    
+    // and anything touched while servicing is serviced in the next pass
+    while (again) {
+        
+        XBLoopDevice *loopDevice = again;
+        
+        again = loopDevice->nextTouched;
+        loopDevice->nextTouched = loop->touched;
+        loop->touched = loopDevice;
+    }
+    return count;
+}
+
+bool
+XBAddLoopDevice(XBEventLoop *loop, XBLoopDevice *loopDevice, XBLinuxDevice *device,
+                void (*gone)(XBLoopDevice *loopDevice))
+{
+    memset(loopDevice, 0, sizeof(XBLoopDevice));
+    loopDevice->device = device;
+    loopDevice->loop = loop;
+    loopDevice->gone = gone;
+    
+    loopDevice->timer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    loopDevice->timer.handler = deviceTimerFired;
+    loopDevice->timer.target = loopDevice;
+    
+    loopDevice->output.fd = device->outputFd;
+    loopDevice->output.handler = deviceWritable;
+    loopDevice->output.target = loopDevice;
+    
+    if (loopDevice->timer.fd < 0)
+        return false;
+    if (!XBAddEventSource(loop, &loopDevice->timer, EPOLLIN)) {
+        close(loopDevice->timer.fd);
+        loopDevice->timer.fd = -1;
+        return false;
+    }
+    return true;
+}
+
+void
+XBRemoveLoopDevice(XBEventLoop *loop, XBLoopDevice *loopDevice)
+{
+    XBLoopDevice **link = &loop->touched;
+    
+    while (*link && *link != loopDevice)
+        link = &(*link)->nextTouched;
+    if (*link)
+        *link = loopDevice->nextTouched;
+    loopDevice->touched = false;
+    
+    removeDevice(loop, loopDevice);
+}
+
+void
+XBTouchLoopDevice(XBEventLoop *loop, XBLoopDevice *loopDevice)
+{
+    if (loopDevice->touched)
+        return;
+    loopDevice->touched = true;
+    loopDevice->nextTouched = loop->touched;
+    loop->touched = loopDevice;
+}
@@ -0,0 +1,81 @@
+//
+//  XBEventLoop.h
+//  XboxControllerHIDLinux
+//
+//  The daemon's one thread: an epoll loop over every fd it waits on, libusb's
+//  (the usbfs fd of each device and libusb's own), a timerfd per device for
+//  its release timer, the uinput fds while they can't take their events, and
+//  signals. Where the kext gives each device a work loop, two thread calls
+//  and a timer source, here every device is a few fds in one epoll set, so
+//  any number of pads cost one thread and no switches between them.
+//
+//  Completions don't service their device right away: the device is marked
+//  with XBTouchLoopDevice(), and every device marked in a pass of the loop
+//  is serviced once at its end, its timer re-armed if its deadline moved
+//  and its output watched if some of it is still waiting.
+//
+
+#ifndef XboxControllerHIDLinux_XBEventLoop_h
+#define XboxControllerHIDLinux_XBEventLoop_h
+
+#include "XBLinuxDevice.h"
+
+#define kMaxLoopEvents          64          // fds taken from one epoll_wait()
+
+typedef void (*XBEventHandler)(void *target, UInt32 events);
+
+// an fd in the loop, owned by whoever added it
+typedef struct {
+    
+    int             fd;
+    XBEventHandler  handler;
+    void *          target;
+    
+} XBEventSource;
+
+typedef struct XBLoopDevice XBLoopDevice;
+
+typedef struct {
+    
+    int             epollFd;
+    XBLoopDevice *  touched;                // to service at the end of the pass
+    UInt64          passes;                 // epoll_wait()s that returned something
+    UInt64          dispatched;             // handlers run
+    
+} XBEventLoop;
+
+// a device's part in the loop
+struct XBLoopDevice {
+    
+    XBLinuxDevice * device;
+    XBEventLoop *   loop;
+    XBEventSource   timer;                  // timerfd for XBLinuxDeviceDeadline()
+    UInt64          armed;                  // when it fires, 0 if disarmed
+    XBEventSource   output;                 // the device's outputFd, watched while output waits
+    bool            watchingOutput;
+    bool            touched;
+    XBLoopDevice *  nextTouched;
+    void            (*gone)(XBLoopDevice *loopDevice);  // XBLinuxDeviceGone(), for its owner to free it
+    void            (*serviced)(XBLoopDevice *loopDevice);  // after each service, for a backend with no fd to wake it
+    
+};
+
+bool XBInitEventLoop(XBEventLoop *loop);
+void XBFreeEventLoop(XBEventLoop *loop);
+
+// events are EPOLLIN, EPOLLOUT ...; false with errno set if epoll won't take the fd
+bool XBAddEventSource(XBEventLoop *loop, XBEventSource *source, UInt32 events);
+bool XBModifyEventSource(XBEventLoop *loop, XBEventSource *source, UInt32 events);
+void XBRemoveEventSource(XBEventLoop *loop, XBEventSource *source);
+
+// Waits up to timeout ns (~0 for ever) for something to do, does it and
+// services the devices touched on the way. Returns the handlers run
+UInt32 XBRunEventLoop(XBEventLoop *loop, UInt64 timeout);
+
+// gone is called, from the loop, once the device is gone
+bool XBAddLoopDevice(XBEventLoop *loop, XBLoopDevice *loopDevice, XBLinuxDevice *device,
+                     void (*gone)(XBLoopDevice *loopDevice));
+void XBRemoveLoopDevice(XBEventLoop *loop, XBLoopDevice *loopDevice);
+void XBTouchLoopDevice(XBEventLoop *loop, XBLoopDevice *loopDevice);
+
+#endif
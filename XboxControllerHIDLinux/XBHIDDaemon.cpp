@@ -0,0 +1,280 @@
+//
+//  XBHIDDaemon.cpp
+//  XboxControllerHIDLinux
+//
+//  The driver's work on Linux, in user space: Xbox pads and IR receivers
+//  matched with the kext's own device tables, read with several interrupt
+//  transfers in flight, run through the driver's report pipeline and handed
+//  to the input layer through uinput.
+//
+//  usage: XBHIDDaemon [--info-plist FILE] [--personality NAME]
+//                     [--option Key=Value]... [--reads N] [--events FILE]
+//                     [--simulate-pads N] [--simulate-remotes N] [--no-usb]
+//                     [--duration MS]
+//
+//  The devices come from the DeviceData of the personality (the generic one
+//  by default) in the driver's Info.plist, its InterruptReads reads are kept
+//  in flight per device unless --reads says otherwise, and the options are
+//  the DeviceOptions keys on top of the driver's defaults. --events sends
+//  the events of every device to FILE instead of a uinput device each.
+//  --simulate-* adds simulated pads (sweeping their sticks) and remotes
+//  (pressing a button every second), in real time, to try it without the
+//  hardware or /dev/uinput; --no-usb leaves real devices alone. It runs
+//  until SIGINT or SIGTERM, or for --duration, and then prints the counts of
+//  the simulated devices as JSON.
+//
+//  Everything runs on one thread, in one XBEventLoop: libusb's fds, the
+//  simulated pipes' and release timers, uinput fds that are full and the
+//  signals, through a signalfd.
+//
+
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
+
+#include <vector>
+
+#include "XBDeviceDatabase.h"
+#include "XBEventLoop.h"
+#include "XBLinuxDevice.h"
+#include "XBSimBackend.h"
+#include "XBUInput.h"
+#ifdef XB_HAVE_LIBUSB
+#include "XBLibUSBBackend.h"
+#endif
+
+#define kMs                 1000000ULL
+#define kSimPadInterval     (4 * kMs)       // the pads' bInterval
+#define kSimRemoteInterval  (16 * kMs)
+
+#ifndef XB_INFO_PLIST
+#define XB_INFO_PLIST       "XboxControllerHID-Info.plist"
+#endif
+
+static void
+usage()
+{
+    fprintf(stderr, "usage: XBHIDDaemon [--info-plist FILE] [--personality NAME]\n"
+                    "                   [--option Key=Value]... [--reads N] [--events FILE]\n"
+                    "                   [--simulate-pads N] [--simulate-remotes N] [--no-usb]\n"
+                    "                   [--duration MS]\n");
+    exit(2);
+}
+
+// SIGINT or SIGTERM, from the signalfd
+static void
+stop(void *target, UInt32 events)
+{
+    XBEventSource *source = (XBEventSource *)target;
+    struct signalfd_siginfo info;
+    (void)events;
+    
+    if (read(source->fd, &info, sizeof(info)) == sizeof(info))
+        source->target = NULL;
+}
+
+static void
+addSimDevice(XBEventLoop *loop, std::vector<XBSimLoopDevice *> &sims, XBSimDeviceType type,
+             const XBLinuxPipeline *pipeline, UInt32 numReads, int eventsFd)
+{
+    XBSimStep sweep = { 10000 * kMs, kSimPatternSweep, 0, 0, 0, 2000 * kMs };
+    XBSimStep idle = { 1000 * kMs, kSimPatternIdle, 0, 0, 0, 0 };
+    XBSimStep press = { 200 * kMs, kSimPatternRemoteButton, 0, 0, 213, 0 };
+    XBSimLoopDevice *sim = new XBSimLoopDevice;
+    XBSimDevice device;
+    int outputFd = eventsFd;
+    UInt8 linuxType = type == kSimDeviceRemote ? kLinuxDeviceRemote : kLinuxDevicePad;
+    
+    XBInitSimDevice(&device, type, type == kSimDeviceRemote ? kSimRemoteInterval : kSimPadInterval, sims.size() + 1);
+    device.loop = true;
+    if (type == kSimDeviceRemote) {
+        XBAddSimStep(&device, &idle);
+        XBAddSimStep(&device, &press);
+    } else
+        XBAddSimStep(&device, &sweep);
+    
+    if (outputFd < 0) {
+        outputFd = XBCreateInputDevice(linuxType, type == kSimDeviceRemote ? "Simulated Xbox DVD Remote" :
+                                                                             "Simulated Xbox Controller", 0, 0);
+        if (outputFd < 0) {
+            perror("uinput");
+            exit(1);
+        }
+    }
+    
+    XBInitSimLinuxDevice(&sim->sim, &device, XBLinuxTime(), pipeline, numReads, outputFd);
+    if (!XBAddSimLoopDevice(loop, sim, NULL)) {
+        perror("epoll");
+        exit(1);
+    }
+    sims.push_back(sim);
+}
+
+static void
+printStats(FILE *file, const char *name, UInt32 index, const XBLinuxDeviceStats *stats, bool last)
+{
+    fprintf(file, "    { \"device\": \"%s %u\", \"reports\": %llu, \"delivered\": %llu, \"suppressed\": %llu, "
+                  "\"repeats\": %llu, \"releases\": %llu, \"ignored\": %llu, \"errors\": %llu, \"halts\": %llu, "
+                  "\"checks\": %llu, \"resets\": %llu, \"events\": %llu, \"writesHeld\": %llu, \"writeErrors\": %llu }%s\n",
+            name, index, (unsigned long long)stats->reports, (unsigned long long)stats->delivered,
+            (unsigned long long)stats->suppressed, (unsigned long long)stats->repeats,
+            (unsigned long long)stats->releases, (unsigned long long)stats->ignored,
+            (unsigned long long)stats->errors, (unsigned long long)stats->halts,
+            (unsigned long long)stats->checks, (unsigned long long)stats->resets,
+            (unsigned long long)stats->events, (unsigned long long)stats->writesHeld,
+            (unsigned long long)stats->writeErrors, last ? "" : ",");
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *plist = XB_INFO_PLIST, *personality = "Generic Xbox Device", *events = NULL;
+    XBReplayOptions options;
+    XBDeviceDatabase database;
+    XBLinuxPipeline pipeline;
+    XBEventLoop loop;
+    XBEventSource signals;
+    sigset_t mask;
+    std::vector<XBSimLoopDevice *> sims;
+    UInt32 numReads = 0, simPads = 0, simRemotes = 0;
+    UInt64 duration = 0, end = 0;
+    bool useUSB = true;
+    int eventsFd = -1;
+#ifdef XB_HAVE_LIBUSB
+    XBLibUSB *usb = NULL;
+#endif
+    
+    XBDefaultReplayOptions(&options);
+    
+    for (int i = 1; i < argc; i++) {
+        
+        const char *arg = argv[i];
+        
+        if (!strcmp(arg, "--no-usb")) {
+            useUSB = false;
+            continue;
+        }
+        
+        if (i + 1 == argc)
+            usage();
+        
+        if (!strcmp(arg, "--info-plist"))
+            plist = argv[++i];
+        else if (!strcmp(arg, "--personality"))
+            personality = argv[++i];
+        else if (!strcmp(arg, "--option")) {
+            if (!XBParsePadOption(&options.padOptions, argv[++i])) {
+                fprintf(stderr, "unknown option %s\n", argv[i]);
+                usage();
+            }
+        }
+        else if (!strcmp(arg, "--reads"))
+            numReads = atoi(argv[++i]);
+        else if (!strcmp(arg, "--events"))
+            events = argv[++i];
+        else if (!strcmp(arg, "--simulate-pads"))
+            simPads = atoi(argv[++i]);
+        else if (!strcmp(arg, "--simulate-remotes"))
+            simRemotes = atoi(argv[++i]);
+        else if (!strcmp(arg, "--duration"))
+            duration = strtoull(argv[++i], NULL, 0) * kMs;
+        else
+            usage();
+    }
+    
+    if (!XBLoadDeviceDatabase(&database, plist, personality)) {
+        fprintf(stderr, "%s: no devices for %s\n", plist, personality);
+        return 1;
+    }
+    
+    // the remote's ButtonMap comes with the personality too
+    memcpy(options.buttonMap, database.buttonMap, sizeof(options.buttonMap));
+    XBInitLinuxPipeline(&pipeline, &options);
+    if (!numReads)
+        numReads = database.interruptReads;
+    
+    if (events) {
+        // a FIFO that isn't read fast enough holds the events back, not the loop
+        eventsFd = open(events, O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK | O_CLOEXEC, 0644);
+        if (eventsFd < 0) {
+            perror(events);
+            return 1;
+        }
+    }
+    
+    // the signals come in on the loop, not as handlers between two of its calls
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigprocmask(SIG_BLOCK, &mask, NULL);
+    
+    signals.fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    signals.handler = stop;
+    signals.target = &signals;
+    if (!XBInitEventLoop(&loop) || signals.fd < 0 || !XBAddEventSource(&loop, &signals, EPOLLIN)) {
+        perror("epoll");
+        return 1;
+    }
+    
+    for (UInt32 i = 0; i < simPads; i++)
+        addSimDevice(&loop, sims, kSimDevicePad, &pipeline, numReads, eventsFd);
+    for (UInt32 i = 0; i < simRemotes; i++)
+        addSimDevice(&loop, sims, kSimDeviceRemote, &pipeline, numReads, eventsFd);
+
+#ifdef XB_HAVE_LIBUSB
+    if (useUSB) {
+        usb = XBOpenLibUSB(&database, &pipeline, numReads, eventsFd, &loop);
+        if (!usb) {
+            fprintf(stderr, "libusb can't be initialized\n");
+            return 1;
+        }
+    }
+#else
+    if (useUSB && sims.empty()) {
+        fprintf(stderr, "built without libusb, only --simulate-pads and --simulate-remotes are there\n");
+        return 1;
+    }
+#endif
+    
+    if (duration)
+        end = XBLinuxTime() + duration;
+    
+    while (signals.target) {
+        
+        UInt64 now = XBLinuxTime();
+        
+        if (end && now >= end)
+            break;
+        XBRunEventLoop(&loop, end ? end - now : ~0ULL);
+    }
+
+#ifdef XB_HAVE_LIBUSB
+    if (usb)
+        XBCloseLibUSB(usb);
+#endif
+    
+    printf("{\n  \"devices\": [\n");
+    for (size_t i = 0; i < sims.size(); i++)
+        printStats(stdout, sims[i]->sim.device.type == kLinuxDeviceRemote ? "simulated remote" : "simulated pad", i,
+                   &sims[i]->sim.device.stats, i + 1 == sims.size());
+    printf("  ]\n}\n");
+    
+    for (size_t i = 0; i < sims.size(); i++) {
+        XBRemoveSimLoopDevice(sims[i]);
+        if (sims[i]->sim.device.outputFd != eventsFd)
+            XBDestroyInputDevice(sims[i]->sim.device.outputFd);
+        XBFreeSimLinuxDevice(&sims[i]->sim);
+        delete sims[i];
+    }
+    if (eventsFd >= 0)
+        close(eventsFd);
+    close(signals.fd);
+    XBFreeEventLoop(&loop);
+    XBFreeDeviceDatabase(&database);
+    return 0;
+}
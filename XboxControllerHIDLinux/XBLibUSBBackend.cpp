@@ -0,0 +1,588 @@
+//
+//  XBLibUSBBackend.cpp
+//  XboxControllerHIDLinux
+//
+//  libusb behind XBLinuxBackend, see XBLibUSBBackend.h.
+//
+
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <libusb.h>
+
+#include "XBLibUSBBackend.h"
+#include "XBUInput.h"
+
+typedef struct XBLibUSBDevice XBLibUSBDevice;
+typedef struct XBLibUSBPollFd XBLibUSBPollFd;
+typedef struct XBLibUSBArrival XBLibUSBArrival;
+
+struct XBLibUSBDevice {
+    
+    XBLinuxDevice           device;
+    XBLoopDevice            loopDevice;
+    bool                    inLoop;
+    XBLibUSB *              usb;
+    libusb_device *         usbDevice;
+    libusb_device_handle *  handle;
+    UInt8                   endpoint;
+    UInt16                  maxPacketSize;
+    bool                    ownsOutput;     // a uinput device of its own
+    SInt32                  cancelStatus[kMaxLinuxReads];   // what a cancelled read completes with
+    XBLibUSBDevice *        next;
+    
+};
+
+// one of libusb's fds in the loop
+struct XBLibUSBPollFd {
+    
+    XBEventSource           source;
+    XBLibUSBPollFd *        next;
+    
+};
+
+// a device plugged in that matched, to open after the hotplug callback
+struct XBLibUSBArrival {
+    
+    libusb_device *         device;
+    XBLibUSBArrival *       next;
+    
+};
+
+struct XBLibUSB {
+    
+    libusb_context *                context;
+    const XBDeviceDatabase *        database;
+    const XBLinuxPipeline *         pipeline;
+    UInt32                          numReads;
+    int                             eventsFd;
+    bool                            hasHotplug;
+    libusb_hotplug_callback_handle  hotplug;
+    XBLibUSBArrival *               arrivals;
+    XBLibUSBDevice *                devices;
+    UInt32                          numDevices;
+    XBEventLoop *                   loop;
+    XBLibUSBPollFd *                pollFds;
+    
+};
+
+static XBLibUSBDevice *
+usbDeviceOf(XBLinuxDevice *device)
+{
+    return (XBLibUSBDevice *)device->backendData;
+}
+
+static SInt32
+transferStatus(XBLibUSBDevice *usbDevice, XBLinuxRead *read, enum libusb_transfer_status status)
+{
+    switch (status) {
+        case LIBUSB_TRANSFER_COMPLETED: return kSimStatusSuccess;
+        case LIBUSB_TRANSFER_OVERFLOW:  return kSimStatusOverrun;
+        case LIBUSB_TRANSFER_STALL:     return kSimStatusPipeStalled;
+        case LIBUSB_TRANSFER_ERROR:     return kSimStatusCRCErr;
+        case LIBUSB_TRANSFER_CANCELLED: return usbDevice->cancelStatus[read - usbDevice->device.reads];
+        default:                        return kSimStatusNotResponding;
+    }
+}
+
+static void LIBUSB_CALL
+readComplete(struct libusb_transfer *transfer)
+{
+    XBLinuxRead *read = (XBLinuxRead *)transfer->user_data;
+    XBLibUSBDevice *usbDevice = usbDeviceOf(read->device);
+    
+    XBCompleteLinuxRead(read, transferStatus(usbDevice, read, transfer->status), transfer->actual_length, XBLinuxTime());
+    XBTouchLoopDevice(usbDevice->usb->loop, &usbDevice->loopDevice);
+}
+
+static SInt32
+submitRead(XBLinuxDevice *device, XBLinuxRead *read)
+{
+    XBLibUSBDevice *usbDevice = usbDeviceOf(device);
+    
+    usbDevice->cancelStatus[read - device->reads] = kSimStatusAborted;
+    
+    switch (libusb_submit_transfer((struct libusb_transfer *)read->transfer)) {
+        case 0:                         return kSimStatusSuccess;
+        case LIBUSB_ERROR_NO_DEVICE:    return kSimStatusNotOpen;
+        default:                        return kSimStatusNoResources;
+    }
+}
+
+// cancels the reads in flight, which then complete with status
+static void
+cancelReads(XBLinuxDevice *device, SInt32 status)
+{
+    XBLibUSBDevice *usbDevice = usbDeviceOf(device);
+    
+    // a read whose completion is running isn't in flight, and isn't found
+    for (UInt32 i = 0; i < device->numReads; i++)
+        if (device->reads[i].queued &&
+            libusb_cancel_transfer((struct libusb_transfer *)device->reads[i].transfer) == 0)
+            usbDevice->cancelStatus[i] = status;
+}
+
+// libusb clears the halt at the host along with the endpoint, in clearEndpointHalt()
+static void
+clearStall(XBLinuxDevice *device)
+{
+    cancelReads(device, kSimStatusTransactionReturned);
+}
+
+static SInt32
+clearEndpointHalt(XBLinuxDevice *device)
+{
+    XBLibUSBDevice *usbDevice = usbDeviceOf(device);
+    
+    return libusb_clear_halt(usbDevice->handle, usbDevice->endpoint) == 0 ? kSimStatusSuccess : kSimStatusNotResponding;
+}
+
+// the hub's view: whether libusb still enumerates the device
+static bool
+isConnected(XBLinuxDevice *device)
+{
+    XBLibUSBDevice *usbDevice = usbDeviceOf(device);
+    libusb_device **list;
+    bool connected = false;
+    ssize_t count;
+    
+    count = libusb_get_device_list(usbDevice->usb->context, &list);
+    for (ssize_t i = 0; i < count && !connected; i++)
+        connected = list[i] == usbDevice->usbDevice;
+    if (count >= 0)
+        libusb_free_device_list(list, 1);
+    
+    return connected;
+}
+
+// A device that comes back under a new address is a new device to libusb:
+// this one is gone, and hotplug brings the other in
+static void
+resetDevice(XBLinuxDevice *device)
+{
+    XBLibUSBDevice *usbDevice = usbDeviceOf(device);
+    
+    if (libusb_reset_device(usbDevice->handle) == 0)
+        XBLinuxDeviceWasReset(device);
+    else
+        device->disconnected = true;
+}
+
+static void
+abortReads(XBLinuxDevice *device)
+{
+    cancelReads(device, kSimStatusAborted);
+}
+
+static const XBLinuxBackend gLibUSBBackend = {
+    submitRead, clearStall, clearEndpointHalt, isConnected, resetDevice, abortReads
+};
+
+// gatherGenericDeviceInfo(): every alternate setting of every interface, as FindNextInterface() finds them
+static void
+gatherDeviceInfo(const struct libusb_config_descriptor *config, UInt32 maxInterfaces, XBGenericDeviceInfo *info)
+{
+    info->numInterfaces = 0;
+    
+    for (UInt32 i = 0; i < config->bNumInterfaces; i++)
+        for (int j = 0; j < config->interface[i].num_altsetting; j++) {
+            
+            const struct libusb_interface_descriptor *descriptor = &config->interface[i].altsetting[j];
+            XBGenericInterfaceInfo *interfaceInfo;
+            
+            if (info->numInterfaces == maxInterfaces || info->numInterfaces == kMaxGenericInterfaces)
+                return;
+            
+            interfaceInfo = &info->interfaces[info->numInterfaces++];
+            interfaceInfo->numEndpoints = descriptor->bNumEndpoints;
+            interfaceInfo->numGathered = 0;
+            
+            for (UInt32 k = 0; k < descriptor->bNumEndpoints && k < kMaxGenericEndpoints; k++) {
+                
+                XBGenericEndpoint *endpoint = &interfaceInfo->endpoints[interfaceInfo->numGathered++];
+                
+                endpoint->interface = info->numInterfaces - 1;
+                endpoint->address = descriptor->endpoint[k].bEndpointAddress & 0x8F;
+                endpoint->maxPacketSize = descriptor->endpoint[k].wMaxPacketSize;
+                endpoint->pollingInterval = descriptor->endpoint[k].bInterval;
+            }
+        }
+}
+
+// the interrupt IN endpoint the kext opens, on the first interface
+static bool
+findInterruptEndpoint(const struct libusb_config_descriptor *config, UInt8 *address, UInt16 *maxPacketSize)
+{
+    const struct libusb_interface_descriptor *descriptor;
+    
+    if (!config->bNumInterfaces || !config->interface[0].num_altsetting)
+        return false;
+    
+    descriptor = &config->interface[0].altsetting[0];
+    for (UInt32 i = 0; i < descriptor->bNumEndpoints; i++) {
+        
+        const struct libusb_endpoint_descriptor *endpoint = &descriptor->endpoint[i];
+        
+        if ((endpoint->bEndpointAddress & LIBUSB_ENDPOINT_IN) &&
+            (endpoint->bmAttributes & 3) == LIBUSB_TRANSFER_TYPE_INTERRUPT) {
+            *address = endpoint->bEndpointAddress;
+            *maxPacketSize = endpoint->wMaxPacketSize;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void
+freeDevice(XBLibUSBDevice *usbDevice)
+{
+    if (usbDevice->inLoop)
+        XBRemoveLoopDevice(usbDevice->usb->loop, &usbDevice->loopDevice);
+    
+    for (UInt32 i = 0; i < usbDevice->device.numReads; i++)
+        if (usbDevice->device.reads[i].transfer)
+            libusb_free_transfer((struct libusb_transfer *)usbDevice->device.reads[i].transfer);
+    
+    if (usbDevice->handle) {
+        libusb_release_interface(usbDevice->handle, 0);
+        libusb_close(usbDevice->handle);
+    }
+    if (usbDevice->ownsOutput)
+        XBDestroyInputDevice(usbDevice->device.outputFd);
+    
+    libusb_unref_device(usbDevice->usbDevice);
+    free(usbDevice);
+}
+
+// didTerminate(): unplugged or stopped, with every transfer back
+static void
+deviceGone(XBLoopDevice *loopDevice)
+{
+    XBLibUSBDevice *usbDevice = usbDeviceOf(loopDevice->device);
+    XBLibUSBDevice **link = &usbDevice->usb->devices;
+    
+    while (*link != usbDevice)
+        link = &(*link)->next;
+    *link = usbDevice->next;
+    usbDevice->usb->numDevices--;
+    freeDevice(usbDevice);
+}
+
+// probe(): by its ids, then by its interfaces. The descriptors are libusb's
+// copies, so this doesn't talk to the device. On a match config is left for
+// the caller to free
+static bool
+matchDevice(XBLibUSB *usb, libusb_device *device, struct libusb_device_descriptor *descriptor,
+            struct libusb_config_descriptor **config, XBDeviceMatch *match)
+{
+    XBGenericDeviceInfo info;
+    
+    if (libusb_get_device_descriptor(device, descriptor) != 0 ||
+        (libusb_get_active_config_descriptor(device, config) != 0 &&
+         libusb_get_config_descriptor(device, 0, config) != 0))
+        return false;
+    
+    gatherDeviceInfo(*config, usb->database->maxInterfaces, &info);
+    
+    if (!XBMatchDevice(usb->database, descriptor->idVendor, descriptor->idProduct, &info, match)) {
+        libusb_free_config_descriptor(*config);
+        return false;
+    }
+    return true;
+}
+
+// probe() and start(): match the device, claim its first interface and start reading
+static void
+openDevice(XBLibUSB *usb, libusb_device *device)
+{
+    struct libusb_device_descriptor descriptor;
+    struct libusb_config_descriptor *config;
+    XBDeviceMatch match;
+    XBLibUSBDevice *usbDevice;
+    int outputFd;
+    bool found;
+    
+    for (XBLibUSBDevice *open = usb->devices; open; open = open->next)
+        if (open->usbDevice == device)
+            return;
+    
+    if (!matchDevice(usb, device, &descriptor, &config, &match))
+        return;
+    
+    usbDevice = (XBLibUSBDevice *)calloc(1, sizeof(XBLibUSBDevice));
+    found = usbDevice && findInterruptEndpoint(config, &usbDevice->endpoint, &usbDevice->maxPacketSize);
+    libusb_free_config_descriptor(config);
+    
+    if (!found) {
+        free(usbDevice);
+        return;
+    }
+    
+    usbDevice->usb = usb;
+    usbDevice->usbDevice = libusb_ref_device(device);
+    
+    if (libusb_open(device, &usbDevice->handle) != 0) {
+        usbDevice->handle = NULL;
+        fprintf(stderr, "%s %s: can't open the device\n", match.vendor, match.name);
+        freeDevice(usbDevice);
+        return;
+    }
+    
+    // xpad or usbhid may have it already
+    libusb_set_auto_detach_kernel_driver(usbDevice->handle, 1);
+    if (libusb_claim_interface(usbDevice->handle, 0) != 0) {
+        libusb_close(usbDevice->handle);
+        usbDevice->handle = NULL;
+        fprintf(stderr, "%s %s: can't claim its interface\n", match.vendor, match.name);
+        freeDevice(usbDevice);
+        return;
+    }
+    
+    outputFd = usb->eventsFd;
+    if (outputFd < 0) {
+        outputFd = XBCreateInputDevice(match.type, match.name, descriptor.idVendor, descriptor.idProduct);
+        if (outputFd < 0) {
+            perror("uinput");
+            freeDevice(usbDevice);
+            return;
+        }
+        usbDevice->ownsOutput = true;
+    }
+    
+    XBInitLinuxDevice(&usbDevice->device, &gLibUSBBackend, usbDevice, usb->pipeline, match.type,
+                      usb->numReads, outputFd);
+    
+    for (UInt32 i = 0; i < usbDevice->device.numReads; i++) {
+        
+        XBLinuxRead *read = &usbDevice->device.reads[i];
+        struct libusb_transfer *transfer = libusb_alloc_transfer(0);
+        UInt32 length = usbDevice->maxPacketSize < kMaxLinuxReportBytes ? usbDevice->maxPacketSize : kMaxLinuxReportBytes;
+        
+        if (!transfer) {
+            freeDevice(usbDevice);
+            return;
+        }
+        libusb_fill_interrupt_transfer(transfer, usbDevice->handle, usbDevice->endpoint, read->buffer, length,
+                                       readComplete, read, 0);
+        read->transfer = transfer;
+    }
+    
+    usbDevice->inLoop = XBAddLoopDevice(usb->loop, &usbDevice->loopDevice, &usbDevice->device, deviceGone);
+    if (!usbDevice->inLoop || !XBStartLinuxDevice(&usbDevice->device)) {
+        fprintf(stderr, "%s %s: can't read from the device\n", match.vendor, match.name);
+        freeDevice(usbDevice);
+        return;
+    }
+    
+    fprintf(stderr, "%s %s (%04x:%04x) on bus %d, address %d, %s\n", match.vendor, match.name,
+            descriptor.idVendor, descriptor.idProduct, libusb_get_bus_number(device),
+            libusb_get_device_address(device), match.known ? "known" : "generic");
+    
+    usbDevice->next = usb->devices;
+    usb->devices = usbDevice;
+    usb->numDevices++;
+}
+
+// Devices can't be opened from the hotplug callback, only remembered. Every
+// USB device on the bus comes through here, only those that match are kept
+static int LIBUSB_CALL
+hotplug(libusb_context *context, libusb_device *device, libusb_hotplug_event event, void *target)
+{
+    XBLibUSB *usb = (XBLibUSB *)target;
+    struct libusb_device_descriptor descriptor;
+    struct libusb_config_descriptor *config;
+    XBDeviceMatch match;
+    XBLibUSBArrival *arrival;
+    (void)context;
+    
+    if (event == LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED) {
+        
+        if (!matchDevice(usb, device, &descriptor, &config, &match))
+            return 0;
+        libusb_free_config_descriptor(config);
+        
+        arrival = (XBLibUSBArrival *)malloc(sizeof(XBLibUSBArrival));
+        if (!arrival) {
+            fprintf(stderr, "%s %s: no memory to open it\n", match.vendor, match.name);
+            return 0;
+        }
+        arrival->device = libusb_ref_device(device);
+        arrival->next = usb->arrivals;
+        usb->arrivals = arrival;
+        return 0;
+    }
+    
+    // willTerminate()
+    for (XBLibUSBDevice *usbDevice = usb->devices; usbDevice; usbDevice = usbDevice->next)
+        if (usbDevice->usbDevice == device && !usbDevice->device.stopping) {
+            usbDevice->device.disconnected = true;
+            XBStopLinuxDevice(&usbDevice->device);
+            XBTouchLoopDevice(usb->loop, &usbDevice->loopDevice);
+        }
+    return 0;
+}
+
+static void
+openArrivals(XBLibUSB *usb)
+{
+    while (usb->arrivals) {
+        
+        XBLibUSBArrival *arrival = usb->arrivals;
+        
+        usb->arrivals = arrival->next;
+        openDevice(usb, arrival->device);
+        libusb_unref_device(arrival->device);
+        free(arrival);
+    }
+}
+
+// Ready fds of libusb: the completions and hotplug events there are, then
+// the devices plugged in. The completions touched their devices
+static void
+handleEvents(void *target, UInt32 events)
+{
+    XBLibUSB *usb = (XBLibUSB *)target;
+    struct timeval zero = { 0, 0 };
+    (void)events;
+    
+    libusb_handle_events_timeout_completed(usb->context, &zero, NULL);
+    openArrivals(usb);
+}
+
+// A removed fd's entry is kept for the next fd: an event of this pass may
+// still point at it
+static void LIBUSB_CALL
+pollFdAdded(int fd, short pollEvents, void *target)
+{
+    XBLibUSB *usb = (XBLibUSB *)target;
+    XBLibUSBPollFd *pollFd = usb->pollFds;
+    UInt32 events = (pollEvents & POLLIN ? (UInt32)EPOLLIN : 0) | (pollEvents & POLLOUT ? (UInt32)EPOLLOUT : 0);
+    
+    while (pollFd && pollFd->source.fd >= 0)
+        pollFd = pollFd->next;
+    
+    if (!pollFd) {
+        pollFd = (XBLibUSBPollFd *)calloc(1, sizeof(XBLibUSBPollFd));
+        if (!pollFd)
+            return;
+        pollFd->source.handler = handleEvents;
+        pollFd->source.target = usb;
+        pollFd->next = usb->pollFds;
+        usb->pollFds = pollFd;
+    }
+    
+    pollFd->source.fd = fd;
+    if (!XBAddEventSource(usb->loop, &pollFd->source, events)) {
+        perror("epoll");
+        pollFd->source.fd = -1;
+    }
+}
+
+static void LIBUSB_CALL
+pollFdRemoved(int fd, void *target)
+{
+    XBLibUSB *usb = (XBLibUSB *)target;
+    
+    for (XBLibUSBPollFd *pollFd = usb->pollFds; pollFd; pollFd = pollFd->next)
+        if (pollFd->source.fd == fd) {
+            XBRemoveEventSource(usb->loop, &pollFd->source);
+            pollFd->source.fd = -1;
+        }
+}
+
+XBLibUSB *
+XBOpenLibUSB(const XBDeviceDatabase *database, const XBLinuxPipeline *pipeline, UInt32 numReads, int eventsFd,
+             XBEventLoop *loop)
+{
+    XBLibUSB *usb = (XBLibUSB *)calloc(1, sizeof(XBLibUSB));
+    const struct libusb_pollfd **pollFds;
+    
+    if (!usb)
+        return NULL;
+    if (libusb_init(&usb->context) != 0) {
+        free(usb);
+        return NULL;
+    }
+    
+    usb->database = database;
+    usb->pipeline = pipeline;
+    usb->numReads = numReads;
+    usb->eventsFd = eventsFd;
+    usb->loop = loop;
+    
+    // the fds libusb has now, and those it opens later
+    pollFds = libusb_get_pollfds(usb->context);
+    for (UInt32 i = 0; pollFds && pollFds[i]; i++)
+        pollFdAdded(pollFds[i]->fd, pollFds[i]->events, usb);
+    libusb_free_pollfds(pollFds);
+    libusb_set_pollfd_notifiers(usb->context, pollFdAdded, pollFdRemoved, usb);
+    
+    // the devices plugged in already come as arrivals too, from the registration
+    if (libusb_has_capability(LIBUSB_CAP_HAS_HOTPLUG))
+        usb->hasHotplug = libusb_hotplug_register_callback(usb->context,
+                                                           (libusb_hotplug_event)(LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED |
+                                                                                  LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT),
+                                                           LIBUSB_HOTPLUG_ENUMERATE, LIBUSB_HOTPLUG_MATCH_ANY,
+                                                           LIBUSB_HOTPLUG_MATCH_ANY, LIBUSB_HOTPLUG_MATCH_ANY,
+                                                           hotplug, usb, &usb->hotplug) == 0;
+    
+    if (!usb->hasHotplug) {
+        
+        libusb_device **list;
+        ssize_t count = libusb_get_device_list(usb->context, &list);
+        
+        for (ssize_t i = 0; i < count; i++)
+            openDevice(usb, list[i]);
+        if (count >= 0)
+            libusb_free_device_list(list, 1);
+    }
+    
+    openArrivals(usb);
+    return usb;
+}
+
+UInt32
+XBLibUSBDeviceCount(const XBLibUSB *usb)
+{
+    return usb->numDevices;
+}
+
+void
+XBCloseLibUSB(XBLibUSB *usb)
+{
+    if (usb->hasHotplug)
+        libusb_hotplug_deregister_callback(usb->context, usb->hotplug);
+    
+    while (usb->arrivals) {
+        
+        XBLibUSBArrival *arrival = usb->arrivals;
+        
+        usb->arrivals = arrival->next;
+        libusb_unref_device(arrival->device);
+        free(arrival);
+    }
+    
+    for (XBLibUSBDevice *usbDevice = usb->devices; usbDevice; usbDevice = usbDevice->next) {
+        XBStopLinuxDevice(&usbDevice->device);
+        XBTouchLoopDevice(usb->loop, &usbDevice->loopDevice);
+    }
+    
+    while (usb->devices)
+        XBRunEventLoop(usb->loop, 10000000);
+    
+    libusb_set_pollfd_notifiers(usb->context, NULL, NULL, NULL);
+    while (usb->pollFds) {
+        
+        XBLibUSBPollFd *pollFd = usb->pollFds;
+        
+        if (pollFd->source.fd >= 0)
+            XBRemoveEventSource(usb->loop, &pollFd->source);
+        usb->pollFds = pollFd->next;
+        free(pollFd);
+    }
+    
+    libusb_exit(usb->context);
+    free(usb);
+}
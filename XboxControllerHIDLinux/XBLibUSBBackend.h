@@ -0,0 +1,49 @@
+//
+//  XBLibUSBBackend.h
+//  XboxControllerHIDLinux
+//
+//  Real devices under the daemon, through libusb. Devices are taken as they
+//  are plugged in (hotplug, or one scan at the start where libusb has no
+//  hotplug), if XBMatchDevice() matches them; the first interrupt IN endpoint
+//  of their first interface is read with the device's ring of asynchronous
+//  transfers. Transfer statuses become the IOReturn values the kext would see
+//  for the same condition:
+//
+//      LIBUSB_TRANSFER_COMPLETED   kSimStatusSuccess
+//      LIBUSB_TRANSFER_OVERFLOW    kSimStatusOverrun
+//      LIBUSB_TRANSFER_STALL       kSimStatusPipeStalled
+//      LIBUSB_TRANSFER_ERROR       kSimStatusCRCErr, a bus error that halts the pipe
+//      LIBUSB_TRANSFER_NO_DEVICE   kSimStatusNotResponding, the check finds it gone
+//      LIBUSB_TRANSFER_TIMED_OUT   kSimStatusNotResponding
+//      LIBUSB_TRANSFER_CANCELLED   kSimStatusTransactionReturned if the halt recovery
+//                                  cancelled it, kSimStatusAborted otherwise
+//
+//  libusb's fds, the usbfs fd of each device and its own, are in the daemon's
+//  XBEventLoop: libusb handles its events when one of them is ready, and the
+//  devices whose reads completed are serviced at the end of that pass. The
+//  transfers have no timeout, and libusb keeps those of its own requests on
+//  a timerfd among its fds on Linux.
+//
+//  Only built where libusb-1.0 is found (XB_HAVE_LIBUSB).
+//
+
+#ifndef XboxControllerHIDLinux_XBLibUSBBackend_h
+#define XboxControllerHIDLinux_XBLibUSBBackend_h
+
+#include "XBDeviceDatabase.h"
+#include "XBEventLoop.h"
+#include "XBLinuxDevice.h"
+
+typedef struct XBLibUSB XBLibUSB;
+
+// Events go to a uinput device per device, or all to eventsFd if it is not
+// -1. The devices run in loop from then on. NULL if libusb can't be initialized
+XBLibUSB *XBOpenLibUSB(const XBDeviceDatabase *database, const XBLinuxPipeline *pipeline,
+                       UInt32 numReads, int eventsFd, XBEventLoop *loop);
+
+// stops every device and runs the loop until its transfers have come back
+void XBCloseLibUSB(XBLibUSB *usb);
+
+UInt32 XBLibUSBDeviceCount(const XBLibUSB *usb);
+
+#endif
@@ -0,0 +1,387 @@
+//
+//  XBLinuxDevice.cpp
+//  XboxControllerHIDLinux
+//
+//  The read ring, report pipeline and recovery of a device, see XBLinuxDevice.h.
+//
+
+#include <string.h>
+#include <time.h>
+
+#include "XBLinuxDevice.h"
+#include "XBUInput.h"
+
+// what a completion leaves the read to, as the kext's ReadDisposition
+typedef enum {
+    
+    kReadRequeue = 0,
+    kReadRecover,                           // queued again by the halt recovery
+    kReadStop
+} ReadDisposition;
+
+void
+XBInitLinuxPipeline(XBLinuxPipeline *pipeline, const XBReplayOptions *options)
+{
+    memset(pipeline, 0, sizeof(XBLinuxPipeline));
+    
+    pipeline->padTransform = XBSelectPadTransform(XBPadTransformFlags(&options->padOptions,
+                                                                      pipeline->leftTriggerTable,
+                                                                      pipeline->rightTriggerTable));
+    XBBuildRemoteButtonTable(options->buttonMap, &pipeline->remoteTable);
+    
+    pipeline->suppressDuplicates = options->padOptions.SuppressDuplicateReports;
+    pipeline->keepalive = (UInt64)options->padOptions.KeepaliveInterval * 1000000;
+    pipeline->remoteReleaseTime = options->remoteReleaseTime;
+}
+
+void
+XBInitLinuxDevice(XBLinuxDevice *device, const XBLinuxBackend *backend, void *backendData,
+                  const XBLinuxPipeline *pipeline, UInt8 type, UInt32 numReads, int outputFd)
+{
+    memset(device, 0, sizeof(XBLinuxDevice));
+    device->backend = backend;
+    device->backendData = backendData;
+    device->pipeline = pipeline;
+    device->type = type;
+    device->outputFd = outputFd;
+    device->retryCount = kLinuxRetryCount;
+    
+    device->numReads = numReads < 1 ? 1 : numReads > kMaxLinuxReads ? kMaxLinuxReads : numReads;
+    for (UInt32 i = 0; i < device->numReads; i++)
+        device->reads[i].device = device;
+}
+
+static bool
+queueRead(XBLinuxRead *read)
+{
+    XBLinuxDevice *device = read->device;
+    
+    read->queued = true;
+    if (device->backend->submitRead(device, read) != kSimStatusSuccess) {
+        read->queued = false;
+        device->stats.submitErrors++;
+        return false;
+    }
+    return true;
+}
+
+// QueueInterruptReads(): the reads that aren't in flight or being completed
+static bool
+queueReads(XBLinuxDevice *device)
+{
+    bool queued = false;
+    
+    for (UInt32 i = 0; i < device->numReads; i++)
+        if (!device->reads[i].queued)
+            queued = queueRead(&device->reads[i]) || queued;
+    
+    return queued;
+}
+
+bool
+XBStartLinuxDevice(XBLinuxDevice *device)
+{
+    return queueReads(device);
+}
+
+void
+XBStopLinuxDevice(XBLinuxDevice *device)
+{
+    device->stopping = true;
+    device->haltPending = false;
+    device->checkPending = false;
+    device->backend->abort(device);
+}
+
+// Writes the events, or holds what the output can't take yet behind what
+// it holds already. True if they were all written now
+static bool
+writeEvents(XBLinuxDevice *device, const struct input_event *events, UInt32 count)
+{
+    size_t length = count * sizeof(struct input_event);
+    ssize_t written = 0;
+    
+    if (!count)
+        return false;
+    
+    // a held write is never split, so events that don't fit are lost whole
+    if (XBFlushLinuxDeviceOutput(device)) {
+        written = XBWriteInputEvents(device->outputFd, events, length);
+        if (written < 0) {
+            device->stats.writeErrors++;
+            return false;
+        }
+    }
+    device->stats.events += count;
+    if ((size_t)written == length)
+        return true;
+    
+    if (device->outputLength + length - written > kMaxLinuxOutputBytes) {
+        device->stats.events -= count;
+        device->stats.writeErrors++;
+        return false;
+    }
+    memcpy(device->output + device->outputLength, (const UInt8 *)events + written, length - written);
+    device->outputLength += length - written;
+    device->stats.writesHeld += count;
+    return false;
+}
+
+static void
+recordLatency(XBLinuxDevice *device, UInt64 timeStamp)
+{
+    if (device->numLatencies < device->maxLatencies)
+        device->latencies[device->numLatencies++] = XBLinuxTime() - timeStamp;
+}
+
+// manipulateReport(), the duplicate suppression and handleReport()
+static void
+handleReport(XBLinuxDevice *device, UInt8 *report, UInt32 length, UInt64 timeStamp)
+{
+    const XBLinuxPipeline *pipeline = device->pipeline;
+    struct input_event events[kMaxInputEvents];
+    
+    device->stats.reports++;
+    
+    if (device->type == kLinuxDevicePad) {
+        
+        XBPadReport *pad = (XBPadReport *)report;
+        
+        if (length != sizeof(XBPadReport)) {
+            device->stats.ignored++;
+            return;
+        }
+        
+        pipeline->padTransform(pad, pipeline->leftTriggerTable, pipeline->rightTriggerTable);
+        
+        if (pipeline->suppressDuplicates && device->hasLastPad &&
+            XBIsDuplicatePadReport(report, (const UInt8 *)&device->lastPad, timeStamp, device->lastPadTime,
+                                   pipeline->keepalive)) {
+            device->stats.suppressed++;
+            return;
+        }
+        
+        if (writeEvents(device, events, XBPadInputEvents(&device->lastPad, pad, events)))
+            recordLatency(device, timeStamp);
+        device->lastPad = *pad;
+        device->lastPadTime = timeStamp;
+        device->hasLastPad = true;
+        
+    } else {
+        
+        XBRemoteReport *remote = (XBRemoteReport *)report;
+        
+        if (length != sizeof(XBActualRemoteReport)) {
+            device->stats.ignored++;
+            return;
+        }
+        
+        // every report holds the button another release time, repeats too
+        device->releaseDeadline = timeStamp + pipeline->remoteReleaseTime;
+        
+        if (!XBFilterRemoteReport((XBActualRemoteReport *)report, &pipeline->remoteTable, &device->lastScancode)) {
+            device->stats.repeats++;
+            return;
+        }
+        
+        if (writeEvents(device, events, XBRemoteInputEvents(&device->lastRemote, remote, events)))
+            recordLatency(device, timeStamp);
+        device->lastRemote = *remote;
+    }
+    
+    device->stats.delivered++;
+}
+
+// the remote's release timer: an empty report, and the held button forgotten
+static void
+releaseRemote(XBLinuxDevice *device)
+{
+    struct input_event events[kMaxInputEvents];
+    XBRemoteReport released;
+    
+    memset(&released, 0, sizeof(released));
+    writeEvents(device, events, XBRemoteInputEvents(&device->lastRemote, &released, events));
+    
+    device->lastRemote = released;
+    device->lastScancode = 0;
+    device->releaseDeadline = 0;
+    device->stats.releases++;
+}
+
+// StartClearFeatureEndpointHalt(): the halt is cleared at the controller now
+// and at the device by the next XBServiceLinuxDevice()
+static void
+startHaltRecovery(XBLinuxDevice *device)
+{
+    // set before clearStall(), which hands the other reads back
+    device->haltPending = true;
+    device->backend->clearStall(device);
+}
+
+void
+XBCompleteLinuxRead(XBLinuxRead *read, SInt32 status, UInt32 length, UInt64 timeStamp)
+{
+    XBLinuxDevice *device = read->device;
+    ReadDisposition disposition = kReadRequeue;
+    
+    if (status != kSimStatusSuccess)
+        device->stats.errors++;
+    
+    switch (status) {
+        
+        case kSimStatusOverrun:
+            // the report is there, but the endpoint is halted; the report is processed below
+            if (!device->stopping)
+                startHaltRecovery(device);
+            disposition = kReadRecover;
+            // fall through
+        case kSimStatusSuccess:
+            device->retryCount = kLinuxRetryCount;
+            
+            handleReport(device, read->buffer, length, timeStamp);
+            
+            if (device->stopping)
+                disposition = kReadStop;
+            break;
+        
+        case kSimStatusNotResponding:
+            if (device->disconnected || device->stopping)
+                disposition = kReadStop;
+            else {
+                device->checkPending = true;
+                device->backend->clearStall(device);
+            }
+            break;
+        
+        case kSimStatusAborted:
+            if (device->stopping || device->deviceIsDead)
+                disposition = kReadStop;
+            break;
+        
+        case kSimStatusUnderrun:
+        case kSimStatusPipeStalled:
+        case kSimStatusCRCErr:
+            if (!device->stopping)
+                startHaltRecovery(device);
+            disposition = kReadRecover;
+            break;
+        
+        case kSimStatusTransactionReturned:
+            disposition = kReadRecover;
+            break;
+        
+        default:
+            if (device->stopping)
+                disposition = kReadStop;
+            break;
+    }
+    
+    // ReleaseInterruptRead()
+    read->queued = false;
+    if (disposition == kReadStop)
+        return;
+    if (disposition == kReadRecover && (device->haltPending || device->stopping))
+        return;
+    queueRead(read);
+}
+
+// kIOUSBMessagePortHasBeenReset
+void
+XBLinuxDeviceWasReset(XBLinuxDevice *device)
+{
+    device->retryCount = kLinuxRetryCount;
+    device->deviceIsDead = false;
+    device->disconnected = false;
+    
+    if (!device->stopping)
+        queueReads(device);
+}
+
+void
+XBServiceLinuxDevice(XBLinuxDevice *device, UInt64 now)
+{
+    // ClearFeatureEndpointHalt(), whose reads are queued again even if it fails
+    if (device->haltPending) {
+        device->backend->clearEndpointHalt(device);
+        device->haltPending = false;
+        device->stats.halts++;
+        queueReads(device);
+    }
+    
+    // CheckForDeadDevice()
+    if (device->checkPending) {
+        
+        device->checkPending = false;
+        device->stats.checks++;
+        
+        if (!device->backend->isConnected(device))
+            device->disconnected = true;
+        else if (--device->retryCount == 0) {
+            device->deviceIsDead = true;
+            device->stats.resets++;
+            device->backend->abort(device);
+            device->backend->resetDevice(device);
+        }
+    }
+    
+    if (device->releaseDeadline && now >= device->releaseDeadline)
+        releaseRemote(device);
+}
+
+UInt64
+XBLinuxDeviceDeadline(const XBLinuxDevice *device)
+{
+    if (device->haltPending || device->checkPending)
+        return kLinuxServiceNow;
+    return device->releaseDeadline;
+}
+
+bool
+XBFlushLinuxDeviceOutput(XBLinuxDevice *device)
+{
+    ssize_t written;
+    
+    if (!device->outputLength)
+        return true;
+    
+    written = XBWriteInputEvents(device->outputFd, device->output, device->outputLength);
+    if (written < 0) {
+        device->stats.writeErrors++;
+        device->outputLength = 0;
+        return true;
+    }
+    
+    memmove(device->output, device->output + written, device->outputLength - written);
+    device->outputLength -= written;
+    return !device->outputLength;
+}
+
+bool
+XBLinuxDeviceOutputPending(const XBLinuxDevice *device)
+{
+    return device->outputLength != 0;
+}
+
+UInt64
+XBLinuxTime(void)
+{
+    struct timespec now;
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (UInt64)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+bool
+XBLinuxDeviceIdle(const XBLinuxDevice *device)
+{
+    for (UInt32 i = 0; i < device->numReads; i++)
+        if (device->reads[i].queued)
+            return false;
+    return true;
+}
+
+bool
+XBLinuxDeviceGone(const XBLinuxDevice *device)
+{
+    return (device->disconnected || device->stopping) && XBLinuxDeviceIdle(device);
+}
@@ -0,0 +1,169 @@
+//
+//  XBLinuxDevice.h
+//  XboxControllerHIDLinux
+//
+//  One pad or IR receiver under the daemon, run the way the kext runs it: a
+//  ring of interrupt reads kept in flight, each completion taken through the
+//  driver's report pipeline to uinput, and the same recovery for the same
+//  statuses (InterruptReadHandler()). A halted pipe is cleared at both ends
+//  before the reads go back on it, a device that stops responding is checked
+//  for and reset after kLinuxRetryCount tries, and a remote button is let go
+//  once no report has come for the release time.
+//
+//  The hardware is behind XBLinuxBackend: libusb on a real system, the
+//  simulator in tests. Statuses are the IOReturn values of XBSimulator.h,
+//  which the libusb backend maps its transfer statuses onto. Nothing here
+//  blocks: a completion only marks the work to do, and XBServiceLinuxDevice()
+//  does it from the daemon's loop, as the kext does it on its thread calls.
+//
+
+#ifndef XboxControllerHIDLinux_XBLinuxDevice_h
+#define XboxControllerHIDLinux_XBLinuxDevice_h
+
+#include <linux/input.h>
+
+#include "XBDeviceDatabase.h"
+#include "XBReplay.h"
+#include "XBSimulator.h"
+
+#define kMaxLinuxReads          16
+#define kMaxLinuxReportBytes    64          // the largest interrupt packet read
+#define kLinuxRetryCount        3           // kHIDDriverRetryCount
+#define kLinuxServiceNow        1           // XBLinuxDeviceDeadline() of recovery waiting to run
+#define kMaxLinuxOutputBytes    (64 * sizeof(struct input_event))   // held while the output can't take them
+
+typedef struct XBLinuxDevice XBLinuxDevice;
+
+typedef struct {
+    
+    XBLinuxDevice * device;
+    bool            queued;                 // on the pipe, or its completion still running
+    void *          transfer;               // the backend's
+    UInt8           buffer[kMaxLinuxReportBytes];
+    
+} XBLinuxRead;
+
+// What the device asks of the hardware. Reads complete through
+// XBCompleteLinuxRead(), a reset through XBLinuxDeviceWasReset()
+typedef struct {
+    
+    SInt32  (*submitRead)(XBLinuxDevice *device, XBLinuxRead *read);
+    void    (*clearStall)(XBLinuxDevice *device);           // ClearStall(), hands the other reads back
+    SInt32  (*clearEndpointHalt)(XBLinuxDevice *device);    // CLEAR_FEATURE(ENDPOINT_HALT)
+    bool    (*isConnected)(XBLinuxDevice *device);
+    void    (*resetDevice)(XBLinuxDevice *device);
+    void    (*abort)(XBLinuxDevice *device);                // hands back every read in flight
+    
+} XBLinuxBackend;
+
+// the report pipeline, shared by the devices of a daemon
+typedef struct {
+    
+    XBPadTransform          padTransform;
+    UInt8                   leftTriggerTable[256];
+    UInt8                   rightTriggerTable[256];
+    XBRemoteButtonTable     remoteTable;
+    bool                    suppressDuplicates;
+    UInt64                  keepalive;      // ns, 0 = never resend
+    UInt64                  remoteReleaseTime;
+    
+} XBLinuxPipeline;
+
+typedef struct {
+    
+    UInt64      reports;                    // completed with a report
+    UInt64      delivered;
+    UInt64      suppressed;                 // duplicates
+    UInt64      repeats;                    // remote repeats of the held button
+    UInt64      releases;                   // remote buttons let go by the release time
+    UInt64      ignored;                    // reports of the wrong size for the device
+    UInt64      errors;                     // completed with an error
+    UInt64      halts;                      // halt recoveries run
+    UInt64      checks;                     // dead-device checks run
+    UInt64      resets;
+    UInt64      events;                     // written to uinput
+    UInt64      writeErrors;
+    UInt64      writesHeld;                 // events the output couldn't take right away
+    UInt64      submitErrors;
+    
+} XBLinuxDeviceStats;
+
+struct XBLinuxDevice {
+    
+    const XBLinuxBackend *  backend;
+    void *                  backendData;
+    const XBLinuxPipeline * pipeline;
+    UInt8                   type;           // XBLinuxDeviceType
+    int                     outputFd;       // uinput, or any file the events go to
+    
+    UInt32                  numReads;
+    XBLinuxRead             reads[kMaxLinuxReads];
+    
+    // recovery, as the kext's flags of the same names
+    bool                    haltPending;
+    bool                    checkPending;
+    UInt32                  retryCount;
+    bool                    deviceIsDead;   // reset asked for
+    bool                    disconnected;
+    bool                    stopping;
+    
+    // the state the uinput device was left in
+    XBPadReport             lastPad;
+    UInt64                  lastPadTime;
+    bool                    hasLastPad;
+    XBRemoteReport          lastRemote;
+    UInt8                   lastScancode;
+    UInt64                  releaseDeadline;    // 0 if no remote button is held
+    
+    // events a non-blocking output didn't take, written before any newer ones
+    UInt8                   output[kMaxLinuxOutputBytes];
+    UInt32                  outputLength;
+    
+    // for benchmarks: ns from the time stamp of each delivered report to its
+    // events written, kept while there is room, if latencies is set
+    UInt64 *                latencies;
+    UInt32                  maxLatencies;
+    UInt32                  numLatencies;
+    
+    XBLinuxDeviceStats      stats;
+    
+};
+
+void XBInitLinuxPipeline(XBLinuxPipeline *pipeline, const XBReplayOptions *options);
+
+// numReads is clamped to 1 ... kMaxLinuxReads
+void XBInitLinuxDevice(XBLinuxDevice *device, const XBLinuxBackend *backend, void *backendData,
+                       const XBLinuxPipeline *pipeline, UInt8 type, UInt32 numReads, int outputFd);
+
+// puts every idle read on the pipe, false if none could be
+bool XBStartLinuxDevice(XBLinuxDevice *device);
+
+// Stops the device for good: the reads in flight are aborted and not queued
+// again. It can be freed once XBLinuxDeviceIdle()
+void XBStopLinuxDevice(XBLinuxDevice *device);
+
+// from the backend, when a read is done; length is of the report read
+void XBCompleteLinuxRead(XBLinuxRead *read, SInt32 status, UInt32 length, UInt64 timeStamp);
+void XBLinuxDeviceWasReset(XBLinuxDevice *device);
+
+// Runs the recovery the completions asked for and the release timer, due by now
+void XBServiceLinuxDevice(XBLinuxDevice *device, UInt64 now);
+
+// when XBServiceLinuxDevice() next has something to do, 0 if nothing
+UInt64 XBLinuxDeviceDeadline(const XBLinuxDevice *device);
+
+// Writes the events held for the output, true once there are none left.
+// The loop calls it when the output can take more
+bool XBFlushLinuxDeviceOutput(XBLinuxDevice *device);
+bool XBLinuxDeviceOutputPending(const XBLinuxDevice *device);
+
+// CLOCK_MONOTONIC in ns, the time stamps of real devices
+UInt64 XBLinuxTime(void);
+
+// no read in flight
+bool XBLinuxDeviceIdle(const XBLinuxDevice *device);
+
+// unplugged or stopped, with all its reads back: nothing more will happen
+bool XBLinuxDeviceGone(const XBLinuxDevice *device);
+
+#endif
@@ -0,0 +1,339 @@
+//
+//  XBPlist.cpp
+//  XboxControllerHIDLinux
+//
+//  The property list reader, see XBPlist.h.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "XBPlist.h"
+
+#define kMaxPlistDepth      32
+
+typedef struct {
+    
+    const char *    text;
+    const char *    end;
+    
+} Parser;
+
+static void
+skipSpace(Parser *parser)
+{
+    for (;;) {
+        
+        while (parser->text < parser->end && strchr(" \t\r\n", *parser->text))
+            parser->text++;
+        
+        // the prolog, the doctype and comments
+        if (!strncmp(parser->text, "<?", 2) || !strncmp(parser->text, "<!", 2)) {
+            
+            const char *close = !strncmp(parser->text, "<!--", 4) ? strstr(parser->text, "-->") : strchr(parser->text, '>');
+            
+            if (!close) {
+                parser->text = parser->end;
+                return;
+            }
+            parser->text = close + (close[0] == '-' ? 3 : 1);
+            continue;
+        }
+        return;
+    }
+}
+
+// reads <name> or <name/>, false if the next tag is something else
+static bool
+openTag(Parser *parser, const char *name, bool *empty)
+{
+    size_t length = strlen(name);
+    
+    skipSpace(parser);
+    if (parser->text[0] != '<' || strncmp(parser->text + 1, name, length))
+        return false;
+    
+    if (parser->text[1 + length] == '>') {
+        *empty = false;
+        parser->text += length + 2;
+        return true;
+    }
+    if (!strncmp(parser->text + 1 + length, "/>", 2)) {
+        *empty = true;
+        parser->text += length + 3;
+        return true;
+    }
+    return false;
+}
+
+static bool
+closeTag(Parser *parser, const char *name)
+{
+    size_t length = strlen(name);
+    
+    skipSpace(parser);
+    if (strncmp(parser->text, "</", 2) || strncmp(parser->text + 2, name, length) || parser->text[2 + length] != '>')
+        return false;
+    
+    parser->text += length + 3;
+    return true;
+}
+
+// the text up to the closing tag, with the entities replaced
+static char *
+readText(Parser *parser, const char *name)
+{
+    const char *close = strstr(parser->text, "</");
+    char *text, *out;
+    
+    if (!close)
+        return NULL;
+    
+    text = out = (char *)malloc(close - parser->text + 1);
+    if (!text)
+        return NULL;
+    
+    while (parser->text < close) {
+        
+        static const struct { const char *entity; char c; } entities[] = {
+            { "&amp;", '&' }, { "&lt;", '<' }, { "&gt;", '>' }, { "&quot;", '"' }, { "&apos;", '\'' }
+        };
+        bool replaced = false;
+        
+        for (UInt32 i = 0; i < sizeof(entities) / sizeof(entities[0]) && *parser->text == '&'; i++)
+            if (!strncmp(parser->text, entities[i].entity, strlen(entities[i].entity))) {
+                *out++ = entities[i].c;
+                parser->text += strlen(entities[i].entity);
+                replaced = true;
+                break;
+            }
+        
+        if (!replaced)
+            *out++ = *parser->text++;
+    }
+    *out = '\0';
+    
+    if (!closeTag(parser, name)) {
+        free(text);
+        return NULL;
+    }
+    return text;
+}
+
+static int
+base64Value(char c)
+{
+    if (c >= 'A' && c <= 'Z')   return c - 'A';
+    if (c >= 'a' && c <= 'z')   return c - 'a' + 26;
+    if (c >= '0' && c <= '9')   return c - '0' + 52;
+    if (c == '+')               return 62;
+    if (c == '/')               return 63;
+    return -1;
+}
+
+static bool
+decodeBase64(XBPlistNode *node, const char *text)
+{
+    size_t length = strlen(text);
+    UInt32 bits = 0, count = 0;
+    
+    node->data = (UInt8 *)malloc(length * 3 / 4 + 1);
+    if (!node->data)
+        return false;
+    
+    for (const char *c = text; *c && *c != '='; c++) {
+        
+        int value = base64Value(*c);
+        
+        if (value < 0)
+            continue;   // line breaks and indentation
+        bits = bits << 6 | value;
+        if (++count == 4) {
+            node->data[node->length++] = bits >> 16;
+            node->data[node->length++] = bits >> 8;
+            node->data[node->length++] = bits;
+            bits = count = 0;
+        }
+    }
+    
+    if (count == 3) {
+        node->data[node->length++] = bits >> 10;
+        node->data[node->length++] = bits >> 2;
+    } else if (count == 2)
+        node->data[node->length++] = bits >> 4;
+    
+    return true;
+}
+
+static XBPlistNode *parseValue(Parser *parser, UInt32 depth);
+
+// the children of an array, or the key and value pairs of a dictionary
+static bool
+parseChildren(Parser *parser, XBPlistNode *node, const char *name, UInt32 depth)
+{
+    XBPlistNode **tail = &node->children;
+    bool empty;
+    
+    for (;;) {
+        
+        XBPlistNode *child;
+        char *key = NULL;
+        
+        if (closeTag(parser, name))
+            return true;
+        
+        if (node->type == kPlistDictionary) {
+            if (!openTag(parser, "key", &empty))
+                return false;
+            key = empty ? strdup("") : readText(parser, "key");
+            if (!key)
+                return false;
+        }
+        
+        child = parseValue(parser, depth + 1);
+        if (!child) {
+            free(key);
+            return false;
+        }
+        child->key = key;
+        
+        *tail = child;
+        tail = &child->next;
+    }
+}
+
+static XBPlistNode *
+parseValue(Parser *parser, UInt32 depth)
+{
+    XBPlistNode *node;
+    bool empty, parsed = false;
+    char *text;
+    
+    if (depth > kMaxPlistDepth)
+        return NULL;
+    
+    node = (XBPlistNode *)calloc(1, sizeof(XBPlistNode));
+    if (!node)
+        return NULL;
+    
+    if (openTag(parser, "dict", &empty)) {
+        node->type = kPlistDictionary;
+        parsed = empty || parseChildren(parser, node, "dict", depth);
+    }
+    else if (openTag(parser, "array", &empty)) {
+        node->type = kPlistArray;
+        parsed = empty || parseChildren(parser, node, "array", depth);
+    }
+    else if (openTag(parser, "string", &empty)) {
+        node->type = kPlistString;
+        node->string = empty ? strdup("") : readText(parser, "string");
+        parsed = node->string != NULL;
+    }
+    else if (openTag(parser, "integer", &empty) && !empty) {
+        node->type = kPlistInteger;
+        text = readText(parser, "integer");
+        if (text) {
+            node->integer = strtoull(text, NULL, 0);
+            parsed = true;
+            free(text);
+        }
+    }
+    else if (openTag(parser, "data", &empty)) {
+        node->type = kPlistData;
+        text = empty ? strdup("") : readText(parser, "data");
+        if (text) {
+            parsed = decodeBase64(node, text);
+            free(text);
+        }
+    }
+    else if (openTag(parser, "true", &empty) && empty) {
+        node->type = kPlistBoolean;
+        node->integer = 1;
+        parsed = true;
+    }
+    else if (openTag(parser, "false", &empty) && empty) {
+        node->type = kPlistBoolean;
+        parsed = true;
+    }
+    
+    if (!parsed) {
+        XBFreePlist(node);
+        return NULL;
+    }
+    return node;
+}
+
+XBPlistNode *
+XBParsePlist(const char *text)
+{
+    Parser parser = { text, text + strlen(text) };
+    XBPlistNode *root;
+    bool wrapped, empty;
+    
+    wrapped = openTag(&parser, "plist version=\"1.0\"", &empty) || openTag(&parser, "plist", &empty);
+    root = parseValue(&parser, 0);
+    if (root && wrapped && !closeTag(&parser, "plist")) {
+        XBFreePlist(root);
+        return NULL;
+    }
+    return root;
+}
+
+XBPlistNode *
+XBReadPlist(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    XBPlistNode *root;
+    char *text;
+    long length;
+    
+    if (!file)
+        return NULL;
+    
+    fseek(file, 0, SEEK_END);
+    length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    
+    text = length >= 0 ? (char *)malloc(length + 1) : NULL;
+    if (!text || fread(text, 1, length, file) != (size_t)length) {
+        free(text);
+        fclose(file);
+        return NULL;
+    }
+    text[length] = '\0';
+    fclose(file);
+    
+    root = XBParsePlist(text);
+    free(text);
+    return root;
+}
+
+void
+XBFreePlist(XBPlistNode *node)
+{
+    while (node) {
+        
+        XBPlistNode *next = node->next;
+        
+        XBFreePlist(node->children);
+        free(node->key);
+        free(node->string);
+        free(node->data);
+        free(node);
+        node = next;
+    }
+}
+
+const XBPlistNode *
+XBPlistGet(const XBPlistNode *dictionary, const char *key, XBPlistType type)
+{
+    if (!dictionary || dictionary->type != kPlistDictionary)
+        return NULL;
+    
+    for (const XBPlistNode *child = dictionary->children; child; child = child->next)
+        if (!strcmp(child->key, key))
+            return !type || child->type == type ? child : NULL;
+    
+    return NULL;
+}
@@ -0,0 +1,48 @@
+//
+//  XBPlist.h
+//  XboxControllerHIDLinux
+//
+//  Just enough of an XML property list reader for the driver's Info.plist:
+//  dictionaries, arrays, strings, integers, data and booleans, read into a
+//  tree that is freed in one go.
+//
+
+#ifndef XboxControllerHIDLinux_XBPlist_h
+#define XboxControllerHIDLinux_XBPlist_h
+
+#include "XboxControllerHIDCore.h"
+
+typedef enum {
+    
+    kPlistString = 1,
+    kPlistInteger,
+    kPlistData,
+    kPlistBoolean,
+    kPlistArray,
+    kPlistDictionary
+} XBPlistType;
+
+typedef struct XBPlistNode XBPlistNode;
+
+struct XBPlistNode {
+    
+    UInt8           type;               // XBPlistType
+    char *          key;                // in a dictionary, NULL otherwise
+    char *          string;             // kPlistString
+    UInt64          integer;            // kPlistInteger, kPlistBoolean
+    UInt8 *         data;               // kPlistData
+    UInt32          length;             // of data
+    XBPlistNode *   children;           // of an array or dictionary, in order
+    XBPlistNode *   next;
+    
+};
+
+// The plist at path, NULL if it can't be read or parsed
+XBPlistNode *XBReadPlist(const char *path);
+XBPlistNode *XBParsePlist(const char *text);
+void XBFreePlist(XBPlistNode *node);
+
+// the value of key in a dictionary, if it has the type asked for (0 for any)
+const XBPlistNode *XBPlistGet(const XBPlistNode *dictionary, const char *key, XBPlistType type);
+
+#endif
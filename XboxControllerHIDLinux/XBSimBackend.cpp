@@ -0,0 +1,209 @@
+//
+//  XBSimBackend.cpp
+//  XboxControllerHIDLinux
+//
+//  The simulator behind XBLinuxBackend, see XBSimBackend.h.
+//
+
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "XBSimBackend.h"
+
+static XBSimPipe *
+pipeOf(XBLinuxDevice *device)
+{
+    return &((XBSimLinuxDevice *)device->backendData)->pipe;
+}
+
+static void
+readComplete(void *target, void *parameter, SInt32 status, UInt32 bufferSizeRemaining, UInt64 timeStamp)
+{
+    (void)target;
+    XBCompleteLinuxRead((XBLinuxRead *)parameter, status, kMaxLinuxReportBytes - bufferSizeRemaining, timeStamp);
+}
+
+static SInt32
+submitRead(XBLinuxDevice *device, XBLinuxRead *read)
+{
+    XBSimCompletion completion = { device, readComplete, read };
+    
+    return XBSimRead(pipeOf(device), read->buffer, kMaxLinuxReportBytes, &completion);
+}
+
+static void
+clearStall(XBLinuxDevice *device)
+{
+    XBSimClearStall(pipeOf(device));
+}
+
+static SInt32
+clearEndpointHalt(XBLinuxDevice *device)
+{
+    return XBSimClearEndpointHalt(pipeOf(device));
+}
+
+static bool
+isConnected(XBLinuxDevice *device)
+{
+    return XBSimDeviceConnected(pipeOf(device));
+}
+
+static void
+resetDevice(XBLinuxDevice *device)
+{
+    XBSimResetDevice(pipeOf(device));
+}
+
+static void
+abortReads(XBLinuxDevice *device)
+{
+    XBSimAbort(pipeOf(device));
+}
+
+static void
+wasReset(void *target)
+{
+    XBLinuxDeviceWasReset((XBLinuxDevice *)target);
+}
+
+static const XBLinuxBackend gSimBackend = {
+    submitRead, clearStall, clearEndpointHalt, isConnected, resetDevice, abortReads
+};
+
+void
+XBInitSimLinuxDevice(XBSimLinuxDevice *sim, const XBSimDevice *simDevice, UInt64 start,
+                     const XBLinuxPipeline *pipeline, UInt32 numReads, int outputFd)
+{
+    UInt8 type = simDevice->type == kSimDeviceRemote ? kLinuxDeviceRemote : kLinuxDevicePad;
+    
+    XBInitSimPipe(&sim->pipe, simDevice, start);
+    XBInitLinuxDevice(&sim->device, &gSimBackend, sim, pipeline, type, numReads, outputFd);
+    XBSimSetResetHandler(&sim->pipe, wasReset, &sim->device);
+}
+
+void
+XBFreeSimLinuxDevice(XBSimLinuxDevice *sim)
+{
+    XBFreeSimPipe(&sim->pipe);
+}
+
+// the next time a device has something to do, never before its pipe's now
+static UInt64
+nextEvent(XBSimLinuxDevice *sim)
+{
+    UInt64 next = XBSimNextEvent(&sim->pipe);
+    UInt64 deadline = XBLinuxDeviceDeadline(&sim->device);
+    
+    if (deadline == kLinuxServiceNow)
+        return sim->pipe.now;
+    return deadline && deadline < next ? deadline : next;
+}
+
+UInt64
+XBRunSimLinuxDevices(XBSimLinuxDevice **devices, UInt32 count, UInt64 time)
+{
+    for (;;) {
+        
+        UInt64 next = ~0ULL;
+        
+        for (UInt32 i = 0; i < count; i++) {
+            
+            UInt64 event = nextEvent(devices[i]);
+            
+            if (event < next)
+                next = event;
+        }
+        
+        if (next > time) {
+            for (UInt32 i = 0; i < count; i++)
+                XBSimRun(&devices[i]->pipe, time);
+            return next;
+        }
+        
+        for (UInt32 i = 0; i < count; i++) {
+            if (nextEvent(devices[i]) > next)
+                continue;
+            XBSimRun(&devices[i]->pipe, next);
+            XBServiceLinuxDevice(&devices[i]->device, next);
+        }
+    }
+}
+
+// the pipe's polls are due: they complete, and the loop services the device
+static void
+pipeTimerFired(void *target, UInt32 events)
+{
+    XBSimLoopDevice *device = (XBSimLoopDevice *)target;
+    XBSimPipe *pipe = &device->sim.pipe;
+    UInt64 expirations, now;
+    (void)events;
+    
+    if (read(device->pipeTimer.fd, &expirations, sizeof(expirations)) != sizeof(expirations))
+        return;
+    device->pipeArmed = 0;
+    
+    now = XBLinuxTime();
+    XBSimRun(pipe, now > pipe->now ? now : pipe->now);
+    XBTouchLoopDevice(device->loop, &device->loopDevice);
+}
+
+// after every service, which may have handed reads back or reset the device
+static void
+armPipeTimer(XBLoopDevice *loopDevice)
+{
+    XBSimLoopDevice *device = (XBSimLoopDevice *)loopDevice->device->backendData;
+    UInt64 next = XBSimNextEvent(&device->sim.pipe);
+    struct itimerspec spec;
+    
+    if (next == device->pipeArmed)
+        return;
+    
+    memset(&spec, 0, sizeof(spec));
+    spec.it_value.tv_sec = next / 1000000000;
+    spec.it_value.tv_nsec = next % 1000000000;
+    if (timerfd_settime(device->pipeTimer.fd, TFD_TIMER_ABSTIME, &spec, NULL) == 0)
+        device->pipeArmed = next;
+}
+
+bool
+XBAddSimLoopDevice(XBEventLoop *loop, XBSimLoopDevice *device, void (*gone)(XBLoopDevice *loopDevice))
+{
+    device->loop = loop;
+    device->pipeArmed = 0;
+    device->pipeTimer.handler = pipeTimerFired;
+    device->pipeTimer.target = device;
+    device->pipeTimer.fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (device->pipeTimer.fd < 0)
+        return false;
+    
+    if (!XBAddLoopDevice(loop, &device->loopDevice, &device->sim.device, gone)) {
+        close(device->pipeTimer.fd);
+        return false;
+    }
+    device->loopDevice.serviced = armPipeTimer;
+    
+    if (!XBAddEventSource(loop, &device->pipeTimer, EPOLLIN)) {
+        XBRemoveLoopDevice(loop, &device->loopDevice);
+        close(device->pipeTimer.fd);
+        return false;
+    }
+    
+    XBStartLinuxDevice(&device->sim.device);
+    armPipeTimer(&device->loopDevice);
+    return true;
+}
+
+void
+XBRemoveSimLoopDevice(XBSimLoopDevice *device)
+{
+    XBRemoveLoopDevice(device->loop, &device->loopDevice);
+    
+    if (device->pipeTimer.fd >= 0) {
+        XBRemoveEventSource(device->loop, &device->pipeTimer);
+        close(device->pipeTimer.fd);
+        device->pipeTimer.fd = -1;
+    }
+}
@@ -0,0 +1,53 @@
+//
+//  XBSimBackend.h
+//  XboxControllerHIDLinux
+//
+//  Simulated pads and remotes under the daemon: an XBSimulator pipe behind
+//  each device's XBLinuxBackend. Time is the simulator's, so tests run the
+//  devices in virtual time; the daemon's --simulate-* options run them up to
+//  the monotonic clock instead, as stand-ins for real hardware, each in the
+//  daemon's event loop through an XBSimLoopDevice.
+//
+
+#ifndef XboxControllerHIDLinux_XBSimBackend_h
+#define XboxControllerHIDLinux_XBSimBackend_h
+
+#include "XBEventLoop.h"
+#include "XBLinuxDevice.h"
+#include "XBSimulator.h"
+
+typedef struct {
+    
+    XBSimPipe       pipe;
+    XBLinuxDevice   device;
+    
+} XBSimLinuxDevice;
+
+// the pipe starts at start; the device is not started yet
+void XBInitSimLinuxDevice(XBSimLinuxDevice *sim, const XBSimDevice *simDevice, UInt64 start,
+                          const XBLinuxPipeline *pipeline, UInt32 numReads, int outputFd);
+void XBFreeSimLinuxDevice(XBSimLinuxDevice *sim);
+
+// Runs the devices up to time: their polls and completions, and the service
+// the completions ask for, in time order. Returns when there is more to do
+UInt64 XBRunSimLinuxDevices(XBSimLinuxDevice **devices, UInt32 count, UInt64 time);
+
+// A simulated device in an XBEventLoop. Its pipe is run up to the monotonic
+// clock by a timerfd set for the pipe's next poll, where a real device's
+// completions would come in on its usbfs fd
+typedef struct {
+    
+    XBSimLinuxDevice    sim;                // first: the device's backendData
+    XBEventLoop *       loop;
+    XBLoopDevice        loopDevice;
+    XBEventSource       pipeTimer;
+    UInt64              pipeArmed;          // the pipe's next event the timer is set for
+    
+} XBSimLoopDevice;
+
+// Adds and starts a device made with XBInitSimLinuxDevice(), started at
+// XBLinuxTime() or later. gone is XBAddLoopDevice()'s
+bool XBAddSimLoopDevice(XBEventLoop *loop, XBSimLoopDevice *device, void (*gone)(XBLoopDevice *loopDevice));
+void XBRemoveSimLoopDevice(XBSimLoopDevice *device);
+
+#endif
@@ -0,0 +1,218 @@
+//
+//  XBUInput.cpp
+//  XboxControllerHIDLinux
+//
+//  The evdev side of the daemon, see XBUInput.h.
+//
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/uinput.h>
+
+#include "XBDeviceDatabase.h"
+#include "XBUInput.h"
+
+// the digital buttons byte, bit 0 first
+static const UInt16 gPadDigitalKeys[8] = {
+    BTN_DPAD_UP, BTN_DPAD_DOWN, BTN_DPAD_LEFT, BTN_DPAD_RIGHT, BTN_START, BTN_SELECT, BTN_THUMBL, BTN_THUMBR
+};
+
+// a, b, x, y, black, white
+static const UInt16 gPadAnalogKeys[6] = {
+    BTN_A, BTN_B, BTN_X, BTN_Y, BTN_C, BTN_Z
+};
+
+// per XBoxRemoteKey
+static const UInt16 gRemoteKeys[kNumRemoteButtons] = {
+    KEY_SCREEN, KEY_REWIND, KEY_PLAY, KEY_FASTFORWARD, KEY_PREVIOUS, KEY_STOP, KEY_PAUSE, KEY_NEXT, KEY_TITLE,
+    KEY_UP, KEY_INFO, KEY_LEFT, KEY_OK, KEY_RIGHT, KEY_MENU, KEY_DOWN, KEY_BACK,
+    KEY_NUMERIC_1, KEY_NUMERIC_2, KEY_NUMERIC_3, KEY_NUMERIC_4, KEY_NUMERIC_5, KEY_NUMERIC_6, KEY_NUMERIC_7,
+    KEY_NUMERIC_8, KEY_NUMERIC_9, KEY_NUMERIC_0
+};
+
+static void
+addEvent(struct input_event *events, UInt32 *count, UInt16 type, UInt16 code, SInt32 value)
+{
+    struct input_event *event = &events[(*count)++];
+    
+    // the kernel stamps events written to uinput
+    memset(event, 0, sizeof(struct input_event));
+    event->type = type;
+    event->code = code;
+    event->value = value;
+}
+
+static UInt32
+finishEvents(struct input_event *events, UInt32 count)
+{
+    if (count)
+        addEvent(events, &count, EV_SYN, SYN_REPORT, 0);
+    return count;
+}
+
+static SInt16
+axis(UInt8 lo, UInt8 hi)
+{
+    return (SInt16)(lo | hi << 8);
+}
+
+UInt32
+XBPadInputEvents(const XBPadReport *last, const XBPadReport *report, struct input_event *events)
+{
+    const UInt8 *lastAnalog = &last->a, *analog = &report->a;
+    UInt32 count = 0;
+    
+    for (UInt32 i = 0; i < 8; i++)
+        if ((last->buttons ^ report->buttons) & 1 << i)
+            addEvent(events, &count, EV_KEY, gPadDigitalKeys[i], report->buttons >> i & 1);
+    
+    for (UInt32 i = 0; i < 6; i++)
+        if (!lastAnalog[i] != !analog[i])
+            addEvent(events, &count, EV_KEY, gPadAnalogKeys[i], analog[i] != 0);
+    
+    if (last->lt != report->lt)
+        addEvent(events, &count, EV_ABS, ABS_Z, report->lt);
+    if (last->rt != report->rt)
+        addEvent(events, &count, EV_ABS, ABS_RZ, report->rt);
+
+#define AXIS(code, field) \
+    if (last->field ## lo != report->field ## lo || last->field ## hi != report->field ## hi) \
+        addEvent(events, &count, EV_ABS, code, axis(report->field ## lo, report->field ## hi));
+    
+    AXIS(ABS_X, lx)
+    AXIS(ABS_Y, ly)
+    AXIS(ABS_RX, rx)
+    AXIS(ABS_RY, ry)
+
+#undef AXIS
+    
+    return finishEvents(events, count);
+}
+
+UInt32
+XBRemoteInputEvents(const XBRemoteReport *last, const XBRemoteReport *report, struct input_event *events)
+{
+    UInt32 count = 0;
+
+#define KEY(field, index) \
+    if (last->field != report->field) \
+        addEvent(events, &count, EV_KEY, gRemoteKeys[index], report->field);
+    
+    KEY(display, kRemoteDisplay)
+    KEY(reverse, kRemoteReverse)
+    KEY(play, kRemotePlay)
+    KEY(forward, kRemoteForward)
+    KEY(skipBackward, kRemoteSkipBackward)
+    KEY(stop, kRemoteStop)
+    KEY(pause, kRemotePause)
+    KEY(skipForward, kRemoteSkipForward)
+    KEY(title, kRemoteTitle)
+    KEY(up, kRemoteUp)
+    KEY(info, kRemoteInfo)
+    KEY(left, kRemoteLeft)
+    KEY(select, kRemoteSelect)
+    KEY(right, kRemoteRight)
+    KEY(menu, kRemoteMenu)
+    KEY(down, kRemoteDown)
+    KEY(back, kRemoteBack)
+    KEY(kp1, kRemoteKP1)
+    KEY(kp2, kRemoteKP2)
+    KEY(kp3, kRemoteKP3)
+    KEY(kp4, kRemoteKP4)
+    KEY(kp5, kRemoteKP5)
+    KEY(kp6, kRemoteKP6)
+    KEY(kp7, kRemoteKP7)
+    KEY(kp8, kRemoteKP8)
+    KEY(kp9, kRemoteKP9)
+    KEY(kp0, kRemoteKP0)
+
+#undef KEY
+    
+    return finishEvents(events, count);
+}
+
+static bool
+setupAxis(int fd, UInt16 code, SInt32 minimum, SInt32 maximum)
+{
+    struct uinput_abs_setup setup;
+    
+    memset(&setup, 0, sizeof(setup));
+    setup.code = code;
+    setup.absinfo.minimum = minimum;
+    setup.absinfo.maximum = maximum;
+    
+    return ioctl(fd, UI_SET_ABSBIT, code) == 0 && ioctl(fd, UI_ABS_SETUP, &setup) == 0;
+}
+
+static bool
+setupKeys(int fd, const UInt16 *keys, UInt32 count)
+{
+    for (UInt32 i = 0; i < count; i++)
+        if (ioctl(fd, UI_SET_KEYBIT, keys[i]) != 0)
+            return false;
+    return true;
+}
+
+int
+XBCreateInputDevice(UInt8 type, const char *name, UInt16 vendorID, UInt16 productID)
+{
+    struct uinput_setup setup;
+    bool ready;
+    int fd, error;
+    
+    fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0)
+        return -1;
+    
+    ready = ioctl(fd, UI_SET_EVBIT, EV_KEY) == 0;
+    
+    if (type == kLinuxDevicePad) {
+        ready = ready && ioctl(fd, UI_SET_EVBIT, EV_ABS) == 0 &&
+                setupKeys(fd, gPadDigitalKeys, 8) && setupKeys(fd, gPadAnalogKeys, 6) &&
+                setupAxis(fd, ABS_X, -32768, 32767) && setupAxis(fd, ABS_Y, -32768, 32767) &&
+                setupAxis(fd, ABS_RX, -32768, 32767) && setupAxis(fd, ABS_RY, -32768, 32767) &&
+                setupAxis(fd, ABS_Z, 0, 255) && setupAxis(fd, ABS_RZ, 0, 255);
+    } else
+        ready = ready && setupKeys(fd, gRemoteKeys, kNumRemoteButtons);
+    
+    if (ready) {
+        memset(&setup, 0, sizeof(setup));
+        setup.id.bustype = BUS_USB;
+        setup.id.vendor = vendorID;
+        setup.id.product = productID;
+        strncpy(setup.name, name, UINPUT_MAX_NAME_SIZE - 1);
+        ready = ioctl(fd, UI_DEV_SETUP, &setup) == 0 && ioctl(fd, UI_DEV_CREATE) == 0;
+    }
+    
+    if (!ready) {
+        error = errno;
+        close(fd);
+        errno = error;
+        return -1;
+    }
+    return fd;
+}
+
+void
+XBDestroyInputDevice(int fd)
+{
+    ioctl(fd, UI_DEV_DESTROY);
+    close(fd);
+}
+
+ssize_t
+XBWriteInputEvents(int fd, const void *events, size_t length)
+{
+    ssize_t written;
+    
+    do
+        written = write(fd, events, length);
+    while (written < 0 && errno == EINTR);
+    
+    if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return 0;
+    return written;
+}
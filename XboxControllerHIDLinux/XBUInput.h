@@ -0,0 +1,37 @@
+//
+//  XBUInput.h
+//  XboxControllerHIDLinux
+//
+//  The reports as evdev events, through a uinput device per pad or remote.
+//  The buttons and axes are those of the driver's HID descriptors: the pad's
+//  six analog buttons (logical 0-1 once clamped) and its eight digital ones,
+//  the triggers as Z and Rz (0-255), the sticks as X, Y, Rx and Ry (signed 16
+//  bit); the remote's 27 buttons as the keys they are labelled with. Only
+//  changes are sent, evdev drops repeated values anyway.
+//
+
+#ifndef XboxControllerHIDLinux_XBUInput_h
+#define XboxControllerHIDLinux_XBUInput_h
+
+#include <sys/types.h>
+#include <linux/input.h>
+
+#include "XboxControllerHIDCore.h"
+
+#define kMaxInputEvents         32          // of one report, with its SYN_REPORT
+
+// The events that take the device from last to report, both as the pipeline
+// delivers them, ending with a SYN_REPORT. 0 if nothing changed
+UInt32 XBPadInputEvents(const XBPadReport *last, const XBPadReport *report, struct input_event *events);
+UInt32 XBRemoteInputEvents(const XBRemoteReport *last, const XBRemoteReport *report, struct input_event *events);
+
+// A uinput device for a device of type (XBLinuxDeviceType), with nothing
+// pressed and the axes at 0. -1 with errno set if it can't be made
+int XBCreateInputDevice(UInt8 type, const char *name, UInt16 vendorID, UInt16 productID);
+void XBDestroyInputDevice(int fd);
+
+// Writes what fd takes of length bytes of events: all of them, fewer, or 0
+// if it would block. -1 with errno set on an error
+ssize_t XBWriteInputEvents(int fd, const void *events, size_t length);
+
+#endif
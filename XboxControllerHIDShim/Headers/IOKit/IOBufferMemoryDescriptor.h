@@ -0,0 +1,33 @@
+//
+//  IOBufferMemoryDescriptor.h
+//  XboxControllerHIDShim
+//
+
+#ifndef XboxControllerHIDShim_IOBufferMemoryDescriptor_h
+#define XboxControllerHIDShim_IOBufferMemoryDescriptor_h
+
+#include <IOKit/IOMemoryDescriptor.h>
+
+class IOBufferMemoryDescriptor : public IOMemoryDescriptor
+{
+    OSDeclareDefaultStructors(IOBufferMemoryDescriptor)
+    
+    vm_size_t   _capacity;
+    
+    virtual void free();
+
+public:
+    // zero-filled, and as long as its capacity
+    static IOBufferMemoryDescriptor *inTaskWithOptions(task_t inTask, IOOptionBits options,
+                                                       vm_size_t capacity, vm_offset_t alignment = 1);
+    static IOBufferMemoryDescriptor *withCapacity(vm_size_t capacity, IODirection withDirection,
+                                                  bool withContiguousMemory = false);
+    static IOBufferMemoryDescriptor *withBytes(const void *bytes, vm_size_t withLength, IODirection withDirection,
+                                               bool withContiguousMemory = false);
+    
+    virtual void setLength(vm_size_t length);
+    virtual vm_size_t getCapacity() const { return _capacity; }
+    virtual void *getBytesNoCopy() { return _bytes; }
+};
+
+#endif
@@ -0,0 +1,24 @@
+//
+//  IOCommandGate.h
+//  XboxControllerHIDShim
+//
+
+#ifndef XboxControllerHIDShim_IOCommandGate_h
+#define XboxControllerHIDShim_IOCommandGate_h
+
+#include <IOKit/IOWorkLoop.h>
+
+class IOCommandGate : public IOEventSource
+{
+    OSDeclareDefaultStructors(IOCommandGate)
+
+public:
+    typedef IOReturn (*Action)(OSObject *owner, void *arg0, void *arg1, void *arg2, void *arg3);
+    
+    static IOCommandGate *commandGate(OSObject *owner);
+    
+    // kIOReturnNotReady until the gate is added to a work loop
+    virtual IOReturn runAction(Action action, void *arg0 = 0, void *arg1 = 0, void *arg2 = 0, void *arg3 = 0);
+};
+
+#endif
@@ -0,0 +1,52 @@
+//
+//  IOLib.h
+//  XboxControllerHIDShim
+//
+//  Allocation, logging and the locks. An IOLock is a mutex with a condition
+//  on CLOCK_MONOTONIC, the event a thread sleeps on is not told apart, every
+//  wakeup wakes them all. An IOSimpleLock is a plain mutex.
+//
+
+#ifndef XboxControllerHIDShim_IOLib_h
+#define XboxControllerHIDShim_IOLib_h
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include <IOKit/IOTypes.h>
+#include <kern/clock.h>
+#include <kern/thread_call.h>
+#include <libkern/c++/OSContainers.h>
+
+void *IOMalloc(vm_size_t size);
+void IOFree(void *address, vm_size_t size);
+
+void IOLog(const char *format, ...) __attribute__((format(printf, 1, 2)));
+
+typedef struct _IOLock          IOLock;
+typedef struct _IOSimpleLock    IOSimpleLock;
+
+// results of IOLockSleepDeadline()
+#define THREAD_AWAKENED         0
+#define THREAD_TIMED_OUT        1
+#define THREAD_INTERRUPTED      2
+
+#define THREAD_UNINT            0
+#define THREAD_INTERRUPTIBLE    1
+#define THREAD_ABORTSAFE        2
+
+IOLock *IOLockAlloc(void);
+void IOLockFree(IOLock *lock);
+void IOLockLock(IOLock *lock);
+void IOLockUnlock(IOLock *lock);
+int IOLockSleep(IOLock *lock, void *event, UInt32 interType);
+int IOLockSleepDeadline(IOLock *lock, void *event, AbsoluteTime deadline, UInt32 interType);
+void IOLockWakeup(IOLock *lock, void *event, bool oneThread);
+
+IOSimpleLock *IOSimpleLockAlloc(void);
+void IOSimpleLockFree(IOSimpleLock *lock);
+void IOSimpleLockLock(IOSimpleLock *lock);
+void IOSimpleLockUnlock(IOSimpleLock *lock);
+
+#endif
@@ -0,0 +1,35 @@
+//
+//  IOMemoryDescriptor.h
+//  XboxControllerHIDShim
+//
+//  Memory is always mapped in the one address space there is, so a
+//  descriptor is its bytes, its length and a direction.
+//
+
+#ifndef XboxControllerHIDShim_IOMemoryDescriptor_h
+#define XboxControllerHIDShim_IOMemoryDescriptor_h
+
+#include <IOKit/IOTypes.h>
+#include <libkern/c++/OSContainers.h>
+
+class IOMemoryDescriptor : public OSObject
+{
+    OSDeclareDefaultStructors(IOMemoryDescriptor)
+
+protected:
+    void *          _bytes;
+    IOByteCount     _length;
+    IODirection     _direction;
+
+public:
+    // of memory the caller keeps until the descriptor is released
+    static IOMemoryDescriptor *withAddress(void *address, IOByteCount withLength, IODirection withDirection);
+    
+    virtual IOByteCount getLength() const { return _length; }
+    virtual IODirection getDirection() const { return _direction; }
+    
+    virtual IOByteCount readBytes(IOByteCount offset, void *bytes, IOByteCount withLength);
+    virtual IOByteCount writeBytes(IOByteCount offset, const void *bytes, IOByteCount withLength);
+};
+
+#endif
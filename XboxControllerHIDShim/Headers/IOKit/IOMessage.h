@@ -0,0 +1,15 @@
+//
+//  IOMessage.h
+//  XboxControllerHIDShim
+//
+
+#ifndef XboxControllerHIDShim_IOMessage_h
+#define XboxControllerHIDShim_IOMessage_h
+
+#include <IOKit/IOReturn.h>
+
+#define iokit_common_msg(message)       ((UInt32)(0xE0000000 | (message)))
+
+#define kIOMessageServiceIsTerminated   iokit_common_msg(0x010)
+
+#endif
@@ -0,0 +1,39 @@
+//
+//  IOReturn.h
+//  XboxControllerHIDShim
+//
+//  The return codes the driver and the USB family use, with the SDK values.
+//
+
+#ifndef XboxControllerHIDShim_IOReturn_h
+#define XboxControllerHIDShim_IOReturn_h
+
+#include <libkern/OSTypes.h>
+
+typedef int     kern_return_t;
+typedef kern_return_t   IOReturn;
+
+#define KERN_SUCCESS                0
+
+#define iokit_common_err(return)    ((IOReturn)(0xE0000000 | (return)))
+
+#define kIOReturnSuccess            KERN_SUCCESS
+#define kIOReturnError              iokit_common_err(0x2bc)
+#define kIOReturnNoMemory           iokit_common_err(0x2bd)
+#define kIOReturnNoResources        iokit_common_err(0x2be)
+#define kIOReturnNoDevice           iokit_common_err(0x2c0)
+#define kIOReturnNotPrivileged      iokit_common_err(0x2c1)
+#define kIOReturnBadArgument        iokit_common_err(0x2c2)
+#define kIOReturnExclusiveAccess    iokit_common_err(0x2c5)
+#define kIOReturnUnsupported        iokit_common_err(0x2c7)
+#define kIOReturnNotOpen            iokit_common_err(0x2cd)
+#define kIOReturnTimeout            iokit_common_err(0x2d6)
+#define kIOReturnNotReady           iokit_common_err(0x2d8)
+#define kIOReturnMessageTooLarge    iokit_common_err(0x2e1)
+#define kIOReturnNotPermitted       iokit_common_err(0x2e2)
+#define kIOReturnUnderrun           iokit_common_err(0x2e7)
+#define kIOReturnOverrun            iokit_common_err(0x2e8)
+#define kIOReturnAborted            iokit_common_err(0x2eb)
+#define kIOReturnNotResponding      iokit_common_err(0x2ed)
+
+#endif
@@ -0,0 +1,120 @@
+//
+//  IOService.h
+//  XboxControllerHIDShim
+//
+//  The registry as far as the driver sees it: a service has one provider,
+//  the clients attached to it, its properties and at most one client that
+//  has it open. Termination runs the phases the driver implements on the
+//  calling thread, see terminate().
+//
+
+#ifndef XboxControllerHIDShim_IOService_h
+#define XboxControllerHIDShim_IOService_h
+
+#include <pthread.h>
+
+#include <IOKit/IOLib.h>
+#include <IOKit/IOTypes.h>
+#include <libkern/c++/OSContainers.h>
+
+class IOService;
+class IOUserClient;
+class IOWorkLoop;
+
+typedef struct IORegistryPlane IORegistryPlane;
+
+class IORegistryEntry : public OSObject
+{
+    OSDeclareDefaultStructors(IORegistryEntry)
+    
+    OSDictionary *          _properties;
+    mutable pthread_mutex_t _propertiesLock;
+    char                    _location[32];
+
+protected:
+    virtual void free();
+
+public:
+    // the properties are the dictionary passed in, not a copy of it
+    virtual bool init(OSDictionary *dictionary = 0);
+    
+    virtual OSObject *getProperty(const char *aKey) const;
+    virtual OSObject *getProperty(const OSString *aKey) const;
+    virtual OSObject *getProperty(const OSSymbol *aKey) const;
+    
+    virtual bool setProperty(const char *aKey, OSObject *anObject);
+    virtual bool setProperty(const OSString *aKey, OSObject *anObject);
+    virtual bool setProperty(const OSSymbol *aKey, OSObject *anObject);
+    virtual bool setProperty(const char *aKey, const char *aString);
+    virtual bool setProperty(const char *aKey, bool aBoolean);
+    virtual bool setProperty(const char *aKey, unsigned long long aValue, unsigned int aNumberOfBits);
+    virtual void removeProperty(const char *aKey);
+    
+    virtual IOReturn setProperties(OSObject *properties);
+    virtual bool serializeProperties(OSSerialize *serializer) const;
+    
+    virtual const char *getName(const IORegistryPlane *plane = 0) const;
+    virtual const char *getLocation(const IORegistryPlane *plane = 0) const;
+    virtual void setLocation(const char *location, const IORegistryPlane *plane = 0);
+};
+
+class IOService : public IORegistryEntry
+{
+    OSDeclareDefaultStructors(IOService)
+    
+    IOService *         _provider;
+    OSArray *           _clients;
+    IOService *         _openClient;
+    volatile bool       _inactive;
+    
+    bool terminatePhases(IOService *provider);
+
+protected:
+    virtual void free();
+    
+    virtual bool handleOpen(IOService *forClient, IOOptionBits options, void *arg);
+    virtual void handleClose(IOService *forClient, IOOptionBits options);
+    virtual bool handleIsOpen(const IOService *forClient) const;
+
+public:
+    virtual bool init(OSDictionary *dictionary = 0);
+    
+    virtual IOService *probe(IOService *provider, SInt32 *score);
+    virtual bool start(IOService *provider);
+    virtual void stop(IOService *provider);
+    
+    virtual bool attach(IOService *provider);
+    virtual void detach(IOService *provider);
+    IOService *getProvider() const { return _provider; }
+    
+    // the first client attached after client, retained
+    IOService *copyNextClient(IOService *client) const;
+    
+    virtual bool open(IOService *forClient, IOOptionBits options = 0, void *arg = 0);
+    virtual void close(IOService *forClient, IOOptionBits options = 0);
+    virtual bool isOpen(const IOService *forClient = 0) const;
+    
+    bool isInactive() const { return _inactive; }
+    
+    // Terminates the service and its clients: all of them are made inactive,
+    // then each gets willTerminate(), its clients are terminated, it gets
+    // didTerminate(), and once its provider is no longer open by it, stop()
+    // and detach(). False if the provider stayed open for too long.
+    virtual bool terminate(IOOptionBits options = 0);
+    virtual bool willTerminate(IOService *provider, IOOptionBits options);
+    virtual bool didTerminate(IOService *provider, IOOptionBits options, bool *defer);
+    
+    virtual IOReturn message(UInt32 type, IOService *provider, void *argument = 0);
+    
+    virtual IOWorkLoop *getWorkLoop() const;
+    
+    virtual IOReturn newUserClient(task_t owningTask, void *securityID, UInt32 type,
+                                   OSDictionary *properties, IOUserClient **handler);
+    virtual IOReturn newUserClient(task_t owningTask, void *securityID, UInt32 type,
+                                   IOUserClient **handler);
+    
+    // the services of the tree from here to be made inactive, for terminate()
+    void markInactive();
+};
+
+#endif
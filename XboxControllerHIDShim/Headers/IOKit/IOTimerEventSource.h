@@ -0,0 +1,33 @@
+//
+//  IOTimerEventSource.h
+//  XboxControllerHIDShim
+//
+
+#ifndef XboxControllerHIDShim_IOTimerEventSource_h
+#define XboxControllerHIDShim_IOTimerEventSource_h
+
+#include <IOKit/IOWorkLoop.h>
+
+class IOTimerEventSource : public IOEventSource
+{
+    OSDeclareDefaultStructors(IOTimerEventSource)
+    
+    friend class IOWorkLoop;
+
+public:
+    typedef void (*Action)(OSObject *owner, IOTimerEventSource *sender);
+
+private:
+    Action      _action;
+    UInt64      _deadline;          // uptime, 0 when not armed
+    UInt32      _generation;        // changes with every set and cancel
+
+public:
+    static IOTimerEventSource *timerEventSource(OSObject *owner, Action action = 0);
+    
+    virtual IOReturn setTimeoutMS(UInt32 ms);
+    virtual IOReturn setTimeoutUS(UInt32 us);
+    virtual void cancelTimeout();
+};
+
+#endif
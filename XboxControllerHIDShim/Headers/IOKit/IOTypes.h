@@ -0,0 +1,39 @@
+//
+//  IOTypes.h
+//  XboxControllerHIDShim
+//
+
+#ifndef XboxControllerHIDShim_IOTypes_h
+#define XboxControllerHIDShim_IOTypes_h
+
+#include <libkern/OSTypes.h>
+#include <IOKit/IOReturn.h>
+
+typedef UInt32              IOOptionBits;
+typedef unsigned long long  IOByteCount;
+typedef unsigned long       vm_size_t;
+typedef unsigned long       vm_offset_t;
+typedef UInt32              IODirection;
+
+// a task only stands for its client, see IOUserClient::clientHasPrivilege()
+typedef struct task *       task_t;
+
+extern task_t               kernel_task;
+extern const vm_size_t      page_size;
+
+task_t current_task(void);
+
+enum {
+    
+    kIODirectionNone    = 0x0,
+    kIODirectionIn      = 0x1,      // user land 'read'
+    kIODirectionOut     = 0x2,      // user land 'write'
+    kIODirectionInOut   = kIODirectionIn | kIODirectionOut
+};
+
+enum {
+    
+    kIOMemoryKernelUserShared   = 0x00010000
+};
+
+#endif
@@ -0,0 +1,33 @@
+//
+//  IOUserClient.h
+//  XboxControllerHIDShim
+//
+//  A user client is opened and called directly by the test that stands for
+//  its task, there is no Mach port in between.
+//
+
+#ifndef XboxControllerHIDShim_IOUserClient_h
+#define XboxControllerHIDShim_IOUserClient_h
+
+#include <IOKit/IOService.h>
+#include <IOKit/IOMemoryDescriptor.h>
+
+#define kIOClientPrivilegeAdministrator "root"
+
+class IOUserClient : public IOService
+{
+    OSDeclareAbstractStructors(IOUserClient)
+
+public:
+    // every task holds every privilege, only a NULL security token holds none
+    static IOReturn clientHasPrivilege(void *securityToken, const char *privilegeName);
+    
+    virtual bool initWithTask(task_t owningTask, void *securityToken, UInt32 type, OSDictionary *properties);
+    virtual bool initWithTask(task_t owningTask, void *securityToken, UInt32 type);
+    
+    virtual IOReturn clientClose();
+    virtual IOReturn clientDied();
+    virtual IOReturn clientMemoryForType(UInt32 type, IOOptionBits *options, IOMemoryDescriptor **memory);
+};
+
+#endif
@@ -0,0 +1,71 @@
+//
+//  IOWorkLoop.h
+//  XboxControllerHIDShim
+//
+//  A work loop is its gate, a recursive mutex, and one thread that runs the
+//  timers added to it with the gate closed. Command gates take the same gate
+//  around their actions, so gated actions and timer actions never overlap.
+//  Removing an event source closes the gate, so once it returns none of the
+//  source's actions is running.
+//
+
+#ifndef XboxControllerHIDShim_IOWorkLoop_h
+#define XboxControllerHIDShim_IOWorkLoop_h
+
+#include <pthread.h>
+
+#include <IOKit/IOTypes.h>
+#include <libkern/c++/OSContainers.h>
+
+class IOWorkLoop;
+class IOTimerEventSource;
+
+class IOEventSource : public OSObject
+{
+    OSDeclareAbstractStructors(IOEventSource)
+    
+    friend class IOWorkLoop;
+
+protected:
+    OSObject *      owner;
+    IOWorkLoop *    workLoop;
+
+public:
+    virtual bool init(OSObject *owner);
+    
+    IOWorkLoop *getWorkLoop() const { return workLoop; }
+    OSObject *getOwner() const { return owner; }
+};
+
+class IOWorkLoop : public OSObject
+{
+    OSDeclareDefaultStructors(IOWorkLoop)
+    
+    friend class IOTimerEventSource;
+    
+    pthread_mutex_t     _gate;
+    pthread_mutex_t     _lock;          // the sources and the timers' deadlines
+    pthread_cond_t      _changed;
+    pthread_t           _thread;
+    bool                _running;
+    OSArray *           _sources;
+    
+    static void *threadMain(void *arg);
+    void runTimers();
+
+protected:
+    virtual void free();
+
+public:
+    static IOWorkLoop *workLoop();
+    
+    virtual bool init();
+    
+    virtual IOReturn addEventSource(IOEventSource *newEvent);
+    virtual IOReturn removeEventSource(IOEventSource *toRemove);
+    
+    virtual void closeGate();
+    virtual void openGate();
+};
+
+#endif
@@ -0,0 +1,44 @@
+//
+//  IOHIDDescriptorParser.h
+//  XboxControllerHIDShim
+//
+//  Only what HIDGetCapabilities() returns: the usage of the first top level
+//  collection and the length of the longest report of each type, with the
+//  report ID byte when the descriptor uses report IDs.
+//
+
+#ifndef XboxControllerHIDShim_IOHIDDescriptorParser_h
+#define XboxControllerHIDShim_IOHIDDescriptorParser_h
+
+#include <IOKit/IOTypes.h>
+
+typedef SInt32 OSStatus;
+
+enum HIDReportType
+{
+    kHIDInputReport = 1,
+    kHIDOutputReport,
+    kHIDFeatureReport,
+    kHIDUnknownReport = 255
+};
+typedef enum HIDReportType HIDReportType;
+
+typedef struct HIDPreparsedData *HIDPreparsedDataRef;
+
+typedef struct HIDCapabilities
+{
+    UInt32          usage;
+    UInt32          usagePage;
+    IOByteCount     inputReportByteLength;
+    IOByteCount     outputReportByteLength;
+    IOByteCount     featureReportByteLength;
+    UInt32          numberCollectionNodes;
+    
+} HIDCapabilities, *HIDCapabilitiesPtr;
+
+OSStatus HIDOpenReportDescriptor(void *hidReportDescriptor, IOByteCount descriptorLength,
+                                 HIDPreparsedDataRef *preparsedDataRef, IOOptionBits flags);
+OSStatus HIDCloseReportDescriptor(HIDPreparsedDataRef preparsedDataRef);
+OSStatus HIDGetCapabilities(HIDPreparsedDataRef preparsedDataRef, HIDCapabilitiesPtr capabilities);
+
+#endif
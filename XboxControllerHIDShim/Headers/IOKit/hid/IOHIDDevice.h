@@ -0,0 +1,81 @@
+//
+//  IOHIDDevice.h
+//  XboxControllerHIDShim
+//
+//  The HID family's side of a device driver. start() gives the device its
+//  own work loop, runs handleStart() and publishes what the driver's new*()
+//  methods return. Reports handed to handleReport() go to the report handler
+//  of the shim, one at a time, in place of the HID event system.
+//
+
+#ifndef XboxControllerHIDShim_IOHIDDevice_h
+#define XboxControllerHIDShim_IOHIDDevice_h
+
+#include <pthread.h>
+
+#include <IOKit/IOService.h>
+#include <IOKit/IOMemoryDescriptor.h>
+#include <IOKit/IOWorkLoop.h>
+#include <IOKit/IOCommandGate.h>
+#include <IOKit/hid/IOHIDKeys.h>
+#include <IOKit/hid/IOHIDDescriptorParser.h>
+#include <kern/clock.h>
+
+class IOHIDDevice;
+
+// shim only: a report as delivered, with the time stamp it was delivered with
+typedef void (*IOHIDReportHandler)(void *target, IOHIDDevice *device, AbsoluteTime timeStamp,
+                                   const void *report, UInt32 length);
+
+class IOHIDDevice : public IOService
+{
+    OSDeclareAbstractStructors(IOHIDDevice)
+    
+    IOWorkLoop *            _workLoop;
+    pthread_mutex_t         _reportLock;
+    IOHIDReportHandler      _reportHandler;
+    void *                  _reportTarget;
+    
+    void publishProperties();
+
+protected:
+    virtual void free();
+
+public:
+    virtual bool init(OSDictionary *dictionary = 0);
+    virtual bool start(IOService *provider);
+    virtual void stop(IOService *provider);
+    
+    virtual bool handleStart(IOService *provider);
+    virtual void handleStop(IOService *provider);
+    
+    virtual IOWorkLoop *getWorkLoop() const;
+    
+    virtual IOReturn newReportDescriptor(IOMemoryDescriptor **descriptor) const;
+    virtual OSString *newTransportString() const;
+    virtual OSString *newManufacturerString() const;
+    virtual OSString *newProductString() const;
+    virtual OSNumber *newVendorIDNumber() const;
+    virtual OSNumber *newProductIDNumber() const;
+    virtual OSNumber *newVersionNumber() const;
+    virtual OSString *newSerialNumberString() const;
+    virtual OSNumber *newLocationIDNumber() const;
+    virtual OSNumber *newPrimaryUsageNumber() const;
+    virtual OSNumber *newPrimaryUsagePageNumber() const;
+    virtual OSString *newIndexedString(UInt8 index) const;
+    
+    virtual IOReturn handleReport(IOMemoryDescriptor *report,
+                                  IOHIDReportType reportType = kIOHIDReportTypeInput,
+                                  IOOptionBits options = 0);
+    virtual IOReturn handleReportWithTime(AbsoluteTime timeStamp, IOMemoryDescriptor *report,
+                                          IOHIDReportType reportType = kIOHIDReportTypeInput,
+                                          IOOptionBits options = 0);
+    
+    virtual IOReturn getReport(IOMemoryDescriptor *report, IOHIDReportType reportType, IOOptionBits options = 0);
+    virtual IOReturn setReport(IOMemoryDescriptor *report, IOHIDReportType reportType, IOOptionBits options = 0);
+    
+    // shim only
+    void setReportHandler(IOHIDReportHandler handler, void *target);
+};
+
+#endif
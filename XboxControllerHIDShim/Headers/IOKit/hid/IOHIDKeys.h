@@ -0,0 +1,35 @@
+//
+//  IOHIDKeys.h
+//  XboxControllerHIDShim
+//
+
+#ifndef XboxControllerHIDShim_IOHIDKeys_h
+#define XboxControllerHIDShim_IOHIDKeys_h
+
+enum IOHIDReportType
+{
+    kIOHIDReportTypeInput = 0,
+    kIOHIDReportTypeOutput,
+    kIOHIDReportTypeFeature,
+    kIOHIDReportTypeCount
+};
+typedef enum IOHIDReportType IOHIDReportType;
+
+// published by IOHIDDevice::start() from the driver's new*() methods
+#define kIOHIDTransportKey              "Transport"
+#define kIOHIDVendorIDKey               "VendorID"
+#define kIOHIDProductIDKey              "ProductID"
+#define kIOHIDVersionNumberKey          "VersionNumber"
+#define kIOHIDManufacturerKey           "Manufacturer"
+#define kIOHIDProductKey                "Product"
+#define kIOHIDSerialNumberKey           "SerialNumber"
+#define kIOHIDLocationIDKey             "LocationID"
+#define kIOHIDPrimaryUsageKey           "PrimaryUsage"
+#define kIOHIDPrimaryUsagePageKey       "PrimaryUsagePage"
+#define kIOHIDReportDescriptorKey       "ReportDescriptor"
+#define kIOHIDMaxInputReportSizeKey     "MaxInputReportSize"
+#define kIOHIDMaxOutputReportSizeKey    "MaxOutputReportSize"
+
+#define kIOHIDElementKey                "Elements"
+
+#endif
@@ -0,0 +1,14 @@
+//
+//  IOUSBBus.h
+//  XboxControllerHIDShim
+//
+
+#ifndef XboxControllerHIDShim_IOUSBBus_h
+#define XboxControllerHIDShim_IOUSBBus_h
+
+#include <IOKit/usb/USB.h>
+#include <IOKit/usb/IOUSBPipe.h>
+#include <IOKit/usb/IOUSBDevice.h>
+#include <IOKit/usb/IOUSBInterface.h>
+
+#endif
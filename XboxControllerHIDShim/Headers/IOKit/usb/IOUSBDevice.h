@@ -0,0 +1,87 @@
+//
+//  IOUSBDevice.h
+//  XboxControllerHIDShim
+//
+//  A device with a simulated interrupt endpoint behind it. Its control
+//  requests are answered here: CLEAR_FEATURE(ENDPOINT_HALT) clears the
+//  simulated endpoint, SET_IDLE and SET_REPORT succeed, anything else stalls.
+//  Once a reset of the port ends, every client that has one of its
+//  interfaces open gets kIOUSBMessagePortHasBeenReset.
+//
+
+#ifndef XboxControllerHIDShim_IOUSBDevice_h
+#define XboxControllerHIDShim_IOUSBDevice_h
+
+#include <pthread.h>
+
+#include <IOKit/IOService.h>
+#include <IOKit/usb/USB.h>
+
+#include "XBSimulator.h"
+
+class IOUSBInterface;
+
+// what a device was sent, for the tests
+typedef struct {
+    
+    UInt64  controlRequests;
+    UInt64  endpointHaltsCleared;
+    UInt64  outputReports;              // SET_REPORT and writes to an OUT pipe
+    UInt8   lastOutput[kTraceReportBytes];
+    UInt32  lastOutputLength;
+    
+} XBShimDeviceStats;
+
+class IOUSBDevice : public IOService
+{
+    OSDeclareDefaultStructors(IOUSBDevice)
+    
+    UInt16              _vendorID;
+    UInt16              _productID;
+    UInt16              _release;
+    USBDeviceAddress    _address;
+    XBSimPipe           _sim;
+    bool                _simStarted;
+    OSArray *           _interfaces;
+    pthread_mutex_t     _statsLock;
+    XBShimDeviceStats   _stats;
+    
+    static void portResetHandler(void *target);
+
+protected:
+    virtual void free();
+
+public:
+    // shim only: the device starts polled by the host controller now
+    virtual bool initWithSim(UInt16 vendorID, UInt16 productID, UInt32 locationID, const XBSimDevice *device);
+    virtual bool addInterface(IOUSBInterface *interface);
+    XBSimPipe *getSimPipe() { return &_sim; }
+    void recordOutput(const void *bytes, UInt32 length);
+    void copyStats(XBShimDeviceStats *stats);
+    // stops the polls, before the device goes away
+    void detachSim();
+    
+    virtual UInt16 GetVendorID() { return _vendorID; }
+    virtual UInt16 GetProductID() { return _productID; }
+    virtual UInt16 GetDeviceRelease() { return _release; }
+    virtual USBDeviceAddress GetAddress() { return _address; }
+    
+    // no strings, like the pads, so the driver falls back on its personality
+    virtual UInt8 GetManufacturerStringIndex() { return 0; }
+    virtual UInt8 GetProductStringIndex() { return 0; }
+    virtual UInt8 GetSerialNumberStringIndex() { return 0; }
+    virtual IOReturn GetStringDescriptor(UInt8 index, char *buf, int maxLen, UInt16 lang = 0x409);
+    
+    virtual IOReturn DeviceRequest(IOUSBDevRequest *request, IOUSBCompletion *completion = 0);
+    virtual IOReturn DeviceRequest(IOUSBDevRequestDesc *request, IOUSBCompletion *completion = 0);
+    virtual IOReturn DeviceRequest(IOUSBDevRequest *request, UInt32 noDataTimeout, UInt32 completionTimeout,
+                                   IOUSBCompletion *completion = 0);
+    
+    virtual IOReturn message(UInt32 type, IOService *provider, void *argument = 0);
+    virtual IOReturn ResetDevice();
+    
+    // not retained for the caller
+    virtual IOUSBInterface *FindNextInterface(IOUSBInterface *current, IOUSBFindInterfaceRequest *request);
+};
+
+#endif
@@ -0,0 +1,48 @@
+//
+//  IOUSBInterface.h
+//  XboxControllerHIDShim
+//
+
+#ifndef XboxControllerHIDShim_IOUSBInterface_h
+#define XboxControllerHIDShim_IOUSBInterface_h
+
+#include <IOKit/IOService.h>
+#include <IOKit/usb/USB.h>
+#include <IOKit/usb/IOUSBDevice.h>
+#include <IOKit/usb/IOUSBPipe.h>
+
+#define kXBShimMaxEndpoints     4
+
+class IOUSBInterface : public IOService
+{
+    OSDeclareDefaultStructors(IOUSBInterface)
+    
+    IOUSBDevice *           _device;        // not retained, the device outlives its interfaces
+    UInt8                   _number;
+    UInt8                   _class, _subClass, _protocol;
+    UInt8                   _numEndpoints;
+    IOUSBEndpointDescriptor _endpoints[kXBShimMaxEndpoints];
+    IOUSBPipe *             _pipes[kXBShimMaxEndpoints];
+
+protected:
+    virtual void free();
+
+public:
+    // shim only: the interrupt IN endpoints read from sim
+    static IOUSBInterface *withEndpoints(IOUSBDevice *device, UInt8 number, UInt8 interfaceClass,
+                                         const IOUSBEndpointDescriptor *endpoints, UInt8 numEndpoints,
+                                         XBSimPipe *sim);
+    
+    virtual IOUSBDevice *GetDevice() { return _device; }
+    virtual UInt8 GetInterfaceNumber() { return _number; }
+    virtual UInt8 GetNumEndpoints() { return _numEndpoints; }
+    virtual UInt8 GetInterfaceClass() { return _class; }
+    virtual UInt8 GetInterfaceSubClass() { return _subClass; }
+    virtual UInt8 GetInterfaceProtocol() { return _protocol; }
+    
+    // not retained for the caller
+    virtual IOUSBPipe *FindNextPipe(IOUSBPipe *current, IOUSBFindEndpointRequest *request);
+    virtual const IOUSBDescriptorHeader *FindNextAssociatedDescriptor(const void *current, UInt8 type);
+};
+
+#endif
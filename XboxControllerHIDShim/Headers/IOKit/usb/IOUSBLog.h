@@ -0,0 +1,19 @@
+//
+//  IOUSBLog.h
+//  XboxControllerHIDShim
+//
+//  USBLog() and USBError() print to stderr when their level is at most the
+//  XB_SHIM_LOG environment variable, and are quiet without it.
+//
+
+#ifndef XboxControllerHIDShim_IOUSBLog_h
+#define XboxControllerHIDShim_IOUSBLog_h
+
+#include <libkern/OSTypes.h>
+
+void XBShimLog(UInt32 level, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+#define USBLog(level, ...)      XBShimLog(level, __VA_ARGS__)
+#define USBError(level, ...)    XBShimLog(level, __VA_ARGS__)
+
+#endif
@@ -0,0 +1,60 @@
+//
+//  IOUSBPipe.h
+//  XboxControllerHIDShim
+//
+//  An interrupt IN pipe is a simulated pipe (XBSimulator.h): Read() queues
+//  on it and the host controller thread completes the reads, with the time
+//  stamp of the poll that completed them and with the gate of the client's
+//  work loop closed, as its completions expect. An OUT pipe hands what is
+//  written to its device, which keeps the last output report.
+//
+
+#ifndef XboxControllerHIDShim_IOUSBPipe_h
+#define XboxControllerHIDShim_IOUSBPipe_h
+
+#include <IOKit/IOMemoryDescriptor.h>
+#include <IOKit/usb/USB.h>
+
+#include "XBSimulator.h"
+
+class IOUSBDevice;
+
+class IOUSBPipe : public OSObject
+{
+    OSDeclareDefaultStructors(IOUSBPipe)
+    
+    IOUSBEndpointDescriptor _descriptor;
+    IOUSBDevice *           _device;        // not retained, the device outlives its pipes
+    XBSimPipe *             _sim;           // IN pipes
+    
+    // a read queued on the simulated pipe, until it completes
+    typedef struct {
+        IOUSBCompletionWithTimeStamp    completion;
+        volatile UInt32                 inUse;
+    } GatedRead;
+    
+    GatedRead               _gatedReads[kSimMaxReads];
+    
+    static void gatedReadComplete(void *target, void *parameter, SInt32 status, UInt32 bufferSizeRemaining,
+                                  UInt64 timeStamp);
+
+public:
+    static IOUSBPipe *ToEndpoint(const IOUSBEndpointDescriptor *endpoint, IOUSBDevice *device, XBSimPipe *sim);
+    
+    virtual IOReturn Read(IOMemoryDescriptor *buffer, UInt32 noDataTimeout, UInt32 completionTimeout,
+                          IOByteCount reqCount, IOUSBCompletionWithTimeStamp *completion = 0,
+                          IOByteCount *bytesRead = 0);
+    virtual IOReturn Write(IOMemoryDescriptor *buffer, UInt32 noDataTimeout = 0, UInt32 completionTimeout = 0,
+                           IOUSBCompletion *completion = 0);
+    
+    virtual IOReturn ClearStall(void);
+    virtual IOReturn Abort(void);
+    
+    virtual const IOUSBEndpointDescriptor *GetEndpointDescriptor() { return &_descriptor; }
+    virtual UInt8 GetEndpointNumber() { return _descriptor.bEndpointAddress & 0x0F; }
+    virtual UInt8 GetDirection() { return (_descriptor.bEndpointAddress & 0x80) ? kUSBIn : kUSBOut; }
+    virtual UInt8 GetType() { return _descriptor.bmAttributes & 0x03; }
+    virtual UInt16 GetMaxPacketSize() { return USBToHostWord(_descriptor.wMaxPacketSize); }
+};
+
+#endif
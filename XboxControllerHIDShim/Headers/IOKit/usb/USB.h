@@ -0,0 +1,203 @@
+//
+//  USB.h
+//  XboxControllerHIDShim
+//
+//  The USB family's types, constants and errors the driver uses, with the
+//  values of the SDK's USB.h and USBSpec.h.
+//
+
+#ifndef XboxControllerHIDShim_USB_h
+#define XboxControllerHIDShim_USB_h
+
+#include <IOKit/IOTypes.h>
+#include <IOKit/IOReturn.h>
+#include <libkern/OSByteOrder.h>
+#include <kern/clock.h>
+
+#define USBToHostWord       OSSwapLittleToHostInt16
+#define HostToUSBWord       OSSwapHostToLittleInt16
+
+#define iokit_usb_err(return)   ((IOReturn)(0xE0004000 | (return)))
+#define iokit_usb_msg(message)  ((UInt32)(0xE0004000 | (message)))
+
+#define kIOUSBCRCErr                iokit_usb_err(0x01)
+#define kIOUSBBitstufErr            iokit_usb_err(0x02)
+#define kIOUSBDataToggleErr         iokit_usb_err(0x03)
+#define kIOUSBPIDCheckErr           iokit_usb_err(0x06)
+#define kIOUSBWrongPIDErr           iokit_usb_err(0x07)
+#define kIOUSBBufferOverrunErr      iokit_usb_err(0x0c)
+#define kIOUSBBufferUnderrunErr     iokit_usb_err(0x0d)
+#define kIOUSBNotSent1Err           iokit_usb_err(0x0e)
+#define kIOUSBNotSent2Err           iokit_usb_err(0x0f)
+#define kIOUSBLinkErr               iokit_usb_err(0x10)
+#define kIOUSBPipeStalled           iokit_usb_err(0x4f)
+#define kIOUSBTransactionReturned   iokit_usb_err(0x50)
+
+#define kIOUSBMessageHubIsDeviceConnected   iokit_usb_msg(0x04)
+#define kIOUSBMessagePortHasBeenReset       iokit_usb_msg(0x0a)
+
+#define kUSBDevicePropertyLocationID        "locationID"
+
+enum {
+    
+    kUSBControl     = 0,
+    kUSBIsoc        = 1,
+    kUSBBulk        = 2,
+    kUSBInterrupt   = 3,
+    kUSBAnyType     = 0xFF
+};
+
+enum {
+    
+    kUSBOut         = 0,
+    kUSBIn          = 1,
+    kUSBNone        = 2,
+    kUSBAnyDirn     = 3
+};
+
+enum {
+    
+    kUSBStandard    = 0,
+    kUSBClass       = 1,
+    kUSBVendor      = 2
+};
+
+enum {
+    
+    kUSBDevice      = 0,
+    kUSBInterface   = 1,
+    kUSBEndpoint    = 2,
+    kUSBOther       = 3
+};
+
+enum {
+    
+    kUSBRqGetStatus     = 0,
+    kUSBRqClearFeature  = 1,
+    kUSBRqSetFeature    = 3
+};
+
+enum {
+    
+    kHIDRqGetReport     = 1,
+    kHIDRqGetIdle       = 2,
+    kHIDRqGetProtocol   = 3,
+    kHIDRqSetReport     = 9,
+    kHIDRqSetIdle       = 10,
+    kHIDRqSetProtocol   = 11
+};
+
+enum {
+    
+    kUSBAnyDesc         = 0,
+    kUSBDeviceDesc      = 1,
+    kUSBConfDesc        = 2,
+    kUSBStringDesc      = 3,
+    kUSBInterfaceDesc   = 4,
+    kUSBEndpointDesc    = 5
+};
+
+enum {
+    
+    kUSBRqDirnShift     = 7,
+    kUSBRqDirnMask      = 1,
+    kUSBRqTypeShift     = 5,
+    kUSBRqTypeMask      = 3,
+    kUSBRqRecipientMask = 0x1F
+};
+
+#define USBmakebmRequestType(direction, type, recipient) \
+    ((((direction) & kUSBRqDirnMask) << kUSBRqDirnShift) | \
+     (((type) & kUSBRqTypeMask) << kUSBRqTypeShift) | \
+     ((recipient) & kUSBRqRecipientMask))
+
+enum {
+    
+    kIOUSBFindInterfaceDontCare = 0xFFFF
+};
+
+typedef UInt16  USBDeviceAddress;
+
+typedef struct IOUSBDescriptorHeader {
+    
+    UInt8   bLength;
+    UInt8   bDescriptorType;
+    
+} __attribute__((packed)) IOUSBDescriptorHeader;
+
+typedef struct IOUSBEndpointDescriptor {
+    
+    UInt8   bLength;
+    UInt8   bDescriptorType;
+    UInt8   bEndpointAddress;
+    UInt8   bmAttributes;
+    UInt16  wMaxPacketSize;         // little endian
+    UInt8   bInterval;
+    
+} __attribute__((packed)) IOUSBEndpointDescriptor;
+
+typedef struct {
+    
+    UInt8   type;
+    UInt8   direction;
+    UInt16  maxPacketSize;
+    UInt8   interval;
+    
+} IOUSBFindEndpointRequest;
+
+typedef struct {
+    
+    UInt16  bInterfaceClass;
+    UInt16  bInterfaceSubClass;
+    UInt16  bInterfaceProtocol;
+    UInt16  bAlternateSetting;
+    
+} IOUSBFindInterfaceRequest;
+
+class IOMemoryDescriptor;
+
+typedef struct {
+    
+    UInt8   bmRequestType;
+    UInt8   bRequest;
+    UInt16  wValue;
+    UInt16  wIndex;
+    UInt16  wLength;
+    void *  pData;
+    UInt32  wLenDone;
+    
+} IOUSBDevRequest;
+
+typedef struct {
+    
+    UInt8                   bmRequestType;
+    UInt8                   bRequest;
+    UInt16                  wValue;
+    UInt16                  wIndex;
+    UInt16                  wLength;
+    IOMemoryDescriptor *    pData;
+    UInt32                  wLenDone;
+    
+} IOUSBDevRequestDesc;
+
+typedef void (*IOUSBCompletionAction)(void *target, void *parameter, IOReturn status, UInt32 bufferSizeRemaining);
+typedef void (*IOUSBCompletionActionWithTimeStamp)(void *target, void *parameter, IOReturn status,
+                                                   UInt32 bufferSizeRemaining, AbsoluteTime timeStamp);
+
+typedef struct {
+    
+    void *                  target;
+    IOUSBCompletionAction   action;
+    void *                  parameter;
+    
+} IOUSBCompletion;
+
+typedef struct {
+    
+    void *                              target;
+    IOUSBCompletionActionWithTimeStamp  action;
+    void *                              parameter;
+    
+} IOUSBCompletionWithTimeStamp;
+
+#endif
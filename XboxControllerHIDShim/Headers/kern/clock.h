@@ -0,0 +1,42 @@
+//
+//  clock.h
+//  XboxControllerHIDShim
+//
+//  Absolute time is CLOCK_MONOTONIC in nanoseconds, so the conversions are
+//  copies. It is the time base of the simulated pipes as well, which makes
+//  the completion time stamps the driver gets comparable to uptime.
+//
+
+#ifndef XboxControllerHIDShim_clock_h
+#define XboxControllerHIDShim_clock_h
+
+#include <libkern/OSTypes.h>
+
+typedef UInt64  AbsoluteTime;
+
+#define AbsoluteTime_to_scalar(x)   (*(UInt64 *)(x))
+
+enum {
+    
+    kNanosecondScale    = 1,
+    kMicrosecondScale   = 1000,
+    kMillisecondScale   = 1000 * 1000,
+    kSecondScale        = 1000 * 1000 * 1000
+};
+
+void clock_get_uptime(UInt64 *result);
+void clock_interval_to_deadline(UInt32 interval, UInt32 scaleFactor, UInt64 *result);
+
+static inline void
+absolutetime_to_nanoseconds(UInt64 abstime, UInt64 *result)
+{
+    *result = abstime;
+}
+
+static inline void
+nanoseconds_to_absolutetime(UInt64 nanoseconds, UInt64 *result)
+{
+    *result = nanoseconds;
+}
+
+#endif
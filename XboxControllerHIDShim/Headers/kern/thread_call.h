@@ -0,0 +1,31 @@
+//
+//  thread_call.h
+//  XboxControllerHIDShim
+//
+//  Callouts run on a small pool of threads. thread_call_free() waits for a
+//  call that is running to return, so the driver can free its calls from
+//  handleStop() while one of them is still finishing.
+//
+
+#ifndef XboxControllerHIDShim_thread_call_h
+#define XboxControllerHIDShim_thread_call_h
+
+#include <libkern/OSTypes.h>
+
+typedef struct thread_call *    thread_call_t;
+typedef void *                  thread_call_param_t;
+typedef void                    (*thread_call_func_t)(thread_call_param_t param0, thread_call_param_t param1);
+
+thread_call_t thread_call_allocate(thread_call_func_t func, thread_call_param_t param0);
+
+// true if the call was pending already
+Boolean thread_call_enter(thread_call_t call);
+Boolean thread_call_enter1(thread_call_t call, thread_call_param_t param1);
+
+// true if the call was pending, and is no longer
+Boolean thread_call_cancel(thread_call_t call);
+
+// false, and the call left alone, while it is pending
+Boolean thread_call_free(thread_call_t call);
+
+#endif
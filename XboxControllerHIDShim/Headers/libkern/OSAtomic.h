@@ -0,0 +1,44 @@
+//
+//  OSAtomic.h
+//  XboxControllerHIDShim
+//
+//  The libkern atomics, on the compiler's __sync builtins like XBOutstandingIO.
+//  The increments return the value from before, as the kernel's do.
+//
+
+#ifndef XboxControllerHIDShim_OSAtomic_h
+#define XboxControllerHIDShim_OSAtomic_h
+
+#include <libkern/OSTypes.h>
+
+static inline SInt32
+OSIncrementAtomic(volatile SInt32 *address)
+{
+    return __sync_fetch_and_add(address, 1);
+}
+
+static inline SInt32
+OSDecrementAtomic(volatile SInt32 *address)
+{
+    return __sync_fetch_and_sub(address, 1);
+}
+
+static inline Boolean
+OSCompareAndSwap(UInt32 oldValue, UInt32 newValue, volatile UInt32 *address)
+{
+    return __sync_bool_compare_and_swap(address, oldValue, newValue);
+}
+
+static inline Boolean
+OSCompareAndSwapPtr(void *oldValue, void *newValue, void * volatile *address)
+{
+    return __sync_bool_compare_and_swap(address, oldValue, newValue);
+}
+
+static inline void
+OSMemoryBarrier(void)
+{
+    __sync_synchronize();
+}
+
+#endif
@@ -0,0 +1,23 @@
+//
+//  OSByteOrder.h
+//  XboxControllerHIDShim
+//
+
+#ifndef XboxControllerHIDShim_OSByteOrder_h
+#define XboxControllerHIDShim_OSByteOrder_h
+
+#include <libkern/OSTypes.h>
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define OSSwapLittleToHostInt16(x)  ((UInt16)(x))
+#define OSSwapLittleToHostInt32(x)  ((UInt32)(x))
+#define OSSwapHostToLittleInt16(x)  ((UInt16)(x))
+#define OSSwapHostToLittleInt32(x)  ((UInt32)(x))
+#else
+#define OSSwapLittleToHostInt16(x)  __builtin_bswap16(x)
+#define OSSwapLittleToHostInt32(x)  __builtin_bswap32(x)
+#define OSSwapHostToLittleInt16(x)  __builtin_bswap16(x)
+#define OSSwapHostToLittleInt32(x)  __builtin_bswap32(x)
+#endif
+
+#endif
@@ -0,0 +1,34 @@
+//
+//  OSTypes.h
+//  XboxControllerHIDShim
+//
+//  The Mac types the driver and its headers use, with the same definitions
+//  XboxControllerHIDCore.h makes outside of Apple's SDKs.
+//
+
+#ifndef XboxControllerHIDShim_OSTypes_h
+#define XboxControllerHIDShim_OSTypes_h
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint8_t     UInt8;
+typedef uint16_t    UInt16;
+typedef uint32_t    UInt32;
+typedef uint64_t    UInt64;
+typedef int8_t      SInt8;
+typedef int16_t     SInt16;
+typedef int32_t     SInt32;
+typedef int64_t     SInt64;
+
+typedef unsigned char   Boolean;
+typedef unsigned long   ByteCount;
+
+#ifndef TRUE
+#define TRUE    1
+#endif
+#ifndef FALSE
+#define FALSE   0
+#endif
+
+#endif
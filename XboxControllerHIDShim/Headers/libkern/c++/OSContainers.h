@@ -0,0 +1,314 @@
+//
+//  OSContainers.h
+//  XboxControllerHIDShim
+//
+//  OSObject and the libkern containers the driver and the personality use.
+//  Objects are reference counted and freed by their last release(), as in
+//  the kernel, and come from a zero-filled allocation, which the driver
+//  relies on for the members its init() doesn't set. OSDynamicCast() is the
+//  C++ dynamic_cast, and the metaclass only keeps a class's name and how to
+//  allocate one, for getName() and for matching a personality's IOClass.
+//
+
+#ifndef XboxControllerHIDShim_OSContainers_h
+#define XboxControllerHIDShim_OSContainers_h
+
+#include <libkern/OSTypes.h>
+
+class OSObject;
+class OSSerialize;
+
+typedef OSObject OSMetaClassBase;
+
+class OSMetaClass
+{
+    const char *        className;
+    OSObject *          (*allocator)(void);
+    const OSMetaClass * next;           // of every class linked in
+
+public:
+    OSMetaClass(const char *className, OSObject *(*allocator)(void));
+    
+    const char *getClassName() const { return className; }
+    
+    // a new instance of the class, NULL for an unknown or abstract one
+    static OSObject *allocClassWithName(const char *name);
+};
+
+#define OSDeclareCommonStructors(className) \
+public: \
+static const OSMetaClass gMetaClass; \
+static const OSMetaClass * const metaClass; \
+virtual const OSMetaClass *getMetaClass() const;
+
+#define OSDeclareDefaultStructors(className) \
+OSDeclareCommonStructors(className) \
+public: \
+className(); \
+protected: \
+virtual ~className();
+
+#define OSDeclareAbstractStructors(className) \
+OSDeclareDefaultStructors(className)
+
+#define OSDefineMetaClassAndStructorsWithAllocator(className, superclassName, allocator) \
+const OSMetaClass className::gMetaClass(#className, allocator); \
+const OSMetaClass * const className::metaClass = &className::gMetaClass; \
+const OSMetaClass *className::getMetaClass() const { return &gMetaClass; } \
+className::className() : superclassName() { } \
+className::~className() { }
+
+#define OSDefineMetaClassAndStructors(className, superclassName) \
+static OSObject *className ## Allocate() { return new className; } \
+OSDefineMetaClassAndStructorsWithAllocator(className, superclassName, className ## Allocate)
+
+#define OSDefineMetaClassAndAbstractStructors(className, superclassName) \
+OSDefineMetaClassAndStructorsWithAllocator(className, superclassName, NULL)
+
+#define OSMetaClassDeclareReservedUnused(className, index) \
+private: \
+virtual void _RESERVED ## className ## index ()
+
+#define OSMetaClassDefineReservedUnused(className, index) \
+void className::_RESERVED ## className ## index () { }
+
+#define OSDynamicCast(type, inst)   (dynamic_cast<type *>((OSObject *)(inst)))
+
+class OSObject
+{
+    OSDeclareCommonStructors(OSObject)
+
+private:
+    mutable volatile SInt32 retainCount;
+
+protected:
+    virtual ~OSObject();
+    
+    // called by the last release()
+    virtual void free();
+
+public:
+    OSObject();
+    
+    static void *operator new(size_t size);
+    static void operator delete(void *memory, size_t size);
+    
+    virtual bool init();
+    
+    virtual void retain() const;
+    virtual void release() const;
+    virtual int getRetainCount() const;
+    
+    virtual bool isEqualTo(const OSObject *anObject) const;
+    virtual bool serialize(OSSerialize *serializer) const;
+};
+
+class OSString : public OSObject
+{
+    OSDeclareDefaultStructors(OSString)
+    
+    char *          string;
+    unsigned int    length;
+    
+    virtual void free();
+
+public:
+    static OSString *withCString(const char *cString);
+    static OSString *withString(const OSString *aString);
+    
+    virtual bool initWithCString(const char *cString);
+    
+    const char *getCStringNoCopy() const { return string; }
+    unsigned int getLength() const { return length; }
+    
+    virtual bool isEqualTo(const OSObject *anObject) const;
+    bool isEqualTo(const OSString *aString) const;
+    bool isEqualTo(const char *aCString) const;
+    
+    virtual bool serialize(OSSerialize *serializer) const;
+};
+
+// not uniqued, symbols compare by their string like any OSString
+class OSSymbol : public OSString
+{
+    OSDeclareDefaultStructors(OSSymbol)
+
+public:
+    static const OSSymbol *withCString(const char *cString);
+    static const OSSymbol *withString(const OSString *aString);
+};
+
+class OSNumber : public OSObject
+{
+    OSDeclareDefaultStructors(OSNumber)
+    
+    UInt64          value;
+    unsigned int    size;
+
+public:
+    static OSNumber *withNumber(unsigned long long value, unsigned int numberOfBits);
+    
+    unsigned int numberOfBits() const { return size; }
+    
+    UInt8 unsigned8BitValue() const { return (UInt8)value; }
+    UInt16 unsigned16BitValue() const { return (UInt16)value; }
+    UInt32 unsigned32BitValue() const { return (UInt32)value; }
+    UInt64 unsigned64BitValue() const { return value; }
+    
+    void setValue(unsigned long long newValue);
+    
+    virtual bool isEqualTo(const OSObject *anObject) const;
+    virtual bool serialize(OSSerialize *serializer) const;
+};
+
+// the two instances are never freed, retain and release are free to use
+class OSBoolean : public OSObject
+{
+    OSDeclareDefaultStructors(OSBoolean)
+    
+    bool    value;
+
+public:
+    static OSBoolean *withBoolean(bool value);
+    
+    bool getValue() const { return value; }
+    bool isTrue() const { return value; }
+    bool isFalse() const { return !value; }
+    
+    virtual void release() const;
+    
+    virtual bool isEqualTo(const OSObject *anObject) const;
+    virtual bool serialize(OSSerialize *serializer) const;
+    
+    // for the two instances
+    static OSBoolean *allocBoolean(bool value);
+};
+
+extern OSBoolean * const kOSBooleanTrue;
+extern OSBoolean * const kOSBooleanFalse;
+
+class OSData : public OSObject
+{
+    OSDeclareDefaultStructors(OSData)
+    
+    void *          data;
+    unsigned int    length;
+    
+    virtual void free();
+
+public:
+    static OSData *withBytes(const void *bytes, unsigned int numBytes);
+    
+    const void *getBytesNoCopy() const { return data; }
+    unsigned int getLength() const { return length; }
+    
+    virtual bool isEqualTo(const OSObject *anObject) const;
+    virtual bool serialize(OSSerialize *serializer) const;
+};
+
+class OSCollection : public OSObject
+{
+    OSDeclareAbstractStructors(OSCollection)
+
+public:
+    virtual unsigned int getCount() const = 0;
+    
+    // what an OSCollectionIterator returns at index: the object, or the key of a dictionary
+    virtual OSObject *iteratorObject(unsigned int index) const = 0;
+};
+
+class OSArray : public OSCollection
+{
+    OSDeclareDefaultStructors(OSArray)
+    
+    OSObject **     array;
+    unsigned int    count;
+    unsigned int    capacity;
+    
+    virtual void free();
+
+public:
+    static OSArray *withCapacity(unsigned int capacity);
+    
+    virtual bool setObject(const OSObject *anObject);
+    virtual OSObject *getObject(unsigned int index) const;
+    virtual void removeObject(unsigned int index);
+    
+    virtual unsigned int getCount() const { return count; }
+    virtual OSObject *iteratorObject(unsigned int index) const { return getObject(index); }
+    
+    virtual bool serialize(OSSerialize *serializer) const;
+};
+
+class OSDictionary : public OSCollection
+{
+    OSDeclareDefaultStructors(OSDictionary)
+    
+    const OSSymbol **   keys;
+    OSObject **         objects;
+    unsigned int        count;
+    unsigned int        capacity;
+    
+    virtual void free();
+    int find(const char *aKey) const;
+
+public:
+    static OSDictionary *withCapacity(unsigned int capacity);
+    
+    // a shallow copy, the objects are shared
+    static OSDictionary *withDictionary(const OSDictionary *dict, unsigned int capacity = 0);
+    
+    virtual bool setObject(const OSSymbol *aKey, const OSObject *anObject);
+    bool setObject(const OSString *aKey, const OSObject *anObject);
+    bool setObject(const char *aKey, const OSObject *anObject);
+    
+    virtual OSObject *getObject(const OSSymbol *aKey) const;
+    OSObject *getObject(const OSString *aKey) const;
+    OSObject *getObject(const char *aKey) const;
+    
+    virtual void removeObject(const char *aKey);
+    
+    virtual unsigned int getCount() const { return count; }
+    virtual OSObject *iteratorObject(unsigned int index) const;
+    
+    virtual bool serialize(OSSerialize *serializer) const;
+};
+
+class OSCollectionIterator : public OSObject
+{
+    OSDeclareDefaultStructors(OSCollectionIterator)
+    
+    const OSCollection *    collection;
+    unsigned int            index;
+    
+    virtual void free();
+
+public:
+    static OSCollectionIterator *withCollection(const OSCollection *inColl);
+    
+    virtual void reset();
+    virtual OSObject *getNextObject();
+};
+
+// the XML property list of what is serialized into it
+class OSSerialize : public OSObject
+{
+    OSDeclareDefaultStructors(OSSerialize)
+    
+    char *          buffer;
+    unsigned int    length;
+    unsigned int    capacity;
+    
+    virtual void free();
+
+public:
+    static OSSerialize *withCapacity(unsigned int capacity);
+    
+    virtual bool addString(const char *cString);
+    bool addXMLString(const char *cString);     // with &, < and > escaped
+    
+    const char *text() const { return buffer ? buffer : ""; }
+    unsigned int getLength() const { return length; }
+};
+
+#endif
@@ -0,0 +1,18 @@
+//
+//  OSUnserialize.h
+//  XboxControllerHIDShim
+//
+//  Property lists into libkern containers, for loading the driver's
+//  personality from its Info.plist. Understands the elements an Info.plist
+//  has: dict, array, key, string, integer, data, true and false.
+//
+
+#ifndef XboxControllerHIDShim_OSUnserialize_h
+#define XboxControllerHIDShim_OSUnserialize_h
+
+#include <libkern/c++/OSContainers.h>
+
+// the top level object of buffer, or NULL with the reason in *errorString
+OSObject *OSUnserializeXML(const char *buffer, OSString **errorString = 0);
+
+#endif
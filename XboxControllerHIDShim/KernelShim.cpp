@@ -0,0 +1,494 @@
+//
+//  KernelShim.cpp
+//  XboxControllerHIDShim
+//
+//  The kernel services under the driver: logging, allocation, the clock,
+//  the locks, the callout threads and the memory descriptors.
+//
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+
+#include <IOKit/IOLib.h>
+#include <IOKit/IOBufferMemoryDescriptor.h>
+#include <IOKit/usb/IOUSBLog.h>
+
+#include "KernelShimPrivate.h"
+
+task_t kernel_task = (task_t)&kernel_task;
+const vm_size_t page_size = 4096;
+
+static struct task {
+    
+    int unused;
+    
+} gCurrentTask;
+
+task_t
+current_task(void)
+{
+    return &gCurrentTask;
+}
+
+// -- logging -----------------------------------------------
+// ----------------------------------------------------------
+
+static int
+logLevel()
+{
+    static int level = -2;
+    
+    if (level == -2) {
+        
+        const char *value = getenv("XB_SHIM_LOG");
+        level = value ? atoi(value) : -1;
+    }
+    return level;
+}
+
+void
+XBShimLog(UInt32 level, const char *format, ...)
+{
+    va_list arguments;
+    
+    if ((int)level > logLevel())
+        return;
+    
+    va_start(arguments, format);
+    vfprintf(stderr, format, arguments);
+    va_end(arguments);
+    fputc('\n', stderr);
+}
+
+void
+IOLog(const char *format, ...)
+{
+    va_list arguments;
+    
+    if (logLevel() < 0)
+        return;
+    
+    va_start(arguments, format);
+    vfprintf(stderr, format, arguments);
+    va_end(arguments);
+}
+
+void *
+IOMalloc(vm_size_t size)
+{
+    return malloc(size);
+}
+
+void
+IOFree(void *address, vm_size_t size)
+{
+    free(address);
+}
+
+// -- clock -------------------------------------------------
+// ----------------------------------------------------------
+
+void
+clock_get_uptime(UInt64 *result)
+{
+    struct timespec now;
+    
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    *result = (UInt64)now.tv_sec * kSecondScale + now.tv_nsec;
+}
+
+void
+clock_interval_to_deadline(UInt32 interval, UInt32 scaleFactor, UInt64 *result)
+{
+    clock_get_uptime(result);
+    *result += (UInt64)interval * scaleFactor;
+}
+
+void
+XBShimInitCondition(pthread_cond_t *condition)
+{
+    pthread_condattr_t attributes;
+    
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(condition, &attributes);
+    pthread_condattr_destroy(&attributes);
+}
+
+void
+XBShimDeadline(UInt64 uptime, struct timespec *deadline)
+{
+    deadline->tv_sec = uptime / kSecondScale;
+    deadline->tv_nsec = uptime % kSecondScale;
+}
+
+// -- locks -------------------------------------------------
+// ----------------------------------------------------------
+
+struct _IOLock {
+    
+    pthread_mutex_t mutex;
+    pthread_cond_t  condition;
+};
+
+struct _IOSimpleLock {
+    
+    pthread_mutex_t mutex;
+};
+
+IOLock *
+IOLockAlloc(void)
+{
+    IOLock *lock = (IOLock *)IOMalloc(sizeof(IOLock));
+    
+    if (!lock)
+        return NULL;
+    
+    pthread_mutex_init(&lock->mutex, NULL);
+    XBShimInitCondition(&lock->condition);
+    return lock;
+}
+
+void
+IOLockFree(IOLock *lock)
+{
+    pthread_cond_destroy(&lock->condition);
+    pthread_mutex_destroy(&lock->mutex);
+    IOFree(lock, sizeof(IOLock));
+}
+
+void
+IOLockLock(IOLock *lock)
+{
+    pthread_mutex_lock(&lock->mutex);
+}
+
+void
+IOLockUnlock(IOLock *lock)
+{
+    pthread_mutex_unlock(&lock->mutex);
+}
+
+int
+IOLockSleep(IOLock *lock, void *event, UInt32 interType)
+{
+    pthread_cond_wait(&lock->condition, &lock->mutex);
+    return THREAD_AWAKENED;
+}
+
+int
+IOLockSleepDeadline(IOLock *lock, void *event, AbsoluteTime deadline, UInt32 interType)
+{
+    struct timespec time;
+    
+    XBShimDeadline(deadline, &time);
+    if (pthread_cond_timedwait(&lock->condition, &lock->mutex, &time) == ETIMEDOUT)
+        return THREAD_TIMED_OUT;
+    return THREAD_AWAKENED;
+}
+
+void
+IOLockWakeup(IOLock *lock, void *event, bool oneThread)
+{
+    pthread_cond_broadcast(&lock->condition);
+}
+
+IOSimpleLock *
+IOSimpleLockAlloc(void)
+{
+    IOSimpleLock *lock = (IOSimpleLock *)IOMalloc(sizeof(IOSimpleLock));
+    
+    if (lock)
+        pthread_mutex_init(&lock->mutex, NULL);
+    return lock;
+}
+
+void
+IOSimpleLockFree(IOSimpleLock *lock)
+{
+    pthread_mutex_destroy(&lock->mutex);
+    IOFree(lock, sizeof(IOSimpleLock));
+}
+
+void
+IOSimpleLockLock(IOSimpleLock *lock)
+{
+    pthread_mutex_lock(&lock->mutex);
+}
+
+void
+IOSimpleLockUnlock(IOSimpleLock *lock)
+{
+    pthread_mutex_unlock(&lock->mutex);
+}
+
+// -- thread calls ------------------------------------------
+// ----------------------------------------------------------
+
+// Pending calls wait in a queue for one of the callout threads. A call that
+// is entered again while it runs may run again on another thread meanwhile,
+// as in the kernel.
+#define kCalloutThreads     4
+
+struct thread_call {
+    
+    thread_call_func_t      func;
+    thread_call_param_t     param0;
+    thread_call_param_t     param1;
+    bool                    pending;
+    UInt32                  running;
+    struct thread_call *    next;
+};
+
+static pthread_mutex_t  gCalloutLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   gCalloutQueued = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t   gCalloutDone = PTHREAD_COND_INITIALIZER;
+static thread_call_t    gCalloutHead, gCalloutTail;
+static pthread_once_t   gCalloutOnce = PTHREAD_ONCE_INIT;
+
+static void *
+calloutThread(void *arg)
+{
+    pthread_mutex_lock(&gCalloutLock);
+    
+    for (;;) {
+        
+        thread_call_t call;
+        thread_call_param_t param1;
+        
+        while (!gCalloutHead)
+            pthread_cond_wait(&gCalloutQueued, &gCalloutLock);
+        
+        call = gCalloutHead;
+        gCalloutHead = call->next;
+        if (!gCalloutHead)
+            gCalloutTail = NULL;
+        call->next = NULL;
+        call->pending = false;
+        call->running++;
+        param1 = call->param1;
+        pthread_mutex_unlock(&gCalloutLock);
+        
+        call->func(call->param0, param1);
+        
+        pthread_mutex_lock(&gCalloutLock);
+        call->running--;
+        pthread_cond_broadcast(&gCalloutDone);
+    }
+    
+    return NULL;
+}
+
+static void
+startCalloutThreads()
+{
+    for (int i = 0; i < kCalloutThreads; i++) {
+        
+        pthread_t thread;
+        
+        if (pthread_create(&thread, NULL, calloutThread, NULL) == 0)
+            pthread_detach(thread);
+    }
+}
+
+// unlinks a pending call, with gCalloutLock held
+static void
+dequeueCall(thread_call_t call)
+{
+    thread_call_t *link = &gCalloutHead;
+    thread_call_t previous = NULL;
+    
+    while (*link && *link != call) {
+        previous = *link;
+        link = &(*link)->next;
+    }
+    if (!*link)
+        return;
+    
+    *link = call->next;
+    if (gCalloutTail == call)
+        gCalloutTail = previous;
+    call->next = NULL;
+    call->pending = false;
+}
+
+thread_call_t
+thread_call_allocate(thread_call_func_t func, thread_call_param_t param0)
+{
+    thread_call_t call;
+    
+    pthread_once(&gCalloutOnce, startCalloutThreads);
+    
+    call = (thread_call_t)calloc(1, sizeof(struct thread_call));
+    if (!call)
+        return NULL;
+    
+    call->func = func;
+    call->param0 = param0;
+    return call;
+}
+
+Boolean
+thread_call_enter1(thread_call_t call, thread_call_param_t param1)
+{
+    Boolean wasPending;
+    
+    pthread_mutex_lock(&gCalloutLock);
+    
+    wasPending = call->pending;
+    call->param1 = param1;
+    if (!wasPending) {
+        
+        call->pending = true;
+        if (gCalloutTail)
+            gCalloutTail->next = call;
+        else
+            gCalloutHead = call;
+        gCalloutTail = call;
+        pthread_cond_signal(&gCalloutQueued);
+    }
+    
+    pthread_mutex_unlock(&gCalloutLock);
+    return wasPending;
+}
+
+Boolean
+thread_call_enter(thread_call_t call)
+{
+    return thread_call_enter1(call, NULL);
+}
+
+Boolean
+thread_call_cancel(thread_call_t call)
+{
+    Boolean wasPending;
+    
+    pthread_mutex_lock(&gCalloutLock);
+    wasPending = call->pending;
+    if (wasPending)
+        dequeueCall(call);
+    pthread_mutex_unlock(&gCalloutLock);
+    
+    return wasPending;
+}
+
+Boolean
+thread_call_free(thread_call_t call)
+{
+    pthread_mutex_lock(&gCalloutLock);
+    
+    if (call->pending) {
+        pthread_mutex_unlock(&gCalloutLock);
+        return FALSE;
+    }
+    
+    while (call->running)
+        pthread_cond_wait(&gCalloutDone, &gCalloutLock);
+    
+    pthread_mutex_unlock(&gCalloutLock);
+    free(call);
+    return TRUE;
+}
+
+// -- memory descriptors ------------------------------------
+// ----------------------------------------------------------
+
+OSDefineMetaClassAndStructors(IOMemoryDescriptor, OSObject)
+
+IOMemoryDescriptor *
+IOMemoryDescriptor::withAddress(void *address, IOByteCount withLength, IODirection withDirection)
+{
+    IOMemoryDescriptor *me = new IOMemoryDescriptor;
+    
+    if (me && !me->init()) {
+        me->release();
+        return NULL;
+    }
+    
+    me->_bytes = address;
+    me->_length = withLength;
+    me->_direction = withDirection;
+    return me;
+}
+
+IOByteCount
+IOMemoryDescriptor::readBytes(IOByteCount offset, void *bytes, IOByteCount withLength)
+{
+    if (offset >= _length)
+        return 0;
+    if (withLength > _length - offset)
+        withLength = _length - offset;
+    
+    memcpy(bytes, (UInt8 *)_bytes + offset, withLength);
+    return withLength;
+}
+
+IOByteCount
+IOMemoryDescriptor::writeBytes(IOByteCount offset, const void *bytes, IOByteCount withLength)
+{
+    if (offset >= _length)
+        return 0;
+    if (withLength > _length - offset)
+        withLength = _length - offset;
+    
+    memcpy((UInt8 *)_bytes + offset, bytes, withLength);
+    return withLength;
+}
+
+OSDefineMetaClassAndStructors(IOBufferMemoryDescriptor, IOMemoryDescriptor)
+
+IOBufferMemoryDescriptor *
+IOBufferMemoryDescriptor::inTaskWithOptions(task_t inTask, IOOptionBits options,
+                                            vm_size_t capacity, vm_offset_t alignment)
+{
+    IOBufferMemoryDescriptor *me = new IOBufferMemoryDescriptor;
+    void *bytes = NULL;
+    
+    if (!me)
+        return NULL;
+    
+    if (alignment < sizeof(void *))
+        alignment = sizeof(void *);
+    if (!me->init() || posix_memalign(&bytes, alignment, capacity ? capacity : 1) != 0) {
+        me->release();
+        return NULL;
+    }
+    
+    memset(bytes, 0, capacity);
+    me->_bytes = bytes;
+    me->_length = capacity;
+    me->_capacity = capacity;
+    me->_direction = options & kIODirectionInOut;
+    return me;
+}
+
+IOBufferMemoryDescriptor *
+IOBufferMemoryDescriptor::withCapacity(vm_size_t capacity, IODirection withDirection, bool withContiguousMemory)
+{
+    return inTaskWithOptions(kernel_task, withDirection, capacity, 1);
+}
+
+IOBufferMemoryDescriptor *
+IOBufferMemoryDescriptor::withBytes(const void *bytes, vm_size_t withLength, IODirection withDirection,
+                                    bool withContiguousMemory)
+{
+    IOBufferMemoryDescriptor *me = withCapacity(withLength, withDirection, withContiguousMemory);
+    
+    if (me)
+        memcpy(me->_bytes, bytes, withLength);
+    return me;
+}
+
+void
+IOBufferMemoryDescriptor::setLength(vm_size_t length)
+{
+    _length = length < _capacity ? length : _capacity;
+}
+
+void
+IOBufferMemoryDescriptor::free()
+{
+    ::free(_bytes);
+    IOMemoryDescriptor::free();
+}
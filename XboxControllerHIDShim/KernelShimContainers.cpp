@@ -0,0 +1,1031 @@
+//
+//  KernelShimContainers.cpp
+//  XboxControllerHIDShim
+//
+//  OSObject, the containers, and the property lists they are read from and
+//  written to.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libkern/OSAtomic.h>
+#include <libkern/c++/OSContainers.h>
+#include <libkern/c++/OSUnserialize.h>
+
+// -- metaclasses -------------------------------------------
+// ----------------------------------------------------------
+
+// constant-initialized, so the classes can link in from any static constructor
+static const OSMetaClass *gClasses = NULL;
+
+OSMetaClass::OSMetaClass(const char *inClassName, OSObject *(*inAllocator)(void))
+    : className(inClassName), allocator(inAllocator), next(gClasses)
+{
+    gClasses = this;
+}
+
+OSObject *
+OSMetaClass::allocClassWithName(const char *name)
+{
+    for (const OSMetaClass *meta = gClasses; meta; meta = meta->next)
+        if (strcmp(meta->className, name) == 0)
+            return meta->allocator ? meta->allocator() : NULL;
+    
+    return NULL;
+}
+
+// -- OSObject ----------------------------------------------
+// ----------------------------------------------------------
+
+const OSMetaClass OSObject::gMetaClass("OSObject", NULL);
+const OSMetaClass * const OSObject::metaClass = &OSObject::gMetaClass;
+
+const OSMetaClass *
+OSObject::getMetaClass() const
+{
+    return &gMetaClass;
+}
+
+OSObject::OSObject() : retainCount(1)
+{
+}
+
+OSObject::~OSObject()
+{
+}
+
+void *
+OSObject::operator new(size_t size)
+{
+    return calloc(1, size);
+}
+
+void
+OSObject::operator delete(void *memory, size_t size)
+{
+    ::free(memory);
+}
+
+bool
+OSObject::init()
+{
+    return true;
+}
+
+void
+OSObject::free()
+{
+    delete this;
+}
+
+void
+OSObject::retain() const
+{
+    OSIncrementAtomic(&retainCount);
+}
+
+void
+OSObject::release() const
+{
+    if (OSDecrementAtomic(&retainCount) == 1)
+        const_cast<OSObject *>(this)->free();
+}
+
+int
+OSObject::getRetainCount() const
+{
+    return retainCount;
+}
+
+bool
+OSObject::isEqualTo(const OSObject *anObject) const
+{
+    return this == anObject;
+}
+
+bool
+OSObject::serialize(OSSerialize *serializer) const
+{
+    return serializer->addString("<string/>");
+}
+
+// -- OSString, OSSymbol ------------------------------------
+// ----------------------------------------------------------
+
+OSDefineMetaClassAndStructors(OSString, OSObject)
+
+OSString *
+OSString::withCString(const char *cString)
+{
+    OSString *me = new OSString;
+    
+    if (me && !me->initWithCString(cString)) {
+        me->release();
+        return NULL;
+    }
+    return me;
+}
+
+OSString *
+OSString::withString(const OSString *aString)
+{
+    return withCString(aString->getCStringNoCopy());
+}
+
+bool
+OSString::initWithCString(const char *cString)
+{
+    if (!cString || !OSObject::init())
+        return false;
+    
+    string = strdup(cString);
+    length = (unsigned int)strlen(cString);
+    return string != NULL;
+}
+
+void
+OSString::free()
+{
+    ::free(string);
+    OSObject::free();
+}
+
+bool
+OSString::isEqualTo(const OSObject *anObject) const
+{
+    const OSString *aString = OSDynamicCast(const OSString, anObject);
+    
+    return aString && isEqualTo(aString);
+}
+
+bool
+OSString::isEqualTo(const OSString *aString) const
+{
+    return length == aString->length && strcmp(string, aString->string) == 0;
+}
+
+bool
+OSString::isEqualTo(const char *aCString) const
+{
+    return strcmp(string, aCString) == 0;
+}
+
+bool
+OSString::serialize(OSSerialize *serializer) const
+{
+    return serializer->addString("<string>")
+        && serializer->addXMLString(string)
+        && serializer->addString("</string>");
+}
+
+OSDefineMetaClassAndStructors(OSSymbol, OSString)
+
+const OSSymbol *
+OSSymbol::withCString(const char *cString)
+{
+    OSSymbol *me = new OSSymbol;
+    
+    if (me && !me->initWithCString(cString)) {
+        me->release();
+        return NULL;
+    }
+    return me;
+}
+
+const OSSymbol *
+OSSymbol::withString(const OSString *aString)
+{
+    return withCString(aString->getCStringNoCopy());
+}
+
+// -- OSNumber, OSBoolean, OSData ---------------------------
+// ----------------------------------------------------------
+
+OSDefineMetaClassAndStructors(OSNumber, OSObject)
+
+OSNumber *
+OSNumber::withNumber(unsigned long long value, unsigned int numberOfBits)
+{
+    OSNumber *me = new OSNumber;
+    
+    if (me && !me->init()) {
+        me->release();
+        return NULL;
+    }
+    
+    me->size = numberOfBits;
+    me->setValue(value);
+    return me;
+}
+
+void
+OSNumber::setValue(unsigned long long newValue)
+{
+    value = size < 64 ? newValue & ((1ULL << size) - 1) : newValue;
+}
+
+bool
+OSNumber::isEqualTo(const OSObject *anObject) const
+{
+    const OSNumber *aNumber = OSDynamicCast(const OSNumber, anObject);
+    
+    return aNumber && aNumber->value == value;
+}
+
+bool
+OSNumber::serialize(OSSerialize *serializer) const
+{
+    char text[64];
+    
+    snprintf(text, sizeof(text), "<integer size=\"%u\">0x%llx</integer>", size, (unsigned long long)value);
+    return serializer->addString(text);
+}
+
+OSDefineMetaClassAndStructors(OSBoolean, OSObject)
+
+OSBoolean * const kOSBooleanTrue = OSBoolean::allocBoolean(true);
+OSBoolean * const kOSBooleanFalse = OSBoolean::allocBoolean(false);
+
+OSBoolean *
+OSBoolean::allocBoolean(bool value)
+{
+    OSBoolean *me = new OSBoolean;
+    
+    me->value = value;
+    return me;
+}
+
+OSBoolean *
+OSBoolean::withBoolean(bool value)
+{
+    return value ? kOSBooleanTrue : kOSBooleanFalse;
+}
+
+void
+OSBoolean::release() const
+{
+}
+
+bool
+OSBoolean::isEqualTo(const OSObject *anObject) const
+{
+    return this == anObject;
+}
+
+bool
+OSBoolean::serialize(OSSerialize *serializer) const
+{
+    return serializer->addString(value ? "<true/>" : "<false/>");
+}
+
+OSDefineMetaClassAndStructors(OSData, OSObject)
+
+OSData *
+OSData::withBytes(const void *bytes, unsigned int numBytes)
+{
+    OSData *me = new OSData;
+    
+    if (!me)
+        return NULL;
+    
+    me->data = malloc(numBytes ? numBytes : 1);
+    if (!me->init() || !me->data) {
+        me->release();
+        return NULL;
+    }
+    
+    memcpy(me->data, bytes, numBytes);
+    me->length = numBytes;
+    return me;
+}
+
+void
+OSData::free()
+{
+    ::free(data);
+    OSObject::free();
+}
+
+bool
+OSData::isEqualTo(const OSObject *anObject) const
+{
+    const OSData *aData = OSDynamicCast(const OSData, anObject);
+    
+    return aData && aData->length == length && memcmp(aData->data, data, length) == 0;
+}
+
+bool
+OSData::serialize(OSSerialize *serializer) const
+{
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    const UInt8 *bytes = (const UInt8 *)data;
+    char quad[5] = { 0 };
+    
+    if (!serializer->addString("<data>"))
+        return false;
+    
+    for (unsigned int i = 0; i < length; i += 3) {
+        
+        UInt32 group = bytes[i] << 16;
+        
+        if (i + 1 < length)
+            group |= bytes[i + 1] << 8;
+        if (i + 2 < length)
+            group |= bytes[i + 2];
+        
+        quad[0] = digits[(group >> 18) & 63];
+        quad[1] = digits[(group >> 12) & 63];
+        quad[2] = i + 1 < length ? digits[(group >> 6) & 63] : '=';
+        quad[3] = i + 2 < length ? digits[group & 63] : '=';
+        if (!serializer->addString(quad))
+            return false;
+    }
+    
+    return serializer->addString("</data>");
+}
+
+// -- collections -------------------------------------------
+// ----------------------------------------------------------
+
+OSDefineMetaClassAndAbstractStructors(OSCollection, OSObject)
+
+static bool
+growArray(void **array, unsigned int *capacity, unsigned int needed, size_t size)
+{
+    unsigned int newCapacity;
+    void *newArray;
+    
+    if (needed <= *capacity)
+        return true;
+    
+    newCapacity = *capacity ? *capacity * 2 : 4;
+    if (newCapacity < needed)
+        newCapacity = needed;
+    
+    newArray = realloc(*array, newCapacity * size);
+    if (!newArray)
+        return false;
+    
+    *array = newArray;
+    *capacity = newCapacity;
+    return true;
+}
+
+OSDefineMetaClassAndStructors(OSArray, OSCollection)
+
+OSArray *
+OSArray::withCapacity(unsigned int capacity)
+{
+    OSArray *me = new OSArray;
+    
+    if (me && (!me->init() || !growArray((void **)&me->array, &me->capacity, capacity, sizeof(OSObject *)))) {
+        me->release();
+        return NULL;
+    }
+    return me;
+}
+
+void
+OSArray::free()
+{
+    for (unsigned int i = 0; i < count; i++)
+        array[i]->release();
+    ::free(array);
+    OSCollection::free();
+}
+
+bool
+OSArray::setObject(const OSObject *anObject)
+{
+    if (!anObject || !growArray((void **)&array, &capacity, count + 1, sizeof(OSObject *)))
+        return false;
+    
+    anObject->retain();
+    array[count++] = const_cast<OSObject *>(anObject);
+    return true;
+}
+
+OSObject *
+OSArray::getObject(unsigned int index) const
+{
+    return index < count ? array[index] : NULL;
+}
+
+void
+OSArray::removeObject(unsigned int index)
+{
+    OSObject *object;
+    
+    if (index >= count)
+        return;
+    
+    object = array[index];
+    memmove(&array[index], &array[index + 1], (count - index - 1) * sizeof(OSObject *));
+    count--;
+    object->release();
+}
+
+bool
+OSArray::serialize(OSSerialize *serializer) const
+{
+    if (!serializer->addString("<array>"))
+        return false;
+    
+    for (unsigned int i = 0; i < count; i++)
+        if (!array[i]->serialize(serializer))
+            return false;
+    
+    return serializer->addString("</array>");
+}
+
+OSDefineMetaClassAndStructors(OSDictionary, OSCollection)
+
+OSDictionary *
+OSDictionary::withCapacity(unsigned int capacity)
+{
+    OSDictionary *me = new OSDictionary;
+    
+    if (!me)
+        return NULL;
+    
+    // both arrays grow together, sized by capacity
+    if (!me->init() || !growArray((void **)&me->keys, &me->capacity, capacity ? capacity : 1, sizeof(OSSymbol *))
+        || !(me->objects = (OSObject **)calloc(me->capacity, sizeof(OSObject *)))) {
+        me->release();
+        return NULL;
+    }
+    return me;
+}
+
+OSDictionary *
+OSDictionary::withDictionary(const OSDictionary *dict, unsigned int capacity)
+{
+    OSDictionary *me = withCapacity(capacity > dict->count ? capacity : dict->count);
+    
+    if (!me)
+        return NULL;
+    
+    for (unsigned int i = 0; i < dict->count; i++)
+        me->setObject(dict->keys[i], dict->objects[i]);
+    return me;
+}
+
+void
+OSDictionary::free()
+{
+    for (unsigned int i = 0; i < count; i++) {
+        keys[i]->release();
+        objects[i]->release();
+    }
+    ::free(keys);
+    ::free(objects);
+    OSCollection::free();
+}
+
+int
+OSDictionary::find(const char *aKey) const
+{
+    for (unsigned int i = 0; i < count; i++)
+        if (strcmp(keys[i]->getCStringNoCopy(), aKey) == 0)
+            return (int)i;
+    
+    return -1;
+}
+
+bool
+OSDictionary::setObject(const OSSymbol *aKey, const OSObject *anObject)
+{
+    int index;
+    
+    if (!aKey || !anObject)
+        return false;
+    
+    index = find(aKey->getCStringNoCopy());
+    anObject->retain();
+    
+    if (index >= 0) {
+        
+        objects[index]->release();
+        objects[index] = const_cast<OSObject *>(anObject);
+        return true;
+    }
+    
+    if (count == capacity) {
+        
+        unsigned int keyCapacity = capacity;
+        OSObject **newObjects;
+        
+        if (!growArray((void **)&keys, &keyCapacity, count + 1, sizeof(OSSymbol *))) {
+            anObject->release();
+            return false;
+        }
+        newObjects = (OSObject **)realloc(objects, keyCapacity * sizeof(OSObject *));
+        if (!newObjects) {
+            anObject->release();
+            return false;
+        }
+        objects = newObjects;
+        capacity = keyCapacity;
+    }
+    
+    aKey->retain();
+    keys[count] = aKey;
+    objects[count] = const_cast<OSObject *>(anObject);
+    count++;
+    return true;
+}
+
+bool
+OSDictionary::setObject(const OSString *aKey, const OSObject *anObject)
+{
+    const OSSymbol *symbol;
+    bool result;
+    
+    if (!aKey)
+        return false;
+    
+    symbol = OSSymbol::withString(aKey);
+    result = setObject(symbol, anObject);
+    if (symbol)
+        symbol->release();
+    return result;
+}
+
+bool
+OSDictionary::setObject(const char *aKey, const OSObject *anObject)
+{
+    const OSSymbol *symbol;
+    bool result;
+    
+    if (!aKey)
+        return false;
+    
+    symbol = OSSymbol::withCString(aKey);
+    result = setObject(symbol, anObject);
+    if (symbol)
+        symbol->release();
+    return result;
+}
+
+OSObject *
+OSDictionary::getObject(const OSSymbol *aKey) const
+{
+    return aKey ? getObject(aKey->getCStringNoCopy()) : NULL;
+}
+
+OSObject *
+OSDictionary::getObject(const OSString *aKey) const
+{
+    return aKey ? getObject(aKey->getCStringNoCopy()) : NULL;
+}
+
+OSObject *
+OSDictionary::getObject(const char *aKey) const
+{
+    int index = aKey ? find(aKey) : -1;
+    
+    return index >= 0 ? objects[index] : NULL;
+}
+
+void
+OSDictionary::removeObject(const char *aKey)
+{
+    int index = find(aKey);
+    const OSSymbol *key;
+    OSObject *object;
+    
+    if (index < 0)
+        return;
+    
+    key = keys[index];
+    object = objects[index];
+    memmove(&keys[index], &keys[index + 1], (count - index - 1) * sizeof(OSSymbol *));
+    memmove(&objects[index], &objects[index + 1], (count - index - 1) * sizeof(OSObject *));
+    count--;
+    key->release();
+    object->release();
+}
+
+OSObject *
+OSDictionary::iteratorObject(unsigned int index) const
+{
+    return index < count ? const_cast<OSSymbol *>(keys[index]) : NULL;
+}
+
+bool
+OSDictionary::serialize(OSSerialize *serializer) const
+{
+    if (!serializer->addString("<dict>"))
+        return false;
+    
+    for (unsigned int i = 0; i < count; i++)
+        if (!serializer->addString("<key>")
+            || !serializer->addXMLString(keys[i]->getCStringNoCopy())
+            || !serializer->addString("</key>")
+            || !objects[i]->serialize(serializer))
+            return false;
+    
+    return serializer->addString("</dict>");
+}
+
+OSDefineMetaClassAndStructors(OSCollectionIterator, OSObject)
+
+OSCollectionIterator *
+OSCollectionIterator::withCollection(const OSCollection *inColl)
+{
+    OSCollectionIterator *me;
+    
+    if (!inColl)
+        return NULL;
+    
+    me = new OSCollectionIterator;
+    if (me && !me->init()) {
+        me->release();
+        return NULL;
+    }
+    
+    inColl->retain();
+    me->collection = inColl;
+    return me;
+}
+
+void
+OSCollectionIterator::free()
+{
+    if (collection)
+        collection->release();
+    OSObject::free();
+}
+
+void
+OSCollectionIterator::reset()
+{
+    index = 0;
+}
+
+OSObject *
+OSCollectionIterator::getNextObject()
+{
+    OSObject *object = collection->iteratorObject(index);
+    
+    if (object)
+        index++;
+    return object;
+}
+
+// -- OSSerialize -------------------------------------------
+// ----------------------------------------------------------
+
+OSDefineMetaClassAndStructors(OSSerialize, OSObject)
+
+OSSerialize *
+OSSerialize::withCapacity(unsigned int capacity)
+{
+    OSSerialize *me = new OSSerialize;
+    
+    if (me && (!me->init() || !growArray((void **)&me->buffer, &me->capacity, capacity + 1, 1))) {
+        me->release();
+        return NULL;
+    }
+    
+    me->buffer[0] = '\0';
+    return me;
+}
+
+void
+OSSerialize::free()
+{
+    ::free(buffer);
+    OSObject::free();
+}
+
+bool
+OSSerialize::addString(const char *cString)
+{
+    unsigned int added = (unsigned int)strlen(cString);
+    
+    if (!growArray((void **)&buffer, &capacity, length + added + 1, 1))
+        return false;
+    
+    memcpy(buffer + length, cString, added + 1);
+    length += added;
+    return true;
+}
+
+bool
+OSSerialize::addXMLString(const char *cString)
+{
+    char character[2] = { 0 };
+    
+    for (; *cString; cString++) {
+        
+        bool added;
+        
+        switch (*cString) {
+            case '&':   added = addString("&amp;");    break;
+            case '<':   added = addString("&lt;");     break;
+            case '>':   added = addString("&gt;");     break;
+            default:
+                character[0] = *cString;
+                added = addString(character);
+                break;
+        }
+        if (!added)
+            return false;
+    }
+    return true;
+}
+
+// -- OSUnserializeXML --------------------------------------
+// ----------------------------------------------------------
+
+typedef struct {
+    
+    const char *    next;
+    const char *    error;
+    
+} XBPlistParser;
+
+typedef struct {
+    
+    char    name[16];
+    bool    closing;
+    bool    empty;      // <name/>
+    
+} XBPlistTag;
+
+static void
+skipSpace(XBPlistParser *parser)
+{
+    while (*parser->next == ' ' || *parser->next == '\t' || *parser->next == '\n' || *parser->next == '\r')
+        parser->next++;
+}
+
+// the next element tag, past the processing instructions, comments and DOCTYPE
+static bool
+nextTag(XBPlistParser *parser, XBPlistTag *tag)
+{
+    for (;;) {
+        
+        const char *end;
+        size_t length;
+        
+        skipSpace(parser);
+        if (*parser->next != '<') {
+            parser->error = *parser->next ? "text outside of an element" : "unexpected end";
+            return false;
+        }
+        
+        if (strncmp(parser->next, "<?", 2) == 0 || strncmp(parser->next, "<!", 2) == 0) {
+            
+            end = strncmp(parser->next, "<!--", 4) == 0 ? strstr(parser->next, "-->") : strchr(parser->next, '>');
+            if (!end) {
+                parser->error = "unterminated declaration";
+                return false;
+            }
+            parser->next = strchr(end, '>') + 1;
+            continue;
+        }
+        
+        end = strchr(parser->next, '>');
+        if (!end) {
+            parser->error = "unterminated tag";
+            return false;
+        }
+        
+        parser->next++;
+        tag->closing = *parser->next == '/';
+        if (tag->closing)
+            parser->next++;
+        tag->empty = end[-1] == '/';
+        
+        // the name, attributes are ignored
+        length = strcspn(parser->next, " \t\r\n/>");
+        if (length >= sizeof(tag->name)) {
+            parser->error = "unknown element";
+            return false;
+        }
+        memcpy(tag->name, parser->next, length);
+        tag->name[length] = '\0';
+        
+        parser->next = end + 1;
+        return true;
+    }
+}
+
+// the text up to the closing tag of name, with the entities replaced, malloc'd
+static char *
+elementText(XBPlistParser *parser, const char *name)
+{
+    char closing[24];
+    const char *end;
+    char *text, *out;
+    
+    snprintf(closing, sizeof(closing), "</%s>", name);
+    end = strstr(parser->next, closing);
+    if (!end) {
+        parser->error = "unterminated element";
+        return NULL;
+    }
+    
+    text = out = (char *)malloc(end - parser->next + 1);
+    if (!text) {
+        parser->error = "no memory";
+        return NULL;
+    }
+    
+    while (parser->next < end) {
+        
+        if (strncmp(parser->next, "&amp;", 5) == 0) {
+            *out++ = '&';
+            parser->next += 5;
+        } else if (strncmp(parser->next, "&lt;", 4) == 0) {
+            *out++ = '<';
+            parser->next += 4;
+        } else if (strncmp(parser->next, "&gt;", 4) == 0) {
+            *out++ = '>';
+            parser->next += 4;
+        } else
+            *out++ = *parser->next++;
+    }
+    *out = '\0';
+    
+    parser->next = end + strlen(closing);
+    return text;
+}
+
+static int
+base64Value(char c)
+{
+    if (c >= 'A' && c <= 'Z')   return c - 'A';
+    if (c >= 'a' && c <= 'z')   return c - 'a' + 26;
+    if (c >= '0' && c <= '9')   return c - '0' + 52;
+    if (c == '+')               return 62;
+    if (c == '/')               return 63;
+    return -1;
+}
+
+static OSData *
+decodeData(const char *text)
+{
+    size_t capacity = strlen(text) / 4 * 3 + 3;
+    UInt8 *bytes = (UInt8 *)malloc(capacity);
+    unsigned int length = 0, bits = 0;
+    UInt32 group = 0;
+    OSData *data;
+    
+    if (!bytes)
+        return NULL;
+    
+    for (; *text && *text != '='; text++) {
+        
+        int value = base64Value(*text);
+        
+        if (value < 0)
+            continue;   // whitespace
+        
+        group = group << 6 | value;
+        bits += 6;
+        if (bits >= 8) {
+            bits -= 8;
+            bytes[length++] = (UInt8)(group >> bits);
+        }
+    }
+    
+    data = OSData::withBytes(bytes, length);
+    free(bytes);
+    return data;
+}
+
+static OSObject *parseObject(XBPlistParser *parser, const XBPlistTag *tag);
+
+static OSObject *
+parseDictionary(XBPlistParser *parser)
+{
+    OSDictionary *dictionary = OSDictionary::withCapacity(8);
+    XBPlistTag tag;
+    
+    while (dictionary && nextTag(parser, &tag)) {
+        
+        char *key;
+        OSObject *object;
+        
+        if (tag.closing && strcmp(tag.name, "dict") == 0)
+            return dictionary;
+        
+        if (tag.closing || strcmp(tag.name, "key") != 0) {
+            parser->error = "expected a key";
+            break;
+        }
+        
+        key = tag.empty ? strdup("") : elementText(parser, "key");
+        if (!key || !nextTag(parser, &tag)) {
+            free(key);
+            break;
+        }
+        
+        object = parseObject(parser, &tag);
+        if (object) {
+            dictionary->setObject(key, object);
+            object->release();
+        }
+        free(key);
+        if (!object)
+            break;
+    }
+    
+    if (dictionary)
+        dictionary->release();
+    return NULL;
+}
+
+static OSObject *
+parseArray(XBPlistParser *parser)
+{
+    OSArray *array = OSArray::withCapacity(4);
+    XBPlistTag tag;
+    
+    while (array && nextTag(parser, &tag)) {
+        
+        OSObject *object;
+        
+        if (tag.closing && strcmp(tag.name, "array") == 0)
+            return array;
+        
+        object = parseObject(parser, &tag);
+        if (!object)
+            break;
+        array->setObject(object);
+        object->release();
+    }
+    
+    if (array)
+        array->release();
+    return NULL;
+}
+
+static OSObject *
+parseObject(XBPlistParser *parser, const XBPlistTag *tag)
+{
+    OSObject *object = NULL;
+    char *text;
+    
+    if (tag->closing) {
+        parser->error = "unexpected closing tag";
+        return NULL;
+    }
+    
+    if (strcmp(tag->name, "true") == 0)
+        return OSBoolean::withBoolean(true);
+    if (strcmp(tag->name, "false") == 0)
+        return OSBoolean::withBoolean(false);
+    
+    if (strcmp(tag->name, "dict") == 0)
+        return tag->empty ? OSDictionary::withCapacity(1) : parseDictionary(parser);
+    if (strcmp(tag->name, "array") == 0)
+        return tag->empty ? OSArray::withCapacity(1) : parseArray(parser);
+    
+    if (strcmp(tag->name, "string") != 0 && strcmp(tag->name, "integer") != 0 && strcmp(tag->name, "data") != 0) {
+        parser->error = "unknown element";
+        return NULL;
+    }
+    
+    text = tag->empty ? strdup("") : elementText(parser, tag->name);
+    if (!text)
+        return NULL;
+    
+    if (strcmp(tag->name, "string") == 0)
+        object = OSString::withCString(text);
+    else if (strcmp(tag->name, "integer") == 0)
+        object = OSNumber::withNumber(strtoull(text, NULL, 0), 64);
+    else
+        object = decodeData(text);
+    
+    free(text);
+    if (!object)
+        parser->error = "no memory";
+    return object;
+}
+
+OSObject *
+OSUnserializeXML(const char *buffer, OSString **errorString)
+{
+    XBPlistParser parser = { buffer, NULL };
+    XBPlistTag tag;
+    OSObject *object = NULL;
+    
+    // the <plist> wrapper is optional
+    if (nextTag(&parser, &tag)) {
+        
+        if (!tag.closing && strcmp(tag.name, "plist") == 0)
+            nextTag(&parser, &tag);
+        if (!parser.error)
+            object = parseObject(&parser, &tag);
+    }
+    
+    if (!object && errorString)
+        *errorString = OSString::withCString(parser.error ? parser.error : "no object");
+    return object;
+}
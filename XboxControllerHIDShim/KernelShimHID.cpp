@@ -0,0 +1,350 @@
+//
+//  KernelShimHID.cpp
+//  XboxControllerHIDShim
+//
+//  IOHIDDevice, and the little of the HID descriptor parser the driver
+//  calls.
+//
+
+#include <IOKit/IOLib.h>
+#include <IOKit/hid/IOHIDDevice.h>
+
+// -- IOHIDDevice -------------------------------------------
+// ----------------------------------------------------------
+
+// longest report handed on to the report handler
+#define kMaxReportBytes     256
+
+OSDefineMetaClassAndAbstractStructors(IOHIDDevice, IOService)
+
+bool
+IOHIDDevice::init(OSDictionary *dictionary)
+{
+    if (!IOService::init(dictionary))
+        return false;
+    
+    pthread_mutex_init(&_reportLock, NULL);
+    return true;
+}
+
+void
+IOHIDDevice::free()
+{
+    if (_workLoop)
+        _workLoop->release();
+    pthread_mutex_destroy(&_reportLock);
+    IOService::free();
+}
+
+bool
+IOHIDDevice::start(IOService *provider)
+{
+    if (!IOService::start(provider))
+        return false;
+    
+    _workLoop = IOWorkLoop::workLoop();
+    if (!_workLoop)
+        return false;
+    
+    if (!handleStart(provider))
+        return false;
+    
+    publishProperties();
+    return true;
+}
+
+void
+IOHIDDevice::stop(IOService *provider)
+{
+    handleStop(provider);
+    IOService::stop(provider);
+}
+
+bool
+IOHIDDevice::handleStart(IOService *provider)
+{
+    return true;
+}
+
+void
+IOHIDDevice::handleStop(IOService *provider)
+{
+}
+
+IOWorkLoop *
+IOHIDDevice::getWorkLoop() const
+{
+    return _workLoop;
+}
+
+// what IOHIDDevice::start() puts in the registry for the HID manager
+void
+IOHIDDevice::publishProperties()
+{
+    struct {
+        
+        const char *key;
+        OSObject *  object;
+        
+    } properties[] = {
+        { kIOHIDTransportKey,           newTransportString() },
+        { kIOHIDVendorIDKey,            newVendorIDNumber() },
+        { kIOHIDProductIDKey,           newProductIDNumber() },
+        { kIOHIDVersionNumberKey,       newVersionNumber() },
+        { kIOHIDManufacturerKey,        newManufacturerString() },
+        { kIOHIDProductKey,             newProductString() },
+        { kIOHIDSerialNumberKey,        newSerialNumberString() },
+        { kIOHIDLocationIDKey,          newLocationIDNumber() },
+        { kIOHIDPrimaryUsageKey,        newPrimaryUsageNumber() },
+        { kIOHIDPrimaryUsagePageKey,    newPrimaryUsagePageNumber() },
+    };
+    IOMemoryDescriptor *descriptor = NULL;
+    
+    for (unsigned int i = 0; i < sizeof(properties) / sizeof(properties[0]); i++)
+        if (properties[i].object) {
+            setProperty(properties[i].key, properties[i].object);
+            properties[i].object->release();
+        }
+    
+    if (newReportDescriptor(&descriptor) == kIOReturnSuccess && descriptor) {
+        
+        IOByteCount length = descriptor->getLength();
+        void *bytes = IOMalloc(length);
+        
+        if (bytes) {
+            
+            OSData *data;
+            
+            descriptor->readBytes(0, bytes, length);
+            data = OSData::withBytes(bytes, (unsigned int)length);
+            if (data) {
+                setProperty(kIOHIDReportDescriptorKey, data);
+                data->release();
+            }
+            IOFree(bytes, length);
+        }
+        descriptor->release();
+    }
+}
+
+IOReturn
+IOHIDDevice::newReportDescriptor(IOMemoryDescriptor **descriptor) const
+{
+    return kIOReturnUnsupported;
+}
+
+OSString *IOHIDDevice::newTransportString() const { return NULL; }
+OSString *IOHIDDevice::newManufacturerString() const { return NULL; }
+OSString *IOHIDDevice::newProductString() const { return NULL; }
+OSNumber *IOHIDDevice::newVendorIDNumber() const { return NULL; }
+OSNumber *IOHIDDevice::newProductIDNumber() const { return NULL; }
+OSNumber *IOHIDDevice::newVersionNumber() const { return NULL; }
+OSString *IOHIDDevice::newSerialNumberString() const { return NULL; }
+OSNumber *IOHIDDevice::newLocationIDNumber() const { return NULL; }
+OSNumber *IOHIDDevice::newPrimaryUsageNumber() const { return NULL; }
+OSNumber *IOHIDDevice::newPrimaryUsagePageNumber() const { return NULL; }
+OSString *IOHIDDevice::newIndexedString(UInt8 index) const { return NULL; }
+
+IOReturn
+IOHIDDevice::handleReport(IOMemoryDescriptor *report, IOHIDReportType reportType, IOOptionBits options)
+{
+    AbsoluteTime now;
+    
+    clock_get_uptime(&now);
+    return handleReportWithTime(now, report, reportType, options);
+}
+
+IOReturn
+IOHIDDevice::handleReportWithTime(AbsoluteTime timeStamp, IOMemoryDescriptor *report,
+                                  IOHIDReportType reportType, IOOptionBits options)
+{
+    UInt8 bytes[kMaxReportBytes];
+    UInt32 length;
+    
+    if (!report)
+        return kIOReturnBadArgument;
+    
+    length = (UInt32)report->readBytes(0, bytes, sizeof(bytes));
+    
+    // the HID event system takes one report at a time
+    pthread_mutex_lock(&_reportLock);
+    if (_reportHandler)
+        _reportHandler(_reportTarget, this, timeStamp, bytes, length);
+    pthread_mutex_unlock(&_reportLock);
+    
+    return kIOReturnSuccess;
+}
+
+IOReturn
+IOHIDDevice::getReport(IOMemoryDescriptor *report, IOHIDReportType reportType, IOOptionBits options)
+{
+    return kIOReturnUnsupported;
+}
+
+IOReturn
+IOHIDDevice::setReport(IOMemoryDescriptor *report, IOHIDReportType reportType, IOOptionBits options)
+{
+    return kIOReturnUnsupported;
+}
+
+void
+IOHIDDevice::setReportHandler(IOHIDReportHandler handler, void *target)
+{
+    pthread_mutex_lock(&_reportLock);
+    _reportHandler = handler;
+    _reportTarget = target;
+    pthread_mutex_unlock(&_reportLock);
+}
+
+// -- descriptor parser -------------------------------------
+// ----------------------------------------------------------
+
+#define kMaxReportIDs       256
+#define kMaxGlobalStack     8
+
+struct HIDPreparsedData {
+    
+    HIDCapabilities capabilities;
+};
+
+typedef struct {
+    
+    UInt32  usagePage;
+    UInt32  reportSize;
+    UInt32  reportCount;
+    UInt32  reportID;
+    
+} XBHIDGlobals;
+
+OSStatus
+HIDOpenReportDescriptor(void *hidReportDescriptor, IOByteCount descriptorLength,
+                        HIDPreparsedDataRef *preparsedDataRef, IOOptionBits flags)
+{
+    // bits of each report, by type (input, output, feature) and report ID
+    static const UInt8 mainTypes[3] = { 0x80, 0x90, 0xB0 };
+    UInt32 (*bits)[kMaxReportIDs];
+    const UInt8 *item = (const UInt8 *)hidReportDescriptor;
+    const UInt8 *end = item + descriptorLength;
+    XBHIDGlobals globals = { 0, 0, 0, 0 }, stack[kMaxGlobalStack];
+    UInt32 depth = 0, collections = 0, collectionDepth = 0, usage = 0;
+    bool usesReportIDs = false, haveUsage = false;
+    HIDPreparsedDataRef parsed;
+    IOByteCount lengths[3];
+    
+    bits = (UInt32 (*)[kMaxReportIDs])calloc(3, sizeof(*bits));
+    parsed = (HIDPreparsedDataRef)calloc(1, sizeof(*parsed));
+    if (!bits || !parsed) {
+        ::free(bits);
+        ::free(parsed);
+        return kIOReturnNoMemory;
+    }
+    
+    while (item < end) {
+        
+        UInt8 prefix = *item++;
+        UInt32 size = (prefix & 3) == 3 ? 4 : prefix & 3;
+        UInt32 data = 0;
+        
+        // long items carry nothing the capabilities need
+        if (prefix == 0xFE) {
+            if (item + 2 > end)
+                break;
+            item += 2 + item[0];
+            continue;
+        }
+        
+        if (item + size > end)
+            break;
+        for (UInt32 i = 0; i < size; i++)
+            data |= (UInt32)item[i] << (8 * i);
+        item += size;
+        
+        switch (prefix & 0xFC) {
+            
+            case 0x04:  globals.usagePage = data;       break;
+            case 0x74:  globals.reportSize = data;      break;
+            case 0x94:  globals.reportCount = data;     break;
+            case 0x84:
+                globals.reportID = data & 0xFF;
+                usesReportIDs = true;
+                break;
+            case 0xA4:
+                if (depth < kMaxGlobalStack)
+                    stack[depth++] = globals;
+                break;
+            case 0xB4:
+                if (depth > 0)
+                    globals = stack[--depth];
+                break;
+            
+            case 0x08:
+                // a 4 byte usage has its page in the upper half
+                if (!haveUsage)
+                    usage = size == 4 ? data : (globals.usagePage << 16) | data;
+                break;
+            
+            case 0xA0:
+                if (collectionDepth++ == 0) {
+                    collections++;
+                    haveUsage = true;
+                    if (!parsed->capabilities.usagePage) {
+                        parsed->capabilities.usagePage = usage >> 16;
+                        parsed->capabilities.usage = usage & 0xFFFF;
+                    }
+                }
+                parsed->capabilities.numberCollectionNodes++;
+                break;
+            case 0xC0:
+                if (collectionDepth > 0)
+                    collectionDepth--;
+                break;
+            
+            default:
+                for (UInt32 type = 0; type < 3; type++)
+                    if ((prefix & 0xFC) == mainTypes[type])
+                        bits[type][globals.reportID] += globals.reportSize * globals.reportCount;
+                break;
+        }
+    }
+    
+    for (UInt32 type = 0; type < 3; type++) {
+        
+        UInt32 most = 0;
+        
+        for (UInt32 id = 0; id < kMaxReportIDs; id++)
+            if (bits[type][id] > most)
+                most = bits[type][id];
+        
+        lengths[type] = most ? (most + 7) / 8 + (usesReportIDs ? 1 : 0) : 0;
+    }
+    
+    parsed->capabilities.inputReportByteLength = lengths[0];
+    parsed->capabilities.outputReportByteLength = lengths[1];
+    parsed->capabilities.featureReportByteLength = lengths[2];
+    
+    ::free(bits);
+    if (!collections) {
+        ::free(parsed);
+        return kIOReturnBadArgument;
+    }
+    
+    *preparsedDataRef = parsed;
+    return kIOReturnSuccess;
+}
+
+OSStatus
+HIDCloseReportDescriptor(HIDPreparsedDataRef preparsedDataRef)
+{
+    ::free(preparsedDataRef);
+    return kIOReturnSuccess;
+}
+
+OSStatus
+HIDGetCapabilities(HIDPreparsedDataRef preparsedDataRef, HIDCapabilitiesPtr capabilities)
+{
+    if (!preparsedDataRef)
+        return kIOReturnBadArgument;
+    
+    *capabilities = preparsedDataRef->capabilities;
+    return kIOReturnSuccess;
+}
@@ -0,0 +1,20 @@
+//
+//  KernelShimPrivate.h
+//  XboxControllerHIDShim
+//
+//  Shared between the parts of the shim, not for the driver or the tests.
+//
+
+#ifndef XboxControllerHIDShim_KernelShimPrivate_h
+#define XboxControllerHIDShim_KernelShimPrivate_h
+
+#include <pthread.h>
+#include <time.h>
+
+#include <libkern/OSTypes.h>
+
+// conditions wait on CLOCK_MONOTONIC, the clock uptime comes from
+void XBShimInitCondition(pthread_cond_t *condition);
+void XBShimDeadline(UInt64 uptime, struct timespec *deadline);
+
+#endif
@@ -0,0 +1,812 @@
+//
+//  KernelShimService.cpp
+//  XboxControllerHIDShim
+//
+//  The registry, termination, user clients and the work loop with its
+//  command gates and timers.
+//
+
+#include <errno.h>
+
+#include <IOKit/IOService.h>
+#include <IOKit/IOUserClient.h>
+#include <IOKit/IOWorkLoop.h>
+#include <IOKit/IOCommandGate.h>
+#include <IOKit/IOTimerEventSource.h>
+
+#include "KernelShimPrivate.h"
+
+// how long terminate() waits for a client to close its provider
+#define kTerminateTimeout   (2ULL * kSecondScale)
+
+// providers, clients and who has what open, one lock for the whole registry
+static pthread_mutex_t  gRegistryLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   gRegistryChanged;
+static pthread_once_t   gRegistryOnce = PTHREAD_ONCE_INIT;
+
+static void
+initRegistry()
+{
+    XBShimInitCondition(&gRegistryChanged);
+}
+
+// -- IORegistryEntry ---------------------------------------
+// ----------------------------------------------------------
+
+OSDefineMetaClassAndStructors(IORegistryEntry, OSObject)
+
+bool
+IORegistryEntry::init(OSDictionary *dictionary)
+{
+    if (!OSObject::init())
+        return false;
+    
+    if (dictionary) {
+        dictionary->retain();
+        _properties = dictionary;
+    } else
+        _properties = OSDictionary::withCapacity(8);
+    
+    pthread_mutex_init(&_propertiesLock, NULL);
+    return _properties != NULL;
+}
+
+void
+IORegistryEntry::free()
+{
+    if (_properties) {
+        _properties->release();
+        pthread_mutex_destroy(&_propertiesLock);
+    }
+    OSObject::free();
+}
+
+OSObject *
+IORegistryEntry::getProperty(const char *aKey) const
+{
+    OSObject *object;
+    
+    pthread_mutex_lock(&_propertiesLock);
+    object = _properties->getObject(aKey);
+    pthread_mutex_unlock(&_propertiesLock);
+    
+    return object;
+}
+
+OSObject *
+IORegistryEntry::getProperty(const OSString *aKey) const
+{
+    return getProperty(aKey->getCStringNoCopy());
+}
+
+OSObject *
+IORegistryEntry::getProperty(const OSSymbol *aKey) const
+{
+    return getProperty(aKey->getCStringNoCopy());
+}
+
+bool
+IORegistryEntry::setProperty(const char *aKey, OSObject *anObject)
+{
+    bool result;
+    
+    pthread_mutex_lock(&_propertiesLock);
+    result = _properties->setObject(aKey, anObject);
+    pthread_mutex_unlock(&_propertiesLock);
+    
+    return result;
+}
+
+bool
+IORegistryEntry::setProperty(const OSString *aKey, OSObject *anObject)
+{
+    return setProperty(aKey->getCStringNoCopy(), anObject);
+}
+
+bool
+IORegistryEntry::setProperty(const OSSymbol *aKey, OSObject *anObject)
+{
+    return setProperty(aKey->getCStringNoCopy(), anObject);
+}
+
+bool
+IORegistryEntry::setProperty(const char *aKey, const char *aString)
+{
+    OSString *string = OSString::withCString(aString);
+    bool result;
+    
+    if (!string)
+        return false;
+    
+    result = setProperty(aKey, string);
+    string->release();
+    return result;
+}
+
+bool
+IORegistryEntry::setProperty(const char *aKey, bool aBoolean)
+{
+    return setProperty(aKey, OSBoolean::withBoolean(aBoolean));
+}
+
+bool
+IORegistryEntry::setProperty(const char *aKey, unsigned long long aValue, unsigned int aNumberOfBits)
+{
+    OSNumber *number = OSNumber::withNumber(aValue, aNumberOfBits);
+    bool result;
+    
+    if (!number)
+        return false;
+    
+    result = setProperty(aKey, number);
+    number->release();
+    return result;
+}
+
+void
+IORegistryEntry::removeProperty(const char *aKey)
+{
+    pthread_mutex_lock(&_propertiesLock);
+    _properties->removeObject(aKey);
+    pthread_mutex_unlock(&_propertiesLock);
+}
+
+IOReturn
+IORegistryEntry::setProperties(OSObject *properties)
+{
+    return kIOReturnUnsupported;
+}
+
+bool
+IORegistryEntry::serializeProperties(OSSerialize *serializer) const
+{
+    bool result;
+    
+    pthread_mutex_lock(&_propertiesLock);
+    result = _properties->serialize(serializer);
+    pthread_mutex_unlock(&_propertiesLock);
+    
+    return result;
+}
+
+const char *
+IORegistryEntry::getName(const IORegistryPlane *plane) const
+{
+    return getMetaClass()->getClassName();
+}
+
+const char *
+IORegistryEntry::getLocation(const IORegistryPlane *plane) const
+{
+    return _location;
+}
+
+void
+IORegistryEntry::setLocation(const char *location, const IORegistryPlane *plane)
+{
+    strncpy(_location, location, sizeof(_location) - 1);
+}
+
+// -- IOService ---------------------------------------------
+// ----------------------------------------------------------
+
+OSDefineMetaClassAndStructors(IOService, IORegistryEntry)
+
+bool
+IOService::init(OSDictionary *dictionary)
+{
+    pthread_once(&gRegistryOnce, initRegistry);
+    
+    if (!IORegistryEntry::init(dictionary))
+        return false;
+    
+    _clients = OSArray::withCapacity(2);
+    return _clients != NULL;
+}
+
+void
+IOService::free()
+{
+    if (_clients)
+        _clients->release();
+    IORegistryEntry::free();
+}
+
+IOService *
+IOService::probe(IOService *provider, SInt32 *score)
+{
+    return this;
+}
+
+bool
+IOService::start(IOService *provider)
+{
+    return true;
+}
+
+void
+IOService::stop(IOService *provider)
+{
+}
+
+bool
+IOService::attach(IOService *provider)
+{
+    bool attached = false;
+    
+    pthread_mutex_lock(&gRegistryLock);
+    if (!_provider && !provider->_inactive && provider->_clients->setObject(this)) {
+        
+        provider->retain();
+        _provider = provider;
+        attached = true;
+    }
+    pthread_mutex_unlock(&gRegistryLock);
+    
+    return attached;
+}
+
+void
+IOService::detach(IOService *provider)
+{
+    bool detached = false;
+    
+    // held over the unlock, the provider's reference may be the last one
+    retain();
+    
+    pthread_mutex_lock(&gRegistryLock);
+    if (_provider == provider) {
+        
+        for (unsigned int i = 0; i < provider->_clients->getCount(); i++)
+            if (provider->_clients->getObject(i) == this) {
+                provider->_clients->removeObject(i);
+                break;
+            }
+        
+        _provider = NULL;
+        detached = true;
+        pthread_cond_broadcast(&gRegistryChanged);
+    }
+    pthread_mutex_unlock(&gRegistryLock);
+    
+    if (detached)
+        provider->release();
+    release();
+}
+
+IOService *
+IOService::copyNextClient(IOService *client) const
+{
+    IOService *next = NULL;
+    unsigned int i = 0;
+    
+    pthread_mutex_lock(&gRegistryLock);
+    
+    if (client) {
+        while (i < _clients->getCount() && _clients->getObject(i) != client)
+            i++;
+        i++;
+    }
+    
+    next = (IOService *)_clients->getObject(i);
+    if (next)
+        next->retain();
+    
+    pthread_mutex_unlock(&gRegistryLock);
+    return next;
+}
+
+bool
+IOService::handleOpen(IOService *forClient, IOOptionBits options, void *arg)
+{
+    if (_openClient && _openClient != forClient)
+        return false;
+    
+    _openClient = forClient;
+    return true;
+}
+
+void
+IOService::handleClose(IOService *forClient, IOOptionBits options)
+{
+    if (_openClient == forClient)
+        _openClient = NULL;
+}
+
+bool
+IOService::handleIsOpen(const IOService *forClient) const
+{
+    return forClient ? _openClient == forClient : _openClient != NULL;
+}
+
+bool
+IOService::open(IOService *forClient, IOOptionBits options, void *arg)
+{
+    bool opened;
+    
+    pthread_mutex_lock(&gRegistryLock);
+    opened = !_inactive && handleOpen(forClient, options, arg);
+    pthread_mutex_unlock(&gRegistryLock);
+    
+    return opened;
+}
+
+void
+IOService::close(IOService *forClient, IOOptionBits options)
+{
+    pthread_mutex_lock(&gRegistryLock);
+    if (handleIsOpen(forClient)) {
+        handleClose(forClient, options);
+        pthread_cond_broadcast(&gRegistryChanged);
+    }
+    pthread_mutex_unlock(&gRegistryLock);
+}
+
+bool
+IOService::isOpen(const IOService *forClient) const
+{
+    bool open;
+    
+    pthread_mutex_lock(&gRegistryLock);
+    open = handleIsOpen(forClient);
+    pthread_mutex_unlock(&gRegistryLock);
+    
+    return open;
+}
+
+// with gRegistryLock held
+void
+IOService::markInactive()
+{
+    _inactive = true;
+    
+    for (unsigned int i = 0; i < _clients->getCount(); i++)
+        ((IOService *)_clients->getObject(i))->markInactive();
+}
+
+// The phases of terminate() for this service and the clients under it, in
+// the order IOKit runs them: willTerminate() top down, didTerminate() bottom
+// up, then stop() and detach() once the provider has been closed
+bool
+IOService::terminatePhases(IOService *provider)
+{
+    IOService *client = NULL;
+    OSArray *clients = OSArray::withCapacity(2);
+    bool defer = false;
+    bool terminated = true;
+    
+    willTerminate(provider, 0);
+    
+    while ((client = copyNextClient(client))) {
+        clients->setObject(client);
+        client->release();
+    }
+    for (unsigned int i = 0; i < clients->getCount(); i++)
+        terminated &= ((IOService *)clients->getObject(i))->terminatePhases(this);
+    clients->release();
+    
+    didTerminate(provider, 0, &defer);
+    
+    if (provider) {
+        
+        struct timespec deadline;
+        UInt64 now;
+        
+        clock_get_uptime(&now);
+        XBShimDeadline(now + kTerminateTimeout, &deadline);
+        
+        pthread_mutex_lock(&gRegistryLock);
+        while (provider->handleIsOpen(this))
+            if (pthread_cond_timedwait(&gRegistryChanged, &gRegistryLock, &deadline) == ETIMEDOUT) {
+                terminated = false;
+                break;
+            }
+        pthread_mutex_unlock(&gRegistryLock);
+    }
+    
+    stop(provider);
+    if (provider)
+        detach(provider);
+    
+    return terminated;
+}
+
+bool
+IOService::terminate(IOOptionBits options)
+{
+    bool wasInactive;
+    
+    pthread_once(&gRegistryOnce, initRegistry);
+    
+    pthread_mutex_lock(&gRegistryLock);
+    wasInactive = _inactive;
+    if (!wasInactive)
+        markInactive();
+    pthread_mutex_unlock(&gRegistryLock);
+    
+    if (wasInactive)
+        return true;
+    
+    return terminatePhases(_provider);
+}
+
+bool
+IOService::willTerminate(IOService *provider, IOOptionBits options)
+{
+    return true;
+}
+
+bool
+IOService::didTerminate(IOService *provider, IOOptionBits options, bool *defer)
+{
+    return true;
+}
+
+IOReturn
+IOService::message(UInt32 type, IOService *provider, void *argument)
+{
+    return kIOReturnUnsupported;
+}
+
+IOWorkLoop *
+IOService::getWorkLoop() const
+{
+    return _provider ? _provider->getWorkLoop() : NULL;
+}
+
+IOReturn
+IOService::newUserClient(task_t owningTask, void *securityID, UInt32 type,
+                         OSDictionary *properties, IOUserClient **handler)
+{
+    return newUserClient(owningTask, securityID, type, handler);
+}
+
+IOReturn
+IOService::newUserClient(task_t owningTask, void *securityID, UInt32 type, IOUserClient **handler)
+{
+    return kIOReturnUnsupported;
+}
+
+// -- IOUserClient ------------------------------------------
+// ----------------------------------------------------------
+
+OSDefineMetaClassAndAbstractStructors(IOUserClient, IOService)
+
+IOReturn
+IOUserClient::clientHasPrivilege(void *securityToken, const char *privilegeName)
+{
+    return securityToken ? kIOReturnSuccess : kIOReturnNotPrivileged;
+}
+
+bool
+IOUserClient::initWithTask(task_t owningTask, void *securityToken, UInt32 type, OSDictionary *properties)
+{
+    return init(properties);
+}
+
+bool
+IOUserClient::initWithTask(task_t owningTask, void *securityToken, UInt32 type)
+{
+    return initWithTask(owningTask, securityToken, type, NULL);
+}
+
+IOReturn
+IOUserClient::clientClose()
+{
+    return kIOReturnUnsupported;
+}
+
+IOReturn
+IOUserClient::clientDied()
+{
+    return clientClose();
+}
+
+IOReturn
+IOUserClient::clientMemoryForType(UInt32 type, IOOptionBits *options, IOMemoryDescriptor **memory)
+{
+    return kIOReturnUnsupported;
+}
+
+// -- IOWorkLoop --------------------------------------------
+// ----------------------------------------------------------
+
+OSDefineMetaClassAndAbstractStructors(IOEventSource, OSObject)
+
+bool
+IOEventSource::init(OSObject *inOwner)
+{
+    if (!OSObject::init())
+        return false;
+    
+    owner = inOwner;
+    return true;
+}
+
+OSDefineMetaClassAndStructors(IOWorkLoop, OSObject)
+
+IOWorkLoop *
+IOWorkLoop::workLoop()
+{
+    IOWorkLoop *me = new IOWorkLoop;
+    
+    if (me && !me->init()) {
+        me->release();
+        return NULL;
+    }
+    return me;
+}
+
+bool
+IOWorkLoop::init()
+{
+    pthread_mutexattr_t attributes;
+    
+    if (!OSObject::init())
+        return false;
+    
+    _sources = OSArray::withCapacity(4);
+    if (!_sources)
+        return false;
+    
+    pthread_mutexattr_init(&attributes);
+    pthread_mutexattr_settype(&attributes, PTHREAD_MUTEX_RECURSIVE);
+    pthread_mutex_init(&_gate, &attributes);
+    pthread_mutexattr_destroy(&attributes);
+    
+    pthread_mutex_init(&_lock, NULL);
+    XBShimInitCondition(&_changed);
+    
+    _running = true;
+    if (pthread_create(&_thread, NULL, threadMain, this) != 0) {
+        _running = false;
+        return false;
+    }
+    return true;
+}
+
+void
+IOWorkLoop::free()
+{
+    if (_sources) {
+        
+        pthread_mutex_lock(&_lock);
+        bool started = _running;
+        _running = false;
+        pthread_cond_broadcast(&_changed);
+        pthread_mutex_unlock(&_lock);
+        
+        if (started) {
+            if (pthread_equal(_thread, pthread_self()))
+                pthread_detach(_thread);
+            else
+                pthread_join(_thread, NULL);
+        }
+        
+        _sources->release();
+        pthread_cond_destroy(&_changed);
+        pthread_mutex_destroy(&_lock);
+        pthread_mutex_destroy(&_gate);
+    }
+    OSObject::free();
+}
+
+void *
+IOWorkLoop::threadMain(void *arg)
+{
+    ((IOWorkLoop *)arg)->runTimers();
+    return NULL;
+}
+
+// Runs each timer once its deadline passes, with the gate closed. A timer
+// that is set again, cancelled or removed while the gate is being taken
+// doesn't run for the deadline it had.
+void
+IOWorkLoop::runTimers()
+{
+    pthread_mutex_lock(&_lock);
+    
+    while (_running) {
+        
+        IOTimerEventSource *due = NULL;
+        UInt64 next = 0, now;
+        
+        for (unsigned int i = 0; i < _sources->getCount(); i++) {
+            
+            IOTimerEventSource *timer = OSDynamicCast(IOTimerEventSource, _sources->getObject(i));
+            
+            if (timer && timer->_deadline && (!next || timer->_deadline < next)) {
+                next = timer->_deadline;
+                due = timer;
+            }
+        }
+        
+        clock_get_uptime(&now);
+        
+        if (!due) {
+            pthread_cond_wait(&_changed, &_lock);
+            
+        } else if (next > now) {
+            
+            struct timespec deadline;
+            
+            XBShimDeadline(next, &deadline);
+            pthread_cond_timedwait(&_changed, &_lock, &deadline);
+            
+        } else {
+            
+            UInt32 generation = due->_generation;
+            bool current = false;
+            
+            due->_deadline = 0;
+            due->retain();
+            pthread_mutex_unlock(&_lock);
+            
+            closeGate();
+            
+            pthread_mutex_lock(&_lock);
+            if (due->_generation == generation)
+                for (unsigned int i = 0; i < _sources->getCount(); i++)
+                    if (_sources->getObject(i) == due)
+                        current = true;
+            pthread_mutex_unlock(&_lock);
+            
+            if (current && due->_action)
+                due->_action(due->owner, due);
+            
+            openGate();
+            due->release();
+            
+            pthread_mutex_lock(&_lock);
+        }
+    }
+    
+    pthread_mutex_unlock(&_lock);
+}
+
+IOReturn
+IOWorkLoop::addEventSource(IOEventSource *newEvent)
+{
+    IOReturn result = kIOReturnSuccess;
+    
+    pthread_mutex_lock(&_lock);
+    if (newEvent->workLoop)
+        result = newEvent->workLoop == this ? kIOReturnSuccess : kIOReturnExclusiveAccess;
+    else if (!_sources->setObject(newEvent))
+        result = kIOReturnNoMemory;
+    else {
+        newEvent->workLoop = this;
+        pthread_cond_broadcast(&_changed);
+    }
+    pthread_mutex_unlock(&_lock);
+    
+    return result;
+}
+
+IOReturn
+IOWorkLoop::removeEventSource(IOEventSource *toRemove)
+{
+    IOReturn result = kIOReturnBadArgument;
+    
+    // none of the source's actions runs once this returns
+    closeGate();
+    pthread_mutex_lock(&_lock);
+    
+    for (unsigned int i = 0; i < _sources->getCount(); i++)
+        if (_sources->getObject(i) == toRemove) {
+            
+            toRemove->workLoop = NULL;
+            _sources->removeObject(i);
+            result = kIOReturnSuccess;
+            break;
+        }
+    
+    pthread_mutex_unlock(&_lock);
+    openGate();
+    
+    return result;
+}
+
+void
+IOWorkLoop::closeGate()
+{
+    pthread_mutex_lock(&_gate);
+}
+
+void
+IOWorkLoop::openGate()
+{
+    pthread_mutex_unlock(&_gate);
+}
+
+// -- IOCommandGate, IOTimerEventSource ---------------------
+// ----------------------------------------------------------
+
+OSDefineMetaClassAndStructors(IOCommandGate, IOEventSource)
+
+IOCommandGate *
+IOCommandGate::commandGate(OSObject *owner)
+{
+    IOCommandGate *me = new IOCommandGate;
+    
+    if (me && !me->init(owner)) {
+        me->release();
+        return NULL;
+    }
+    return me;
+}
+
+IOReturn
+IOCommandGate::runAction(Action action, void *arg0, void *arg1, void *arg2, void *arg3)
+{
+    IOWorkLoop *loop = workLoop;
+    IOReturn result;
+    
+    if (!loop)
+        return kIOReturnNotReady;
+    
+    loop->closeGate();
+    result = action(owner, arg0, arg1, arg2, arg3);
+    loop->openGate();
+    
+    return result;
+}
+
+OSDefineMetaClassAndStructors(IOTimerEventSource, IOEventSource)
+
+IOTimerEventSource *
+IOTimerEventSource::timerEventSource(OSObject *owner, Action action)
+{
+    IOTimerEventSource *me = new IOTimerEventSource;
+    
+    if (me && !me->init(owner)) {
+        me->release();
+        return NULL;
+    }
+    
+    if (me)
+        me->_action = action;
+    return me;
+}
+
+IOReturn
+IOTimerEventSource::setTimeoutUS(UInt32 us)
+{
+    IOWorkLoop *loop = workLoop;
+    UInt64 deadline;
+    
+    if (!loop)
+        return kIOReturnNotReady;
+    
+    clock_interval_to_deadline(us, kMicrosecondScale, &deadline);
+    
+    pthread_mutex_lock(&loop->_lock);
+    _deadline = deadline;
+    _generation++;
+    pthread_cond_broadcast(&loop->_changed);
+    pthread_mutex_unlock(&loop->_lock);
+    
+    return kIOReturnSuccess;
+}
+
+IOReturn
+IOTimerEventSource::setTimeoutMS(UInt32 ms)
+{
+    return setTimeoutUS(ms * 1000);
+}
+
+void
+IOTimerEventSource::cancelTimeout()
+{
+    IOWorkLoop *loop = workLoop;
+    
+    if (!loop) {
+        _deadline = 0;
+        return;
+    }
+    
+    pthread_mutex_lock(&loop->_lock);
+    _deadline = 0;
+    _generation++;
+    pthread_mutex_unlock(&loop->_lock);
+}
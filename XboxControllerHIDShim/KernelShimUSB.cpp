@@ -0,0 +1,574 @@
+//
+//  KernelShimUSB.cpp
+//  XboxControllerHIDShim
+//
+//  Devices, interfaces and pipes over the simulated devices, and the host
+//  controller thread that polls them.
+//
+
+#include <stdio.h>
+
+#include <libkern/OSAtomic.h>
+#include <IOKit/IOLib.h>
+#include <IOKit/IOBufferMemoryDescriptor.h>
+#include <IOKit/IOWorkLoop.h>
+#include <IOKit/usb/IOUSBBus.h>
+
+#include "KernelShimPrivate.h"
+
+// -- host controller ---------------------------------------
+// ----------------------------------------------------------
+
+// The one controller thread runs every attached pipe up to the current
+// uptime, then sleeps until the earliest next event of any of them, or until
+// a clear, abort or reset kicks it to complete the reads handed back.
+#define kMaxPorts   128
+
+static pthread_mutex_t  gControllerLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t   gControllerKick;
+static pthread_cond_t   gControllerIdle;
+static pthread_once_t   gControllerOnce = PTHREAD_ONCE_INIT;
+static pthread_t        gControllerThread;
+static XBSimPipe *      gPorts[kMaxPorts];
+static UInt32           gNumPorts;
+static bool             gKicked;
+static bool             gBusy;          // running pipes, without the lock
+
+static void *
+controllerThread(void *arg)
+{
+    XBSimPipe *ports[kMaxPorts];
+    
+    pthread_mutex_lock(&gControllerLock);
+    
+    for (;;) {
+        
+        UInt32 numPorts = gNumPorts;
+        UInt64 now, next = 0;
+        
+        memcpy(ports, gPorts, numPorts * sizeof(XBSimPipe *));
+        gKicked = false;
+        gBusy = true;
+        pthread_mutex_unlock(&gControllerLock);
+        
+        clock_get_uptime(&now);
+        for (UInt32 i = 0; i < numPorts; i++)
+            XBSimRun(ports[i], now);
+        
+        pthread_mutex_lock(&gControllerLock);
+        gBusy = false;
+        pthread_cond_broadcast(&gControllerIdle);
+        
+        if (gKicked)
+            continue;
+        
+        for (UInt32 i = 0; i < gNumPorts; i++) {
+            
+            UInt64 event = XBSimNextEvent(gPorts[i]);
+            
+            if (!next || event < next)
+                next = event;
+        }
+        
+        if (!next)
+            pthread_cond_wait(&gControllerKick, &gControllerLock);
+        else {
+            
+            struct timespec deadline;
+            
+            XBShimDeadline(next, &deadline);
+            pthread_cond_timedwait(&gControllerKick, &gControllerLock, &deadline);
+        }
+    }
+    
+    return NULL;
+}
+
+static void
+startController()
+{
+    XBShimInitCondition(&gControllerKick);
+    XBShimInitCondition(&gControllerIdle);
+    if (pthread_create(&gControllerThread, NULL, controllerThread, NULL) == 0)
+        pthread_detach(gControllerThread);
+}
+
+static void
+kickController()
+{
+    pthread_mutex_lock(&gControllerLock);
+    gKicked = true;
+    pthread_cond_signal(&gControllerKick);
+    pthread_mutex_unlock(&gControllerLock);
+}
+
+static bool
+attachPort(XBSimPipe *pipe)
+{
+    bool attached = false;
+    
+    pthread_once(&gControllerOnce, startController);
+    
+    pthread_mutex_lock(&gControllerLock);
+    if (gNumPorts < kMaxPorts) {
+        gPorts[gNumPorts++] = pipe;
+        gKicked = true;
+        pthread_cond_signal(&gControllerKick);
+        attached = true;
+    }
+    pthread_mutex_unlock(&gControllerLock);
+    
+    return attached;
+}
+
+// once this returns the controller no longer runs the pipe
+static void
+detachPort(XBSimPipe *pipe)
+{
+    pthread_mutex_lock(&gControllerLock);
+    
+    for (UInt32 i = 0; i < gNumPorts; i++)
+        if (gPorts[i] == pipe) {
+            gPorts[i] = gPorts[--gNumPorts];
+            break;
+        }
+    
+    if (!pthread_equal(pthread_self(), gControllerThread))
+        while (gBusy)
+            pthread_cond_wait(&gControllerIdle, &gControllerLock);
+    
+    pthread_mutex_unlock(&gControllerLock);
+}
+
+// -- IOUSBPipe ---------------------------------------------
+// ----------------------------------------------------------
+
+OSDefineMetaClassAndStructors(IOUSBPipe, OSObject)
+
+IOUSBPipe *
+IOUSBPipe::ToEndpoint(const IOUSBEndpointDescriptor *endpoint, IOUSBDevice *device, XBSimPipe *sim)
+{
+    IOUSBPipe *me = new IOUSBPipe;
+    
+    if (me && !me->init()) {
+        me->release();
+        return NULL;
+    }
+    
+    me->_descriptor = *endpoint;
+    me->_device = device;
+    if ((endpoint->bEndpointAddress & 0x80) && (endpoint->bmAttributes & 0x03) == kUSBInterrupt)
+        me->_sim = sim;
+    return me;
+}
+
+IOReturn
+IOUSBPipe::Read(IOMemoryDescriptor *buffer, UInt32 noDataTimeout, UInt32 completionTimeout,
+                IOByteCount reqCount, IOUSBCompletionWithTimeStamp *completion, IOByteCount *bytesRead)
+{
+    IOBufferMemoryDescriptor *bytes = OSDynamicCast(IOBufferMemoryDescriptor, buffer);
+    XBSimCompletion simCompletion;
+    GatedRead *read = NULL;
+    IOReturn err;
+    
+    // only the asynchronous reads of the interrupt pipe
+    if (!_sim)
+        return kIOReturnUnsupported;
+    if (!bytes || !completion || reqCount > bytes->getLength())
+        return kIOReturnBadArgument;
+    
+    for (UInt32 i = 0; i < kSimMaxReads && !read; i++)
+        if (OSCompareAndSwap(0, 1, &_gatedReads[i].inUse))
+            read = &_gatedReads[i];
+    if (!read)
+        return kIOReturnNoResources;
+    
+    read->completion = *completion;
+    simCompletion.target = read;
+    simCompletion.action = gatedReadComplete;
+    simCompletion.parameter = NULL;
+    
+    err = XBSimRead(_sim, bytes->getBytesNoCopy(), (UInt32)reqCount, &simCompletion);
+    if (err != kIOReturnSuccess)
+        OSCompareAndSwap(1, 0, &read->inUse);
+    return err;
+}
+
+// On the controller thread: the client's completion runs with the gate of its
+// work loop closed, as on the USB family's work loop, so it never races what
+// the client does in runAction() or its timers
+void
+IOUSBPipe::gatedReadComplete(void *target, void *parameter, SInt32 status, UInt32 bufferSizeRemaining,
+                             UInt64 timeStamp)
+{
+    GatedRead *read = (GatedRead *)target;
+    IOUSBCompletionWithTimeStamp completion = read->completion;
+    IOService *client = OSDynamicCast(IOService, completion.target);
+    IOWorkLoop *workLoop = client ? client->getWorkLoop() : NULL;
+    
+    // free before the action, which usually queues the next read
+    OSCompareAndSwap(1, 0, &read->inUse);
+    
+    if (workLoop)
+        workLoop->closeGate();
+    completion.action(completion.target, completion.parameter, status, bufferSizeRemaining, timeStamp);
+    if (workLoop)
+        workLoop->openGate();
+}
+
+IOReturn
+IOUSBPipe::Write(IOMemoryDescriptor *buffer, UInt32 noDataTimeout, UInt32 completionTimeout,
+                 IOUSBCompletion *completion)
+{
+    UInt8 bytes[kTraceReportBytes];
+    UInt32 length;
+    
+    if (GetDirection() != kUSBOut || !buffer)
+        return kIOReturnBadArgument;
+    if (!XBSimDeviceConnected(_device->getSimPipe()))
+        return kIOReturnNotResponding;
+    
+    length = (UInt32)buffer->readBytes(0, bytes, sizeof(bytes));
+    _device->recordOutput(bytes, length);
+    
+    if (completion && completion->action)
+        completion->action(completion->target, completion->parameter, kIOReturnSuccess, 0);
+    return kIOReturnSuccess;
+}
+
+IOReturn
+IOUSBPipe::ClearStall(void)
+{
+    if (_sim) {
+        XBSimClearStall(_sim);
+        kickController();
+    }
+    return kIOReturnSuccess;
+}
+
+IOReturn
+IOUSBPipe::Abort(void)
+{
+    if (_sim) {
+        XBSimAbort(_sim);
+        kickController();
+    }
+    return kIOReturnSuccess;
+}
+
+// -- IOUSBInterface ----------------------------------------
+// ----------------------------------------------------------
+
+OSDefineMetaClassAndStructors(IOUSBInterface, IOService)
+
+IOUSBInterface *
+IOUSBInterface::withEndpoints(IOUSBDevice *device, UInt8 number, UInt8 interfaceClass,
+                              const IOUSBEndpointDescriptor *endpoints, UInt8 numEndpoints,
+                              XBSimPipe *sim)
+{
+    IOUSBInterface *me = new IOUSBInterface;
+    
+    if (!me)
+        return NULL;
+    
+    if (!me->init() || numEndpoints > kXBShimMaxEndpoints) {
+        me->release();
+        return NULL;
+    }
+    
+    me->_device = device;
+    me->_number = number;
+    me->_class = interfaceClass;
+    
+    for (UInt8 i = 0; i < numEndpoints; i++) {
+        
+        me->_endpoints[i] = endpoints[i];
+        me->_pipes[i] = IOUSBPipe::ToEndpoint(&endpoints[i], device, sim);
+        if (!me->_pipes[i]) {
+            me->release();
+            return NULL;
+        }
+        me->_numEndpoints++;
+    }
+    
+    return me;
+}
+
+void
+IOUSBInterface::free()
+{
+    for (UInt8 i = 0; i < _numEndpoints; i++)
+        _pipes[i]->release();
+    IOService::free();
+}
+
+IOUSBPipe *
+IOUSBInterface::FindNextPipe(IOUSBPipe *current, IOUSBFindEndpointRequest *request)
+{
+    UInt8 i = 0;
+    
+    if (current) {
+        while (i < _numEndpoints && _pipes[i] != current)
+            i++;
+        i++;
+    }
+    
+    for (; i < _numEndpoints; i++) {
+        
+        IOUSBPipe *pipe = _pipes[i];
+        
+        if (request->type != kUSBAnyType && request->type != pipe->GetType())
+            continue;
+        if (request->direction != kUSBAnyDirn && request->direction != pipe->GetDirection())
+            continue;
+        
+        request->maxPacketSize = pipe->GetMaxPacketSize();
+        request->interval = pipe->GetEndpointDescriptor()->bInterval;
+        return pipe;
+    }
+    
+    return NULL;
+}
+
+const IOUSBDescriptorHeader *
+IOUSBInterface::FindNextAssociatedDescriptor(const void *current, UInt8 type)
+{
+    UInt8 i = 0;
+    
+    if (type != kUSBEndpointDesc && type != kUSBAnyDesc)
+        return NULL;
+    
+    if (current) {
+        while (i < _numEndpoints && &_endpoints[i] != current)
+            i++;
+        i++;
+    }
+    
+    return i < _numEndpoints ? (const IOUSBDescriptorHeader *)&_endpoints[i] : NULL;
+}
+
+// -- IOUSBDevice -------------------------------------------
+// ----------------------------------------------------------
+
+OSDefineMetaClassAndStructors(IOUSBDevice, IOService)
+
+bool
+IOUSBDevice::initWithSim(UInt16 vendorID, UInt16 productID, UInt32 locationID, const XBSimDevice *device)
+{
+    static volatile SInt32 nextAddress = 1;
+    char location[16];
+    UInt64 now;
+    
+    if (!init())
+        return false;
+    
+    _interfaces = OSArray::withCapacity(2);
+    if (!_interfaces)
+        return false;
+    
+    _vendorID = vendorID;
+    _productID = productID;
+    _release = 0x0100;
+    _address = (USBDeviceAddress)(OSIncrementAtomic(&nextAddress) & 0x7F);
+    
+    snprintf(location, sizeof(location), "%x", locationID);
+    setLocation(location);
+    setProperty(kUSBDevicePropertyLocationID, locationID, 32);
+    
+    pthread_mutex_init(&_statsLock, NULL);
+    
+    // virtual time is uptime, so completion time stamps are too
+    clock_get_uptime(&now);
+    XBInitSimPipe(&_sim, device, now);
+    XBSimSetResetHandler(&_sim, portResetHandler, this);
+    _simStarted = true;
+    
+    return attachPort(&_sim);
+}
+
+void
+IOUSBDevice::free()
+{
+    if (_simStarted) {
+        detachSim();
+        XBFreeSimPipe(&_sim);
+        pthread_mutex_destroy(&_statsLock);
+    }
+    if (_interfaces)
+        _interfaces->release();
+    IOService::free();
+}
+
+bool
+IOUSBDevice::addInterface(IOUSBInterface *interface)
+{
+    OSObject *locationID = getProperty(kUSBDevicePropertyLocationID);
+    
+    if (locationID)
+        interface->setProperty(kUSBDevicePropertyLocationID, locationID);
+    interface->setLocation(getLocation());
+    
+    return _interfaces->setObject(interface) && interface->attach(this);
+}
+
+void
+IOUSBDevice::detachSim()
+{
+    detachPort(&_sim);
+}
+
+void
+IOUSBDevice::recordOutput(const void *bytes, UInt32 length)
+{
+    if (length > sizeof(_stats.lastOutput))
+        length = sizeof(_stats.lastOutput);
+    
+    pthread_mutex_lock(&_statsLock);
+    _stats.outputReports++;
+    memcpy(_stats.lastOutput, bytes, length);
+    _stats.lastOutputLength = length;
+    pthread_mutex_unlock(&_statsLock);
+}
+
+void
+IOUSBDevice::copyStats(XBShimDeviceStats *stats)
+{
+    pthread_mutex_lock(&_statsLock);
+    *stats = _stats;
+    pthread_mutex_unlock(&_statsLock);
+}
+
+// the end of a reset, on the controller thread
+void
+IOUSBDevice::portResetHandler(void *target)
+{
+    IOUSBDevice *me = (IOUSBDevice *)target;
+    
+    for (unsigned int i = 0; i < me->_interfaces->getCount(); i++) {
+        
+        IOUSBInterface *interface = (IOUSBInterface *)me->_interfaces->getObject(i);
+        IOService *client = NULL;
+        
+        while ((client = interface->copyNextClient(client))) {
+            
+            if (interface->isOpen(client))
+                client->message(kIOUSBMessagePortHasBeenReset, interface);
+            client->release();
+        }
+    }
+}
+
+IOReturn
+IOUSBDevice::GetStringDescriptor(UInt8 index, char *buf, int maxLen, UInt16 lang)
+{
+    return kIOReturnBadArgument;
+}
+
+IOReturn
+IOUSBDevice::DeviceRequest(IOUSBDevRequest *request, IOUSBCompletion *completion)
+{
+    IOReturn status = kIOReturnSuccess;
+    
+    pthread_mutex_lock(&_statsLock);
+    _stats.controlRequests++;
+    pthread_mutex_unlock(&_statsLock);
+    
+    if (!XBSimDeviceConnected(&_sim))
+        return kIOReturnNotResponding;
+    
+    if (request->bmRequestType == USBmakebmRequestType(kUSBOut, kUSBStandard, kUSBEndpoint)
+        && request->bRequest == kUSBRqClearFeature) {
+        
+        status = XBSimClearEndpointHalt(&_sim);
+        if (status == kIOReturnSuccess) {
+            pthread_mutex_lock(&_statsLock);
+            _stats.endpointHaltsCleared++;
+            pthread_mutex_unlock(&_statsLock);
+        }
+        
+    } else if (request->bmRequestType == USBmakebmRequestType(kUSBOut, kUSBClass, kUSBInterface)
+               && request->bRequest == kHIDRqSetReport) {
+        
+        recordOutput(request->pData, request->wLength);
+        
+    } else if (request->bmRequestType != USBmakebmRequestType(kUSBOut, kUSBClass, kUSBInterface)
+               || request->bRequest != kHIDRqSetIdle)
+        status = kIOUSBPipeStalled;
+    
+    request->wLenDone = status == kIOReturnSuccess ? request->wLength : 0;
+    if (completion && completion->action)
+        completion->action(completion->target, completion->parameter, status, 0);
+    return status;
+}
+
+IOReturn
+IOUSBDevice::DeviceRequest(IOUSBDevRequestDesc *request, IOUSBCompletion *completion)
+{
+    UInt8 bytes[kTraceReportBytes];
+    IOUSBDevRequest plain;
+    IOReturn status;
+    
+    plain.bmRequestType = request->bmRequestType;
+    plain.bRequest = request->bRequest;
+    plain.wValue = request->wValue;
+    plain.wIndex = request->wIndex;
+    plain.wLength = request->wLength;
+    plain.pData = bytes;
+    plain.wLenDone = 0;
+    
+    if (plain.wLength > sizeof(bytes))
+        plain.wLength = sizeof(bytes);
+    if (request->pData)
+        plain.wLength = (UInt16)request->pData->readBytes(0, bytes, plain.wLength);
+    
+    status = DeviceRequest(&plain, completion);
+    request->wLenDone = plain.wLenDone;
+    return status;
+}
+
+IOReturn
+IOUSBDevice::DeviceRequest(IOUSBDevRequest *request, UInt32 noDataTimeout, UInt32 completionTimeout,
+                           IOUSBCompletion *completion)
+{
+    return DeviceRequest(request, completion);
+}
+
+IOReturn
+IOUSBDevice::message(UInt32 type, IOService *provider, void *argument)
+{
+    if (type == kIOUSBMessageHubIsDeviceConnected)
+        return XBSimDeviceConnected(&_sim) ? kIOReturnSuccess : kIOReturnNoDevice;
+    
+    return IOService::message(type, provider, argument);
+}
+
+IOReturn
+IOUSBDevice::ResetDevice()
+{
+    XBSimResetDevice(&_sim);
+    kickController();
+    return kIOReturnSuccess;
+}
+
+IOUSBInterface *
+IOUSBDevice::FindNextInterface(IOUSBInterface *current, IOUSBFindInterfaceRequest *request)
+{
+    unsigned int i = 0;
+    
+    if (current) {
+        while (i < _interfaces->getCount() && _interfaces->getObject(i) != current)
+            i++;
+        i++;
+    }
+    
+    for (; i < _interfaces->getCount(); i++) {
+        
+        IOUSBInterface *interface = (IOUSBInterface *)_interfaces->getObject(i);
+        
+        if (request->bInterfaceClass == kIOUSBFindInterfaceDontCare
+            || request->bInterfaceClass == interface->GetInterfaceClass())
+            return interface;
+    }
+    
+    return NULL;
+}
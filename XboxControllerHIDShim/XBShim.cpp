@@ -0,0 +1,204 @@
+//
+//  XBShim.cpp
+//  XboxControllerHIDShim
+//
+//  Devices on the shim's bus and the driver matched to them, see XBShim.h.
+//
+
+#include <stdio.h>
+
+#include <libkern/c++/OSUnserialize.h>
+
+#include "XBShim.h"
+
+OSDictionary *
+XBShimLoadPersonality(const char *path, const char *name)
+{
+    FILE *file = fopen(path, "rb");
+    OSDictionary *plist, *personalities, *personality = NULL;
+    OSObject *object;
+    char *text;
+    long length;
+    
+    if (!file)
+        return NULL;
+    
+    fseek(file, 0, SEEK_END);
+    length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+    
+    text = (char *)malloc(length + 1);
+    if (!text || fread(text, 1, length, file) != (size_t)length) {
+        free(text);
+        fclose(file);
+        return NULL;
+    }
+    text[length] = '\0';
+    fclose(file);
+    
+    object = OSUnserializeXML(text);
+    free(text);
+    
+    plist = OSDynamicCast(OSDictionary, object);
+    if (plist) {
+        
+        personalities = OSDynamicCast(OSDictionary, plist->getObject("IOKitPersonalities"));
+        if (personalities)
+            personality = OSDynamicCast(OSDictionary, personalities->getObject(name));
+        if (personality)
+            personality->retain();
+    }
+    
+    if (object)
+        object->release();
+    return personality;
+}
+
+static void
+setEndpoint(IOUSBEndpointDescriptor *endpoint, UInt8 address, UInt16 maxPacketSize, UInt8 interval)
+{
+    endpoint->bLength = sizeof(IOUSBEndpointDescriptor);
+    endpoint->bDescriptorType = kUSBEndpointDesc;
+    endpoint->bEndpointAddress = address;
+    endpoint->bmAttributes = kUSBInterrupt;
+    endpoint->wMaxPacketSize = HostToUSBWord(maxPacketSize);
+    endpoint->bInterval = interval;
+}
+
+void
+XBShimPadDescription(XBShimDeviceDescription *description, UInt32 locationID)
+{
+    memset(description, 0, sizeof(XBShimDeviceDescription));
+    description->vendorID = 0x045E;
+    description->productID = 0x0202;
+    description->locationID = locationID;
+    description->numInterfaces = 1;
+    
+    description->interfaces[0].interfaceClass = 0x58;
+    description->interfaces[0].numEndpoints = 2;
+    setEndpoint(&description->interfaces[0].endpoints[0], 0x82, 32, 4);
+    setEndpoint(&description->interfaces[0].endpoints[1], 0x02, 32, 4);
+}
+
+void
+XBShimRemoteDescription(XBShimDeviceDescription *description, UInt32 locationID)
+{
+    memset(description, 0, sizeof(XBShimDeviceDescription));
+    description->vendorID = 0x045E;
+    description->productID = 0x0284;
+    description->locationID = locationID;
+    description->numInterfaces = 2;
+    
+    // the second interface is the DVD kit's ROM, with no endpoints
+    description->interfaces[0].interfaceClass = 0x58;
+    description->interfaces[0].numEndpoints = 1;
+    setEndpoint(&description->interfaces[0].endpoints[0], 0x81, 8, 16);
+    description->interfaces[1].interfaceClass = 0x59;
+}
+
+IOUSBDevice *
+XBShimCreateDevice(const XBShimDeviceDescription *description, const XBSimDevice *sim)
+{
+    IOUSBDevice *device = new IOUSBDevice;
+    
+    if (!device)
+        return NULL;
+    
+    if (!device->initWithSim(description->vendorID, description->productID, description->locationID, sim)) {
+        device->release();
+        return NULL;
+    }
+    
+    for (UInt8 i = 0; i < description->numInterfaces; i++) {
+        
+        const XBShimInterfaceDescription *interfaceDescription = &description->interfaces[i];
+        IOUSBInterface *interface;
+        bool added;
+        
+        interface = IOUSBInterface::withEndpoints(device, i, interfaceDescription->interfaceClass,
+                                                  interfaceDescription->endpoints,
+                                                  interfaceDescription->numEndpoints, device->getSimPipe());
+        if (!interface) {
+            XBShimDestroyDevice(device);
+            return NULL;
+        }
+        
+        added = device->addInterface(interface);
+        interface->release();
+        if (!added) {
+            XBShimDestroyDevice(device);
+            return NULL;
+        }
+    }
+    
+    return device;
+}
+
+IOUSBInterface *
+XBShimInterface(IOUSBDevice *device, UInt32 index)
+{
+    IOUSBFindInterfaceRequest request = { kIOUSBFindInterfaceDontCare, kIOUSBFindInterfaceDontCare,
+                                          kIOUSBFindInterfaceDontCare, kIOUSBFindInterfaceDontCare };
+    IOUSBInterface *interface = device->FindNextInterface(NULL, &request);
+    
+    while (interface && index--)
+        interface = device->FindNextInterface(interface, &request);
+    return interface;
+}
+
+bool
+XBShimDestroyDevice(IOUSBDevice *device)
+{
+    bool terminated = device->terminate();
+    
+    device->detachSim();
+    device->release();
+    return terminated;
+}
+
+IOService *
+XBShimMatch(OSDictionary *personality, IOService *provider, SInt32 *score)
+{
+    OSString *className = OSDynamicCast(OSString, personality->getObject("IOClass"));
+    OSDictionary *properties;
+    IOService *service;
+    
+    if (!className)
+        return NULL;
+    
+    service = OSDynamicCast(IOService, OSMetaClass::allocClassWithName(className->getCStringNoCopy()));
+    if (!service)
+        return NULL;
+    
+    // every instance gets a copy of the personality, as from the IOKit catalogue
+    properties = OSDictionary::withDictionary(personality);
+    if (!properties || !service->init(properties)) {
+        if (properties)
+            properties->release();
+        service->release();
+        return NULL;
+    }
+    properties->release();
+    
+    if (!service->attach(provider)) {
+        service->release();
+        return NULL;
+    }
+    
+    if (!service->probe(provider, score) || !service->start(provider)) {
+        service->detach(provider);
+        service->release();
+        return NULL;
+    }
+    
+    return service;
+}
+
+void
+XBShimSetReportHandler(IOService *service, IOHIDReportHandler handler, void *target)
+{
+    IOHIDDevice *device = OSDynamicCast(IOHIDDevice, service);
+    
+    if (device)
+        device->setReportHandler(handler, target);
+}
@@ -0,0 +1,69 @@
+//
+//  XBShim.h
+//  XboxControllerHIDShim
+//
+//  Running the driver on the kernel shim: simulated devices plugged into the
+//  shim's bus, the driver matched to one of their interfaces from its own
+//  personality, as IOKit would, and the reports it delivers handed to the
+//  caller in place of the HID event system.
+//
+//  The shim is the subset of libkern, IOKit and the USB and HID families
+//  the driver calls, on pthreads (see Headers/): command gates and timers
+//  run on a work loop thread, thread calls on a pool of callout threads, and
+//  the interrupt pipes are XBSimulator pipes, polled in real time by a host
+//  controller thread. XboxControllerHID.cpp compiles against it unmodified.
+//
+
+#ifndef XboxControllerHIDShim_XBShim_h
+#define XboxControllerHIDShim_XBShim_h
+
+#include <IOKit/usb/IOUSBBus.h>
+#include <IOKit/hid/IOHIDDevice.h>
+
+#include "XBSimulator.h"
+
+#define kXBShimMaxInterfaces    2
+
+typedef struct {
+    
+    UInt8                   interfaceClass;
+    UInt8                   numEndpoints;
+    IOUSBEndpointDescriptor endpoints[kXBShimMaxEndpoints];
+    
+} XBShimInterfaceDescription;
+
+typedef struct {
+    
+    UInt16                      vendorID;
+    UInt16                      productID;
+    UInt32                      locationID;
+    UInt8                       numInterfaces;
+    XBShimInterfaceDescription  interfaces[kXBShimMaxInterfaces];
+    
+} XBShimDeviceDescription;
+
+// The personality named name from the IOKitPersonalities of the Info.plist
+// at path, NULL if there is none
+OSDictionary *XBShimLoadPersonality(const char *path, const char *name);
+
+// an Xbox pad (045e:0202) and the DVD kit's IR receiver (045e:0284), as they describe themselves
+void XBShimPadDescription(XBShimDeviceDescription *description, UInt32 locationID);
+void XBShimRemoteDescription(XBShimDeviceDescription *description, UInt32 locationID);
+
+// The device plugged in, its interrupt IN endpoint simulated by sim and
+// polled from now on. Release it with XBShimDestroyDevice()
+IOUSBDevice *XBShimCreateDevice(const XBShimDeviceDescription *description, const XBSimDevice *sim);
+IOUSBInterface *XBShimInterface(IOUSBDevice *device, UInt32 index);
+
+// Terminates the device and every driver on it, then releases it once the
+// controller no longer polls it. False if a driver didn't close in time
+bool XBShimDestroyDevice(IOUSBDevice *device);
+
+// A new instance of the personality's IOClass, attached to provider, probed
+// and started. The caller holds a reference to it
+IOService *XBShimMatch(OSDictionary *personality, IOService *provider, SInt32 *score);
+
+// the reports the device hands to the HID layer, on the thread that delivers them
+void XBShimSetReportHandler(IOService *service, IOHIDReportHandler handler, void *target);
+
+#endif
@@ -0,0 +1,200 @@
+//
+//  libusb.h
+//  XboxControllerHIDTests
+//
+//  The part of libusb-1.0 that XBLibUSBBackend.cpp uses, with the same names
+//  and signatures, so XBLibUSBBackendTests can build the backend against the
+//  fake devices it defines where libusb isn't installed.
+//
+
+#ifndef XboxControllerHIDTests_FakeLibUSB_libusb_h
+#define XboxControllerHIDTests_FakeLibUSB_libusb_h
+
+#include <stdint.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+#define LIBUSB_CALL
+
+typedef struct libusb_context libusb_context;
+typedef struct libusb_device libusb_device;
+typedef struct libusb_device_handle libusb_device_handle;
+typedef int libusb_hotplug_callback_handle;
+
+enum libusb_error {
+    
+    LIBUSB_SUCCESS          = 0,
+    LIBUSB_ERROR_IO         = -1,
+    LIBUSB_ERROR_NO_DEVICE  = -4,
+    LIBUSB_ERROR_NOT_FOUND  = -5,
+    LIBUSB_ERROR_NO_MEM     = -11
+};
+
+enum libusb_transfer_status {
+    
+    LIBUSB_TRANSFER_COMPLETED,
+    LIBUSB_TRANSFER_ERROR,
+    LIBUSB_TRANSFER_TIMED_OUT,
+    LIBUSB_TRANSFER_CANCELLED,
+    LIBUSB_TRANSFER_STALL,
+    LIBUSB_TRANSFER_NO_DEVICE,
+    LIBUSB_TRANSFER_OVERFLOW
+};
+
+enum { LIBUSB_ENDPOINT_IN = 0x80, LIBUSB_ENDPOINT_OUT = 0x00 };
+
+enum libusb_transfer_type {
+    
+    LIBUSB_TRANSFER_TYPE_CONTROL        = 0,
+    LIBUSB_TRANSFER_TYPE_ISOCHRONOUS    = 1,
+    LIBUSB_TRANSFER_TYPE_BULK           = 2,
+    LIBUSB_TRANSFER_TYPE_INTERRUPT      = 3
+};
+
+enum { LIBUSB_CAP_HAS_HOTPLUG = 0x0001 };
+
+typedef enum {
+    
+    LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED = 1 << 0,
+    LIBUSB_HOTPLUG_EVENT_DEVICE_LEFT    = 1 << 1
+} libusb_hotplug_event;
+
+typedef enum { LIBUSB_HOTPLUG_ENUMERATE = 1 << 0 } libusb_hotplug_flag;
+
+#define LIBUSB_HOTPLUG_MATCH_ANY -1
+
+struct libusb_device_descriptor {
+    
+    uint8_t     bLength;
+    uint8_t     bDescriptorType;
+    uint16_t    bcdUSB;
+    uint8_t     bDeviceClass;
+    uint8_t     bDeviceSubClass;
+    uint8_t     bDeviceProtocol;
+    uint8_t     bMaxPacketSize0;
+    uint16_t    idVendor;
+    uint16_t    idProduct;
+    uint16_t    bcdDevice;
+    uint8_t     iManufacturer;
+    uint8_t     iProduct;
+    uint8_t     iSerialNumber;
+    uint8_t     bNumConfigurations;
+};
+
+struct libusb_endpoint_descriptor {
+    
+    uint8_t     bEndpointAddress;
+    uint8_t     bmAttributes;
+    uint16_t    wMaxPacketSize;
+    uint8_t     bInterval;
+};
+
+struct libusb_interface_descriptor {
+    
+    uint8_t     bInterfaceNumber;
+    uint8_t     bAlternateSetting;
+    uint8_t     bNumEndpoints;
+    uint8_t     bInterfaceClass;
+    const struct libusb_endpoint_descriptor *endpoint;
+};
+
+struct libusb_interface {
+    
+    const struct libusb_interface_descriptor *altsetting;
+    int         num_altsetting;
+};
+
+struct libusb_config_descriptor {
+    
+    uint8_t     bNumInterfaces;
+    uint8_t     bConfigurationValue;
+    const struct libusb_interface *interface;
+};
+
+struct libusb_transfer;
+typedef void (LIBUSB_CALL *libusb_transfer_cb_fn)(struct libusb_transfer *transfer);
+
+struct libusb_transfer {
+    
+    libusb_device_handle *      dev_handle;
+    uint8_t                     flags;
+    unsigned char               endpoint;
+    unsigned char               type;
+    unsigned int                timeout;
+    enum libusb_transfer_status status;
+    int                         length;
+    int                         actual_length;
+    libusb_transfer_cb_fn       callback;
+    void *                      user_data;
+    unsigned char *             buffer;
+    int                         num_iso_packets;
+};
+
+struct libusb_pollfd {
+    
+    int         fd;
+    short       events;
+};
+
+typedef int (LIBUSB_CALL *libusb_hotplug_callback_fn)(libusb_context *ctx, libusb_device *device,
+                                                      libusb_hotplug_event event, void *user_data);
+typedef void (LIBUSB_CALL *libusb_pollfd_added_cb)(int fd, short events, void *user_data);
+typedef void (LIBUSB_CALL *libusb_pollfd_removed_cb)(int fd, void *user_data);
+
+int libusb_init(libusb_context **ctx);
+void libusb_exit(libusb_context *ctx);
+int libusb_has_capability(uint32_t capability);
+
+int libusb_hotplug_register_callback(libusb_context *ctx, libusb_hotplug_event events, libusb_hotplug_flag flags,
+                                     int vendor_id, int product_id, int dev_class,
+                                     libusb_hotplug_callback_fn cb_fn, void *user_data,
+                                     libusb_hotplug_callback_handle *callback_handle);
+void libusb_hotplug_deregister_callback(libusb_context *ctx, libusb_hotplug_callback_handle callback_handle);
+
+ssize_t libusb_get_device_list(libusb_context *ctx, libusb_device ***list);
+void libusb_free_device_list(libusb_device **list, int unref_devices);
+libusb_device *libusb_ref_device(libusb_device *dev);
+void libusb_unref_device(libusb_device *dev);
+uint8_t libusb_get_bus_number(libusb_device *dev);
+uint8_t libusb_get_device_address(libusb_device *dev);
+
+int libusb_get_device_descriptor(libusb_device *dev, struct libusb_device_descriptor *desc);
+int libusb_get_active_config_descriptor(libusb_device *dev, struct libusb_config_descriptor **config);
+int libusb_get_config_descriptor(libusb_device *dev, uint8_t config_index, struct libusb_config_descriptor **config);
+void libusb_free_config_descriptor(struct libusb_config_descriptor *config);
+
+int libusb_open(libusb_device *dev, libusb_device_handle **dev_handle);
+void libusb_close(libusb_device_handle *dev_handle);
+int libusb_set_auto_detach_kernel_driver(libusb_device_handle *dev_handle, int enable);
+int libusb_claim_interface(libusb_device_handle *dev_handle, int interface_number);
+int libusb_release_interface(libusb_device_handle *dev_handle, int interface_number);
+int libusb_clear_halt(libusb_device_handle *dev_handle, unsigned char endpoint);
+int libusb_reset_device(libusb_device_handle *dev_handle);
+
+struct libusb_transfer *libusb_alloc_transfer(int iso_packets);
+void libusb_free_transfer(struct libusb_transfer *transfer);
+int libusb_submit_transfer(struct libusb_transfer *transfer);
+int libusb_cancel_transfer(struct libusb_transfer *transfer);
+
+int libusb_handle_events_timeout_completed(libusb_context *ctx, struct timeval *tv, int *completed);
+const struct libusb_pollfd **libusb_get_pollfds(libusb_context *ctx);
+void libusb_free_pollfds(const struct libusb_pollfd **pollfds);
+void libusb_set_pollfd_notifiers(libusb_context *ctx, libusb_pollfd_added_cb added_cb,
+                                 libusb_pollfd_removed_cb removed_cb, void *user_data);
+
+static inline void
+libusb_fill_interrupt_transfer(struct libusb_transfer *transfer, libusb_device_handle *dev_handle,
+                               unsigned char endpoint, unsigned char *buffer, int length,
+                               libusb_transfer_cb_fn callback, void *user_data, unsigned int timeout)
+{
+    transfer->dev_handle = dev_handle;
+    transfer->endpoint = endpoint;
+    transfer->type = LIBUSB_TRANSFER_TYPE_INTERRUPT;
+    transfer->timeout = timeout;
+    transfer->buffer = buffer;
+    transfer->length = length;
+    transfer->user_data = user_data;
+    transfer->callback = callback;
+}
+
+#endif
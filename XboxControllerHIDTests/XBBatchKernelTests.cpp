@@ -0,0 +1,75 @@
+//
+//  XBBatchKernelTests.cpp
+//  XboxControllerHIDTests
+//
+//  Every batch kernel this host supports against the per-report transform the
+//  driver runs, byte for byte, for every option mask and every tail length.
+//
+
+#include <string.h>
+
+#include "XboxControllerHIDCore.h"
+#include "XBTest.h"
+
+#define kMaxReports 100
+
+static void
+testKernel(XBPadBatchKernel kernel)
+{
+    XBTestRandom random = { 0xBF58476D1CE4E5B9ULL };
+    
+    for (UInt32 mask = 0; mask < kNumPadTransforms; mask++) {
+        
+        UInt8 leftTable[256], rightTable[256];
+        
+        XBBuildTriggerTable(leftTable, XBTestNext(&random) & 1, 2 + XBTestNext(&random) % 254);
+        XBBuildTriggerTable(rightTable, XBTestNext(&random) & 1, 2 + XBTestNext(&random) % 254);
+        
+        for (UInt32 count = 0; count <= kMaxReports; count++) {
+            
+            // one spare byte, so the reports also start unaligned
+            UInt8 buffer[kMaxReports * sizeof(XBPadReport) + 1];
+            XBPadReport expected[kMaxReports];
+            UInt32 offset = count & 1;
+            XBPadReport *reports = (XBPadReport *)(buffer + offset);
+            
+            XBTestFill(&random, buffer, sizeof(buffer));
+            
+            // plenty of zero buttons, which the clamp has to leave at 0
+            for (UInt32 i = 0; i < count; i++)
+                if (XBTestNext(&random) % 2)
+                    reports[i].a = reports[i].white = 0;
+            
+            memcpy(expected, reports, count * sizeof(XBPadReport));
+            for (UInt32 i = 0; i < count; i++)
+                XBSelectPadTransform(mask)(&expected[i], leftTable, rightTable);
+            
+            XBTransformPadReports(kernel, mask, reports, count, leftTable, rightTable);
+            
+            if (memcmp(reports, expected, count * sizeof(XBPadReport)) != 0) {
+                fprintf(stderr, "%s: mask %u, %u reports differ\n", XBPadBatchKernelName(kernel), mask, count);
+                gTestFailures++;
+                return;
+            }
+        }
+    }
+}
+
+int
+main()
+{
+    XB_CHECK(XBPadBatchKernelSupported(kPadBatchScalar));
+    XB_CHECK(XBPadBatchKernelSupported(XBBestPadBatchKernel()));
+    XB_CHECK(!XBPadBatchKernelSupported(kNumPadBatchKernels));
+    
+    for (int kernel = 0; kernel < kNumPadBatchKernels; kernel++) {
+        
+        printf("%s: %s\n", XBPadBatchKernelName((XBPadBatchKernel)kernel),
+               XBPadBatchKernelSupported((XBPadBatchKernel)kernel) ? "tested" : "not supported here");
+        
+        // unsupported kernels fall back to the scalar one, which has to work too
+        testKernel((XBPadBatchKernel)kernel);
+    }
+    
+    return XB_TEST_RESULT();
+}
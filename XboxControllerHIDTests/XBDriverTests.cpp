@@ -0,0 +1,702 @@
+//
+//  XBDriverTests.cpp
+//  XboxControllerHIDTests
+//
+//  The driver itself, XboxControllerHID.cpp unmodified, on the kernel shim:
+//  matched from its own personality to simulated pads and IR receivers, its
+//  read loop running against them in real time, each fault recovered the
+//  way it recovers on a real bus, and every device terminated cleanly at the
+//  end. Then 32 pads polled every millisecond side by side, with the read
+//  ring as deep as the personality's InterruptReads and with a single read.
+//
+//  Each scenario also reports the reports it got per second, the latency
+//  from the completion of a read until the report handler saw it, and the
+//  polls that found no read queued and lost their report, as JSON, so runs
+//  can be compared from commit to commit.
+//
+//  usage: XBDriverTests [--duration MS] [--pads N] [--output FILE]
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <IOKit/IOBufferMemoryDescriptor.h>
+#include <IOKit/IOUserClient.h>
+#include <libkern/c++/OSContainers.h>
+
+#include "XBShim.h"
+#include "XboxControllerHID.h"
+#include "XboxControllerHIDKeys.h"
+#include "XBTest.h"
+
+#define kMs                 1000000ULL
+#define kMaxLatencies       (1 << 20)
+#define kMaxPads            256
+
+static const char *gInfoPlist = XB_INFO_PLIST;
+static OSDictionary *gPersonality;
+static UInt64 gDuration = 300 * kMs;
+static FILE *gOutput;
+static bool gFirstResult = true;
+
+// -- report handler ----------------------------------------
+// ----------------------------------------------------------
+
+// what the HID layer got from every device of a scenario
+typedef struct {
+    
+    volatile UInt64 reports;
+    volatile UInt64 releases;           // all zero reports of a remote
+    UInt64 *        latencies;          // ns, the first kMaxLatencies reports
+    UInt8           last[kTraceReportBytes];
+    UInt32          lastLength;
+    UInt64          lastTime;
+    
+} Received;
+
+static void
+receiveReport(void *target, IOHIDDevice *, AbsoluteTime timeStamp, const void *report, UInt32 length)
+{
+    Received *received = (Received *)target;
+    UInt64 now, index;
+    bool zero = true;
+    
+    clock_get_uptime(&now);
+    
+    index = __sync_fetch_and_add(&received->reports, 1);
+    if (index < kMaxLatencies)
+        received->latencies[index] = now - AbsoluteTime_to_scalar(&timeStamp);
+    
+    for (UInt32 i = 0; i < length; i++)
+        zero = zero && ((const UInt8 *)report)[i] == 0;
+    if (zero)
+        __sync_fetch_and_add(&received->releases, 1);
+    
+    // the last one of a single device scenario; with more, just one of the last
+    received->lastLength = length < kTraceReportBytes ? length : kTraceReportBytes;
+    memcpy(received->last, report, received->lastLength);
+    received->lastTime = AbsoluteTime_to_scalar(&timeStamp);
+}
+
+static Received *
+newReceived()
+{
+    Received *received = new Received;
+    
+    memset(received, 0, sizeof(Received));
+    received->latencies = new UInt64[kMaxLatencies];
+    return received;
+}
+
+static void
+deleteReceived(Received *received)
+{
+    delete [] received->latencies;
+    delete received;
+}
+
+// -- devices -----------------------------------------------
+// ----------------------------------------------------------
+
+// a device plugged in and the driver matched to its first interface
+typedef struct {
+    
+    IOUSBDevice *   device;
+    IOService *     driver;
+    
+} Plugged;
+
+// matched from personality, gPersonality if NULL
+static bool
+plugIn(Plugged *plugged, const XBShimDeviceDescription *description, const XBSimDevice *sim, Received *received,
+       OSDictionary *personality = NULL)
+{
+    SInt32 score = 0;
+    
+    plugged->driver = NULL;
+    plugged->device = XBShimCreateDevice(description, sim);
+    if (!plugged->device)
+        return false;
+    
+    plugged->driver = XBShimMatch(personality ? personality : gPersonality, XBShimInterface(plugged->device, 0), &score);
+    if (!plugged->driver)
+        return false;
+    
+    XBShimSetReportHandler(plugged->driver, receiveReport, received);
+    return true;
+}
+
+// unplugged, with the driver gone from the device before it goes
+static void
+unplug(Plugged *plugged)
+{
+    if (plugged->device)
+        XB_CHECK(XBShimDestroyDevice(plugged->device));
+    if (plugged->driver)
+        plugged->driver->release();
+    plugged->device = NULL;
+    plugged->driver = NULL;
+}
+
+static void
+plugPad(Plugged *plugged, const XBSimDevice *sim, Received *received, UInt32 locationID,
+        OSDictionary *personality = NULL)
+{
+    XBShimDeviceDescription description;
+    
+    XBShimPadDescription(&description, locationID);
+    XB_CHECK(plugIn(plugged, &description, sim, received, personality));
+}
+
+static void
+sleepNs(UInt64 ns)
+{
+    usleep((useconds_t)(ns / 1000));
+}
+
+static void
+simStats(Plugged *plugged, XBSimStats *stats)
+{
+    XBSimPipe *pipe = plugged->device->getSimPipe();
+    
+    pthread_mutex_lock(&pipe->lock);
+    *stats = pipe->stats;
+    pthread_mutex_unlock(&pipe->lock);
+}
+
+// the reads the driver keeps queued, as it published them
+static UInt32
+interruptReads(Plugged *plugged)
+{
+    OSNumber *number = plugged->driver ? OSDynamicCast(OSNumber, plugged->driver->getProperty(kInterruptReadsKey)) : NULL;
+    
+    return number ? number->unsigned32BitValue() : 0;
+}
+
+// -- statistics --------------------------------------------
+// ----------------------------------------------------------
+
+// a statistics command, as a client sends it
+static IOReturn
+statisticsCommand(IOService *driver, const char *key)
+{
+    OSDictionary *command = OSDictionary::withCapacity(1);
+    IOReturn result;
+    
+    command->setObject(key, kOSBooleanTrue);
+    result = driver->setProperties(command);
+    command->release();
+    return result;
+}
+
+// a number of the Statistics last published, or an Errors count if error
+static UInt64
+publishedStatistic(IOService *driver, const char *key, const char *error = NULL)
+{
+    OSDictionary *statistics = OSDynamicCast(OSDictionary, driver->getProperty(kStatisticsKey));
+    OSNumber *number = NULL;
+    
+    if (!statistics)
+        return 0;
+    
+    if (error) {
+        OSDictionary *errors = OSDynamicCast(OSDictionary, statistics->getObject(kStatErrorsKey));
+        if (errors)
+            number = OSDynamicCast(OSNumber, errors->getObject(error));
+    }
+    else
+        number = OSDynamicCast(OSNumber, statistics->getObject(key));
+    
+    return number ? number->unsigned64BitValue() : 0;
+}
+
+// the values counted in all buckets of a histogram last published
+static UInt64
+publishedHistogram(IOService *driver, const char *key)
+{
+    OSDictionary *statistics = OSDynamicCast(OSDictionary, driver->getProperty(kStatisticsKey));
+    OSArray *buckets = statistics ? OSDynamicCast(OSArray, statistics->getObject(key)) : NULL;
+    OSNumber *number;
+    UInt64 count = 0;
+    
+    for (UInt32 i = 0; buckets && i < buckets->getCount(); i++) {
+        number = OSDynamicCast(OSNumber, buckets->getObject(i));
+        count += number ? number->unsigned64BitValue() : 0;
+    }
+    return count;
+}
+
+// the driver's Statistics, published as when a client asks for them
+static UInt64
+statistic(IOService *driver, const char *key, const char *error = NULL)
+{
+    XB_CHECK_EQUAL(statisticsCommand(driver, kClientPublishStatisticsKey), kIOReturnSuccess);
+    return publishedStatistic(driver, key, error);
+}
+
+static UInt64
+histogram(IOService *driver, const char *key)
+{
+    XB_CHECK_EQUAL(statisticsCommand(driver, kClientPublishStatisticsKey), kIOReturnSuccess);
+    return publishedHistogram(driver, key);
+}
+
+// ResetStatistics publishes what it cleared, with nothing counted since
+static void
+checkStatisticsReset(IOService *driver)
+{
+    XB_CHECK_EQUAL(statisticsCommand(driver, kClientResetStatisticsKey), kIOReturnSuccess);
+    XB_CHECK_EQUAL(publishedStatistic(driver, kStatReportsDeliveredKey), 0);
+    XB_CHECK_EQUAL(publishedStatistic(driver, kStatHaltRecoveryTotalKey), 0);
+    XB_CHECK_EQUAL(publishedHistogram(driver, kStatReportLatencyKey), 0);
+    XB_CHECK_EQUAL(publishedHistogram(driver, kStatReportIntervalKey), 0);
+    XB_CHECK_EQUAL(publishedHistogram(driver, kStatHaltRecoveryKey), 0);
+}
+
+static int
+compareLatencies(const void *a, const void *b)
+{
+    UInt64 x = *(const UInt64 *)a, y = *(const UInt64 *)b;
+    
+    return x < y ? -1 : x > y;
+}
+
+static double
+percentileUs(const UInt64 *sorted, UInt64 count, double percentile)
+{
+    UInt64 index = (UInt64)(percentile * (count - 1));
+    
+    return count ? sorted[index] / 1000.0 : 0;
+}
+
+// missed are the polls of all pads that found no read queued
+static void
+writeResult(const char *name, UInt32 pads, UInt32 reads, UInt64 missed, Received *received, UInt64 elapsed)
+{
+    UInt64 count = received->reports < kMaxLatencies ? received->reports : kMaxLatencies;
+    
+    qsort(received->latencies, count, sizeof(UInt64), compareLatencies);
+    
+    fprintf(gOutput, "%s\n    { \"scenario\": \"%s\", \"pads\": %u, \"interruptReads\": %u, \"reports\": %llu, "
+            "\"reportsPerSecond\": %.1f, \"missed\": %llu,\n"
+            "      \"latencyUs\": { \"p50\": %.1f, \"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f } }",
+            gFirstResult ? "" : ",", name, pads, reads, (unsigned long long)received->reports,
+            received->reports * 1e9 / elapsed, (unsigned long long)missed,
+            percentileUs(received->latencies, count, 0.5), percentileUs(received->latencies, count, 0.99),
+            percentileUs(received->latencies, count, 0.999), count ? received->latencies[count - 1] / 1000.0 : 0);
+    gFirstResult = false;
+}
+
+// -- scenarios ---------------------------------------------
+// ----------------------------------------------------------
+
+static void
+testPad()
+{
+    XBSimDevice sim;
+    XBSimStep hold = { 10000 * kMs, kSimPatternHold, 0x11, 200, 0, 0 };
+    Received *received = newReceived();
+    Plugged plugged;
+    IOBufferMemoryDescriptor *report, *output;
+    IOUserClient *client = NULL;
+    IOMemoryDescriptor *ring = NULL;
+    IOOptionBits options = 0;
+    XBShimDeviceStats deviceStats;
+    XBSimPipe *pipe;
+    XBSimStats stats;
+    UInt64 delivered;
+    UInt32 reads;
+    static const UInt8 rumble[6] = { 0, 6, 0, 128, 0, 128 };
+    
+    XBInitSimDevice(&sim, kSimDevicePad, 4 * kMs, 1);
+    XBAddSimStep(&sim, &hold);
+    plugPad(&plugged, &sim, received, 0x1A100000);
+    if (!plugged.driver) {
+        unplug(&plugged);
+        deleteReceived(received);
+        return;
+    }
+    
+    // the trace, open for the whole run
+    XB_CHECK_EQUAL(plugged.driver->newUserClient(current_task(), (void *)1, kTraceClientType, NULL, &client),
+                   kIOReturnSuccess);
+    if (client)
+        XB_CHECK_EQUAL(client->clientMemoryForType(kTraceMemoryRing, &options, &ring),
+                       kIOReturnSuccess);
+    
+    sleepNs(gDuration);
+    
+    // every poll delivered, the held buttons in each
+    simStats(&plugged, &stats);
+    delivered = statistic(plugged.driver, kStatReportsDeliveredKey);
+    XB_CHECK(received->reports > 0);
+    XB_CHECK(stats.reports >= received->reports);
+    XB_CHECK(delivered >= received->reports);
+    XB_CHECK(received->reports * 4 * kMs >= gDuration / 2);
+    XB_CHECK_EQUAL(stats.errors, 0);
+    XB_CHECK(histogram(plugged.driver, kStatReportLatencyKey) > 0);
+    XB_CHECK(publishedHistogram(plugged.driver, kStatReportIntervalKey) > 0);
+    XB_CHECK_EQUAL(publishedHistogram(plugged.driver, kStatHaltRecoveryKey), 0);
+    
+    // stamped with the poll that carried it, not when the driver got to it
+    pipe = plugged.device->getSimPipe();
+    XB_CHECK(received->lastTime > pipe->start);
+    XB_CHECK_EQUAL((received->lastTime - pipe->start) % (4 * kMs), 0);
+    
+    // the last report, again from the driver
+    report = IOBufferMemoryDescriptor::withCapacity(kTraceReportBytes, kIODirectionIn);
+    XB_CHECK_EQUAL(((IOHIDDevice *)plugged.driver)->getReport(report, kIOHIDReportTypeInput, 0), kIOReturnSuccess);
+    XB_CHECK(report->getLength() >= received->lastLength);
+    XB_CHECK(received->lastLength > 0);
+    XB_CHECK(!memcmp(report->getBytesNoCopy(), received->last, received->lastLength));
+    report->release();
+    
+    // rumble goes out on the OUT pipe
+    output = IOBufferMemoryDescriptor::withBytes(rumble, sizeof(rumble), kIODirectionOut);
+    XB_CHECK_EQUAL(((IOHIDDevice *)plugged.driver)->setReport(output, kIOHIDReportTypeOutput, 0), kIOReturnSuccess);
+    output->release();
+    plugged.device->copyStats(&deviceStats);
+    XB_CHECK_EQUAL(deviceStats.outputReports, 1);
+    XB_CHECK_EQUAL(deviceStats.lastOutputLength, sizeof(rumble));
+    
+    // and the trace saw what was delivered, as it was delivered
+    if (ring) {
+        
+        XBTraceRing *header = (XBTraceRing *)((IOBufferMemoryDescriptor *)ring)->getBytesNoCopy();
+        XBTraceRecord record;
+        UInt64 traced = 0, output = 0;
+        bool match = true;
+        
+        XB_CHECK_EQUAL(header->version, kTraceFormatVersion);
+        while (XBTraceRingPop(header, &record, 1) == 1) {
+            if (record.flags & kTraceRecordOutput)
+                output++;
+            else if (record.flags & kTraceRecordDelivered) {
+                traced++;
+                match = match && record.transformed[2] == 0x11;
+            }
+        }
+        XB_CHECK(traced > 0);
+        XB_CHECK(match);
+        XB_CHECK_EQUAL(output, 1);
+        ring->release();
+    }
+    if (client) {
+        XB_CHECK_EQUAL(client->clientClose(), kIOReturnSuccess);
+        client->release();
+    }
+    
+    checkStatisticsReset(plugged.driver);
+    
+    reads = interruptReads(&plugged);
+    unplug(&plugged);
+    writeResult("pad", 1, reads, stats.missed, received, gDuration);
+    deleteReceived(received);
+}
+
+// a DeviceOptions key, as the preference pane sets it
+static IOReturn
+setPadOption(IOService *driver, const char *key, OSObject *value)
+{
+    OSDictionary *properties = OSDictionary::withCapacity(3);
+    OSString *type = OSString::withCString(kDeviceTypePadKey);
+    OSString *optionKey = OSString::withCString(key);
+    IOReturn result;
+    
+    properties->setObject(kTypeKey, type);
+    properties->setObject(kClientOptionKeyKey, optionKey);
+    properties->setObject(kClientOptionValueKey, value);
+    result = driver->setProperties(properties);
+    
+    type->release();
+    optionKey->release();
+    properties->release();
+    return result;
+}
+
+// A pad held still with its duplicates suppressed and no keepalive delivers
+// nothing new, and a fresh getReport() still comes back at its next poll
+// with what it last delivered, long before kFreshReportTimeoutMS
+static void
+testDuplicates()
+{
+    XBSimDevice sim;
+    XBSimStep hold = { 10000 * kMs, kSimPatternHold, 0x11, 200, 0, 0 };
+    Received *received = newReceived();
+    Plugged plugged;
+    IOBufferMemoryDescriptor *report;
+    OSNumber *never = OSNumber::withNumber(0ULL, 16);
+    XBSimStats stats;
+    UInt64 reports, start, end;
+    UInt32 reads;
+    
+    XBInitSimDevice(&sim, kSimDevicePad, 4 * kMs, 4);
+    XBAddSimStep(&sim, &hold);
+    plugPad(&plugged, &sim, received, 0x1A400000);
+    if (!plugged.driver) {
+        unplug(&plugged);
+        never->release();
+        deleteReceived(received);
+        return;
+    }
+    
+    XB_CHECK_EQUAL(setPadOption(plugged.driver, kOptionKeepaliveIntervalKey, never), kIOReturnSuccess);
+    XB_CHECK_EQUAL(setPadOption(plugged.driver, kOptionSuppressDuplicateReportsKey, kOSBooleanTrue), kIOReturnSuccess);
+    never->release();
+    
+    sleepNs(50 * kMs);
+    reports = received->reports;
+    sleepNs(50 * kMs);
+    XB_CHECK(reports > 0);
+    XB_CHECK_EQUAL(received->reports, reports);
+    XB_CHECK(statistic(plugged.driver, kStatReportsSuppressedKey) > 0);
+    
+    report = IOBufferMemoryDescriptor::withCapacity(kTraceReportBytes, kIODirectionIn);
+    clock_get_uptime(&start);
+    XB_CHECK_EQUAL(((IOHIDDevice *)plugged.driver)->getReport(report, kIOHIDReportTypeInput, kGetReportOptionFresh),
+                   kIOReturnSuccess);
+    clock_get_uptime(&end);
+    XB_CHECK(end - start < kFreshReportTimeoutMS * kMs / 2);
+    XB_CHECK(!memcmp(report->getBytesNoCopy(), received->last, received->lastLength));
+    report->release();
+    
+    simStats(&plugged, &stats);
+    reads = interruptReads(&plugged);
+    unplug(&plugged);
+    writeResult("duplicates", 1, reads, stats.missed, received, 100 * kMs);
+    deleteReceived(received);
+}
+
+// A pad with one fault at 100 ms. The driver has to get the reports going
+// again, within the run
+typedef struct {
+    
+    const char *name;
+    XBSimFault  fault;
+    const char *error;                  // Statistics Errors key of the fault
+    UInt64      count;                  // errors it counts, 0 for as many as fail until the reset or unplug
+    bool        halts;                  // the endpoint halts and has to be cleared
+    bool        timed;                  // input stops until then, which shows in HaltRecoveryTotal
+    bool        resets;
+    
+} FaultScenario;
+
+static void
+testFault(const FaultScenario *scenario)
+{
+    XBSimDevice sim;
+    Received *received = newReceived();
+    Plugged plugged;
+    XBShimDeviceStats deviceStats;
+    XBSimStats stats;
+    UInt64 start;
+    UInt32 reads;
+    
+    XBInitSimDevice(&sim, kSimDevicePad, 4 * kMs, 2);
+    XBAddSimFault(&sim, &scenario->fault);
+    plugPad(&plugged, &sim, received, 0x1A200000);
+    if (!plugged.driver) {
+        unplug(&plugged);
+        deleteReceived(received);
+        return;
+    }
+    start = plugged.device->getSimPipe()->start;
+    
+    // the fault, the recovery and a while of reports after it
+    sleepNs(gDuration < 250 * kMs ? 250 * kMs : gDuration);
+    
+    simStats(&plugged, &stats);
+    plugged.device->copyStats(&deviceStats);
+    
+    if (scenario->count)
+        XB_CHECK_EQUAL(statistic(plugged.driver, NULL, scenario->error), scenario->count);
+    else
+        XB_CHECK(statistic(plugged.driver, NULL, scenario->error) > 0);
+    XB_CHECK_EQUAL(stats.resets, scenario->resets ? 1 : 0);
+    if (scenario->halts)
+        XB_CHECK(deviceStats.endpointHaltsCleared >= 1);
+    if (scenario->timed) {
+        XB_CHECK(statistic(plugged.driver, kStatHaltRecoveryTotalKey) > 0);
+        XB_CHECK(publishedHistogram(plugged.driver, kStatHaltRecoveryKey) > 0);
+        checkStatisticsReset(plugged.driver);
+    }
+    if (!scenario->fault.unplug)
+        XB_CHECK(received->lastTime > start + scenario->fault.time + (scenario->resets ? kSimResetTime : 0));
+    else
+        XB_CHECK(received->lastTime < start + scenario->fault.time);
+    
+    reads = interruptReads(&plugged);
+    unplug(&plugged);
+    writeResult(scenario->name, 1, reads, stats.missed, received, gDuration);
+    deleteReceived(received);
+}
+
+static void
+testFaults()
+{
+    static const FaultScenario scenarios[] = {
+        // the overrun brings its report, so there is no time without input to measure
+        { "stall",          { 100 * kMs, kSimStatusCRCErr, 0, false },          "CRCErr",           1, true,  true,  false },
+        { "overrun",        { 100 * kMs, kSimStatusOverrun, 0, false },         "Overrun",          1, true,  false, false },
+        { "notResponding",  { 100 * kMs, kSimStatusNotResponding, 2, false },   "NotResponding",    2, false, false, false },
+        { "reset",          { 100 * kMs, kSimStatusNotResponding, 0, false },   "NotResponding",    0, false, false, true  },
+        { "unplug",         { 100 * kMs, kSimStatusNotResponding, 0, true },    "NotResponding",    0, false, false, false },
+    };
+    
+    for (UInt32 i = 0; i < sizeof(scenarios) / sizeof(scenarios[0]); i++)
+        testFault(&scenarios[i]);
+}
+
+static void
+testRemote()
+{
+    XBSimDevice sim;
+    XBSimStep idle = { 50 * kMs, kSimPatternIdle, 0, 0, 0, 0 };
+    XBSimStep press = { 150 * kMs, kSimPatternRemoteButton, 0, 0, 213, 0 };
+    Received *received = newReceived();
+    XBShimDeviceDescription description;
+    Plugged plugged;
+    XBSimStats stats;
+    UInt32 reads;
+    
+    XBInitSimDevice(&sim, kSimDeviceRemote, 16 * kMs, 3);
+    XBAddSimStep(&sim, &idle);
+    XBAddSimStep(&sim, &press);
+    XBAddSimStep(&sim, &idle);
+    XBAddSimStep(&sim, &idle);
+    XBAddSimStep(&sim, &press);
+    
+    XBShimRemoteDescription(&description, 0x1A300000);
+    XB_CHECK(plugIn(&plugged, &description, &sim, received));
+    
+    // two presses, each repeated while held, and the release timer ends each one
+    sleepNs(600 * kMs);
+    XB_CHECK_EQUAL(received->releases, 2);
+    XB_CHECK(received->reports >= 2 * 2);
+    
+    simStats(&plugged, &stats);
+    reads = interruptReads(&plugged);
+    unplug(&plugged);
+    writeResult("remote", 1, reads, stats.missed, received, 600 * kMs);
+    deleteReceived(received);
+}
+
+// numReads reads queued per pad, the personality's InterruptReads if 0
+static void
+testThroughput(UInt32 numPads, UInt32 numReads)
+{
+    XBSimDevice sim;
+    XBSimStep sweep = { 10000 * kMs, kSimPatternSweep, 0, 0, 0, 100 * kMs };
+    Received *received = newReceived();
+    Plugged *pads = new Plugged[numPads];
+    OSDictionary *personality = OSDictionary::withDictionary(gPersonality);
+    UInt64 polls = 0, missed = 0, start, end;
+    UInt32 reads;
+    
+    if (numReads) {
+        
+        OSNumber *number = OSNumber::withNumber(numReads, 32);
+        
+        personality->setObject(kInterruptReadsKey, number);
+        number->release();
+    }
+    
+    clock_get_uptime(&start);
+    for (UInt32 i = 0; i < numPads; i++) {
+        
+        XBInitSimDevice(&sim, kSimDevicePad, kMs, 100 + i);
+        XBAddSimStep(&sim, &sweep);
+        plugPad(&pads[i], &sim, received, 0x1B000000 + (i << 16), personality);
+    }
+    
+    sleepNs(gDuration);
+    
+    // most polls reach the driver, on a busy machine not quite all
+    for (UInt32 i = 0; i < numPads; i++) {
+        
+        XBSimStats stats;
+        
+        if (!pads[i].device)
+            continue;
+        simStats(&pads[i], &stats);
+        polls += stats.polls;
+        missed += stats.missed;
+        XB_CHECK_EQUAL(stats.errors, 0);
+    }
+    XB_CHECK(received->reports > 0);
+    XB_CHECK(received->reports >= polls / 2);
+    
+    reads = interruptReads(&pads[0]);
+    if (numReads)
+        XB_CHECK_EQUAL(reads, numReads);
+    
+    for (UInt32 i = 0; i < numPads; i++)
+        unplug(&pads[i]);
+    clock_get_uptime(&end);
+    
+    writeResult("throughput", numPads, reads, missed, received, end - start);
+    personality->release();
+    delete [] pads;
+    deleteReceived(received);
+}
+
+static void
+usage()
+{
+    fprintf(stderr, "usage: XBDriverTests [--duration MS] [--pads N] [--output FILE]\n");
+    exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+    UInt32 numPads = 32;
+    const char *output = NULL;
+    
+    for (int i = 1; i < argc; i++) {
+        
+        if (i + 1 == argc)
+            usage();
+        
+        if (!strcmp(argv[i], "--duration"))
+            gDuration = strtoull(argv[++i], NULL, 0) * kMs;
+        else if (!strcmp(argv[i], "--pads"))
+            numPads = (UInt32)strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--output"))
+            output = argv[++i];
+        else
+            usage();
+    }
+    
+    if (gDuration == 0 || numPads == 0 || numPads > kMaxPads)
+        usage();
+    
+    gOutput = output ? fopen(output, "w") : stdout;
+    if (!gOutput) {
+        perror(output);
+        return 1;
+    }
+    
+    gPersonality = XBShimLoadPersonality(gInfoPlist, "Generic Xbox Device");
+    XB_CHECK(gPersonality != NULL);
+    if (!gPersonality)
+        return XB_TEST_RESULT();
+    
+    fprintf(gOutput, "{\n  \"benchmark\": \"XBDriverTests\",\n  \"durationMs\": %llu,\n  \"results\": [",
+            (unsigned long long)(gDuration / kMs));
+    
+    testPad();
+    testDuplicates();
+    testFaults();
+    testRemote();
+    testThroughput(numPads, 0);
+    testThroughput(numPads, 1);
+    
+    fprintf(gOutput, "\n  ]\n}\n");
+    if (output)
+        fclose(gOutput);
+    
+    gPersonality->release();
+    return XB_TEST_RESULT();
+}
@@ -0,0 +1,442 @@
+//
+//  XBGenericPatternTests.cpp
+//  XboxControllerHIDTests
+//
+//  The compiled GenericProperties patterns against a walk of the property
+//  tree itself, the way findGenericDevice() matched devices before them.
+//
+
+#include "XboxControllerHIDCore.h"
+#include "XBTest.h"
+
+#include <string.h>
+
+#define kMaxTreeEndpoints       4
+#define kMaxDeviceInterfaces    6
+#define kMaxDeviceEndpoints     5
+
+// -- GenericProperties tree --------------------------------
+// ----------------------------------------------------------
+
+// an entry of an Endpoints array, any key may be missing
+typedef struct {
+    
+    bool    isDictionary;
+    bool    hasAttributes, hasMaxPacketSize, hasPollingInterval;
+    UInt8   attributes;
+    UInt16  maxPacketSize;
+    UInt8   pollingInterval;
+    
+} TreeEndpoint;
+
+typedef struct {
+    
+    bool            isDictionary;
+    bool            hasEndpoints;
+    UInt32          numEndpoints;
+    TreeEndpoint    endpoints[kMaxTreeEndpoints];
+    
+} TreeInterface;
+
+typedef struct {
+    
+    UInt32          numInterfaces;
+    TreeInterface   interfaces[kMaxGenericInterfaces];
+    
+} Tree;
+
+// -- device ------------------------------------------------
+// ----------------------------------------------------------
+
+typedef struct {
+    
+    UInt8   address;
+    UInt16  maxPacketSize;
+    UInt8   pollingInterval;
+    
+} DeviceEndpoint;
+
+typedef struct {
+    
+    UInt32          numEndpoints;
+    DeviceEndpoint  endpoints[kMaxDeviceEndpoints];
+    
+} DeviceInterface;
+
+typedef struct {
+    
+    UInt32          numInterfaces;
+    DeviceInterface interfaces[kMaxDeviceInterfaces];
+    
+} Device;
+
+// IOUSBInterface::GetEndpointProperties()
+static bool
+getEndpointProperties(const DeviceInterface *interface, UInt8 index, UInt8 direction, UInt16 *maxPacketSize, UInt8 *pollingInterval)
+{
+    for (UInt32 e = 0; e < interface->numEndpoints; e++) {
+        
+        const DeviceEndpoint *endpoint = &interface->endpoints[e];
+        
+        if ((endpoint->address & 0xF) == index && (endpoint->address & 0x80) == direction) {
+            *maxPacketSize = endpoint->maxPacketSize;
+            *pollingInterval = endpoint->pollingInterval;
+            return true;
+        }
+    }
+    
+    return false;
+}
+
+// the tree walk findGenericDevice() used to do for one device type
+static bool
+walkTree(const Tree *tree, const Device *device)
+{
+    UInt32 numActualInterfaces = 0;
+    bool allEndpointsMatched = true;
+    
+    for (UInt32 j = 0; j < tree->numInterfaces; j++) {
+        
+        if (j >= device->numInterfaces)
+            continue;
+        
+        const DeviceInterface *foundInterface = &device->interfaces[j];
+        const TreeInterface *interfaceEntry = &tree->interfaces[j];
+        
+        numActualInterfaces++;
+        
+        if (!interfaceEntry->isDictionary || !interfaceEntry->hasEndpoints)
+            continue;
+        
+        UInt32 numActualEndpoints = 0;
+        
+        for (UInt32 k = 0; k < interfaceEntry->numEndpoints; k++) {
+            
+            const TreeEndpoint *endpointEntry = &interfaceEntry->endpoints[k];
+            bool endpointMatched = false;
+            
+            if (k < foundInterface->numEndpoints && endpointEntry->isDictionary) {
+                
+                UInt8 attributes = endpointEntry->hasAttributes ? endpointEntry->attributes : 0;
+                UInt16 genericMaxPacketSize = endpointEntry->hasMaxPacketSize ? endpointEntry->maxPacketSize : 0;
+                UInt8 genericPollingInterval = endpointEntry->hasPollingInterval ? endpointEntry->pollingInterval : 0;
+                UInt16 maxPacketSize;
+                UInt8 pollingInterval;
+                
+                if (getEndpointProperties(foundInterface, attributes & 0xF, attributes & 0x80, &maxPacketSize, &pollingInterval)) {
+                    
+                    numActualEndpoints++;
+                    
+                    if (maxPacketSize == genericMaxPacketSize && pollingInterval == genericPollingInterval)
+                        endpointMatched = true;
+                }
+            }
+            
+            if (!endpointMatched)
+                allEndpointsMatched = false;
+        }
+        
+        if (interfaceEntry->numEndpoints != numActualEndpoints)
+            allEndpointsMatched = false;
+    }
+    
+    return tree->numInterfaces == numActualInterfaces && allEndpointsMatched;
+}
+
+// what XboxControllerHID::compileGenericPattern() does with the same tree
+static bool
+compilePattern(const Tree *tree, XBGenericPattern *pattern)
+{
+    if (!XBInitGenericPattern(pattern, tree->numInterfaces))
+        return false;
+    
+    for (UInt32 j = 0; j < tree->numInterfaces; j++) {
+        
+        const TreeInterface *interfaceEntry = &tree->interfaces[j];
+        
+        if (!interfaceEntry->isDictionary || !interfaceEntry->hasEndpoints)
+            continue;
+        
+        for (UInt32 k = 0; k < interfaceEntry->numEndpoints; k++) {
+            
+            const TreeEndpoint *endpointEntry = &interfaceEntry->endpoints[k];
+            XBGenericEndpoint *endpoint = XBAddGenericEndpoint(pattern, j);
+            
+            if (!endpoint)
+                return false;
+            
+            if (!endpointEntry->isDictionary)
+                continue;
+            
+            endpoint->address = XBGenericEndpointAddress(endpointEntry->hasAttributes ? endpointEntry->attributes : 0);
+            if (endpointEntry->hasMaxPacketSize)
+                endpoint->maxPacketSize = endpointEntry->maxPacketSize;
+            if (endpointEntry->hasPollingInterval)
+                endpoint->pollingInterval = endpointEntry->pollingInterval;
+        }
+    }
+    
+    return true;
+}
+
+// what XboxControllerHID::gatherGenericDeviceInfo() reads from the device
+static void
+gatherInfo(const Device *device, UInt32 maxInterfaces, XBGenericDeviceInfo *info)
+{
+    info->numInterfaces = 0;
+    
+    while (info->numInterfaces < device->numInterfaces && info->numInterfaces < maxInterfaces) {
+        
+        const DeviceInterface *interface = &device->interfaces[info->numInterfaces];
+        XBGenericInterfaceInfo *interfaceInfo = &info->interfaces[info->numInterfaces++];
+        
+        interfaceInfo->numEndpoints = interface->numEndpoints;
+        interfaceInfo->numGathered = 0;
+        
+        for (UInt32 e = 0; e < interface->numEndpoints; e++) {
+            
+            XBGenericEndpoint *endpoint = &interfaceInfo->endpoints[interfaceInfo->numGathered++];
+            
+            endpoint->interface = info->numInterfaces - 1;
+            endpoint->address = interface->endpoints[e].address;
+            endpoint->maxPacketSize = interface->endpoints[e].maxPacketSize;
+            endpoint->pollingInterval = interface->endpoints[e].pollingInterval;
+        }
+    }
+}
+
+// -- random trees and devices ------------------------------
+// ----------------------------------------------------------
+
+static const UInt8 gAddresses[] = { 0x81, 0x82, 0x83, 0x01, 0x02 };
+static const UInt16 gPacketSizes[] = { 6, 8, 20, 32 };
+static const UInt8 gIntervals[] = { 4, 8, 10 };
+
+#define PICK(random, array) (array[XBTestNext(random) % (sizeof(array) / sizeof(array[0]))])
+
+static void
+randomDevice(XBTestRandom *random, Device *device)
+{
+    device->numInterfaces = XBTestNext(random) % (kMaxDeviceInterfaces + 1);
+    
+    for (UInt32 j = 0; j < device->numInterfaces; j++) {
+        
+        DeviceInterface *interface = &device->interfaces[j];
+        UInt32 first = XBTestNext(random) % kMaxDeviceEndpoints;
+        
+        // addresses are unique on an interface, as on a real device
+        interface->numEndpoints = XBTestNext(random) % (kMaxDeviceEndpoints + 1);
+        for (UInt32 e = 0; e < interface->numEndpoints; e++) {
+            interface->endpoints[e].address = gAddresses[(first + e) % kMaxDeviceEndpoints];
+            interface->endpoints[e].maxPacketSize = PICK(random, gPacketSizes);
+            interface->endpoints[e].pollingInterval = PICK(random, gIntervals);
+        }
+    }
+}
+
+// A tree describing the device, or close to it, so that matches are common
+// and misses come from a single difference.
+static void
+treeForDevice(XBTestRandom *random, const Device *device, Tree *tree)
+{
+    memset(tree, 0, sizeof(Tree));
+    
+    tree->numInterfaces = device->numInterfaces < kMaxGenericInterfaces ? device->numInterfaces : kMaxGenericInterfaces;
+    if (tree->numInterfaces > 0 && XBTestNext(random) % 4 == 0)
+        tree->numInterfaces -= XBTestNext(random) % (tree->numInterfaces + 1);
+    
+    for (UInt32 j = 0; j < tree->numInterfaces; j++) {
+        
+        const DeviceInterface *interface = &device->interfaces[j];
+        TreeInterface *interfaceEntry = &tree->interfaces[j];
+        
+        interfaceEntry->isDictionary = XBTestNext(random) % 16 != 0;
+        interfaceEntry->hasEndpoints = XBTestNext(random) % 16 != 0;
+        interfaceEntry->numEndpoints = interface->numEndpoints < kMaxTreeEndpoints ? interface->numEndpoints : kMaxTreeEndpoints;
+        
+        for (UInt32 k = 0; k < interfaceEntry->numEndpoints; k++) {
+            
+            TreeEndpoint *endpointEntry = &interfaceEntry->endpoints[k];
+            const DeviceEndpoint *endpoint = &interface->endpoints[XBTestNext(random) % interface->numEndpoints];
+            
+            endpointEntry->isDictionary = true;
+            endpointEntry->hasAttributes = true;
+            endpointEntry->hasMaxPacketSize = true;
+            endpointEntry->hasPollingInterval = true;
+            
+            // transfer type bits ride along in Attributes
+            endpointEntry->attributes = endpoint->address | (XBTestNext(random) % 2 ? 0x03 << 4 : 0);
+            endpointEntry->maxPacketSize = endpoint->maxPacketSize;
+            endpointEntry->pollingInterval = endpoint->pollingInterval;
+        }
+    }
+    
+    // then one difference, or none
+    UInt32 j = tree->numInterfaces ? XBTestNext(random) % tree->numInterfaces : 0;
+    TreeInterface *interfaceEntry = &tree->interfaces[j];
+    TreeEndpoint *endpointEntry = &interfaceEntry->endpoints[interfaceEntry->numEndpoints ? XBTestNext(random) % interfaceEntry->numEndpoints : 0];
+    bool haveEndpoint = tree->numInterfaces && interfaceEntry->numEndpoints;
+    
+    switch (XBTestNext(random) % 10) {
+        
+        case 0:
+            if (haveEndpoint)
+                endpointEntry->maxPacketSize = PICK(random, gPacketSizes);
+            break;
+        
+        case 1:
+            if (haveEndpoint)
+                endpointEntry->pollingInterval = PICK(random, gIntervals);
+            break;
+        
+        case 2:
+            if (haveEndpoint)
+                endpointEntry->attributes = PICK(random, gAddresses);
+            break;
+        
+        case 3:
+            if (haveEndpoint)
+                endpointEntry->isDictionary = false;
+            break;
+        
+        case 4:
+            if (haveEndpoint) {
+                endpointEntry->hasAttributes = XBTestNext(random) % 2;
+                endpointEntry->hasMaxPacketSize = XBTestNext(random) % 2;
+                endpointEntry->hasPollingInterval = XBTestNext(random) % 2;
+            }
+            break;
+        
+        case 5:
+            // more endpoints than the interface has
+            if (tree->numInterfaces && interfaceEntry->numEndpoints < kMaxTreeEndpoints) {
+                
+                TreeEndpoint *extra = &interfaceEntry->endpoints[interfaceEntry->numEndpoints++];
+                
+                extra->isDictionary = extra->hasAttributes = extra->hasMaxPacketSize = extra->hasPollingInterval = true;
+                extra->attributes = PICK(random, gAddresses);
+                extra->maxPacketSize = PICK(random, gPacketSizes);
+                extra->pollingInterval = PICK(random, gIntervals);
+            }
+            break;
+        
+        case 6:
+            // more interfaces than the device has
+            if (tree->numInterfaces < kMaxGenericInterfaces) {
+                tree->interfaces[tree->numInterfaces].isDictionary = true;
+                tree->interfaces[tree->numInterfaces].hasEndpoints = false;
+                tree->numInterfaces++;
+            }
+            break;
+        
+        default:
+            break;
+    }
+}
+
+static void
+testAgainstTreeWalk()
+{
+    XBTestRandom random = { 0x94D049BB133111EBULL };
+    UInt32 matched = 0;
+    
+    for (int round = 0; round < 200000; round++) {
+        
+        Device device;
+        Tree tree;
+        XBGenericPattern pattern;
+        XBGenericDeviceInfo info;
+        
+        randomDevice(&random, &device);
+        treeForDevice(&random, &device, &tree);
+        
+        XB_CHECK(compilePattern(&tree, &pattern));
+        
+        // the driver gathers as many interfaces as its largest pattern needs
+        gatherInfo(&device, XBTestNext(&random) % 2 ? kMaxGenericInterfaces : pattern.numInterfaces, &info);
+        
+        bool expected = walkTree(&tree, &device);
+        bool actual = XBMatchGenericPattern(&pattern, &info);
+        
+        if (expected != actual) {
+            fprintf(stderr, "round %d: tree walk %d, pattern %d\n", round, expected, actual);
+            gTestFailures++;
+            return;
+        }
+        
+        matched += actual;
+    }
+    
+    // both outcomes were covered
+    XB_CHECK(matched > 20000);
+    XB_CHECK(matched < 180000);
+}
+
+static void
+testPatternLimits()
+{
+    XBGenericPattern pattern;
+    
+    XB_CHECK(!XBInitGenericPattern(&pattern, kMaxGenericInterfaces + 1));
+    XB_CHECK(XBInitGenericPattern(&pattern, 2));
+    
+    XB_CHECK(XBAddGenericEndpoint(&pattern, 2) == NULL);
+    
+    for (int k = 0; k < kMaxGenericEndpoints; k++) {
+        
+        XBGenericEndpoint *endpoint = XBAddGenericEndpoint(&pattern, k % 2);
+        
+        XB_CHECK(endpoint != NULL);
+        if (endpoint)
+            XB_CHECK_EQUAL(endpoint->address, kGenericEndpointInvalid);
+    }
+    
+    XB_CHECK(XBAddGenericEndpoint(&pattern, 0) == NULL);
+    XB_CHECK_EQUAL(pattern.numEndpoints, kMaxGenericEndpoints);
+    XB_CHECK_EQUAL(pattern.interfaceEndpoints[0], kMaxGenericEndpoints / 2);
+    XB_CHECK_EQUAL(pattern.interfaceEndpoints[1], kMaxGenericEndpoints / 2);
+}
+
+// the Microsoft pad's GenericProperties against the pad itself
+static void
+testPad()
+{
+    XBGenericPattern pattern;
+    XBGenericDeviceInfo info;
+    XBGenericEndpoint *endpoint;
+    Device pad = { 1, { { 2, { { 0x82, 32, 4 }, { 0x02, 32, 4 } } } } };
+    
+    XBInitGenericPattern(&pattern, 1);
+    endpoint = XBAddGenericEndpoint(&pattern, 0);
+    endpoint->address = XBGenericEndpointAddress(0x82 | 0x30);
+    endpoint->maxPacketSize = 32;
+    endpoint->pollingInterval = 4;
+    endpoint = XBAddGenericEndpoint(&pattern, 0);
+    endpoint->address = XBGenericEndpointAddress(0x02);
+    endpoint->maxPacketSize = 32;
+    endpoint->pollingInterval = 4;
+    
+    gatherInfo(&pad, kMaxGenericInterfaces, &info);
+    XB_CHECK(XBMatchGenericPattern(&pattern, &info));
+    
+    // a polling interval off by one is no match
+    pad.interfaces[0].endpoints[1].pollingInterval = 8;
+    gatherInfo(&pad, kMaxGenericInterfaces, &info);
+    XB_CHECK(!XBMatchGenericPattern(&pattern, &info));
+    
+    // neither is a missing endpoint
+    pad.interfaces[0].endpoints[1].pollingInterval = 4;
+    pad.interfaces[0].numEndpoints = 1;
+    gatherInfo(&pad, kMaxGenericInterfaces, &info);
+    XB_CHECK(!XBMatchGenericPattern(&pattern, &info));
+}
+
+int
+main()
+{
+    testAgainstTreeWalk();
+    testPatternLimits();
+    testPad();
+    
+    return XB_TEST_RESULT();
+}
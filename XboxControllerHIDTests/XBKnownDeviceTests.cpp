@@ -0,0 +1,131 @@
+//
+//  XBKnownDeviceTests.cpp
+//  XboxControllerHIDTests
+//
+//  The sorted known device table against a linear search of the same entries,
+//  and the parsing of the KnownDevices vendor/product keys.
+//
+
+#include "XboxControllerHIDCore.h"
+#include "XBTest.h"
+
+#define kMaxDevices 512
+
+// an entry as the driver keeps it, with the insertion order standing in for its strings
+typedef struct {
+    
+    UInt32  deviceID;
+    UInt32  order;
+    
+} Device;
+
+static const Device *
+linearFind(const Device *devices, UInt32 count, UInt32 deviceID)
+{
+    for (UInt32 i = 0; i < count; i++)
+        if (devices[i].deviceID == deviceID)
+            return &devices[i];
+    
+    return NULL;
+}
+
+static void
+testTable()
+{
+    XBTestRandom random = { 0xD1B54A32D192ED03ULL };
+    
+    for (int round = 0; round < 200; round++) {
+        
+        Device table[kMaxDevices], inserted[kMaxDevices];
+        UInt32 count = 0;
+        UInt32 size = XBTestNext(&random) % kMaxDevices;
+        
+        // a few vendors with many products each, and some duplicates
+        for (UInt32 i = 0; i < size; i++) {
+            
+            UInt16 vendor = 0x045E + XBTestNext(&random) % 8;
+            UInt16 product = XBTestNext(&random) % 64;
+            Device *device = XBInsertKnownDevice(table, &count, XBDeviceID(vendor, product));
+            
+            device->order = i;
+            inserted[i] = *device;
+        }
+        XB_CHECK_EQUAL(count, size);
+        
+        for (UInt32 i = 1; i < count; i++) {
+            
+            XB_CHECK(table[i - 1].deviceID <= table[i].deviceID);
+            if (table[i - 1].deviceID == table[i].deviceID)
+                XB_CHECK(table[i - 1].order < table[i].order);
+        }
+        
+        // every ID, present or not, finds the first entry inserted for it
+        for (UInt32 vendor = 0x045E - 1; vendor <= 0x045E + 8; vendor++) {
+            
+            for (UInt32 product = 0; product < 66; product++) {
+                
+                UInt32 deviceID = XBDeviceID(vendor, product);
+                const Device *found = XBFindKnownDevice(table, count, deviceID);
+                const Device *expected = linearFind(inserted, size, deviceID);
+                
+                XB_CHECK_EQUAL(found != NULL, expected != NULL);
+                if (found && expected)
+                    XB_CHECK_EQUAL(found->order, expected->order);
+            }
+        }
+    }
+    
+    // the ends of the key space and an empty table
+    Device table[4];
+    UInt32 count = 0;
+    
+    XB_CHECK(XBFindKnownDevice(table, count, 0) == NULL);
+    XBInsertKnownDevice(table, &count, 0xFFFFFFFF)->order = 0;
+    XBInsertKnownDevice(table, &count, 0)->order = 1;
+    XB_CHECK_EQUAL(XBFindKnownDevice(table, count, 0)->order, 1);
+    XB_CHECK_EQUAL(XBFindKnownDevice(table, count, 0xFFFFFFFF)->order, 0);
+    XB_CHECK(XBFindKnownDevice(table, count, 1) == NULL);
+}
+
+static void
+testParseDeviceID()
+{
+    static const struct {
+        
+        const char *    string;
+        bool            valid;
+        UInt16          id;
+        
+    } cases[] = {
+        
+        { "1118",   true,   1118 },
+        { "0",      true,   0 },
+        { "00738",  true,   738 },
+        { "65535",  true,   65535 },
+        { "65536",  false,  0 },
+        { "999999999999", false, 0 },
+        { "",       false,  0 },
+        { "0x45e",  false,  0 },
+        { "12a",    false,  0 },
+        { "-1",     false,  0 },
+        { " 1",     false,  0 },
+        { "Vendor", false,  0 },
+    };
+    
+    for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+        
+        UInt16 id = 0xABCD;
+        
+        XB_CHECK_EQUAL(XBParseDeviceID(cases[i].string, &id), cases[i].valid);
+        XB_CHECK_EQUAL(id, cases[i].valid ? cases[i].id : 0xABCD);
+    }
+}
+
+int
+main()
+{
+    testTable();
+    testParseDeviceID();
+    
+    return XB_TEST_RESULT();
+}
@@ -0,0 +1,623 @@
+//
+//  XBLibUSBBackendTests.cpp
+//  XboxControllerHIDTests
+//
+//  The libusb backend without libusb: XBLibUSBBackend.cpp built against
+//  FakeLibUSB/libusb.h and the fake bus below, whose devices are plugged in,
+//  enumerated and complete their transfers when the test says so, with a
+//  pipe in the event loop for libusb's fd. Checks that the devices plugged
+//  in before the daemon starts are open when XBOpenLibUSB() returns, that
+//  only the devices the driver takes are held on to, that any number can
+//  arrive between two passes of the loop, and that every device, descriptor
+//  and transfer is given back on close.
+//
+
+#include <fcntl.h>
+#include <linux/input.h>
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <libusb.h>
+
+#include "XBDeviceDatabase.h"
+#include "XBEventLoop.h"
+#include "XBLibUSBBackend.h"
+#include "XBTest.h"
+#include "XBUInput.h"
+
+#define kMs                 1000000ULL
+#define kFakeDevices        128
+#define kFakeTransfers      1024
+
+static const char *gInfoPlist = XB_INFO_PLIST;
+
+// -- the fake libusb ----------------------------------------
+
+struct libusb_device {
+    
+    struct libusb_device_descriptor     descriptor;
+    struct libusb_endpoint_descriptor   endpoints[2];
+    struct libusb_interface_descriptor  altsetting;
+    struct libusb_interface             interface;
+    struct libusb_config_descriptor     config;
+    bool                                plugged;
+    bool                                arriving;   // hotplug event on the next pass
+    int                                 refs;       // the backend's
+    int                                 maxRefs;
+    UInt8                               address;
+    
+};
+
+struct libusb_device_handle {
+    
+    libusb_device *     device;
+    bool                claimed;
+    
+};
+
+struct libusb_context {
+    
+    int                         fds[2];         // readable while there are events to handle
+    struct libusb_pollfd        pollFd;
+    libusb_hotplug_callback_fn  hotplug;
+    void *                      hotplugTarget;
+    
+};
+
+typedef struct {
+    
+    struct libusb_transfer  transfer;           // what the backend sees, first
+    bool                    submitted;
+    bool                    cancelled;
+    bool                    completed;          // with a report, on the next pass
+    
+} FakeTransfer;
+
+static struct {
+    
+    libusb_device       devices[kFakeDevices];
+    UInt32              numDevices;
+    bool                hasHotplug;
+    libusb_context *    context;
+    FakeTransfer *      transfers[kFakeTransfers];
+    UInt32              numTransfers;           // allocated
+    UInt32              numHandles;             // open
+    UInt32              numConfigs;             // config descriptors not freed
+    
+} gBus;
+
+static void
+wakeBus()
+{
+    if (gBus.context && write(gBus.context->fds[1], "", 1) < 0)
+        perror("pipe");
+}
+
+int
+libusb_init(libusb_context **ctx)
+{
+    libusb_context *context = (libusb_context *)calloc(1, sizeof(libusb_context));
+    
+    if (!context || pipe2(context->fds, O_NONBLOCK | O_CLOEXEC) != 0) {
+        free(context);
+        return LIBUSB_ERROR_NO_MEM;
+    }
+    context->pollFd.fd = context->fds[0];
+    context->pollFd.events = POLLIN;
+    gBus.context = *ctx = context;
+    return LIBUSB_SUCCESS;
+}
+
+void
+libusb_exit(libusb_context *ctx)
+{
+    close(ctx->fds[0]);
+    close(ctx->fds[1]);
+    free(ctx);
+    gBus.context = NULL;
+}
+
+int
+libusb_has_capability(uint32_t capability)
+{
+    return capability == LIBUSB_CAP_HAS_HOTPLUG && gBus.hasHotplug;
+}
+
+int
+libusb_hotplug_register_callback(libusb_context *ctx, libusb_hotplug_event events, libusb_hotplug_flag flags,
+                                 int vendor_id, int product_id, int dev_class,
+                                 libusb_hotplug_callback_fn cb_fn, void *user_data,
+                                 libusb_hotplug_callback_handle *callback_handle)
+{
+    (void)events; (void)vendor_id; (void)product_id; (void)dev_class;
+    
+    ctx->hotplug = cb_fn;
+    ctx->hotplugTarget = user_data;
+    *callback_handle = 1;
+    
+    // as libusb does, every device there is arrives before this returns
+    if (flags & LIBUSB_HOTPLUG_ENUMERATE)
+        for (UInt32 i = 0; i < gBus.numDevices; i++)
+            if (gBus.devices[i].plugged)
+                cb_fn(ctx, &gBus.devices[i], LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED, user_data);
+    return LIBUSB_SUCCESS;
+}
+
+void
+libusb_hotplug_deregister_callback(libusb_context *ctx, libusb_hotplug_callback_handle callback_handle)
+{
+    (void)callback_handle;
+    ctx->hotplug = NULL;
+}
+
+libusb_device *
+libusb_ref_device(libusb_device *dev)
+{
+    if (++dev->refs > dev->maxRefs)
+        dev->maxRefs = dev->refs;
+    return dev;
+}
+
+void
+libusb_unref_device(libusb_device *dev)
+{
+    dev->refs--;
+}
+
+ssize_t
+libusb_get_device_list(libusb_context *ctx, libusb_device ***list)
+{
+    ssize_t count = 0;
+    (void)ctx;
+    
+    *list = (libusb_device **)calloc(gBus.numDevices + 1, sizeof(libusb_device *));
+    if (!*list)
+        return LIBUSB_ERROR_NO_MEM;
+    for (UInt32 i = 0; i < gBus.numDevices; i++)
+        if (gBus.devices[i].plugged)
+            (*list)[count++] = libusb_ref_device(&gBus.devices[i]);
+    return count;
+}
+
+void
+libusb_free_device_list(libusb_device **list, int unref_devices)
+{
+    for (UInt32 i = 0; unref_devices && list[i]; i++)
+        libusb_unref_device(list[i]);
+    free(list);
+}
+
+uint8_t
+libusb_get_bus_number(libusb_device *dev)
+{
+    (void)dev;
+    return 1;
+}
+
+uint8_t
+libusb_get_device_address(libusb_device *dev)
+{
+    return dev->address;
+}
+
+int
+libusb_get_device_descriptor(libusb_device *dev, struct libusb_device_descriptor *desc)
+{
+    *desc = dev->descriptor;
+    return LIBUSB_SUCCESS;
+}
+
+int
+libusb_get_active_config_descriptor(libusb_device *dev, struct libusb_config_descriptor **config)
+{
+    gBus.numConfigs++;
+    *config = &dev->config;
+    return LIBUSB_SUCCESS;
+}
+
+int
+libusb_get_config_descriptor(libusb_device *dev, uint8_t config_index, struct libusb_config_descriptor **config)
+{
+    (void)config_index;
+    return libusb_get_active_config_descriptor(dev, config);
+}
+
+void
+libusb_free_config_descriptor(struct libusb_config_descriptor *config)
+{
+    if (config)
+        gBus.numConfigs--;
+}
+
+int
+libusb_open(libusb_device *dev, libusb_device_handle **dev_handle)
+{
+    *dev_handle = (libusb_device_handle *)calloc(1, sizeof(libusb_device_handle));
+    if (!*dev_handle)
+        return LIBUSB_ERROR_NO_MEM;
+    (*dev_handle)->device = dev;
+    gBus.numHandles++;
+    return LIBUSB_SUCCESS;
+}
+
+void
+libusb_close(libusb_device_handle *dev_handle)
+{
+    free(dev_handle);
+    gBus.numHandles--;
+}
+
+int
+libusb_set_auto_detach_kernel_driver(libusb_device_handle *dev_handle, int enable)
+{
+    (void)dev_handle; (void)enable;
+    return LIBUSB_SUCCESS;
+}
+
+int
+libusb_claim_interface(libusb_device_handle *dev_handle, int interface_number)
+{
+    (void)interface_number;
+    dev_handle->claimed = true;
+    return LIBUSB_SUCCESS;
+}
+
+int
+libusb_release_interface(libusb_device_handle *dev_handle, int interface_number)
+{
+    (void)interface_number;
+    dev_handle->claimed = false;
+    return LIBUSB_SUCCESS;
+}
+
+int
+libusb_clear_halt(libusb_device_handle *dev_handle, unsigned char endpoint)
+{
+    (void)dev_handle; (void)endpoint;
+    return LIBUSB_SUCCESS;
+}
+
+int
+libusb_reset_device(libusb_device_handle *dev_handle)
+{
+    (void)dev_handle;
+    return LIBUSB_SUCCESS;
+}
+
+struct libusb_transfer *
+libusb_alloc_transfer(int iso_packets)
+{
+    FakeTransfer *transfer;
+    (void)iso_packets;
+    
+    if (gBus.numTransfers == kFakeTransfers)
+        return NULL;
+    transfer = (FakeTransfer *)calloc(1, sizeof(FakeTransfer));
+    if (transfer)
+        gBus.transfers[gBus.numTransfers++] = transfer;
+    return &transfer->transfer;
+}
+
+void
+libusb_free_transfer(struct libusb_transfer *transfer)
+{
+    for (UInt32 i = 0; i < gBus.numTransfers; i++)
+        if (&gBus.transfers[i]->transfer == transfer) {
+            free(gBus.transfers[i]);
+            gBus.transfers[i] = gBus.transfers[--gBus.numTransfers];
+            return;
+        }
+}
+
+int
+libusb_submit_transfer(struct libusb_transfer *transfer)
+{
+    FakeTransfer *fake = (FakeTransfer *)transfer;
+    
+    if (!transfer->dev_handle->device->plugged)
+        return LIBUSB_ERROR_NO_DEVICE;
+    fake->submitted = true;
+    fake->cancelled = fake->completed = false;
+    return LIBUSB_SUCCESS;
+}
+
+int
+libusb_cancel_transfer(struct libusb_transfer *transfer)
+{
+    FakeTransfer *fake = (FakeTransfer *)transfer;
+    
+    if (!fake->submitted || fake->cancelled)
+        return LIBUSB_ERROR_NOT_FOUND;
+    fake->cancelled = true;
+    wakeBus();
+    return LIBUSB_SUCCESS;
+}
+
+// hotplug events first, then the transfers that are done
+int
+libusb_handle_events_timeout_completed(libusb_context *ctx, struct timeval *tv, int *completed)
+{
+    char drain[64];
+    (void)tv; (void)completed;
+    
+    while (read(ctx->fds[0], drain, sizeof(drain)) > 0)
+        ;
+    
+    for (UInt32 i = 0; i < gBus.numDevices; i++)
+        if (gBus.devices[i].arriving) {
+            gBus.devices[i].arriving = false;
+            if (ctx->hotplug)
+                ctx->hotplug(ctx, &gBus.devices[i], LIBUSB_HOTPLUG_EVENT_DEVICE_ARRIVED, ctx->hotplugTarget);
+        }
+    
+    for (UInt32 i = 0; i < gBus.numTransfers; i++) {
+        
+        FakeTransfer *fake = gBus.transfers[i];
+        
+        if (!fake->submitted || !(fake->cancelled || fake->completed))
+            continue;
+        
+        fake->submitted = false;
+        fake->transfer.status = fake->cancelled ? LIBUSB_TRANSFER_CANCELLED : LIBUSB_TRANSFER_COMPLETED;
+        if (fake->cancelled)
+            fake->transfer.actual_length = 0;
+        fake->transfer.callback(&fake->transfer);
+    }
+    return LIBUSB_SUCCESS;
+}
+
+const struct libusb_pollfd **
+libusb_get_pollfds(libusb_context *ctx)
+{
+    const struct libusb_pollfd **pollFds = (const struct libusb_pollfd **)calloc(2, sizeof(struct libusb_pollfd *));
+    
+    if (pollFds)
+        pollFds[0] = &ctx->pollFd;
+    return pollFds;
+}
+
+void
+libusb_free_pollfds(const struct libusb_pollfd **pollfds)
+{
+    free(pollfds);
+}
+
+void
+libusb_set_pollfd_notifiers(libusb_context *ctx, libusb_pollfd_added_cb added_cb,
+                            libusb_pollfd_removed_cb removed_cb, void *user_data)
+{
+    (void)ctx; (void)added_cb; (void)removed_cb; (void)user_data;
+}
+
+// -- the bus ------------------------------------------------
+
+static void
+resetBus(bool hasHotplug)
+{
+    memset(&gBus, 0, sizeof(gBus));
+    gBus.hasHotplug = hasHotplug;
+}
+
+// A pad has the interrupt IN and OUT endpoints the driver reads and writes,
+// anything else two bulk endpoints that match no device type
+static libusb_device *
+addDevice(UInt16 vendorID, UInt16 productID, bool pad)
+{
+    libusb_device *device = &gBus.devices[gBus.numDevices];
+    
+    device->descriptor.idVendor = vendorID;
+    device->descriptor.idProduct = productID;
+    device->address = (UInt8)(++gBus.numDevices);
+    
+    for (UInt32 i = 0; i < 2; i++) {
+        device->endpoints[i].bEndpointAddress = i ? 0x02 : 0x81;
+        device->endpoints[i].bmAttributes = pad ? LIBUSB_TRANSFER_TYPE_INTERRUPT : LIBUSB_TRANSFER_TYPE_BULK;
+        device->endpoints[i].wMaxPacketSize = pad ? 32 : 512;
+        device->endpoints[i].bInterval = pad ? 4 : 0;
+    }
+    device->altsetting.bNumEndpoints = 2;
+    device->altsetting.endpoint = device->endpoints;
+    device->interface.altsetting = &device->altsetting;
+    device->interface.num_altsetting = 1;
+    device->config.bNumInterfaces = 1;
+    device->config.interface = &device->interface;
+    return device;
+}
+
+static UInt32
+submittedReads(const libusb_device *device)
+{
+    UInt32 count = 0;
+    
+    for (UInt32 i = 0; i < gBus.numTransfers; i++)
+        if (gBus.transfers[i]->submitted && gBus.transfers[i]->transfer.dev_handle->device == device)
+            count++;
+    return count;
+}
+
+// completes one of the device's reads with report on the next pass
+static bool
+completeRead(const libusb_device *device, const void *report, int length)
+{
+    for (UInt32 i = 0; i < gBus.numTransfers; i++) {
+        
+        FakeTransfer *fake = gBus.transfers[i];
+        
+        if (fake->submitted && !fake->cancelled && fake->transfer.dev_handle->device == device) {
+            memcpy(fake->transfer.buffer, report, length);
+            fake->transfer.actual_length = length;
+            fake->completed = true;
+            wakeBus();
+            return true;
+        }
+    }
+    return false;
+}
+
+// all given back: no ref, handle, descriptor or transfer left
+static void
+checkBusReleased()
+{
+    for (UInt32 i = 0; i < gBus.numDevices; i++)
+        XB_CHECK_EQUAL(gBus.devices[i].refs, 0);
+    XB_CHECK_EQUAL(gBus.numHandles, 0);
+    XB_CHECK_EQUAL(gBus.numConfigs, 0);
+    XB_CHECK_EQUAL(gBus.numTransfers, 0);
+}
+
+// -- the tests ----------------------------------------------
+
+typedef struct {
+    
+    XBDeviceDatabase    database;
+    XBLinuxPipeline     pipeline;
+    XBEventLoop         loop;
+    int                 events[2];          // the devices' events, read from events[0]
+    
+} Daemon;
+
+static bool
+startDaemon(Daemon *daemon)
+{
+    XBReplayOptions options;
+    
+    memset(daemon, 0, sizeof(Daemon));
+    if (!XBLoadDeviceDatabase(&daemon->database, gInfoPlist, "Generic Xbox Device"))
+        return false;
+    
+    XBDefaultReplayOptions(&options);
+    memcpy(options.buttonMap, daemon->database.buttonMap, sizeof(options.buttonMap));
+    XBInitLinuxPipeline(&daemon->pipeline, &options);
+    
+    return XBInitEventLoop(&daemon->loop) && pipe2(daemon->events, O_NONBLOCK) == 0;
+}
+
+static void
+stopDaemon(Daemon *daemon)
+{
+    close(daemon->events[0]);
+    close(daemon->events[1]);
+    XBFreeEventLoop(&daemon->loop);
+    XBFreeDeviceDatabase(&daemon->database);
+}
+
+// The pads plugged in before the start are open once XBOpenLibUSB() returns,
+// with their reads queued, whether they came by hotplug or by the scan
+static void
+testDevicesAtStart(bool hasHotplug)
+{
+    libusb_device *pads[3];
+    Daemon daemon;
+    XBLibUSB *usb;
+    
+    XB_CHECK(startDaemon(&daemon));
+    resetBus(hasHotplug);
+    
+    for (UInt32 i = 0; i < 40; i++)
+        addDevice(0x1234, (UInt16)i, false)->plugged = true;
+    for (UInt32 i = 0; i < 3; i++) {
+        pads[i] = addDevice(0x045E, 0x0202, true);
+        pads[i]->plugged = true;
+    }
+    
+    usb = XBOpenLibUSB(&daemon.database, &daemon.pipeline, 2, daemon.events[1], &daemon.loop);
+    XB_CHECK(usb != NULL);
+    if (!usb) {
+        stopDaemon(&daemon);
+        return;
+    }
+    
+    XB_CHECK_EQUAL(XBLibUSBDeviceCount(usb), 3);
+    for (UInt32 i = 0; i < 3; i++) {
+        XB_CHECK_EQUAL(pads[i]->refs, 1);
+        XB_CHECK_EQUAL(submittedReads(pads[i]), 2);
+    }
+    
+    // the scan holds every device for a while, hotplug only those it takes
+    for (UInt32 i = 0; hasHotplug && i < 40; i++)
+        XB_CHECK_EQUAL(gBus.devices[i].maxRefs, 0);
+    XB_CHECK_EQUAL(gBus.numConfigs, 0);
+    
+    XBCloseLibUSB(usb);
+    checkBusReleased();
+    stopDaemon(&daemon);
+}
+
+static bool
+hasEvent(const struct input_event *events, UInt32 count, UInt16 type, UInt16 code, SInt32 value)
+{
+    for (UInt32 i = 0; i < count; i++)
+        if (events[i].type == type && events[i].code == code && events[i].value == value)
+            return true;
+    return false;
+}
+
+// More pads than ever fit the old arrival list, and other devices, arrive in
+// one pass; every pad is opened and reads, nothing else is held
+static void
+testArrivals()
+{
+    struct input_event events[kMaxInputEvents];
+    libusb_device *pads[40];
+    XBPadReport report;
+    Daemon daemon;
+    XBLibUSB *usb;
+    ssize_t length;
+    
+    XB_CHECK(startDaemon(&daemon));
+    resetBus(true);
+    
+    usb = XBOpenLibUSB(&daemon.database, &daemon.pipeline, 2, daemon.events[1], &daemon.loop);
+    XB_CHECK(usb != NULL);
+    if (!usb) {
+        stopDaemon(&daemon);
+        return;
+    }
+    XB_CHECK_EQUAL(XBLibUSBDeviceCount(usb), 0);
+    
+    for (UInt32 i = 0; i < 40; i++) {
+        addDevice(0x1234, (UInt16)i, false)->arriving = true;
+        pads[i] = addDevice(0x045E, 0x0202, true);
+        pads[i]->arriving = true;
+    }
+    for (UInt32 i = 0; i < gBus.numDevices; i++)
+        gBus.devices[i].plugged = true;
+    wakeBus();
+    
+    XBRunEventLoop(&daemon.loop, 100 * kMs);
+    XB_CHECK_EQUAL(XBLibUSBDeviceCount(usb), 40);
+    for (UInt32 i = 0; i < 40; i++) {
+        XB_CHECK_EQUAL(gBus.devices[2 * i].maxRefs, 0);
+        XB_CHECK_EQUAL(pads[i]->refs, 1);
+        XB_CHECK_EQUAL(submittedReads(pads[i]), 2);
+    }
+    XB_CHECK_EQUAL(gBus.numConfigs, 0);
+    
+    // and the last one to arrive reads: start pressed comes out as an event
+    memset(&report, 0, sizeof(report));
+    report.r2 = sizeof(report);
+    report.buttons = 0x10;
+    XB_CHECK(completeRead(pads[39], &report, sizeof(report)));
+    XBRunEventLoop(&daemon.loop, 100 * kMs);
+    
+    length = read(daemon.events[0], events, sizeof(events));
+    XB_CHECK(length > 0);
+    XB_CHECK(length > 0 && hasEvent(events, (UInt32)(length / sizeof(events[0])), EV_KEY, BTN_START, 1));
+    XB_CHECK_EQUAL(submittedReads(pads[39]), 2);
+    
+    XBCloseLibUSB(usb);
+    checkBusReleased();
+    stopDaemon(&daemon);
+}
+
+int
+main()
+{
+    testDevicesAtStart(true);
+    testDevicesAtStart(false);
+    testArrivals();
+    
+    return XB_TEST_RESULT();
+}
@@ -0,0 +1,781 @@
+//
+//  XBLinuxDaemonTests.cpp
+//  XboxControllerHIDTests
+//
+//  The Linux daemon without the hardware: its device database read from the
+//  driver's Info.plist and matched like probe() matches, the reports as evdev
+//  events, and simulated pads and remotes run through the read ring, the
+//  report pipeline and each recovery, with the events written to a file.
+//  Then the same devices on the daemon's event loop, in real time.
+//
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "XBDeviceDatabase.h"
+#include "XBEventLoop.h"
+#include "XBLinuxDevice.h"
+#include "XBPlist.h"
+#include "XBSimBackend.h"
+#include "XBTest.h"
+#include "XBUInput.h"
+
+#define kMs         1000000ULL
+#define kStart      5000000000ULL
+
+static const char *gInfoPlist = XB_INFO_PLIST;
+
+static void
+testPlist()
+{
+    XBPlistNode *plist = XBParsePlist("<?xml version=\"1.0\"?>\n<!-- a comment -->\n<plist version=\"1.0\">\n"
+                                      "<dict><key>a &amp; b</key><string>&lt;x&gt;</string>"
+                                      "<key>n</key><integer>0x1F</integer><key>d</key><data>AQID\nBA==</data>"
+                                      "<key>t</key><true/><key>e</key><string/>"
+                                      "<key>l</key><array><integer>1</integer><dict/></array></dict></plist>");
+    const XBPlistNode *node;
+    
+    XB_CHECK(plist != NULL);
+    if (!plist)
+        return;
+    
+    node = XBPlistGet(plist, "a & b", kPlistString);
+    XB_CHECK(node && !strcmp(node->string, "<x>"));
+    node = XBPlistGet(plist, "n", kPlistInteger);
+    XB_CHECK(node && node->integer == 31);
+    node = XBPlistGet(plist, "d", kPlistData);
+    XB_CHECK(node && node->length == 4 && node->data[0] == 1 && node->data[3] == 4);
+    node = XBPlistGet(plist, "t", kPlistBoolean);
+    XB_CHECK(node && node->integer == 1);
+    node = XBPlistGet(plist, "e", kPlistString);
+    XB_CHECK(node && !node->string[0]);
+    node = XBPlistGet(plist, "l", kPlistArray);
+    XB_CHECK(node && node->children && node->children->next && node->children->next->type == kPlistDictionary);
+    
+    // the right key with the wrong type is no match
+    XB_CHECK(XBPlistGet(plist, "n", kPlistString) == NULL);
+    XBFreePlist(plist);
+    
+    XB_CHECK(XBParsePlist("<dict><key>a</key><string>b</string>") == NULL);
+    XB_CHECK(XBParsePlist("<dict><key>a</key></dict>") == NULL);
+}
+
+static void
+addEndpoint(XBGenericInterfaceInfo *interface, UInt8 index, UInt8 address, UInt16 maxPacketSize, UInt8 interval)
+{
+    XBGenericEndpoint *endpoint = &interface->endpoints[interface->numGathered++];
+    
+    endpoint->interface = index;
+    endpoint->address = address;
+    endpoint->maxPacketSize = maxPacketSize;
+    endpoint->pollingInterval = interval;
+    interface->numEndpoints = interface->numGathered;
+}
+
+static void
+testDatabase()
+{
+    XBDeviceDatabase database;
+    XBGenericDeviceInfo pad, remote, mouse;
+    XBReplayOptions defaults;
+    XBDeviceMatch match;
+    
+    XB_CHECK(XBLoadDeviceDatabase(&database, gInfoPlist, "Generic Xbox Device"));
+    XB_CHECK(!XBLoadDeviceDatabase(&database, gInfoPlist, "No Such Personality"));
+    XB_CHECK(!XBLoadDeviceDatabase(&database, "/nonexistent/Info.plist", "Generic Xbox Device"));
+    if (!XBLoadDeviceDatabase(&database, gInfoPlist, "Generic Xbox Device"))
+        return;
+    
+    XB_CHECK(database.numDevices > 10);
+    XB_CHECK_EQUAL(database.numSignatures, 2);
+    XB_CHECK_EQUAL(database.maxInterfaces, 2);
+    XB_CHECK_EQUAL(database.interruptReads, 2);
+    
+    // the IR ButtonMap is the one the replay tools default to
+    XBDefaultReplayOptions(&defaults);
+    XB_CHECK(!memcmp(database.buttonMap, defaults.buttonMap, sizeof(defaults.buttonMap)));
+    
+    memset(&pad, 0, sizeof(pad));
+    pad.numInterfaces = 1;
+    addEndpoint(&pad.interfaces[0], 0, 0x82, 32, 4);
+    addEndpoint(&pad.interfaces[0], 0, 0x02, 32, 4);
+    
+    memset(&remote, 0, sizeof(remote));
+    remote.numInterfaces = 2;
+    addEndpoint(&remote.interfaces[0], 0, 0x81, 8, 16);
+    
+    memset(&mouse, 0, sizeof(mouse));
+    mouse.numInterfaces = 1;
+    addEndpoint(&mouse.interfaces[0], 0, 0x81, 4, 10);
+    
+    // known devices by their ids, whatever their endpoints
+    XB_CHECK(XBMatchDevice(&database, 1118, 514, &mouse, &match));
+    XB_CHECK_EQUAL(match.type, kLinuxDevicePad);
+    XB_CHECK(match.known);
+    XB_CHECK(!strcmp(match.name, "Xbox Controller"));
+    XB_CHECK(!strcmp(match.vendor, "Microsoft"));
+    
+    XB_CHECK(XBMatchDevice(&database, 1118, 644, &mouse, &match));
+    XB_CHECK_EQUAL(match.type, kLinuxDeviceRemote);
+    
+    // unknown ids by the GenericProperties of each type
+    XB_CHECK(XBMatchDevice(&database, 0x1234, 0x5678, &pad, &match));
+    XB_CHECK_EQUAL(match.type, kLinuxDevicePad);
+    XB_CHECK(!match.known);
+    
+    XB_CHECK(XBMatchDevice(&database, 0x1234, 0x5678, &remote, &match));
+    XB_CHECK_EQUAL(match.type, kLinuxDeviceRemote);
+    
+    // and nothing else, the kext's last resort left out
+    XB_CHECK(!XBMatchDevice(&database, 0x1234, 0x5678, &mouse, &match));
+    remote.numInterfaces = 1;
+    XB_CHECK(!XBMatchDevice(&database, 0x1234, 0x5678, &remote, &match));
+    
+    XBFreeDeviceDatabase(&database);
+}
+
+static bool
+hasEvent(const struct input_event *events, UInt32 count, UInt16 type, UInt16 code, SInt32 value)
+{
+    for (UInt32 i = 0; i < count; i++)
+        if (events[i].type == type && events[i].code == code && events[i].value == value)
+            return true;
+    return false;
+}
+
+static void
+testEvents()
+{
+    struct input_event events[kMaxInputEvents];
+    XBPadReport last, report;
+    XBRemoteReport lastRemote, remote;
+    UInt32 count;
+    
+    memset(&last, 0, sizeof(last));
+    report = last;
+    report.buttons = 0x91;      // up, start, right click
+    report.a = 1;
+    report.white = 1;
+    report.lt = 200;
+    report.lxhi = 0x80;         // -32768
+    report.ryhi = 0x7F;
+    report.rylo = 0xFF;         // 32767
+    
+    count = XBPadInputEvents(&last, &report, events);
+    XB_CHECK_EQUAL(count, 9);
+    XB_CHECK(hasEvent(events, count, EV_KEY, BTN_DPAD_UP, 1));
+    XB_CHECK(hasEvent(events, count, EV_KEY, BTN_START, 1));
+    XB_CHECK(hasEvent(events, count, EV_KEY, BTN_THUMBR, 1));
+    XB_CHECK(hasEvent(events, count, EV_KEY, BTN_A, 1));
+    XB_CHECK(hasEvent(events, count, EV_KEY, BTN_Z, 1));
+    XB_CHECK(hasEvent(events, count, EV_ABS, ABS_Z, 200));
+    XB_CHECK(hasEvent(events, count, EV_ABS, ABS_X, -32768));
+    XB_CHECK(hasEvent(events, count, EV_ABS, ABS_RY, 32767));
+    XB_CHECK(events[count - 1].type == EV_SYN && events[count - 1].code == SYN_REPORT);
+    
+    // only what changed, and nothing at all for the same report
+    last = report;
+    report.buttons = 0x90;
+    report.lt = 0;
+    count = XBPadInputEvents(&last, &report, events);
+    XB_CHECK_EQUAL(count, 3);
+    XB_CHECK(hasEvent(events, count, EV_KEY, BTN_DPAD_UP, 0));
+    XB_CHECK(hasEvent(events, count, EV_ABS, ABS_Z, 0));
+    XB_CHECK_EQUAL(XBPadInputEvents(&report, &report, events), 0);
+    
+    // an unclamped analog button is pressed at any value
+    last = report;
+    report.b = 37;
+    count = XBPadInputEvents(&last, &report, events);
+    XB_CHECK_EQUAL(count, 2);
+    XB_CHECK(hasEvent(events, count, EV_KEY, BTN_B, 1));
+    
+    memset(&lastRemote, 0, sizeof(lastRemote));
+    remote = lastRemote;
+    remote.menu = 1;
+    remote.kp0 = 1;
+    count = XBRemoteInputEvents(&lastRemote, &remote, events);
+    XB_CHECK_EQUAL(count, 3);
+    XB_CHECK(hasEvent(events, count, EV_KEY, KEY_MENU, 1));
+    XB_CHECK(hasEvent(events, count, EV_KEY, KEY_NUMERIC_0, 1));
+    XB_CHECK_EQUAL(XBRemoteInputEvents(&remote, &remote, events), 0);
+}
+
+// a simulated device writing its events to a file of its own
+typedef struct {
+    
+    XBSimLinuxDevice    sim;
+    XBLinuxPipeline     pipeline;
+    FILE *              events;
+    
+} SimDevice;
+
+static SimDevice *
+startSimDevice(const XBSimDevice *device, UInt32 numReads)
+{
+    SimDevice *sim = new SimDevice;
+    XBReplayOptions options;
+    
+    XBDefaultReplayOptions(&options);
+    XBInitLinuxPipeline(&sim->pipeline, &options);
+    sim->events = tmpfile();
+    XBInitSimLinuxDevice(&sim->sim, device, kStart, &sim->pipeline, numReads, fileno(sim->events));
+    XB_CHECK(XBStartLinuxDevice(&sim->sim.device));
+    return sim;
+}
+
+static void
+runSimDevice(SimDevice *sim, UInt64 time)
+{
+    XBSimLinuxDevice *devices[1] = { &sim->sim };
+    
+    XBRunSimLinuxDevices(devices, 1, kStart + time);
+}
+
+static UInt32
+readEvents(SimDevice *sim, struct input_event *events, UInt32 maxEvents)
+{
+    ssize_t length = pread(fileno(sim->events), events, maxEvents * sizeof(struct input_event), 0);
+    
+    return length < 0 ? 0 : length / sizeof(struct input_event);
+}
+
+static void
+freeSimDevice(SimDevice *sim)
+{
+    XBFreeSimLinuxDevice(&sim->sim);
+    fclose(sim->events);
+    delete sim;
+}
+
+static void
+testSimPad()
+{
+    XBSimDevice device;
+    XBSimStep hold = { 500 * kMs, kSimPatternHold, 0x11, 200, 0, 0 };
+    struct input_event events[64];
+    SimDevice *sim;
+    UInt32 count;
+    
+    XBInitSimDevice(&device, kSimDevicePad, 4 * kMs, 1);
+    XBAddSimStep(&device, &hold);
+    sim = startSimDevice(&device, 2);
+    
+    // the ring is on the pipe
+    XB_CHECK_EQUAL(sim->sim.pipe.count, 2);
+    
+    runSimDevice(sim, 1000 * kMs);
+    XB_CHECK_EQUAL(sim->sim.device.stats.reports, 250);
+    XB_CHECK_EQUAL(sim->sim.device.stats.delivered, 250);
+    XB_CHECK_EQUAL(sim->sim.device.stats.errors, 0);
+    XB_CHECK_EQUAL(sim->sim.device.stats.writeErrors, 0);
+    XB_CHECK_EQUAL(sim->sim.pipe.stats.missed, 0);
+    
+    // pressed with the first report, let go once the script goes idle
+    count = readEvents(sim, events, 64);
+    XB_CHECK_EQUAL(count, sim->sim.device.stats.events);
+    XB_CHECK(hasEvent(events, count, EV_KEY, BTN_DPAD_UP, 1));
+    XB_CHECK(hasEvent(events, count, EV_KEY, BTN_START, 1));
+    XB_CHECK(hasEvent(events, count, EV_KEY, BTN_A, 1));
+    XB_CHECK(hasEvent(events, count, EV_ABS, ABS_RZ, 200));
+    XB_CHECK(hasEvent(events, count, EV_KEY, BTN_DPAD_UP, 0));
+    XB_CHECK(hasEvent(events, count, EV_ABS, ABS_RZ, 0));
+    
+    freeSimDevice(sim);
+    
+    // the read ring is clamped to what a device holds
+    XBInitSimDevice(&device, kSimDevicePad, 4 * kMs, 1);
+    sim = startSimDevice(&device, 0);
+    XB_CHECK_EQUAL(sim->sim.device.numReads, 1);
+    freeSimDevice(sim);
+    sim = startSimDevice(&device, 100);
+    XB_CHECK_EQUAL(sim->sim.device.numReads, kMaxLinuxReads);
+    XB_CHECK_EQUAL(sim->sim.pipe.count, kMaxLinuxReads);
+    freeSimDevice(sim);
+}
+
+static void
+testSimDuplicates()
+{
+    XBSimDevice device;
+    XBSimStep hold = { 2000 * kMs, kSimPatternHold, 0x01, 0, 0, 0 };
+    XBLinuxPipeline pipeline;
+    XBReplayOptions options;
+    SimDevice *sim;
+    
+    XBInitSimDevice(&device, kSimDevicePad, 4 * kMs, 1);
+    XBAddSimStep(&device, &hold);
+    sim = startSimDevice(&device, 2);
+    
+    XBDefaultReplayOptions(&options);
+    options.padOptions.SuppressDuplicateReports = true;
+    options.padOptions.KeepaliveInterval = 100;
+    XBInitLinuxPipeline(&pipeline, &options);
+    sim->sim.device.pipeline = &pipeline;
+    
+    // the first report, then one keepalive every 100 ms
+    runSimDevice(sim, 1000 * kMs);
+    XB_CHECK_EQUAL(sim->sim.device.stats.reports, 250);
+    XB_CHECK_EQUAL(sim->sim.device.stats.delivered, 10);
+    XB_CHECK_EQUAL(sim->sim.device.stats.suppressed, 240);
+    
+    freeSimDevice(sim);
+}
+
+static void
+testSimStall()
+{
+    XBSimDevice device;
+    XBSimFault stall = { 100 * kMs, kSimStatusPipeStalled, 0, false };
+    XBSimFault overrun = { 500 * kMs, kSimStatusOverrun, 0, false };
+    SimDevice *sim;
+    
+    XBInitSimDevice(&device, kSimDevicePad, kMs, 2);
+    XBAddSimFault(&device, &stall);
+    XBAddSimFault(&device, &overrun);
+    sim = startSimDevice(&device, 4);
+    
+    // one recovery each, and every other read handed back comes back on the pipe
+    runSimDevice(sim, 1000 * kMs);
+    XB_CHECK_EQUAL(sim->sim.device.stats.halts, 2);
+    XB_CHECK_EQUAL(sim->sim.device.stats.resets, 0);
+    XB_CHECK_EQUAL(sim->sim.pipe.count, 4);
+    XB_CHECK(!sim->sim.device.haltPending);
+    
+    // the stalled poll is lost, the overrun still has its report
+    XB_CHECK_EQUAL(sim->sim.device.stats.reports, 999);
+    XB_CHECK(XBLinuxDeviceDeadline(&sim->sim.device) == 0);
+    
+    freeSimDevice(sim);
+}
+
+static void
+testSimNotResponding()
+{
+    XBSimDevice device;
+    XBSimFault hung = { 100 * kMs, kSimStatusNotResponding, 0, false };
+    SimDevice *sim;
+    
+    XBInitSimDevice(&device, kSimDevicePad, kMs, 3);
+    XBAddSimFault(&device, &hung);
+    sim = startSimDevice(&device, 2);
+    
+    // reset after the third check, and reading again once it is back
+    runSimDevice(sim, 1000 * kMs);
+    XB_CHECK_EQUAL(sim->sim.device.stats.checks, kLinuxRetryCount);
+    XB_CHECK_EQUAL(sim->sim.device.stats.resets, 1);
+    XB_CHECK_EQUAL(sim->sim.pipe.stats.resets, 1);
+    XB_CHECK(!sim->sim.device.deviceIsDead);
+    XB_CHECK(sim->sim.device.stats.reports > 850);
+    XB_CHECK_EQUAL(sim->sim.pipe.count, 2);
+    
+    freeSimDevice(sim);
+}
+
+static void
+testSimUnplug()
+{
+    XBSimDevice device;
+    XBSimFault unplug = { 100 * kMs, kSimStatusNotResponding, 0, true };
+    SimDevice *sim;
+    
+    XBInitSimDevice(&device, kSimDevicePad, kMs, 3);
+    XBAddSimFault(&device, &unplug);
+    sim = startSimDevice(&device, 2);
+    
+    // found gone by the first check, never reset, and every read stops
+    runSimDevice(sim, 200 * kMs);
+    XB_CHECK(sim->sim.device.disconnected);
+    XB_CHECK_EQUAL(sim->sim.device.stats.resets, 0);
+    XB_CHECK_EQUAL(sim->sim.device.stats.reports, 99);
+    XB_CHECK(XBLinuxDeviceGone(&sim->sim.device));
+    
+    freeSimDevice(sim);
+}
+
+static void
+testSimRemote()
+{
+    XBSimDevice device;
+    XBSimStep idle = { 100 * kMs, kSimPatternIdle, 0, 0, 0, 0 };
+    XBSimStep press = { 150 * kMs, kSimPatternRemoteButton, 0, 0, 213, 0 };
+    struct input_event events[16];
+    SimDevice *sim;
+    UInt32 count;
+    
+    XBInitSimDevice(&device, kSimDeviceRemote, 16 * kMs, 4);
+    XBAddSimStep(&device, &idle);
+    XBAddSimStep(&device, &press);
+    XBAddSimStep(&device, &idle);
+    XBAddSimStep(&device, &idle);
+    XBAddSimStep(&device, &press);
+    sim = startSimDevice(&device, 2);
+    
+    // each press once, its repeats held, and let go by the release time
+    runSimDevice(sim, 400 * kMs);
+    XB_CHECK_EQUAL(sim->sim.device.stats.delivered, 1);
+    XB_CHECK(sim->sim.device.stats.repeats > 0);
+    XB_CHECK_EQUAL(sim->sim.device.stats.releases, 1);
+    XB_CHECK_EQUAL(sim->sim.device.releaseDeadline, 0);
+    
+    runSimDevice(sim, 1000 * kMs);
+    XB_CHECK_EQUAL(sim->sim.device.stats.delivered, 2);
+    XB_CHECK_EQUAL(sim->sim.device.stats.releases, 2);
+    
+    count = readEvents(sim, events, 16);
+    XB_CHECK_EQUAL(count, 8);
+    XB_CHECK(events[0].type == EV_KEY && events[0].code == KEY_SCREEN && events[0].value == 1);
+    XB_CHECK(events[2].type == EV_KEY && events[2].code == KEY_SCREEN && events[2].value == 0);
+    XB_CHECK(events[3].type == EV_SYN);
+    
+    freeSimDevice(sim);
+}
+
+static void
+testSimStop()
+{
+    XBSimDevice device;
+    SimDevice *sim;
+    
+    XBInitSimDevice(&device, kSimDevicePad, kMs, 5);
+    sim = startSimDevice(&device, 4);
+    
+    runSimDevice(sim, 10 * kMs);
+    XBStopLinuxDevice(&sim->sim.device);
+    XB_CHECK(!XBLinuxDeviceGone(&sim->sim.device));
+    
+    // the aborted reads come back and stay off the pipe
+    runSimDevice(sim, 20 * kMs);
+    XB_CHECK(XBLinuxDeviceGone(&sim->sim.device));
+    XB_CHECK_EQUAL(sim->sim.pipe.count, 0);
+    XB_CHECK_EQUAL(sim->sim.device.stats.reports, 10);
+    
+    freeSimDevice(sim);
+}
+
+static void
+testManyDevices()
+{
+    const UInt32 numPads = 16, numRemotes = 4;
+    SimDevice *sims[numPads + numRemotes];
+    XBSimLinuxDevice *devices[numPads + numRemotes];
+    UInt64 reports = 0, releases = 0;
+    
+    for (UInt32 i = 0; i < numPads + numRemotes; i++) {
+        
+        XBSimDevice device;
+        XBSimStep random = { 1000 * kMs, kSimPatternRandom, 0, 0, 0, 0 };
+        XBSimStep idle = { 100 * kMs, kSimPatternIdle, 0, 0, 0, 0 };
+        XBSimStep press = { 100 * kMs, kSimPatternRemoteButton, 0, 0, 166, 0 };
+        XBSimFault stall = { (UInt64)(i + 1) * 40 * kMs, kSimStatusPipeStalled, 0, false };
+        
+        if (i < numPads) {
+            XBInitSimDevice(&device, kSimDevicePad, kMs, i);
+            XBAddSimStep(&device, &random);
+            XBAddSimFault(&device, &stall);
+        } else {
+            XBInitSimDevice(&device, kSimDeviceRemote, 16 * kMs, i);
+            XBAddSimStep(&device, &idle);
+            XBAddSimStep(&device, &press);
+            device.loop = true;
+        }
+        sims[i] = startSimDevice(&device, 2);
+        devices[i] = &sims[i]->sim;
+    }
+    
+    // one thread, in time order across them all
+    XBRunSimLinuxDevices(devices, numPads + numRemotes, kStart + 1000 * kMs);
+    
+    for (UInt32 i = 0; i < numPads + numRemotes; i++) {
+        if (i < numPads) {
+            reports += devices[i]->device.stats.reports;
+            XB_CHECK_EQUAL(devices[i]->device.stats.halts, 1);
+        } else
+            releases += devices[i]->device.stats.releases;
+        freeSimDevice(sims[i]);
+    }
+    XB_CHECK_EQUAL(reports, numPads * (1000 - 1));    
+    // the last press is still held at the end
+    XB_CHECK_EQUAL(releases, numRemotes * 4);
+}
+
+// devices on a loop, in real time from now
+typedef struct {
+    
+    XBEventLoop         loop;
+    XBLinuxPipeline     pipeline;
+    XBSimLoopDevice     devices[16];
+    UInt32              numDevices;
+    
+} LoopDevices;
+
+static UInt32 gLoopDevicesGone;
+
+static void
+loopDeviceGone(XBLoopDevice *loopDevice)
+{
+    (void)loopDevice;
+    gLoopDevicesGone++;
+}
+
+static void
+initLoopDevices(LoopDevices *loop)
+{
+    XBReplayOptions options;
+    
+    XBDefaultReplayOptions(&options);
+    XBInitLinuxPipeline(&loop->pipeline, &options);
+    XB_CHECK(XBInitEventLoop(&loop->loop));
+    loop->numDevices = 0;
+    gLoopDevicesGone = 0;
+}
+
+static XBSimLoopDevice *
+addLoopDevice(LoopDevices *loop, const XBSimDevice *device, UInt64 start, int outputFd)
+{
+    XBSimLoopDevice *sim = &loop->devices[loop->numDevices++];
+    
+    XBInitSimLinuxDevice(&sim->sim, device, start, &loop->pipeline, 2, outputFd);
+    XB_CHECK(XBAddSimLoopDevice(&loop->loop, sim, loopDeviceGone));
+    return sim;
+}
+
+static void
+runLoopDevices(LoopDevices *loop, UInt64 end)
+{
+    for (UInt64 now = XBLinuxTime(); now < end; now = XBLinuxTime())
+        XBRunEventLoop(&loop->loop, end - now);
+}
+
+static void
+freeLoopDevices(LoopDevices *loop)
+{
+    for (UInt32 i = 0; i < loop->numDevices; i++) {
+        XBRemoveSimLoopDevice(&loop->devices[i]);
+        XBFreeSimLinuxDevice(&loop->devices[i].sim);
+    }
+    XBFreeEventLoop(&loop->loop);
+}
+
+static void
+testLoopDevices()
+{
+    LoopDevices *loop = new LoopDevices;
+    XBSimStep random = { 1000 * kMs, kSimPatternRandom, 0, 0, 0, 0 };
+    XBSimStep idle = { 50 * kMs, kSimPatternIdle, 0, 0, 0, 0 };
+    XBSimStep press = { 100 * kMs, kSimPatternRemoteButton, 0, 0, 213, 0 };
+    XBSimFault stall = { 20 * kMs, kSimStatusPipeStalled, 0, false };
+    XBSimDevice remote;
+    UInt64 start = XBLinuxTime(), reports = 0;
+    int outputFd = open("/dev/null", O_WRONLY);
+    
+    initLoopDevices(loop);
+    for (UInt32 i = 0; i < 8; i++) {
+        
+        XBSimDevice device;
+        
+        XBInitSimDevice(&device, kSimDevicePad, kMs, i);
+        XBAddSimStep(&device, &random);
+        XBAddSimFault(&device, &stall);
+        addLoopDevice(loop, &device, start, outputFd);
+    }
+    
+    XBInitSimDevice(&remote, kSimDeviceRemote, 16 * kMs, 8);
+    XBAddSimStep(&remote, &idle);
+    XBAddSimStep(&remote, &press);
+    addLoopDevice(loop, &remote, start, outputFd);
+    
+    // the release timer fires 80 ms after the press ends
+    runLoopDevices(loop, start + 300 * kMs);
+    
+    for (UInt32 i = 0; i < 8; i++) {
+        
+        XBLinuxDevice *device = &loop->devices[i].sim.device;
+        
+        reports += device->stats.reports;
+        XB_CHECK_EQUAL(device->stats.halts, 1);
+        XB_CHECK_EQUAL(device->stats.writeErrors, 0);
+        XB_CHECK_EQUAL(loop->devices[i].sim.pipe.count, 2);
+    }
+    XB_CHECK_EQUAL(loop->devices[8].sim.device.stats.delivered, 1);
+    XB_CHECK_EQUAL(loop->devices[8].sim.device.stats.releases, 1);
+    XB_CHECK_EQUAL(loop->devices[8].sim.device.releaseDeadline, 0);
+    
+    // every poll due was read, however late the loop woke, and most wakeups served several pads
+    XB_CHECK(reports >= 8 * 280);
+    XB_CHECK(loop->loop.passes < reports / 2);
+    XB_CHECK_EQUAL(gLoopDevicesGone, 0);
+    
+    freeLoopDevices(loop);
+    close(outputFd);
+    delete loop;
+}
+
+static void
+testLoopUnplug()
+{
+    LoopDevices *loop = new LoopDevices;
+    XBSimFault unplug = { 20 * kMs, kSimStatusNotResponding, 0, true };
+    XBSimDevice device;
+    UInt64 start = XBLinuxTime();
+    int outputFd = open("/dev/null", O_WRONLY);
+    XBSimLoopDevice *sim;
+    
+    initLoopDevices(loop);
+    XBInitSimDevice(&device, kSimDevicePad, kMs, 1);
+    XBAddSimFault(&device, &unplug);
+    sim = addLoopDevice(loop, &device, start, outputFd);
+    
+    // found gone by its check, and out of the loop
+    runLoopDevices(loop, start + 100 * kMs);
+    XB_CHECK_EQUAL(gLoopDevicesGone, 1);
+    XB_CHECK(XBLinuxDeviceGone(&sim->sim.device));
+    XB_CHECK_EQUAL(sim->loopDevice.timer.fd, -1);
+    XB_CHECK_EQUAL(sim->sim.device.stats.reports, 19);
+    
+    freeLoopDevices(loop);
+    close(outputFd);
+    delete loop;
+}
+
+static void
+testLoopHeldOutput()
+{
+    LoopDevices *loop = new LoopDevices;
+    XBSimStep random = { 1000 * kMs, kSimPatternRandom, 0, 0, 0, 0 };
+    XBSimDevice device;
+    XBSimLoopDevice *sim;
+    struct input_event events[256];
+    UInt64 start = XBLinuxTime(), received = 0;
+    bool whole = true;
+    int fds[2];
+    
+    XB_CHECK(pipe2(fds, O_NONBLOCK) == 0);
+    fcntl(fds[1], F_SETPIPE_SZ, 4096);
+    
+    initLoopDevices(loop);
+    XBInitSimDevice(&device, kSimDevicePad, kMs, 2);
+    XBAddSimStep(&device, &random);
+    sim = addLoopDevice(loop, &device, start, fds[1]);
+    
+    // nobody reads: the pipe fills, the events are held and then lost, whole
+    runLoopDevices(loop, start + 100 * kMs);
+    XB_CHECK(sim->sim.device.stats.writesHeld > 0);
+    XB_CHECK(sim->sim.device.stats.writeErrors > 0);
+    XB_CHECK(XBLinuxDeviceOutputPending(&sim->sim.device));
+    XB_CHECK(sim->loopDevice.watchingOutput);
+    
+    // and once it is read again, what was held goes out first
+    for (UInt64 end = start + 100 * kMs; end < start + 200 * kMs; end += 5 * kMs) {
+        
+        ssize_t length;
+        
+        while ((length = read(fds[0], events, sizeof(events))) > 0) {
+            whole = whole && length % sizeof(struct input_event) == 0;
+            for (UInt32 i = 0; i < length / sizeof(struct input_event); i++)
+                whole = whole && (events[i].type == EV_KEY || events[i].type == EV_ABS || events[i].type == EV_SYN);
+            received += length / sizeof(struct input_event);
+        }
+        runLoopDevices(loop, end);
+    }
+    XB_CHECK(whole);
+    XB_CHECK(received > 0);
+    XB_CHECK(!XBLinuxDeviceOutputPending(&sim->sim.device));
+    XB_CHECK(!sim->loopDevice.watchingOutput);
+    
+    freeLoopDevices(loop);
+    close(fds[0]);
+    close(fds[1]);
+    delete loop;
+}
+
+// the pipe polls no more, as a real device that sends nothing wakes nobody
+static void
+freezeLoopDevice(LoopDevices *loop, XBSimLoopDevice *sim)
+{
+    XBRemoveEventSource(&loop->loop, &sim->pipeTimer);
+}
+
+static void
+testLoopIdleDevices()
+{
+    LoopDevices *loop = new LoopDevices;
+    XBSimStep idle = { 20 * kMs, kSimPatternIdle, 0, 0, 0, 0 };
+    XBSimStep press = { 1000 * kMs, kSimPatternRemoteButton, 0, 0, 213, 0 };
+    XBSimStep random = { 1000 * kMs, kSimPatternRandom, 0, 0, 0, 0 };
+    XBSimDevice remote, pad;
+    XBSimLoopDevice *remoteSim, *padSim;
+    struct input_event events[256];
+    UInt64 start = XBLinuxTime(), passes;
+    int outputFd = open("/dev/null", O_WRONLY);
+    int fds[2];
+    
+    XB_CHECK(pipe2(fds, O_NONBLOCK) == 0);
+    fcntl(fds[1], F_SETPIPE_SZ, 4096);
+    
+    initLoopDevices(loop);
+    XBInitSimDevice(&remote, kSimDeviceRemote, 16 * kMs, 9);
+    XBAddSimStep(&remote, &idle);
+    XBAddSimStep(&remote, &press);
+    remoteSim = addLoopDevice(loop, &remote, start, outputFd);
+    XBInitSimDevice(&pad, kSimDevicePad, kMs, 10);
+    XBAddSimStep(&pad, &random);
+    padSim = addLoopDevice(loop, &pad, start, fds[1]);
+    
+    // pressed, and the pad's output full
+    runLoopDevices(loop, start + 60 * kMs);
+    XB_CHECK_EQUAL(remoteSim->sim.device.stats.delivered, 1);
+    XB_CHECK_EQUAL(remoteSim->sim.device.stats.releases, 0);
+    XB_CHECK(padSim->loopDevice.watchingOutput);
+    
+    // the release timer alone lets the key go
+    freezeLoopDevice(loop, remoteSim);
+    freezeLoopDevice(loop, padSim);
+    runLoopDevices(loop, start + 200 * kMs);
+    XB_CHECK_EQUAL(remoteSim->sim.device.stats.releases, 1);
+    XB_CHECK_EQUAL(remoteSim->sim.device.releaseDeadline, 0);
+    
+    // and the output, once read, is flushed and no longer watched, the loop idle again
+    while (read(fds[0], events, sizeof(events)) > 0)
+        ;
+    runLoopDevices(loop, start + 210 * kMs);
+    while (read(fds[0], events, sizeof(events)) > 0)
+        ;
+    runLoopDevices(loop, start + 220 * kMs);
+    XB_CHECK(!XBLinuxDeviceOutputPending(&padSim->sim.device));
+    XB_CHECK(!padSim->loopDevice.watchingOutput);
+    
+    passes = loop->loop.passes;
+    runLoopDevices(loop, start + 270 * kMs);
+    XB_CHECK(loop->loop.passes - passes < 5);
+    
+    freeLoopDevices(loop);
+    close(fds[0]);
+    close(fds[1]);
+    close(outputFd);
+    delete loop;
+}
+
+int
+main()
+{
+    testPlist();
+    testDatabase();
+    testEvents();
+    testSimPad();
+    testSimDuplicates();
+    testSimStall();
+    testSimNotResponding();
+    testSimUnplug();
+    testSimRemote();
+    testSimStop();
+    testManyDevices();
+    testLoopDevices();
+    testLoopUnplug();
+    testLoopHeldOutput();
+    testLoopIdleDevices();
+    
+    return XB_TEST_RESULT();
+}
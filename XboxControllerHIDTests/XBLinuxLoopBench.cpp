@@ -0,0 +1,226 @@
+//
+//  XBLinuxLoopBench.cpp
+//  XboxControllerHIDTests
+//
+//  How the daemon's event loop scales with the pads on it: 1, 2, 4 ... up
+//  to 64 simulated pads, each sending a new random report every interval
+//  through the whole daemon path (pipe timerfd, read completion, report
+//  pipeline, events written), all on one XBEventLoop and one thread. Each
+//  count reports the CPU the process used, in all and per pad, the wakeups
+//  and context switches it took, and the latency from when a report was due
+//  to when its events were written, as JSON, so runs can be compared from
+//  commit to commit.
+//
+//  usage: XBLinuxLoopBench [--duration MS] [--interval MS] [--max-pads N]
+//                          [--output FILE]
+//
+//  The pads poll in step, as pads on one bus do, so a wakeup of the loop
+//  usually completes reads of many of them. Events go to /dev/null.
+//
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/resource.h>
+
+#include <vector>
+
+#include "XBEventLoop.h"
+#include "XBSimBackend.h"
+
+#define kMs                 1000000ULL
+#define kBenchReads         2
+
+static FILE *gOutput;
+static bool gFirstResult = true;
+
+static UInt64
+cpuTime(const struct rusage *usage)
+{
+    return (UInt64)(usage->ru_utime.tv_sec + usage->ru_stime.tv_sec) * 1000000000 +
+           (UInt64)(usage->ru_utime.tv_usec + usage->ru_stime.tv_usec) * 1000;
+}
+
+// Threads: in /proc/self/status, 0 if it can't be read
+static int
+threadCount()
+{
+    FILE *file = fopen("/proc/self/status", "r");
+    char line[256];
+    int threads = 0;
+    
+    if (!file)
+        return 0;
+    while (fgets(line, sizeof(line), file))
+        if (sscanf(line, "Threads: %d", &threads) == 1)
+            break;
+    fclose(file);
+    return threads;
+}
+
+static int
+compareLatencies(const void *a, const void *b)
+{
+    UInt64 x = *(const UInt64 *)a, y = *(const UInt64 *)b;
+    
+    return x < y ? -1 : x > y;
+}
+
+static double
+percentileUs(const UInt64 *sorted, UInt64 count, double percentile)
+{
+    UInt64 index = (UInt64)(percentile * (count - 1));
+    
+    return count ? sorted[index] / 1000.0 : 0;
+}
+
+static bool
+benchPads(UInt32 numPads, UInt64 duration, UInt64 interval, int eventsFd)
+{
+    XBReplayOptions options;
+    XBLinuxPipeline pipeline;
+    XBEventLoop loop;
+    std::vector<XBSimLoopDevice *> pads;
+    std::vector<UInt64> latencies;
+    struct rusage before, after;
+    UInt32 maxLatencies = (UInt32)(duration / interval) + 16;
+    UInt64 start, end, elapsed, cpu, reports = 0, errors = 0, switches;
+    int threads;
+    
+    XBDefaultReplayOptions(&options);
+    XBInitLinuxPipeline(&pipeline, &options);
+    if (!XBInitEventLoop(&loop)) {
+        perror("epoll");
+        return false;
+    }
+    
+    start = XBLinuxTime() + 10 * kMs;
+    for (UInt32 i = 0; i < numPads; i++) {
+        
+        XBSimStep random = { duration + 100 * kMs, kSimPatternRandom, 0, 0, 0, 0 };
+        XBSimLoopDevice *pad = new XBSimLoopDevice;
+        XBSimDevice device;
+        
+        XBInitSimDevice(&device, kSimDevicePad, interval, i + 1);
+        XBAddSimStep(&device, &random);
+        XBInitSimLinuxDevice(&pad->sim, &device, start, &pipeline, kBenchReads, eventsFd);
+        
+        pad->sim.device.latencies = new UInt64[maxLatencies];
+        pad->sim.device.maxLatencies = maxLatencies;
+        
+        if (!XBAddSimLoopDevice(&loop, pad, NULL)) {
+            perror("epoll");
+            return false;
+        }
+        pads.push_back(pad);
+    }
+    
+    getrusage(RUSAGE_SELF, &before);
+    end = start + duration;
+    for (UInt64 now = XBLinuxTime(); now < end; now = XBLinuxTime())
+        XBRunEventLoop(&loop, end - now);
+    getrusage(RUSAGE_SELF, &after);
+    threads = threadCount();
+    
+    elapsed = XBLinuxTime() - start;
+    cpu = cpuTime(&after) - cpuTime(&before);
+    switches = (after.ru_nvcsw - before.ru_nvcsw) + (after.ru_nivcsw - before.ru_nivcsw);
+    
+    for (UInt32 i = 0; i < numPads; i++) {
+        
+        XBLinuxDevice *device = &pads[i]->sim.device;
+        
+        reports += device->stats.reports;
+        errors += device->stats.errors + device->stats.writeErrors;
+        latencies.insert(latencies.end(), device->latencies, device->latencies + device->numLatencies);
+        
+        XBRemoveSimLoopDevice(pads[i]);
+        XBFreeSimLinuxDevice(&pads[i]->sim);
+        delete [] device->latencies;
+        delete pads[i];
+    }
+    XBFreeEventLoop(&loop);
+    
+    qsort(latencies.data(), latencies.size(), sizeof(UInt64), compareLatencies);
+    
+    fprintf(gOutput, "%s\n    { \"pads\": %u, \"threads\": %d, \"reports\": %llu, \"errors\": %llu, "
+            "\"reportsPerSecond\": %.1f,\n"
+            "      \"cpuPercent\": %.3f, \"cpuPercentPerPad\": %.4f, \"cpuUsPerReport\": %.3f,\n"
+            "      \"wakeups\": %llu, \"handlersPerWakeup\": %.2f, \"contextSwitches\": %llu,\n"
+            "      \"latencyUs\": { \"p50\": %.1f, \"p99\": %.1f, \"p999\": %.1f, \"max\": %.1f } }",
+            gFirstResult ? "" : ",", numPads, threads, (unsigned long long)reports, (unsigned long long)errors,
+            reports * 1e9 / elapsed, cpu * 100.0 / elapsed, cpu * 100.0 / elapsed / numPads,
+            reports ? cpu / 1000.0 / reports : 0, (unsigned long long)loop.passes,
+            loop.passes ? (double)loop.dispatched / loop.passes : 0, (unsigned long long)switches,
+            percentileUs(latencies.data(), latencies.size(), 0.5),
+            percentileUs(latencies.data(), latencies.size(), 0.99),
+            percentileUs(latencies.data(), latencies.size(), 0.999),
+            latencies.empty() ? 0 : latencies.back() / 1000.0);
+    fflush(gOutput);
+    gFirstResult = false;
+    return true;
+}
+
+static void
+usage()
+{
+    fprintf(stderr, "usage: XBLinuxLoopBench [--duration MS] [--interval MS] [--max-pads N]\n"
+                    "                        [--output FILE]\n");
+    exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+    UInt64 duration = 2000 * kMs, interval = 1 * kMs;
+    UInt32 maxPads = 64;
+    const char *output = NULL;
+    int eventsFd;
+    
+    for (int i = 1; i < argc; i++) {
+        
+        if (i + 1 == argc)
+            usage();
+        
+        if (!strcmp(argv[i], "--duration"))
+            duration = strtoull(argv[++i], NULL, 0) * kMs;
+        else if (!strcmp(argv[i], "--interval"))
+            interval = strtoull(argv[++i], NULL, 0) * kMs;
+        else if (!strcmp(argv[i], "--max-pads"))
+            maxPads = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--output"))
+            output = argv[++i];
+        else
+            usage();
+    }
+    
+    if (!duration || !interval || !maxPads)
+        usage();
+    
+    gOutput = output ? fopen(output, "w") : stdout;
+    if (!gOutput) {
+        perror(output);
+        return 1;
+    }
+    
+    eventsFd = open("/dev/null", O_WRONLY | O_NONBLOCK | O_CLOEXEC);
+    if (eventsFd < 0) {
+        perror("/dev/null");
+        return 1;
+    }
+    
+    fprintf(gOutput, "{\n  \"benchmark\": \"XBLinuxLoopBench\",\n  \"durationMs\": %llu,\n  \"intervalMs\": %llu,\n"
+            "  \"results\": [", (unsigned long long)(duration / kMs), (unsigned long long)(interval / kMs));
+    
+    for (UInt32 pads = 1; pads <= maxPads; pads *= 2)
+        if (!benchPads(pads, duration, interval, eventsFd))
+            return 1;
+    
+    fprintf(gOutput, "\n  ]\n}\n");
+    if (gOutput != stdout)
+        fclose(gOutput);
+    close(eventsFd);
+    return 0;
+}
@@ -0,0 +1,104 @@
+//
+//  XBOutstandingIOTests.cpp
+//  XboxControllerHIDTests
+//
+//  Stress test of the outstanding I/O count and the provider close handoff.
+//  Worker threads play the read ring: each completion queues the next read
+//  before it ends, until termination stops them. Another thread plays
+//  didTerminate. The provider must be closed exactly once, and only after
+//  the last I/O has ended.
+//
+
+#include <thread>
+#include <vector>
+
+#include "XboxControllerHIDCore.h"
+#include "XBTest.h"
+
+#define kRounds     2000
+#define kWorkers    4
+
+typedef struct {
+    
+    XBOutstandingIO io;
+    volatile int    terminating;        // isInactive()
+    volatile int    closes;             // times the provider was closed
+    volatile int    closedInFlight;     // closed while I/O was still counted
+    
+} Driver;
+
+static void
+closeProvider(Driver *driver)
+{
+    if (!XBClaimClose(&driver->io))
+        return;
+    
+    if (driver->io.count != 0)
+        __sync_fetch_and_add(&driver->closedInFlight, 1);
+    __sync_fetch_and_add(&driver->closes, 1);
+}
+
+static void
+endIO(Driver *driver)
+{
+    if (XBEndIO(&driver->io))
+        closeProvider(driver);
+}
+
+static void
+worker(Driver *driver, UInt64 seed)
+{
+    XBTestRandom random = { seed };
+    
+    // each completion queues the next read before it is done, as the ring does
+    while (!driver->terminating) {
+        
+        XBBeginIO(&driver->io);
+        if (XBTestNext(&random) & 1)
+            std::this_thread::yield();
+        endIO(driver);
+    }
+    
+    // the aborted read ends without queueing another
+    endIO(driver);
+}
+
+int
+main()
+{
+    for (int round = 0; round < kRounds; round++) {
+        
+        Driver driver = { { 0, 0, 0 }, 0, 0, 0 };
+        std::vector<std::thread> workers;
+        
+        // start() holds one I/O of its own until it is done, and queues the reads before it drops it
+        XBBeginIO(&driver.io);
+        for (int i = 0; i < kWorkers; i++)
+            XBBeginIO(&driver.io);
+        for (int i = 0; i < kWorkers; i++)
+            workers.push_back(std::thread(worker, &driver, 0x9E3779B97F4A7C15ULL * (round * kWorkers + i + 1)));
+        endIO(&driver);
+        
+        for (int i = 0; i < round % 50; i++)
+            std::this_thread::yield();
+        
+        // willTerminate aborts the pipe, didTerminate asks for the close. Every
+        // fourth round the aborted reads have all completed by then.
+        driver.terminating = 1;
+        if (round % 4 == 0)
+            while (driver.io.count)
+                std::this_thread::yield();
+        
+        if (XBRequestClose(&driver.io))
+            closeProvider(&driver);
+        
+        for (size_t i = 0; i < workers.size(); i++)
+            workers[i].join();
+        
+        XB_CHECK_EQUAL(driver.io.count, 0);
+        XB_CHECK_EQUAL(driver.closes, 1);
+        XB_CHECK_EQUAL(driver.closedInFlight, 0);
+    }
+    
+    return XB_TEST_RESULT();
+}
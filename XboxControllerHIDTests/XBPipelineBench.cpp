@@ -0,0 +1,460 @@
+//
+//  XBPipelineBench.cpp
+//  XboxControllerHIDTests
+//
+//  Cost of the report transforms per report, for every combination of pad
+//  options and for the remote's scancode conversion, next to the code they
+//  replaced, and the batch kernels at batch sizes from 1 to 64K reports.
+//  Results go out as JSON, so runs can be compared from commit to commit.
+//
+//  usage: XBPipelineBench [--reports N] [--repeat N] [--pad-input FILE]
+//                         [--remote-input FILE] [--output FILE]
+//
+//  The input files hold raw reports back to back, as read from the device
+//  (20 bytes per pad report, 6 per remote report). Without them the reports
+//  are random.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "XboxControllerHIDCore.h"
+#include "XBReference.h"
+
+// -- instruction counter -----------------------------------
+// ----------------------------------------------------------
+
+// user space instructions retired, if the kernel lets us count them
+static int gInstructionCounter = -1;
+
+static void
+openInstructionCounter()
+{
+#ifdef __linux__
+    struct perf_event_attr attr;
+    
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    
+    gInstructionCounter = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+#endif
+}
+
+static void
+startInstructionCounter()
+{
+#ifdef __linux__
+    if (gInstructionCounter >= 0) {
+        ioctl(gInstructionCounter, PERF_EVENT_IOC_RESET, 0);
+        ioctl(gInstructionCounter, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+static long long
+stopInstructionCounter()
+{
+    long long count = -1;
+    
+#ifdef __linux__
+    if (gInstructionCounter >= 0) {
+        ioctl(gInstructionCounter, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(gInstructionCounter, &count, sizeof(count)) != sizeof(count))
+            count = -1;
+    }
+#endif
+    
+    return count;
+}
+
+// -- measurements ------------------------------------------
+// ----------------------------------------------------------
+
+static UInt64
+now()
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (UInt64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+typedef struct {
+    
+    double  nsPerReport;            // fastest of the repeats
+    double  instructionsPerReport;  // of the same repeat, negative without a counter
+    
+} Measurement;
+
+// one pass over a copy of the stream, so every repeat sees the raw reports
+#define MEASURE(result, stream, work, count, repeat, pass) \
+do { \
+(result).nsPerReport = -1; \
+(result).instructionsPerReport = -1; \
+for (int _r = 0; _r < (repeat); _r++) { \
+memcpy((work), (stream), (count) * sizeof((stream)[0])); \
+startInstructionCounter(); \
+UInt64 _start = now(); \
+pass; \
+double _ns = (double)(now() - _start) / (count); \
+long long _instructions = stopInstructionCounter(); \
+if ((result).nsPerReport < 0 || _ns < (result).nsPerReport) { \
+(result).nsPerReport = _ns; \
+(result).instructionsPerReport = _instructions >= 0 ? (double)_instructions / (count) : -1; \
+} \
+} \
+} while (0)
+
+static FILE *gOutput;
+static bool gFirstResult = true;
+
+// options and batchSize are left out when negative
+static void
+printResult(const char *stream, const char *report, int options, UInt32 mask, int batchSize,
+            const char *variant, const Measurement *m)
+{
+    fprintf(gOutput, "%s\n    { \"stream\": \"%s\", \"report\": \"%s\", ", gFirstResult ? "" : ",", stream, report);
+    if (options >= 0)
+        fprintf(gOutput, "\"options\": %d, \"mask\": %u, ", options, mask);
+    if (batchSize >= 0)
+        fprintf(gOutput, "\"batchSize\": %d, ", batchSize);
+    fprintf(gOutput, "\"variant\": \"%s\", \"nsPerReport\": %.3f, \"reportsPerSec\": %.0f, \"instructionsPerReport\": ",
+            variant, m->nsPerReport, m->nsPerReport > 0 ? 1e9 / m->nsPerReport : 0.0);
+    if (m->instructionsPerReport >= 0)
+        fprintf(gOutput, "%.2f }", m->instructionsPerReport);
+    else
+        fprintf(gOutput, "null }");
+    
+    gFirstResult = false;
+}
+
+// -- streams -----------------------------------------------
+// ----------------------------------------------------------
+
+// synthetic reports, the same for every run
+static UInt64 gRandomState = 0x5851F42D4C957F2DULL;
+
+static UInt8
+randomByte()
+{
+    gRandomState ^= gRandomState << 13;
+    gRandomState ^= gRandomState >> 7;
+    gRandomState ^= gRandomState << 17;
+    return (UInt8)(gRandomState >> 24);
+}
+
+static void
+randomFill(void *buffer, size_t length)
+{
+    for (size_t i = 0; i < length; i++)
+        ((UInt8 *)buffer)[i] = randomByte();
+}
+
+// -- pad ---------------------------------------------------
+// ----------------------------------------------------------
+
+// The pad options that change what a report goes through, one bit each: the
+// kPadTransform* bits, then a trigger threshold above 1 for either trigger.
+// Every one of the 512 combinations is measured.
+#define kPadOptionLeftThreshold     (1 << 7)
+#define kPadOptionRightThreshold    (1 << 8)
+#define kNumPadOptions              (1 << 9)
+
+static void
+padOptions(int bits, PadOptions *options, UInt32 *mask)
+{
+    memset(options, 0, sizeof(*options));
+    
+    options->invertY = bits & kPadTransformInvertY;
+    options->invertX = bits & kPadTransformInvertX;
+    options->invertRy = bits & kPadTransformInvertRy;
+    options->invertRx = bits & kPadTransformInvertRx;
+    options->clampButtons = bits & kPadTransformClampButtons;
+    options->clampLeft = bits & kPadTransformLeftTrigger;
+    options->clampRight = bits & kPadTransformRightTrigger;
+    options->leftThreshold = (bits & kPadOptionLeftThreshold) ? 30 : 0;
+    options->rightThreshold = (bits & kPadOptionRightThreshold) ? 30 : 0;
+    
+    // what setDeviceOptions() selects for them
+    *mask = bits & (kPadTransformInvertY | kPadTransformInvertX | kPadTransformInvertRy |
+                    kPadTransformInvertRx | kPadTransformClampButtons);
+    if (options->clampLeft || options->leftThreshold > 1)
+        *mask |= kPadTransformLeftTrigger;
+    if (options->clampRight || options->rightThreshold > 1)
+        *mask |= kPadTransformRightTrigger;
+}
+
+static void
+benchPad(const char *stream, const XBPadReport *reports, UInt32 count, int repeat)
+{
+    XBPadReport *work = (XBPadReport *)malloc(count * sizeof(XBPadReport));
+    
+    for (int bits = 0; bits < kNumPadOptions; bits++) {
+        
+        PadOptions options;
+        UInt32 mask;
+        UInt8 leftTable[256], rightTable[256];
+        Measurement m;
+        
+        padOptions(bits, &options, &mask);
+        XBBuildTriggerTable(leftTable, options.clampLeft, options.leftThreshold);
+        XBBuildTriggerTable(rightTable, options.clampRight, options.rightThreshold);
+        
+        // every option tested per report, as manipulateReport() did before the transforms were specialized
+        MEASURE(m, reports, work, count, repeat,
+                for (UInt32 i = 0; i < count; i++)
+                    referencePadTransform(&work[i], &options));
+        printResult(stream, "pad", bits, mask, -1, "reference", &m);
+        
+        // one report per call through the selected transform, as the driver does it
+        XBPadTransform transform = XBSelectPadTransform(mask);
+        
+        MEASURE(m, reports, work, count, repeat,
+                for (UInt32 i = 0; i < count; i++)
+                    transform(&work[i], leftTable, rightTable));
+        printResult(stream, "pad", bits, mask, -1, "specialized", &m);
+        
+        XBPadBatchTransform batchTransform = XBSelectPadBatchTransform(mask);
+        
+        MEASURE(m, reports, work, count, repeat,
+                batchTransform(work, count, leftTable, rightTable));
+        printResult(stream, "pad", bits, mask, -1, "batch", &m);
+    }
+    
+    free(work);
+}
+
+// Every batch kernel with all pad options on, over the stream in batches of
+// 1 to 64K reports, so the cost of a call shows next to the cost per report
+static void
+benchPadBatches(const char *stream, const XBPadReport *reports, UInt32 count, int repeat)
+{
+    XBPadReport *work = (XBPadReport *)malloc(count * sizeof(XBPadReport));
+    UInt32 mask = kNumPadTransforms - 1;
+    UInt8 leftTable[256], rightTable[256];
+    
+    XBBuildTriggerTable(leftTable, false, 30);
+    XBBuildTriggerTable(rightTable, true, 30);
+    
+    for (int kernel = 0; kernel < kNumPadBatchKernels; kernel++) {
+        
+        if (!XBPadBatchKernelSupported((XBPadBatchKernel)kernel))
+            continue;
+        
+        for (UInt32 batchSize = 1; batchSize <= 65536 && batchSize <= count; batchSize *= 2) {
+            
+            Measurement m;
+            
+            MEASURE(m, reports, work, count, repeat,
+                    for (UInt32 i = 0; i < count; i += batchSize)
+                        XBTransformPadReports((XBPadBatchKernel)kernel, mask, &work[i],
+                                              count - i < batchSize ? count - i : batchSize, leftTable, rightTable));
+            printResult(stream, "pad", kNumPadOptions - 1, mask, batchSize, XBPadBatchKernelName((XBPadBatchKernel)kernel), &m);
+        }
+    }
+    
+    free(work);
+}
+
+// -- remote ------------------------------------------------
+// ----------------------------------------------------------
+
+static void
+benchRemote(const char *stream, const XBActualRemoteReport *reports, UInt32 count, int repeat)
+{
+    XBActualRemoteReport *work = (XBActualRemoteReport *)malloc(count * sizeof(XBActualRemoteReport));
+    XBRemoteButtonTable table;
+    int scancodes[kNumRemoteButtons];
+    Measurement m;
+    
+    // the default ButtonMap of Info.plist
+    static const int defaultScancodes[kNumRemoteButtons] = {
+        213, 226, 234, 227, 221, 224, 230, 223, 229, 166,
+        195, 169, 11, 168, 247, 167, 216, 206, 205, 204,
+        203, 202, 201, 200, 199, 198, 207
+    };
+    
+    memcpy(scancodes, defaultScancodes, sizeof(scancodes));
+    XBBuildRemoteButtonTable(scancodes, &table);
+    
+    // the per-button decode it replaced
+    MEASURE(m, reports, work, count, repeat,
+            UInt8 lastButtonPressed = 0;
+            for (UInt32 i = 0; i < count; i++) {
+                if (work[i].scancode == lastButtonPressed)
+                    continue;
+                lastButtonPressed = work[i].scancode;
+                referenceRemoteConvert(&work[i], scancodes);
+            });
+    printResult(stream, "remote", -1, 0, -1, "reference", &m);
+    
+    // manipulateRemoteReport(): drop repeats of the held button, convert the rest
+    MEASURE(m, reports, work, count, repeat,
+            UInt8 lastButtonPressed = 0;
+            for (UInt32 i = 0; i < count; i++) {
+                if (work[i].scancode == lastButtonPressed)
+                    continue;
+                lastButtonPressed = work[i].scancode;
+                XBConvertRemoteReport(&work[i], &table);
+            });
+    printResult(stream, "remote", -1, 0, -1, "table", &m);
+    
+    free(work);
+}
+
+// -- recorded streams --------------------------------------
+// ----------------------------------------------------------
+
+// raw reports of one size back to back, NULL if the file can't be read
+static void *
+readReports(const char *path, size_t reportSize, UInt32 *count)
+{
+    FILE *file = fopen(path, "rb");
+    char *bytes = NULL;
+    size_t length = 0, capacity = 0, n;
+    
+    if (!file) {
+        perror(path);
+        return NULL;
+    }
+    
+    do {
+        if (length == capacity) {
+            capacity = capacity ? capacity * 2 : 1 << 16;
+            bytes = (char *)realloc(bytes, capacity);
+        }
+        n = fread(bytes + length, 1, capacity - length, file);
+        length += n;
+    } while (n > 0);
+    
+    fclose(file);
+    
+    *count = length / reportSize;
+    if (*count == 0) {
+        fprintf(stderr, "%s: no reports\n", path);
+        free(bytes);
+        return NULL;
+    }
+    
+    return bytes;
+}
+
+static void
+usage()
+{
+    fprintf(stderr, "usage: XBPipelineBench [--reports N] [--repeat N] [--pad-input FILE]\n"
+                    "                       [--remote-input FILE] [--output FILE]\n");
+    exit(2);
+}
+
+int
+main(int argc, char **argv)
+{
+    UInt32 count = 1 << 16;
+    int repeat = 5;
+    const char *padInput = NULL, *remoteInput = NULL, *output = NULL;
+    XBPadReport *recordedPads = NULL;
+    XBActualRemoteReport *recordedRemotes = NULL;
+    UInt32 numRecordedPads = 0, numRecordedRemotes = 0;
+    
+    for (int i = 1; i < argc; i++) {
+        
+        if (i + 1 == argc)
+            usage();
+        
+        if (!strcmp(argv[i], "--reports"))
+            count = strtoul(argv[++i], NULL, 0);
+        else if (!strcmp(argv[i], "--repeat"))
+            repeat = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--pad-input"))
+            padInput = argv[++i];
+        else if (!strcmp(argv[i], "--remote-input"))
+            remoteInput = argv[++i];
+        else if (!strcmp(argv[i], "--output"))
+            output = argv[++i];
+        else
+            usage();
+    }
+    
+    if (count == 0 || repeat <= 0)
+        usage();
+    
+    // the recorded streams before the output, so a bad one leaves no half written results
+    if (padInput) {
+        recordedPads = (XBPadReport *)readReports(padInput, sizeof(XBPadReport), &numRecordedPads);
+        if (!recordedPads)
+            return 1;
+    }
+    if (remoteInput) {
+        recordedRemotes = (XBActualRemoteReport *)readReports(remoteInput, sizeof(XBActualRemoteReport),
+                                                              &numRecordedRemotes);
+        if (!recordedRemotes) {
+            free(recordedPads);
+            return 1;
+        }
+    }
+    
+    gOutput = output ? fopen(output, "w") : stdout;
+    if (!gOutput) {
+        perror(output);
+        return 1;
+    }
+    
+    openInstructionCounter();
+    
+    fprintf(gOutput, "{\n  \"benchmark\": \"XBPipelineBench\",\n  \"reports\": %u,\n  \"repeat\": %d,\n"
+            "  \"instructionCounter\": %s,\n  \"results\": [",
+            count, repeat, gInstructionCounter >= 0 ? "true" : "false");
+    
+    XBPadReport *pads = (XBPadReport *)malloc(count * sizeof(XBPadReport));
+    XBActualRemoteReport *remotes = (XBActualRemoteReport *)malloc(count * sizeof(XBActualRemoteReport));
+    
+    randomFill(pads, count * sizeof(XBPadReport));
+    
+    // a held remote button repeats its scancode, so runs of the same one
+    for (UInt32 i = 0; i < count; i++) {
+        randomFill(&remotes[i], sizeof(XBActualRemoteReport));
+        if (i > 0 && randomByte() % 4)
+            remotes[i].scancode = remotes[i - 1].scancode;
+    }
+    
+    benchPad("synthetic", pads, count, repeat);
+    benchPadBatches("synthetic", pads, count, repeat);
+    benchRemote("synthetic", remotes, count, repeat);
+    
+    free(pads);
+    free(remotes);
+    
+    // recorded streams
+    if (recordedPads) {
+        benchPad("recorded", recordedPads, numRecordedPads, repeat);
+        benchPadBatches("recorded", recordedPads, numRecordedPads, repeat);
+        free(recordedPads);
+    }
+    
+    if (recordedRemotes) {
+        benchRemote("recorded", recordedRemotes, numRecordedRemotes, repeat);
+        free(recordedRemotes);
+    }
+    
+    fprintf(gOutput, "\n  ]\n}\n");
+    
+    if (output)
+        fclose(gOutput);
+    
+    return 0;
+}
@@ -0,0 +1,126 @@
+//
+//  XBReference.h
+//  XboxControllerHIDTests
+//
+//  The report transforms as the driver did them before XboxControllerHIDCore,
+//  testing every option per report. The tests check the core against these,
+//  and XBPipelineBench measures both.
+//
+
+#ifndef XboxControllerHIDTests_XBReference_h
+#define XboxControllerHIDTests_XBReference_h
+
+#include "XboxControllerHIDCore.h"
+
+// -- reference implementations -----------------------------
+// ----------------------------------------------------------
+
+typedef struct {
+    
+    bool invertY, invertX, invertRy, invertRx;
+    bool clampButtons;
+    bool clampLeft, clampRight;
+    UInt8 leftThreshold, rightThreshold;
+    
+} PadOptions;
+
+static inline UInt8
+referenceTrigger(UInt8 value, bool clamp, UInt8 threshold)
+{
+    if (clamp)
+        return value < threshold ? 0 : 1;
+    
+    if (threshold <= 1)
+        return value;
+    
+    if (value < threshold)
+        return 0;
+    
+    if (threshold < 255)
+        return (254*value + 255*(1 - threshold)) / (255 - threshold);
+    
+    return 255;
+}
+
+// manipulateReport() as it was before the transforms were specialized
+static inline void
+referencePadTransform(XBPadReport *raw, const PadOptions *options)
+{
+#define INVERT_AXIS(name) \
+SInt16 name = (raw->name ## hi << 8) | raw->name ## lo; \
+name = -(name + 1); \
+raw->name ## hi = name >> 8; \
+raw->name ## lo = name & 0xFF;
+    
+    if (options->invertY) {
+        INVERT_AXIS(ly)
+    }
+    if (options->invertRy) {
+        INVERT_AXIS(ry)
+    }
+    if (options->invertX) {
+        INVERT_AXIS(lx)
+    }
+    if (options->invertRx) {
+        INVERT_AXIS(rx)
+    }
+    
+#undef INVERT_AXIS
+    
+    if (options->clampButtons) {
+        
+        if (raw->a != 0) raw->a = 1;
+        if (raw->b != 0) raw->b = 1;
+        if (raw->x != 0) raw->x = 1;
+        if (raw->y != 0) raw->y = 1;
+        if (raw->black != 0) raw->black = 1;
+        if (raw->white != 0) raw->white = 1;
+    }
+    
+    raw->lt = referenceTrigger(raw->lt, options->clampLeft, options->leftThreshold);
+    raw->rt = referenceTrigger(raw->rt, options->clampRight, options->rightThreshold);
+}
+
+// the per-button decode manipulateReport() did with the ButtonMap array
+static inline void
+referenceRemoteConvert(XBActualRemoteReport *raw, const int scancodes[kNumRemoteButtons])
+{
+    UInt8 scancode = raw->scancode;
+    XBRemoteReport *converted = (XBRemoteReport *)raw;
+    
+#define SET_REPORT_FIELD(field, index) \
+if (scancodes[index] >= 0) \
+converted->field = (scancode == (UInt8)scancodes[index]);
+    
+    SET_REPORT_FIELD(select, kRemoteSelect)
+    SET_REPORT_FIELD(up, kRemoteUp)
+    SET_REPORT_FIELD(down, kRemoteDown)
+    SET_REPORT_FIELD(left, kRemoteLeft)
+    SET_REPORT_FIELD(right, kRemoteRight)
+    SET_REPORT_FIELD(title, kRemoteTitle)
+    SET_REPORT_FIELD(info, kRemoteInfo)
+    SET_REPORT_FIELD(menu, kRemoteMenu)
+    SET_REPORT_FIELD(back, kRemoteBack)
+    SET_REPORT_FIELD(display, kRemoteDisplay)
+    SET_REPORT_FIELD(play, kRemotePlay)
+    SET_REPORT_FIELD(stop, kRemoteStop)
+    SET_REPORT_FIELD(pause, kRemotePause)
+    SET_REPORT_FIELD(reverse, kRemoteReverse)
+    SET_REPORT_FIELD(forward, kRemoteForward)
+    SET_REPORT_FIELD(skipBackward, kRemoteSkipBackward)
+    SET_REPORT_FIELD(skipForward, kRemoteSkipForward)
+    SET_REPORT_FIELD(kp0, kRemoteKP0)
+    SET_REPORT_FIELD(kp1, kRemoteKP1)
+    SET_REPORT_FIELD(kp2, kRemoteKP2)
+    SET_REPORT_FIELD(kp3, kRemoteKP3)
+    SET_REPORT_FIELD(kp4, kRemoteKP4)
+    SET_REPORT_FIELD(kp5, kRemoteKP5)
+    SET_REPORT_FIELD(kp6, kRemoteKP6)
+    SET_REPORT_FIELD(kp7, kRemoteKP7)
+    SET_REPORT_FIELD(kp8, kRemoteKP8)
+    SET_REPORT_FIELD(kp9, kRemoteKP9)
+    
+#undef SET_REPORT_FIELD
+}
+
+#endif
@@ -0,0 +1,233 @@
+//
+//  XBReplayTests.cpp
+//  XboxControllerHIDTests
+//
+//  The replay pipeline: pad reports transformed as the reference transforms
+//  would for the options, duplicates suppressed until the keepalive passes,
+//  remote repeats filtered until the release timer would have fired, failed
+//  reads and output reports passed on, and differences from the recording
+//  found.
+//
+
+#include <string.h>
+
+#include "XBReference.h"
+#include "XBReplay.h"
+#include "XBTest.h"
+
+#define kPad        0x14100000
+#define kRemote     0x14200000
+#define kMs         1000000ULL
+
+static void
+makeRecord(XBTraceRecord *record, UInt32 locationID, UInt64 timeStamp, const void *report, UInt8 length)
+{
+    memset(record, 0, sizeof(XBTraceRecord));
+    record->timeStamp = timeStamp;
+    record->locationID = locationID;
+    record->length = length;
+    record->version = kTraceFormatVersion;
+    memcpy(record->raw, report, length);
+    memcpy(record->transformed, report, length);
+}
+
+static void
+testPadTransform()
+{
+    XBTestRandom random = { 0x5EED5EED5EED5EEDULL };
+    XBReplayOptions options;
+    XBReplayer *replayer = new XBReplayer;
+    PadOptions reference = { false, true, true, false, false, true, false, 100, 200 };
+    
+    XBDefaultReplayOptions(&options);
+    options.padOptions.InvertYAxis = false;
+    options.padOptions.InvertXAxis = true;
+    options.padOptions.ClampButtons = false;
+    options.padOptions.ClampLeftTrigger = true;
+    options.padOptions.LeftTriggerThreshold = 100;
+    options.padOptions.RightTriggerThreshold = 200;
+    XBInitReplayer(replayer, &options);
+    
+    for (int i = 0; i < 10000; i++) {
+        
+        XBPadReport report, expected;
+        XBTraceRecord in, out;
+        
+        XBTestFill(&random, &report, sizeof(report));
+        makeRecord(&in, kPad, 1000 + i * kMs, &report, sizeof(report));
+        expected = report;
+        referencePadTransform(&expected, &reference);
+        
+        XBReplayRecord(replayer, &in, &out);
+        XB_CHECK(!memcmp(out.raw, &report, sizeof(report)));
+        XB_CHECK(!memcmp(out.transformed, &expected, sizeof(expected)));
+        XB_CHECK_EQUAL(out.flags, kTraceRecordDelivered);
+    }
+    
+    XB_CHECK_EQUAL(replayer->stats.records, 10000);
+    XB_CHECK_EQUAL(replayer->stats.delivered, 10000);
+    delete replayer;
+}
+
+static void
+testDuplicates()
+{
+    XBReplayOptions options;
+    XBReplayer *replayer = new XBReplayer;
+    XBPadReport report, other;
+    XBTraceRecord in, out;
+    
+    XBDefaultReplayOptions(&options);
+    options.padOptions.SuppressDuplicateReports = true;
+    options.padOptions.KeepaliveInterval = 100;
+    XBInitReplayer(replayer, &options);
+    
+    memset(&report, 0, sizeof(report));
+    report.r2 = sizeof(report);
+    other = report;
+    other.a = 255;
+    
+    // first one goes out, the same one until the keepalive doesn't
+    makeRecord(&in, kPad, 0, &report, sizeof(report));
+    XBReplayRecord(replayer, &in, &out);
+    XB_CHECK_EQUAL(out.flags, kTraceRecordDelivered);
+    
+    for (UInt64 t = 8; t < 100; t += 8) {
+        makeRecord(&in, kPad, t * kMs, &report, sizeof(report));
+        XBReplayRecord(replayer, &in, &out);
+        XB_CHECK_EQUAL(out.flags, kTraceRecordSuppressed);
+    }
+    
+    makeRecord(&in, kPad, 100 * kMs, &report, sizeof(report));
+    XBReplayRecord(replayer, &in, &out);
+    XB_CHECK_EQUAL(out.flags, kTraceRecordDelivered);
+    
+    // a change always goes out, and other pads keep their own last report
+    makeRecord(&in, kPad, 101 * kMs, &other, sizeof(other));
+    XBReplayRecord(replayer, &in, &out);
+    XB_CHECK_EQUAL(out.flags, kTraceRecordDelivered);
+    
+    makeRecord(&in, kPad + 0x100, 102 * kMs, &other, sizeof(other));
+    XBReplayRecord(replayer, &in, &out);
+    XB_CHECK_EQUAL(out.flags, kTraceRecordDelivered);
+    
+    XB_CHECK_EQUAL(replayer->stats.suppressed, 12);
+    XB_CHECK_EQUAL(replayer->stats.delivered, 4);
+    delete replayer;
+}
+
+static void
+testRemote()
+{
+    XBReplayOptions options;
+    XBReplayer *replayer = new XBReplayer;
+    XBActualRemoteReport report, expected;
+    XBTraceRecord in, out;
+    
+    XBDefaultReplayOptions(&options);
+    XBInitReplayer(replayer, &options);
+    
+    memset(&report, 0, sizeof(report));
+    report.scancode = options.buttonMap[kRemotePlay];
+    expected = report;
+    referenceRemoteConvert(&expected, options.buttonMap);
+    
+    // a held button repeats every 64 ms or so
+    for (int i = 0; i < 5; i++) {
+        makeRecord(&in, kRemote, i * 64 * kMs, &report, sizeof(report));
+        XBReplayRecord(replayer, &in, &out);
+        if (i == 0) {
+            XB_CHECK_EQUAL(out.flags, kTraceRecordDelivered);
+            XB_CHECK(!memcmp(out.transformed, &expected, sizeof(expected)));
+        } else
+            XB_CHECK_EQUAL(out.flags, 0);
+    }
+    
+    // let go long enough for the release timer, then press it again
+    makeRecord(&in, kRemote, (4 * 64 + 80) * kMs, &report, sizeof(report));
+    XBReplayRecord(replayer, &in, &out);
+    XB_CHECK_EQUAL(out.flags, kTraceRecordDelivered);
+    
+    XB_CHECK_EQUAL(replayer->stats.repeats, 4);
+    XB_CHECK_EQUAL(replayer->stats.releases, 1);
+    delete replayer;
+}
+
+static void
+testPassed()
+{
+    XBReplayOptions options;
+    XBReplayer *replayer = new XBReplayer;
+    XBPadReport report;
+    XBTraceRecord in, out;
+    
+    XBDefaultReplayOptions(&options);
+    XBInitReplayer(replayer, &options);
+    memset(&report, 0x80, sizeof(report));
+    
+    // a failed read
+    makeRecord(&in, kPad, 0, &report, 0);
+    in.status = (SInt32)0xE000404F;     // kIOUSBPipeStalled
+    XBReplayRecord(replayer, &in, &out);
+    XB_CHECK(!memcmp(&in, &out, sizeof(in)));
+    
+    // an output report
+    makeRecord(&in, kPad, 1, &report, 6);
+    in.flags = kTraceRecordOutput | kTraceRecordDelivered;
+    XBReplayRecord(replayer, &in, &out);
+    XB_CHECK(!memcmp(&in, &out, sizeof(in)));
+    XB_CHECK(!XBReplayDiffers(&in, &out));
+    
+    XB_CHECK_EQUAL(replayer->stats.passed, 2);
+    XB_CHECK_EQUAL(replayer->stats.delivered, 0);
+    delete replayer;
+}
+
+static void
+testDiffers()
+{
+    XBReplayOptions options;
+    XBReplayer *replayer = new XBReplayer;
+    XBPadReport report;
+    XBTraceRecord recorded, out;
+    
+    XBDefaultReplayOptions(&options);
+    XBInitReplayer(replayer, &options);
+    memset(&report, 0, sizeof(report));
+    report.lxlo = 0x12;
+    report.lylo = 0x34;
+    
+    // recorded with the defaults: replays the same
+    makeRecord(&recorded, kPad, 0, &report, sizeof(report));
+    XBReplayRecord(replayer, &recorded, &out);
+    recorded = out;
+    XBReplayRecord(replayer, &recorded, &out);
+    XB_CHECK(!XBReplayDiffers(&recorded, &out));
+    
+    // with the Y axis no longer inverted it doesn't
+    options.padOptions.InvertYAxis = false;
+    XBInitReplayer(replayer, &options);
+    XBReplayRecord(replayer, &recorded, &out);
+    XB_CHECK(XBReplayDiffers(&recorded, &out));
+    
+    // nor when it was suppressed when recorded
+    XBInitReplayer(replayer, &options);
+    XBReplayRecord(replayer, &recorded, &out);
+    recorded = out;
+    recorded.flags = kTraceRecordSuppressed;
+    XB_CHECK(XBReplayDiffers(&recorded, &out));
+    
+    delete replayer;
+}
+
+int
+main()
+{
+    testPadTransform();
+    testDuplicates();
+    testRemote();
+    testPassed();
+    testDiffers();
+    
+    return XB_TEST_RESULT();
+}
@@ -0,0 +1,476 @@
+//
+//  XBSimulatorTests.cpp
+//  XboxControllerHIDTests
+//
+//  The simulated devices and pipe: scripted reports at every polling interval
+//  down to 1 ms, the same completions for the same device, remote repeats,
+//  and each injected fault recovered the way the driver recovers it, with a
+//  small read ring standing in for the driver's. Ends with 32 pads run side
+//  by side.
+//
+
+#include <string.h>
+
+#include "XBSimulator.h"
+#include "XBTest.h"
+
+#define kMs         1000000ULL
+#define kStart      5000000000ULL
+#define kNumReads   4
+
+// A ring of reads following the driver's rules: requeue after a report,
+// leave halting errors to a recovery that clears both sides and queues
+// every read again, and reset the device after 3 checks that find it
+// still connected but not responding
+typedef struct Client Client;
+
+typedef struct {
+    
+    Client *    client;
+    UInt8       buffer[32];
+    bool        queued;
+    
+} ClientRead;
+
+struct Client {
+    
+    XBSimPipe * pipe;
+    ClientRead  reads[kNumReads];
+    UInt64      reports;
+    UInt64      hash;
+    UInt64      lastTime;
+    UInt64      statuses[8];    // success, overrun, stalled, CRC, returned, not responding, aborted, other
+    bool        recoverPending;
+    bool        checkPending;
+    int         retries;
+    UInt64      haltTime;       // first error of a halt, 0 if none
+    UInt64      recoveryTotal;
+    UInt64      recoveries;
+    bool        reset;
+    bool        outOfOrder;
+};
+
+static int
+statusIndex(SInt32 status)
+{
+    switch (status) {
+        case kSimStatusSuccess:             return 0;
+        case kSimStatusOverrun:             return 1;
+        case kSimStatusPipeStalled:         return 2;
+        case kSimStatusCRCErr:              return 3;
+        case kSimStatusTransactionReturned: return 4;
+        case kSimStatusNotResponding:       return 5;
+        case kSimStatusAborted:             return 6;
+        default:                            return 7;
+    }
+}
+
+static void completeRead(void *target, void *parameter, SInt32 status, UInt32 remaining, UInt64 timeStamp);
+
+static void
+queueRead(ClientRead *read)
+{
+    XBSimCompletion completion = { read->client, completeRead, read };
+    
+    if (read->queued)
+        return;
+    if (XBSimRead(read->client->pipe, read->buffer, sizeof(read->buffer), &completion) == kSimStatusSuccess)
+        read->queued = true;
+}
+
+static void
+queueReads(Client *client)
+{
+    for (int i = 0; i < kNumReads; i++)
+        queueRead(&client->reads[i]);
+}
+
+static void
+completeRead(void *target, void *parameter, SInt32 status, UInt32 remaining, UInt64 timeStamp)
+{
+    Client *client = (Client *)target;
+    ClientRead *read = (ClientRead *)parameter;
+    bool requeue = true;
+    
+    read->queued = false;
+    client->statuses[statusIndex(status)]++;
+    
+    switch (status) {
+        
+        case kSimStatusOverrun:
+            client->recoverPending = true;
+            XBSimClearStall(client->pipe);
+            requeue = false;
+            // the report is there
+            // fall through
+        
+        case kSimStatusSuccess:
+            client->retries = 3;
+            if (timeStamp < client->lastTime)
+                client->outOfOrder = true;
+            client->lastTime = timeStamp;
+            client->reports++;
+            for (UInt32 i = 0; i < sizeof(read->buffer) - remaining; i++)
+                client->hash = (client->hash ^ read->buffer[i]) * 0x100000001B3ULL;
+            client->hash ^= timeStamp;
+            if (client->haltTime && !client->recoverPending) {
+                client->recoveryTotal += timeStamp - client->haltTime;
+                client->recoveries++;
+                client->haltTime = 0;
+            }
+            break;
+        
+        case kSimStatusPipeStalled:
+        case kSimStatusCRCErr:
+            if (!client->haltTime)
+                client->haltTime = timeStamp;
+            client->recoverPending = true;
+            XBSimClearStall(client->pipe);
+            requeue = false;
+            break;
+        
+        case kSimStatusTransactionReturned:
+            requeue = !client->recoverPending;
+            break;
+        
+        case kSimStatusNotResponding:
+            if (!client->haltTime)
+                client->haltTime = timeStamp;
+            client->checkPending = true;
+            XBSimClearStall(client->pipe);
+            break;
+        
+        case kSimStatusAborted:
+            requeue = false;
+            break;
+    }
+    
+    if (requeue)
+        queueRead(read);
+}
+
+static void
+resetDone(void *target)
+{
+    Client *client = (Client *)target;
+    
+    client->reset = true;
+    client->retries = 3;
+    queueReads(client);
+}
+
+static void
+initClient(Client *client, XBSimPipe *pipe)
+{
+    memset(client, 0, sizeof(Client));
+    client->pipe = pipe;
+    client->retries = 3;
+    client->hash = 0xCBF29CE484222325ULL;
+    for (int i = 0; i < kNumReads; i++)
+        client->reads[i].client = client;
+    XBSimSetResetHandler(pipe, resetDone, client);
+    queueReads(client);
+}
+
+// the driver's thread calls, made between the completions
+static void
+runClient(Client *client, UInt64 until)
+{
+    while (XBSimNextEvent(client->pipe) <= until) {
+        
+        XBSimRun(client->pipe, XBSimNextEvent(client->pipe));
+        
+        if (client->recoverPending) {
+            XBSimClearEndpointHalt(client->pipe);
+            client->recoverPending = false;
+            queueReads(client);
+        }
+        
+        if (client->checkPending) {
+            client->checkPending = false;
+            if (XBSimDeviceConnected(client->pipe) && --client->retries == 0)
+                XBSimResetDevice(client->pipe);
+        }
+    }
+    XBSimRun(client->pipe, until);
+}
+
+static void
+runDevice(const XBSimDevice *device, UInt64 duration, Client *client, XBSimPipe *pipe)
+{
+    XBInitSimPipe(pipe, device, kStart);
+    initClient(client, pipe);
+    runClient(client, kStart + duration);
+}
+
+static void
+testPadIntervals()
+{
+    UInt64 intervals[] = { 1 * kMs, 4 * kMs, 8 * kMs };
+    
+    for (int i = 0; i < 3; i++) {
+        
+        XBSimDevice device;
+        XBSimStep sweep = { 500 * kMs, kSimPatternSweep, 0, 0, 0, 200 * kMs };
+        XBSimStep random = { 500 * kMs, kSimPatternRandom, 0, 0, 0, 0 };
+        XBSimPipe *pipe = new XBSimPipe, *again = new XBSimPipe;
+        Client *client = new Client, *clientAgain = new Client;
+        
+        XBInitSimDevice(&device, kSimDevicePad, intervals[i], 42);
+        XB_CHECK(XBAddSimStep(&device, &sweep));
+        XB_CHECK(XBAddSimStep(&device, &random));
+        
+        // a report at every poll, one interval apart, and the same ones every run
+        runDevice(&device, 1000 * kMs, client, pipe);
+        XB_CHECK_EQUAL(client->reports, 1000 * kMs / intervals[i]);
+        XB_CHECK_EQUAL(client->lastTime, kStart + 1000 * kMs);
+        XB_CHECK_EQUAL(pipe->stats.missed, 0);
+        XB_CHECK(!client->outOfOrder);
+        
+        runDevice(&device, 1000 * kMs, clientAgain, again);
+        XB_CHECK_EQUAL(client->hash, clientAgain->hash);
+        
+        XBFreeSimPipe(pipe);
+        XBFreeSimPipe(again);
+        delete pipe;
+        delete again;
+        delete client;
+        delete clientAgain;
+    }
+}
+
+static void
+testPadPatterns()
+{
+    XBSimDevice device;
+    XBPadReport report;
+    UInt32 length;
+    XBSimStep hold = { 100 * kMs, kSimPatternHold, 0x11, 200, 0, 0 };
+    XBSimStep sweep = { 1000 * kMs, kSimPatternSweep, 0, 0, 0, 1000 * kMs };
+    SInt16 lx, minLx = 0, maxLx = 0;
+    
+    XBInitSimDevice(&device, kSimDevicePad, kMs, 7);
+    XBAddSimStep(&device, &hold);
+    XBAddSimStep(&device, &sweep);
+    
+    XB_CHECK(XBSimReport(&device, 0, 50 * kMs, &report, &length));
+    XB_CHECK_EQUAL(length, sizeof(XBPadReport));
+    XB_CHECK_EQUAL(report.r2, sizeof(XBPadReport));
+    XB_CHECK_EQUAL(report.buttons, 0x11);
+    XB_CHECK_EQUAL(report.a, 200);
+    XB_CHECK_EQUAL(report.rt, 200);
+    XB_CHECK_EQUAL(report.lxlo | report.lxhi, 0);
+    
+    // the sweep covers the whole range of the axis
+    for (UInt64 t = 100; t < 1100; t++) {
+        XBSimReport(&device, t, t * kMs, &report, &length);
+        lx = (SInt16)(report.lxhi << 8 | report.lxlo);
+        minLx = lx < minLx ? lx : minLx;
+        maxLx = lx > maxLx ? lx : maxLx;
+    }
+    XB_CHECK(minLx < -32000);
+    XB_CHECK(maxLx > 32000);
+    
+    // past the end of the script it is idle, unless it loops
+    XBSimReport(&device, 0, 1200 * kMs, &report, &length);
+    XB_CHECK_EQUAL(report.buttons, 0);
+    device.loop = true;
+    XBSimReport(&device, 0, 1150 * kMs, &report, &length);
+    XB_CHECK_EQUAL(report.buttons, 0x11);
+}
+
+static void
+testRemote()
+{
+    XBSimDevice device;
+    XBSimStep press = { 300 * kMs, kSimPatternRemoteButton, 0, 0, 213, 0 };
+    XBSimStep idle = { 700 * kMs, kSimPatternIdle, 0, 0, 0, 0 };
+    XBSimPipe *pipe = new XBSimPipe;
+    Client *client = new Client;
+    
+    XBInitSimDevice(&device, kSimDeviceRemote, 8 * kMs, 1);
+    XBAddSimStep(&device, &idle);
+    XBAddSimStep(&device, &press);
+    XBAddSimStep(&device, &idle);
+    
+    // reports only while the button is held: at 700 ms, then every 64 ms
+    runDevice(&device, 2000 * kMs, client, pipe);
+    XB_CHECK_EQUAL(client->reports, 5);
+    XB_CHECK_EQUAL(client->reads[0].buffer[2] | client->reads[1].buffer[2], 213);
+    XB_CHECK_EQUAL(pipe->stats.naks, pipe->stats.polls - 5);
+    
+    XBFreeSimPipe(pipe);
+    delete pipe;
+    delete client;
+}
+
+static void
+testStall()
+{
+    XBSimDevice device;
+    XBSimFault stall = { 100 * kMs, kSimStatusPipeStalled, 0, false };
+    XBSimFault crc = { 200 * kMs, kSimStatusCRCErr, 0, false };
+    XBSimFault overrun = { 300 * kMs, kSimStatusOverrun, 0, false };
+    XBSimPipe *pipe = new XBSimPipe;
+    Client *client = new Client;
+    
+    XBInitSimDevice(&device, kSimDevicePad, kMs, 3);
+    XBAddSimFault(&device, &stall);
+    XBAddSimFault(&device, &crc);
+    XBAddSimFault(&device, &overrun);
+    
+    runDevice(&device, 1000 * kMs, client, pipe);
+    
+    // each halt costs its poll and hands back the other reads, the overrun keeps its report
+    XB_CHECK_EQUAL(client->statuses[statusIndex(kSimStatusPipeStalled)], 1);
+    XB_CHECK_EQUAL(client->statuses[statusIndex(kSimStatusCRCErr)], 1);
+    XB_CHECK_EQUAL(client->statuses[statusIndex(kSimStatusOverrun)], 1);
+    XB_CHECK_EQUAL(client->statuses[statusIndex(kSimStatusTransactionReturned)], 3 * (kNumReads - 1));
+    XB_CHECK_EQUAL(client->reports, 1000 - 2);
+    XB_CHECK_EQUAL(client->recoveries, 2);
+    XB_CHECK_EQUAL(client->recoveryTotal, 2 * kMs);
+    XB_CHECK(!client->outOfOrder);
+    
+    XBFreeSimPipe(pipe);
+    delete pipe;
+    delete client;
+}
+
+static void
+testHaltUntilCleared()
+{
+    XBSimDevice device;
+    XBSimFault stall = { 10 * kMs, kSimStatusPipeStalled, 0, false };
+    XBSimPipe *pipe = new XBSimPipe;
+    Client *client = new Client;
+    ClientRead *read;
+    
+    XBInitSimDevice(&device, kSimDevicePad, kMs, 3);
+    XBAddSimFault(&device, &stall);
+    XBInitSimPipe(pipe, &device, kStart);
+    initClient(client, pipe);
+    
+    // a read queued again after ClearStall() but before the endpoint is cleared stalls again
+    XBSimRun(pipe, kStart + 10 * kMs);
+    XB_CHECK_EQUAL(client->statuses[statusIndex(kSimStatusPipeStalled)], 1);
+    XBSimRun(pipe, kStart + 10 * kMs);
+    client->recoverPending = false;
+    read = &client->reads[0];
+    read->queued = false;
+    queueRead(read);
+    XBSimRun(pipe, kStart + 11 * kMs);
+    XB_CHECK_EQUAL(client->statuses[statusIndex(kSimStatusPipeStalled)], 2);
+    
+    // and with the recovery left undone, nothing arrives anymore
+    XBSimRun(pipe, kStart + 50 * kMs);
+    XB_CHECK_EQUAL(client->statuses[statusIndex(kSimStatusPipeStalled)], 2);
+    XB_CHECK_EQUAL(client->reports, 9);
+    
+    XBFreeSimPipe(pipe);
+    delete pipe;
+    delete client;
+}
+
+static void
+testNotResponding()
+{
+    XBSimDevice device;
+    XBSimFault brief = { 100 * kMs, kSimStatusNotResponding, 2, false };
+    XBSimFault hung = { 500 * kMs, kSimStatusNotResponding, 0, false };
+    XBSimPipe *pipe = new XBSimPipe;
+    Client *client = new Client;
+    
+    XBInitSimDevice(&device, kSimDevicePad, kMs, 3);
+    XBAddSimFault(&device, &brief);
+    XBAddSimFault(&device, &hung);
+    
+    runDevice(&device, 1000 * kMs, client, pipe);
+    
+    // two failed polls, then a hang the third check resets, and the device is back after the reset
+    XB_CHECK(client->reset);
+    XB_CHECK_EQUAL(pipe->stats.resets, 1);
+    XB_CHECK_EQUAL(client->statuses[statusIndex(kSimStatusAborted)], kNumReads);
+    XB_CHECK_EQUAL(client->recoveries, 2);
+    XB_CHECK_EQUAL(client->lastTime, kStart + 1000 * kMs);
+    XB_CHECK(client->recoveryTotal > kSimResetTime);
+    
+    XBFreeSimPipe(pipe);
+    delete pipe;
+    delete client;
+}
+
+static void
+testUnplug()
+{
+    XBSimDevice device;
+    XBSimFault unplug = { 100 * kMs, kSimStatusNotResponding, 0, true };
+    XBSimPipe *pipe = new XBSimPipe;
+    Client *client = new Client;
+    
+    XBInitSimDevice(&device, kSimDevicePad, kMs, 3);
+    XBAddSimFault(&device, &unplug);
+    
+    runDevice(&device, 200 * kMs, client, pipe);
+    
+    // the hub doesn't see it anymore, so it is never reset
+    XB_CHECK(!XBSimDeviceConnected(pipe));
+    XB_CHECK(!client->reset);
+    XB_CHECK_EQUAL(client->reports, 99);
+    XB_CHECK_EQUAL(XBSimClearEndpointHalt(pipe), kSimStatusNotResponding);
+    
+    XBFreeSimPipe(pipe);
+    delete pipe;
+    delete client;
+}
+
+static void
+testManyPads()
+{
+    const int numPads = 32;
+    XBSimPipe *pipes = new XBSimPipe[numPads];
+    Client *clients = new Client[numPads];
+    UInt64 reports = 0;
+    
+    for (int i = 0; i < numPads; i++) {
+        
+        XBSimDevice device;
+        XBSimStep random = { 1000 * kMs, kSimPatternRandom, 0, 0, 0, 0 };
+        XBSimFault stall = { (UInt64)(i + 1) * 20 * kMs, kSimStatusPipeStalled, 0, false };
+        
+        XBInitSimDevice(&device, kSimDevicePad, kMs, i);
+        XBAddSimStep(&device, &random);
+        XBAddSimFault(&device, &stall);
+        XBInitSimPipe(&pipes[i], &device, kStart);
+        initClient(&clients[i], &pipes[i]);
+    }
+    
+    // one thread, advancing them all a millisecond at a time
+    for (UInt64 t = kStart + kMs; t <= kStart + 1000 * kMs; t += kMs)
+        for (int i = 0; i < numPads; i++)
+            runClient(&clients[i], t);
+    
+    for (int i = 0; i < numPads; i++) {
+        reports += clients[i].reports;
+        XB_CHECK_EQUAL(clients[i].recoveries, 1);
+        XBFreeSimPipe(&pipes[i]);
+    }
+    XB_CHECK_EQUAL(reports, numPads * (1000 - 1));
+    
+    delete[] pipes;
+    delete[] clients;
+}
+
+int
+main()
+{
+    testPadIntervals();
+    testPadPatterns();
+    testRemote();
+    testStall();
+    testHaltUntilCleared();
+    testNotResponding();
+    testUnplug();
+    testManyPads();
+    
+    return XB_TEST_RESULT();
+}
@@ -0,0 +1,65 @@
+//
+//  XBTest.h
+//  XboxControllerHIDTests
+//
+//  Minimal checks for the host tests: every failed check is printed and
+//  counted, and the test exits with XB_TEST_RESULT() at the end of main().
+//
+
+#ifndef XboxControllerHIDTests_XBTest_h
+#define XboxControllerHIDTests_XBTest_h
+
+#include <stdio.h>
+#include <stdint.h>
+
+static int gTestFailures = 0;
+
+#define XB_CHECK(cond) \
+do { \
+if (!(cond)) { \
+fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+gTestFailures++; \
+} \
+} while (0)
+
+#define XB_CHECK_EQUAL(a, b) \
+do { \
+long long _a = (long long)(a), _b = (long long)(b); \
+if (_a != _b) { \
+fprintf(stderr, "%s:%d: check failed: %s == %s (%lld != %lld)\n", __FILE__, __LINE__, #a, #b, _a, _b); \
+gTestFailures++; \
+} \
+} while (0)
+
+#define XB_TEST_RESULT() \
+(gTestFailures ? (fprintf(stderr, "%d check(s) failed\n", gTestFailures), 1) : 0)
+
+// deterministic xorshift generator, so failures reproduce
+typedef struct {
+    
+    uint64_t state;
+    
+} XBTestRandom;
+
+static inline uint64_t
+XBTestNext(XBTestRandom *random)
+{
+    uint64_t x = random->state;
+    
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    random->state = x;
+    return x;
+}
+
+static inline void
+XBTestFill(XBTestRandom *random, void *buffer, size_t length)
+{
+    uint8_t *bytes = (uint8_t *)buffer;
+    
+    for (size_t i = 0; i < length; i++)
+        bytes[i] = (uint8_t)(XBTestNext(random) >> 24);
+}
+
+#endif
@@ -0,0 +1,409 @@
+//
+//  XBTraceFileTests.cpp
+//  XboxControllerHIDTests
+//
+//  Trace capture files: a synthetic trace of pad, remote and output reports
+//  (with failed and truncated reads, and gaps longer than a block can span)
+//  written and read back record for record, seeks against the times the
+//  records were made with, and files that are damaged or were never closed.
+//
+//  usage: XBTraceFileTests [--records N]
+//
+//  The records are a function of their number, so a 100M record run needs no
+//  more memory than a short one (XB_LARGE_TESTS registers one).
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "XBTraceFile.h"
+#include "XBTest.h"
+
+#define kDefaultRecords     2000000ULL
+#define kSeeks              2000
+#define kStartTime          1000000000ULL
+#define kGapEvery           100000ULL       // records between gaps
+#define kGapTime            5000000000ULL   // longer than kTraceBlockSpan
+
+static char gPath[256];
+
+static UInt64
+mix(UInt64 x)
+{
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+// strictly increasing, with a long gap every kGapEvery records
+static UInt64
+recordTime(UInt64 i)
+{
+    return kStartTime + i * 1000 + (i / kGapEvery) * kGapTime + mix(i) % 1000;
+}
+
+static void
+makeRecord(UInt64 i, XBTraceRecord *record)
+{
+    UInt64 h = mix(i);
+    UInt32 length;
+    
+    memset(record, 0, sizeof(XBTraceRecord));
+    record->timeStamp = recordTime(i);
+    record->locationID = 0x14100000 | (UInt32)((h >> 20) % 4) << 8;
+    record->version = kTraceFormatVersion;
+    
+    switch ((h >> 10) % 16) {
+        case 11:
+        case 12: length = sizeof(XBActualRemoteReport); break;
+        case 13: length = 6; record->flags = kTraceRecordOutput; break;
+        case 14: length = 0; record->status = (SInt32)0xE00002D8; break;
+        case 15: length = kTraceReportBytes; record->flags = kTraceRecordTruncated; break;
+        default: length = sizeof(XBPadReport); break;
+    }
+    record->length = length;
+    
+    if (length && !(record->flags & kTraceRecordOutput))
+        record->flags |= (h >> 40) & 1 ? kTraceRecordSuppressed : kTraceRecordDelivered;
+    
+    for (UInt32 j = 0; j < length; j += 8) {
+        
+        UInt64 raw = mix(h + j), transformed = mix(~h + j);
+        UInt32 n = length - j < 8 ? length - j : 8;
+        
+        memcpy(record->raw + j, &raw, n);
+        if (!(record->flags & kTraceRecordOutput))
+            memcpy(record->transformed + j, &transformed, n);
+    }
+}
+
+static bool
+writeTrace(UInt64 first, UInt64 count)
+{
+    XBTraceWriter writer;
+    XBTraceRecord record;
+    bool written = true;
+    
+    if (!XBOpenTraceWriter(&writer, gPath))
+        return false;
+    
+    for (UInt64 i = first; i < first + count; i++) {
+        makeRecord(i, &record);
+        if (!XBTraceWrite(&writer, &record))
+            written = false;
+    }
+    
+    return XBCloseTraceWriter(&writer) && written;
+}
+
+// -- round trip and seeks ----------------------------------
+// ----------------------------------------------------------
+
+static void
+testRoundTrip(UInt64 count)
+{
+    XBTraceReader reader;
+    XBTraceCursor cursor;
+    XBTraceRecord record, expected;
+    XBTraceReadResult result;
+    UInt64 i = 0, mismatches = 0;
+    
+    XB_CHECK(writeTrace(0, count));
+    XB_CHECK(XBOpenTraceReader(&reader, gPath));
+    XB_CHECK(!reader.recovered);
+    XB_CHECK_EQUAL(reader.recordCount, count);
+    
+    XBTraceSeek(&cursor, &reader, 0);
+    while ((result = XBTraceNext(&cursor, &record)) == kTraceReadRecord) {
+        makeRecord(i++, &expected);
+        if (memcmp(&record, &expected, sizeof(XBTraceRecord)) != 0 && mismatches++ < 10)
+            fprintf(stderr, "record %llu differs\n", (unsigned long long)i - 1);
+    }
+    
+    XB_CHECK_EQUAL(result, kTraceReadEnd);
+    XB_CHECK_EQUAL(i, count);
+    XB_CHECK_EQUAL(mismatches, 0);
+    
+    // blocks are in time order and never span more than their offsets can hold
+    for (UInt64 block = 0; block < reader.blockCount; block++) {
+        
+        const XBTraceIndexEntry *entry = &reader.index[block];
+        
+        if (entry->lastTime - entry->firstTime > kTraceBlockSpan ||
+            (block && entry->firstTime < reader.index[block - 1].lastTime)) {
+            fprintf(stderr, "block %llu out of order\n", (unsigned long long)block);
+            gTestFailures++;
+            break;
+        }
+    }
+    
+    printf("round trip: %llu records in %llu blocks, %llu bytes\n", (unsigned long long)count,
+           (unsigned long long)reader.blockCount, (unsigned long long)reader.size);
+    XBCloseTraceReader(&reader);
+}
+
+// the first record at or after time
+static UInt64
+expectedSeek(UInt64 count, UInt64 time)
+{
+    UInt64 low = 0, high = count;
+    
+    while (low < high) {
+        
+        UInt64 middle = low + (high - low) / 2;
+        
+        if (recordTime(middle) < time)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    
+    return low;
+}
+
+static void
+testSeeks(UInt64 count)
+{
+    XBTestRandom random = { 0x7A3C91E25D04B68FULL };
+    UInt64 endTime = recordTime(count - 1) + 1;
+    XBTraceReader reader;
+    XBTraceCursor cursor;
+    XBTraceRecord record, expected;
+    
+    XB_CHECK(XBOpenTraceReader(&reader, gPath));
+    
+    for (int seek = 0; seek < kSeeks; seek++) {
+        
+        UInt64 time, i;
+        XBTraceReadResult result;
+        
+        // exact record times, times in between, and both ends
+        switch (seek % 4) {
+            case 0: time = recordTime(XBTestNext(&random) % count); break;
+            case 1: time = XBTestNext(&random) % (endTime + 1000); break;
+            case 2: time = seek & 4 ? 0 : endTime; break;
+            default: time = recordTime(XBTestNext(&random) % count) + 1; break;
+        }
+        
+        i = expectedSeek(count, time);
+        XBTraceSeek(&cursor, &reader, time);
+        result = XBTraceNext(&cursor, &record);
+        
+        if (i == count) {
+            XB_CHECK_EQUAL(result, kTraceReadEnd);
+            continue;
+        }
+        
+        makeRecord(i, &expected);
+        if (result != kTraceReadRecord || memcmp(&record, &expected, sizeof(XBTraceRecord)) != 0) {
+            fprintf(stderr, "seek to %llu: expected record %llu\n", (unsigned long long)time, (unsigned long long)i);
+            gTestFailures++;
+            break;
+        }
+    }
+    
+    XBCloseTraceReader(&reader);
+}
+
+// -- writer rules ------------------------------------------
+// ----------------------------------------------------------
+
+static void
+testOrder()
+{
+    XBTraceWriter writer;
+    XBTraceReader reader;
+    XBTraceCursor cursor;
+    XBTraceRecord record;
+    
+    XB_CHECK(XBOpenTraceWriter(&writer, gPath));
+    
+    makeRecord(10, &record);
+    XB_CHECK(XBTraceWrite(&writer, &record));
+    XB_CHECK(XBTraceWrite(&writer, &record));      // same time is fine
+    makeRecord(9, &record);
+    XB_CHECK(!XBTraceWrite(&writer, &record));     // earlier is not
+    makeRecord(11, &record);
+    XB_CHECK(XBTraceWrite(&writer, &record));
+    
+    XB_CHECK(XBCloseTraceWriter(&writer));
+    
+    XB_CHECK(XBOpenTraceReader(&reader, gPath));
+    XB_CHECK_EQUAL(reader.recordCount, 3);
+    XBTraceSeek(&cursor, &reader, recordTime(10) + 1);
+    XB_CHECK_EQUAL(XBTraceNext(&cursor, &record), kTraceReadRecord);
+    XB_CHECK_EQUAL(record.timeStamp, recordTime(11));
+    XBCloseTraceReader(&reader);
+    
+    // an empty trace is still a trace
+    XB_CHECK(XBOpenTraceWriter(&writer, gPath));
+    XB_CHECK(XBCloseTraceWriter(&writer));
+    XB_CHECK(XBOpenTraceReader(&reader, gPath));
+    XB_CHECK_EQUAL(reader.blockCount, 0);
+    XBTraceSeek(&cursor, &reader, 0);
+    XB_CHECK_EQUAL(XBTraceNext(&cursor, &record), kTraceReadEnd);
+    XBCloseTraceReader(&reader);
+}
+
+// -- damaged files -----------------------------------------
+// ----------------------------------------------------------
+
+static void
+flipByte(UInt64 offset)
+{
+    FILE *file = fopen(gPath, "r+b");
+    int byte;
+    
+    fseek(file, (long)offset, SEEK_SET);
+    byte = fgetc(file);
+    fseek(file, (long)offset, SEEK_SET);
+    fputc(byte ^ 0x40, file);
+    fclose(file);
+}
+
+static void
+testCorruptBlock()
+{
+    XBTraceReader reader;
+    XBTraceCursor cursor;
+    XBTraceRecord record, expected;
+    XBTraceReadResult result;
+    XBTraceIndexEntry damaged;
+    UInt64 firstDamaged = 0, i = 0, corrupt = 0, mismatches = 0;
+    
+    XB_CHECK(writeTrace(0, 20000));
+    XB_CHECK(XBOpenTraceReader(&reader, gPath));
+    XB_CHECK(reader.blockCount > 4);
+    damaged = reader.index[2];
+    for (int block = 0; block < 2; block++)
+        firstDamaged += reader.index[block].count;
+    XBCloseTraceReader(&reader);
+    
+    flipByte(damaged.offset + sizeof(XBTraceBlockHeader) + damaged.payloadSize / 2);
+    
+    // the damaged block is reported once and skipped, the rest reads as written
+    XB_CHECK(XBOpenTraceReader(&reader, gPath));
+    XBTraceSeek(&cursor, &reader, 0);
+    while ((result = XBTraceNext(&cursor, &record)) != kTraceReadEnd) {
+        
+        if (result == kTraceReadCorrupt) {
+            XB_CHECK_EQUAL(i, firstDamaged);
+            i += damaged.count;
+            corrupt++;
+            continue;
+        }
+        
+        makeRecord(i++, &expected);
+        if (memcmp(&record, &expected, sizeof(XBTraceRecord)) != 0)
+            mismatches++;
+    }
+    
+    XB_CHECK_EQUAL(corrupt, 1);
+    XB_CHECK_EQUAL(i, 20000);
+    XB_CHECK_EQUAL(mismatches, 0);
+    
+    // and so does a seek into it
+    XBTraceSeek(&cursor, &reader, damaged.firstTime);
+    XB_CHECK_EQUAL(XBTraceNext(&cursor, &record), kTraceReadCorrupt);
+    XB_CHECK_EQUAL(XBTraceNext(&cursor, &record), kTraceReadRecord);
+    makeRecord(firstDamaged + damaged.count, &expected);
+    XB_CHECK(memcmp(&record, &expected, sizeof(XBTraceRecord)) == 0);
+    XBCloseTraceReader(&reader);
+}
+
+static void
+testUnclosedFile()
+{
+    XBTraceReader reader;
+    XBTraceCursor cursor;
+    XBTraceRecord record, expected;
+    UInt64 complete = 0, i = 0, mismatches = 0;
+    UInt64 cut;
+    
+    XB_CHECK(writeTrace(0, 20000));
+    XB_CHECK(XBOpenTraceReader(&reader, gPath));
+    
+    // as if the writer died halfway through writing the last block
+    cut = reader.index[reader.blockCount - 1].offset + 100;
+    for (UInt64 block = 0; block + 1 < reader.blockCount; block++)
+        complete += reader.index[block].count;
+    XBCloseTraceReader(&reader);
+    
+    XB_CHECK(truncate(gPath, (off_t)cut) == 0);
+    
+    XB_CHECK(XBOpenTraceReader(&reader, gPath));
+    XB_CHECK(reader.recovered);
+    XB_CHECK_EQUAL(reader.recordCount, complete);
+    
+    XBTraceSeek(&cursor, &reader, 0);
+    while (XBTraceNext(&cursor, &record) == kTraceReadRecord) {
+        makeRecord(i++, &expected);
+        if (memcmp(&record, &expected, sizeof(XBTraceRecord)) != 0)
+            mismatches++;
+    }
+    
+    XB_CHECK_EQUAL(i, complete);
+    XB_CHECK_EQUAL(mismatches, 0);
+    XBCloseTraceReader(&reader);
+}
+
+// A trailer whose indexOffset wraps around to add up to the file size, with an
+// index as long as the file: the reader falls back to the blocks
+static void
+testWrappedIndexOffset()
+{
+    XBTraceReader reader;
+    XBTraceFileTrailer trailer;
+    FILE *file;
+    UInt64 records, size;
+    
+    XB_CHECK(writeTrace(0, 20000));
+    XB_CHECK(XBOpenTraceReader(&reader, gPath));
+    records = reader.recordCount;
+    XBCloseTraceReader(&reader);
+    
+    file = fopen(gPath, "ab");
+    fseek(file, 0, SEEK_END);
+    size = (UInt64)ftell(file);
+    for (; size % sizeof(XBTraceIndexEntry) != 0; size++)
+        fputc(0, file);
+    size += sizeof(trailer);
+    
+    memset(&trailer, 0, sizeof(trailer));
+    trailer.blockCount = size / sizeof(XBTraceIndexEntry);
+    trailer.indexOffset = size - sizeof(trailer) - trailer.blockCount * sizeof(XBTraceIndexEntry);
+    trailer.recordCount = records;
+    trailer.magic = kTraceIndexMagic;
+    fwrite(&trailer, sizeof(trailer), 1, file);
+    fclose(file);
+    
+    XB_CHECK(XBOpenTraceReader(&reader, gPath));
+    XB_CHECK(reader.recovered);
+    XB_CHECK_EQUAL(reader.recordCount, records);
+    XBCloseTraceReader(&reader);
+}
+
+int
+main(int argc, char **argv)
+{
+    UInt64 count = kDefaultRecords;
+    const char *directory = getenv("TMPDIR");
+    
+    for (int i = 1; i < argc; i++)
+        if (!strcmp(argv[i], "--records") && i + 1 < argc)
+            count = strtoull(argv[++i], NULL, 0);
+    
+    snprintf(gPath, sizeof(gPath), "%s/XBTraceFileTests.%d.trace", directory ? directory : "/tmp", (int)getpid());
+    
+    testRoundTrip(count);
+    testSeeks(count);
+    testOrder();
+    testCorruptBlock();
+    testUnclosedFile();
+    testWrappedIndexOffset();
+    
+    unlink(gPath);
+    return XB_TEST_RESULT();
+}
@@ -0,0 +1,164 @@
+//
+//  XBTraceRingTests.cpp
+//  XboxControllerHIDTests
+//
+//  The trace ring between the driver and its client. A producer thread plays
+//  the read completions and a consumer thread plays the client: every record
+//  has to arrive whole and in order, or be counted as dropped. A client that
+//  scribbles over the shared header must not make the producer write outside
+//  the ring.
+//
+
+#include <string.h>
+
+#include <thread>
+#include <vector>
+
+#include "XboxControllerHIDCore.h"
+#include "XBTest.h"
+
+#define kCapacity       64
+#define kRecords        200000
+#define kPopBatch       16
+#define kGuardBytes     256
+#define kCorruptRounds  100000
+
+static void
+fillRecord(XBTraceRecord *record, UInt64 sequence)
+{
+    memset(record, (UInt8)sequence, sizeof(XBTraceRecord));
+    record->timeStamp = sequence;
+}
+
+static bool
+checkRecord(const XBTraceRecord *record, UInt64 sequence)
+{
+    XBTraceRecord expected;
+    
+    fillRecord(&expected, sequence);
+    return memcmp(record, &expected, sizeof(XBTraceRecord)) == 0;
+}
+
+static void
+producer(XBTraceProducer *producer, volatile UInt32 *pushed, volatile int *done, UInt64 seed)
+{
+    XBTestRandom random = { seed };
+    XBTraceRecord record;
+    
+    for (UInt64 sequence = 0; sequence < kRecords; sequence++) {
+        
+        fillRecord(&record, sequence);
+        if (XBTraceRingPush(producer, &record))
+            __sync_fetch_and_add(pushed, 1);
+        
+        // bursts, so the ring runs full now and then
+        if ((XBTestNext(&random) & 63) == 0)
+            std::this_thread::yield();
+    }
+    
+    __sync_synchronize();
+    *done = 1;
+}
+
+static void
+testProducerConsumer()
+{
+    std::vector<UInt8> memory(XBTraceRingSize(kCapacity));
+    XBTraceRing *ring = (XBTraceRing *)&memory[0];
+    XBTraceProducer ringProducer;
+    volatile UInt32 pushed = 0;
+    volatile int done = 0;
+    XBTraceRecord records[kPopBatch];
+    UInt64 received = 0, last = 0;
+    bool ordered = true, whole = true;
+    
+    XBInitTraceRing(&ringProducer, ring, kCapacity);
+    XB_CHECK_EQUAL(ring->version, kTraceFormatVersion);
+    XB_CHECK_EQUAL(ring->capacity, kCapacity);
+    
+    std::thread thread(producer, &ringProducer, &pushed, &done, 0x2545F4914F6CDD1DULL);
+    
+    for (;;) {
+        
+        int finished = done;
+        UInt32 n;
+        
+        __sync_synchronize();
+        n = XBTraceRingPop(ring, records, kPopBatch);
+        
+        for (UInt32 i = 0; i < n; i++) {
+            
+            UInt64 sequence = records[i].timeStamp;
+            
+            if (received && sequence <= last)
+                ordered = false;
+            if (!checkRecord(&records[i], sequence))
+                whole = false;
+            last = sequence;
+            received++;
+        }
+        
+        if (!n) {
+            if (finished)
+                break;
+            std::this_thread::yield();
+        }
+    }
+    
+    thread.join();
+    
+    XB_CHECK(ordered);
+    XB_CHECK(whole);
+    XB_CHECK_EQUAL(received, pushed);
+    XB_CHECK_EQUAL(received + ring->dropped, kRecords);
+    XB_CHECK_EQUAL(ring->dropped, ringProducer.dropped);
+    XB_CHECK_EQUAL(XBTraceRingPop(ring, records, kPopBatch), 0);
+    
+    printf("producer/consumer: %llu received, %u dropped\n", (unsigned long long)received, ring->dropped);
+}
+
+static void
+testCorruptHeader()
+{
+    XBTestRandom random = { 0xD6E8FEB86659FD93ULL };
+    std::vector<UInt8> memory(kGuardBytes + XBTraceRingSize(kCapacity) + kGuardBytes, 0xA5);
+    XBTraceRing *ring = (XBTraceRing *)&memory[kGuardBytes];
+    XBTraceProducer ringProducer;
+    XBTraceRecord record;
+    bool guarded = true;
+    
+    XBInitTraceRing(&ringProducer, ring, kCapacity);
+    
+    for (UInt64 round = 0; round < kCorruptRounds; round++) {
+        
+        // a broken client writes anything to the header, mostly with a tail
+        // close enough to head that the push still goes ahead
+        switch (XBTestNext(&random) % 5) {
+            case 0: ring->tail = ringProducer.head - (UInt32)(XBTestNext(&random) % (2 * kCapacity)); break;
+            case 1: ring->tail = ringProducer.head + (UInt32)(XBTestNext(&random) % kCapacity); break;
+            case 2: ring->head = (UInt32)XBTestNext(&random); break;
+            case 3: ring->capacity = (UInt32)XBTestNext(&random); break;
+            default: XBTestFill(&random, ring, sizeof(XBTraceRing)); break;
+        }
+        
+        fillRecord(&record, round);
+        XBTraceRingPush(&ringProducer, &record);
+    }
+    
+    for (size_t i = 0; i < kGuardBytes; i++)
+        if (memory[i] != 0xA5 || memory[memory.size() - 1 - i] != 0xA5)
+            guarded = false;
+    
+    XB_CHECK(guarded);
+    XB_CHECK_EQUAL(ringProducer.capacity, kCapacity);
+    XB_CHECK_EQUAL(ringProducer.ring, ring);
+}
+
+int
+main()
+{
+    testProducerConsumer();
+    testCorruptHeader();
+    
+    return XB_TEST_RESULT();
+}
@@ -0,0 +1,164 @@
+//
+//  XBTransformTests.cpp
+//  XboxControllerHIDTests
+//
+//  Every specialized pad transform against the option-testing code it replaced,
+//  and the compiled remote button table against the per-button decode.
+//
+
+#include <string.h>
+
+#include "XboxControllerHIDCore.h"
+#include "XBTest.h"
+#include "XBReference.h"
+
+// -- pad transforms ----------------------------------------
+// ----------------------------------------------------------
+
+static void
+optionsForMask(UInt32 mask, XBTestRandom *random, PadOptions *options)
+{
+    memset(options, 0, sizeof(*options));
+    
+    options->invertY = mask & kPadTransformInvertY;
+    options->invertX = mask & kPadTransformInvertX;
+    options->invertRy = mask & kPadTransformInvertRy;
+    options->invertRx = mask & kPadTransformInvertRx;
+    options->clampButtons = mask & kPadTransformClampButtons;
+    
+    // a trigger bit is either a clamp or a threshold above 1
+    if (mask & kPadTransformLeftTrigger) {
+        
+        options->clampLeft = XBTestNext(random) & 1;
+        options->leftThreshold = 2 + XBTestNext(random) % 254;
+    }
+    if (mask & kPadTransformRightTrigger) {
+        
+        options->clampRight = XBTestNext(random) & 1;
+        options->rightThreshold = 2 + XBTestNext(random) % 254;
+    }
+}
+
+static void
+testPadTransforms()
+{
+    XBTestRandom random = { 0x9E3779B97F4A7C15ULL };
+    
+    for (UInt32 mask = 0; mask < kNumPadTransforms; mask++) {
+        
+        for (int round = 0; round < 64; round++) {
+            
+            PadOptions options;
+            UInt8 leftTable[256], rightTable[256];
+            XBPadReport reports[16], expected[16], single[16];
+            
+            optionsForMask(mask, &random, &options);
+            
+            // the tables must agree with the mask the driver derives from the options
+            XB_CHECK_EQUAL(XBBuildTriggerTable(leftTable, options.clampLeft, options.leftThreshold),
+                           (mask & kPadTransformLeftTrigger) != 0);
+            XB_CHECK_EQUAL(XBBuildTriggerTable(rightTable, options.clampRight, options.rightThreshold),
+                           (mask & kPadTransformRightTrigger) != 0);
+            
+            XBTestFill(&random, reports, sizeof(reports));
+            memcpy(expected, reports, sizeof(reports));
+            memcpy(single, reports, sizeof(reports));
+            
+            for (int i = 0; i < 16; i++) {
+                
+                referencePadTransform(&expected[i], &options);
+                XBSelectPadTransform(mask)(&single[i], leftTable, rightTable);
+            }
+            XBSelectPadBatchTransform(mask)(reports, 16, leftTable, rightTable);
+            
+            XB_CHECK(memcmp(single, expected, sizeof(expected)) == 0);
+            XB_CHECK(memcmp(reports, expected, sizeof(expected)) == 0);
+        }
+    }
+    
+    // axis extremes: -32768 <-> 32767, -1 <-> 0
+    XBPadReport report;
+    
+    memset(&report, 0, sizeof(report));
+    report.lxlo = 0x00; report.lxhi = 0x80;
+    report.lylo = 0xFF; report.lyhi = 0xFF;
+    XBSelectPadTransform(kPadTransformInvertX | kPadTransformInvertY)(&report, NULL, NULL);
+    XB_CHECK_EQUAL(report.lxlo, 0xFF);
+    XB_CHECK_EQUAL(report.lxhi, 0x7F);
+    XB_CHECK_EQUAL(report.lylo, 0x00);
+    XB_CHECK_EQUAL(report.lyhi, 0x00);
+}
+
+// -- remote reports ----------------------------------------
+// ----------------------------------------------------------
+
+static void
+testRemoteButtonTable()
+{
+    XBTestRandom random = { 0x2545F4914F6CDD1DULL };
+    
+    for (int map = 0; map < 256; map++) {
+        
+        int scancodes[kNumRemoteButtons];
+        XBRemoteButtonTable table;
+        
+        // random maps, with some buttons unmapped and some sharing a scancode
+        for (int i = 0; i < kNumRemoteButtons; i++) {
+            
+            UInt64 r = XBTestNext(&random);
+            scancodes[i] = (r & 7) == 0 ? -1 : (int)((r >> 8) & 0xFF);
+        }
+        XBBuildRemoteButtonTable(scancodes, &table);
+        
+        for (int scancode = 0; scancode < 256; scancode++) {
+            
+            XBActualRemoteReport report, expected;
+            
+            XBTestFill(&random, &report, sizeof(report));
+            report.scancode = scancode;
+            expected = report;
+            
+            referenceRemoteConvert(&expected, scancodes);
+            XBConvertRemoteReport(&report, &table);
+            XB_CHECK(memcmp(&report, &expected, sizeof(report)) == 0);
+        }
+    }
+}
+
+// every byte of the report counts, at any alignment, and keepalive lets an
+// equal one through once it has passed
+static void
+testDuplicatePadReports()
+{
+    XBTestRandom random = { 0x5EED0008 };
+    UInt8 buffer[sizeof(XBPadReport) + 8], last[sizeof(XBPadReport)];
+    
+    XBTestFill(&random, last, sizeof(last));
+    
+    for (UInt32 offset = 0; offset < 8; offset++) {
+        
+        UInt8 *report = buffer + offset;
+        
+        memcpy(report, last, sizeof(last));
+        XB_CHECK(XBIsDuplicatePadReport(report, last, 1000, 0, 0));
+        XB_CHECK(XBIsDuplicatePadReport(report, last, 999, 0, 1000));
+        XB_CHECK(!XBIsDuplicatePadReport(report, last, 1000, 0, 1000));
+        
+        for (UInt32 i = 0; i < sizeof(XBPadReport); i++)
+            for (UInt32 bit = 0; bit < 8; bit++) {
+                report[i] ^= 1 << bit;
+                XB_CHECK(!XBIsDuplicatePadReport(report, last, 1000, 0, 0));
+                report[i] ^= 1 << bit;
+            }
+    }
+}
+
+int
+main()
+{
+    testPadTransforms();
+    testRemoteButtonTable();
+    testDuplicatePadReports();
+    
+    return XB_TEST_RESULT();
+}
@@ -0,0 +1,44 @@
+//
+//  XBTriggerTableTests.cpp
+//  XboxControllerHIDTests
+//
+//  Every trigger lookup table, for every clamp setting, threshold and input
+//  value, against the per-report arithmetic the tables replaced.
+//
+
+#include "XboxControllerHIDCore.h"
+#include "XBTest.h"
+#include "XBReference.h"
+
+int
+main()
+{
+    for (int clamp = 0; clamp < 2; clamp++) {
+        
+        for (int threshold = 0; threshold < 256; threshold++) {
+            
+            UInt8 table[256];
+            bool used;
+            
+            // an identity table is reported as unused, so the transform skips the load
+            for (int value = 0; value < 256; value++)
+                table[value] = value;
+            used = XBBuildTriggerTable(table, clamp, threshold);
+            XB_CHECK_EQUAL(used, clamp || threshold > 1);
+            
+            for (int value = 0; value < 256; value++)
+                XB_CHECK_EQUAL(table[value], referenceTrigger(value, clamp, threshold));
+            
+            // the rescale must still reach the ends of the range
+            // (a threshold of 255 turns the trigger into 0 or 255)
+            if (!clamp && threshold > 1) {
+                
+                XB_CHECK_EQUAL(table[threshold - 1], 0);
+                XB_CHECK_EQUAL(table[threshold], threshold < 255 ? 1 : 255);
+                XB_CHECK_EQUAL(table[255], 255);
+            }
+        }
+    }
+    
+    return XB_TEST_RESULT();
+}
@@ -0,0 +1,180 @@
+//
+//  XBReplay.cpp
+//  XboxControllerHIDTools
+//
+//  The driver's report pipeline for recorded reports, see XBReplay.h.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "XboxControllerHIDKeys.h"
+#include "XBReplay.h"
+
+// the ButtonMap of the IR receiver in XboxControllerHID-Info.plist
+static const int gDefaultButtonMap[kNumRemoteButtons] = {
+    213, 226, 234, 227, 221, 224, 230, 223, 229, 166, 195, 169, 11, 168,
+    247, 167, 216, 206, 205, 204, 203, 202, 201, 200, 199, 198, 207
+};
+
+#define kStatusOverrun      ((SInt32)0xE00002E8)   // kIOReturnOverrun, the read still has its report
+
+void
+XBDefaultReplayOptions(XBReplayOptions *options)
+{
+    XBDefaultPadOptions(&options->padOptions);
+    memcpy(options->buttonMap, gDefaultButtonMap, sizeof(gDefaultButtonMap));
+    options->remoteReleaseTime = kRemoteReleaseTime;
+}
+
+bool
+XBParsePadOption(XBPadOptions *options, const char *assignment)
+{
+    const char *equals = strchr(assignment, '=');
+    size_t length;
+    long value;
+    
+    if (!equals)
+        return false;
+    
+    length = equals - assignment;
+    value = strtol(equals + 1, NULL, 0);
+
+#define OPTION(field) \
+    if (length == strlen(kOption ## field ## Key) && !strncmp(assignment, kOption ## field ## Key, length)) { \
+        options->field = value; \
+        return true; \
+    }
+    
+    OPTION(InvertYAxis)
+    OPTION(InvertXAxis)
+    OPTION(InvertRyAxis)
+    OPTION(InvertRxAxis)
+    OPTION(ClampButtons)
+    OPTION(ClampLeftTrigger)
+    OPTION(ClampRightTrigger)
+    OPTION(LeftTriggerThreshold)
+    OPTION(RightTriggerThreshold)
+    OPTION(SuppressDuplicateReports)
+    OPTION(KeepaliveInterval)
+
+#undef OPTION
+    
+    return false;
+}
+
+void
+XBInitReplayer(XBReplayer *replayer, const XBReplayOptions *options)
+{
+    memset(replayer, 0, sizeof(XBReplayer));
+    replayer->options = *options;
+    
+    replayer->padTransform = XBSelectPadTransform(XBPadTransformFlags(&options->padOptions,
+                                                                      replayer->leftTriggerTable,
+                                                                      replayer->rightTriggerTable));
+    XBBuildRemoteButtonTable(options->buttonMap, &replayer->remoteTable);
+    
+    replayer->suppressDuplicates = options->padOptions.SuppressDuplicateReports;
+    replayer->keepalive = (UInt64)options->padOptions.KeepaliveInterval * 1000000;
+}
+
+static XBReplayDevice *
+findDevice(XBReplayer *replayer, UInt32 locationID)
+{
+    XBReplayDevice *device;
+    
+    for (UInt32 i = 0; i < replayer->numDevices; i++)
+        if (replayer->devices[i].locationID == locationID)
+            return &replayer->devices[i];
+    
+    if (replayer->numDevices == kMaxReplayDevices)
+        return NULL;
+    
+    device = &replayer->devices[replayer->numDevices++];
+    device->locationID = locationID;
+    return device;
+}
+
+void
+XBReplayRecord(XBReplayer *replayer, const XBTraceRecord *in, XBTraceRecord *out)
+{
+    XBReplayDevice *device;
+    UInt8 *report = out->transformed;
+    
+    *out = *in;
+    replayer->stats.records++;
+    
+    // output reports, failed reads and reports cut short are only passed on
+    if ((in->flags & (kTraceRecordOutput | kTraceRecordTruncated)) || !in->length ||
+        (in->status != 0 && in->status != kStatusOverrun)) {
+        replayer->stats.passed++;
+        return;
+    }
+    
+    out->flags &= ~(kTraceRecordDelivered | kTraceRecordSuppressed);
+    memset(out->transformed, 0, sizeof(out->transformed));
+    memcpy(report, in->raw, in->length);
+    
+    device = findDevice(replayer, in->locationID);
+    if (!device) {
+        out->flags |= kTraceRecordDelivered;
+        replayer->stats.delivered++;
+        return;
+    }
+    
+    if (device->type == kReplayDeviceUnknown) {
+        if (in->length == sizeof(XBPadReport))
+            device->type = kReplayDevicePad;
+        else if (in->length == sizeof(XBActualRemoteReport))
+            device->type = kReplayDeviceRemote;
+    }
+    
+    // manipulateReport(), which leaves reports of any other size alone
+    if (device->type == kReplayDevicePad && in->length == sizeof(XBPadReport)) {
+        
+        replayer->padTransform((XBPadReport *)report, replayer->leftTriggerTable, replayer->rightTriggerTable);
+        
+        if (replayer->suppressDuplicates && device->hasLastReport &&
+            XBIsDuplicatePadReport(report, device->lastReport, in->timeStamp, device->lastReportTime, replayer->keepalive)) {
+            out->flags |= kTraceRecordSuppressed;
+            replayer->stats.suppressed++;
+            return;
+        }
+        
+        memcpy(device->lastReport, report, sizeof(XBPadReport));
+        device->hasLastReport = true;
+        device->lastReportTime = in->timeStamp;
+    
+    } else if (device->type == kReplayDeviceRemote && in->length == sizeof(XBActualRemoteReport)) {
+        
+        // the release timer fires once no report has come for its interval, and forgets the held button
+        if (device->lastCompletionTime && in->timeStamp - device->lastCompletionTime >= replayer->options.remoteReleaseTime &&
+            device->lastScancode) {
+            device->lastScancode = 0;
+            replayer->stats.releases++;
+        }
+        device->lastCompletionTime = in->timeStamp;
+        
+        if (!XBFilterRemoteReport((XBActualRemoteReport *)report, &replayer->remoteTable, &device->lastScancode)) {
+            replayer->stats.repeats++;
+            return;
+        }
+    }
+    
+    out->flags |= kTraceRecordDelivered;
+    replayer->stats.delivered++;
+}
+
+bool
+XBReplayDiffers(const XBTraceRecord *recorded, const XBTraceRecord *replayed)
+{
+    const UInt8 mask = kTraceRecordDelivered | kTraceRecordSuppressed;
+    
+    if ((recorded->flags & mask) != (replayed->flags & mask))
+        return true;
+    
+    if (recorded->flags & kTraceRecordOutput)
+        return false;
+    
+    return memcmp(recorded->transformed, replayed->transformed, recorded->length) != 0;
+}
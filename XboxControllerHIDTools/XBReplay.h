@@ -0,0 +1,91 @@
+//
+//  XBReplay.h
+//  XboxControllerHIDTools
+//
+//  Runs recorded reports through the driver's report pipeline again: the pad
+//  transform for the options, the remote's repeat filter and scancode
+//  conversion, the remote release timer and duplicate suppression, all from
+//  XboxControllerHIDCore, in the order manipulateReport() and the read
+//  completion take them.
+//
+
+#ifndef XboxControllerHIDTools_XBReplay_h
+#define XboxControllerHIDTools_XBReplay_h
+
+#include "XboxControllerHIDCore.h"
+
+#define kMaxReplayDevices       64
+#define kRemoteReleaseTime      80000000ULL // ns, the driver's _xbTimedEventsInterval
+
+typedef struct {
+    
+    XBPadOptions    padOptions;
+    int             buttonMap[kNumRemoteButtons];   // scancode per XBoxRemoteKey, -1 if unmapped
+    UInt64          remoteReleaseTime;              // ns without a report until a remote button is released
+    
+} XBReplayOptions;
+
+// device types, told apart by their report size since a trace doesn't name them
+typedef enum {
+    
+    kReplayDeviceUnknown = 0,
+    kReplayDevicePad,
+    kReplayDeviceRemote
+} XBReplayDeviceType;
+
+typedef struct {
+    
+    UInt32      locationID;
+    UInt8       type;                           // XBReplayDeviceType
+    UInt8       lastScancode;                   // held remote button
+    bool        hasLastReport;
+    UInt8       lastReport[sizeof(XBPadReport)];  // last delivered pad report
+    UInt64      lastReportTime;
+    UInt64      lastCompletionTime;             // of any report, for the release timer
+    
+} XBReplayDevice;
+
+typedef struct {
+    
+    UInt64      records;
+    UInt64      delivered;
+    UInt64      suppressed;                     // duplicates
+    UInt64      repeats;                        // remote repeats of the held button
+    UInt64      releases;                       // release timer fired between two remote reports
+    UInt64      passed;                         // failed reads and output reports, nothing to run
+    
+} XBReplayStats;
+
+typedef struct {
+    
+    XBReplayOptions         options;
+    XBPadTransform          padTransform;
+    UInt8                   leftTriggerTable[256];
+    UInt8                   rightTriggerTable[256];
+    XBRemoteButtonTable     remoteTable;
+    bool                    suppressDuplicates;
+    UInt64                  keepalive;          // ns, 0 = never resend
+    UInt32                  numDevices;
+    XBReplayDevice          devices[kMaxReplayDevices];
+    XBReplayStats           stats;
+    
+} XBReplayer;
+
+// the driver's defaults, and the IR button map from its Info.plist
+void XBDefaultReplayOptions(XBReplayOptions *options);
+
+// Set a pad option from Key=Value, Key one of the DeviceOptions keys
+// (InvertYAxis=0, LeftTriggerThreshold=128, ...). False if there is no such key
+bool XBParsePadOption(XBPadOptions *options, const char *assignment);
+
+void XBInitReplayer(XBReplayer *replayer, const XBReplayOptions *options);
+
+// Replay one record: out gets the raw report of in, transformed as the driver
+// would now, and the delivered/suppressed flags it would set. Records of more
+// than kMaxReplayDevices devices go through untransformed.
+void XBReplayRecord(XBReplayer *replayer, const XBTraceRecord *in, XBTraceRecord *out);
+
+// true if the replayed record was transformed or delivered differently
+bool XBReplayDiffers(const XBTraceRecord *recorded, const XBTraceRecord *replayed);
+
+#endif
@@ -0,0 +1,502 @@
+//
+//  XBSimulator.cpp
+//  XboxControllerHIDTools
+//
+//  Virtual pads and IR receivers behind a simulated interrupt pipe, see
+//  XBSimulator.h.
+//
+
+#include <string.h>
+
+#include "XBSimulator.h"
+
+#define kSimNotRespondingUntilReset     0xFFFFFFFF
+
+static UInt64
+mix(UInt64 x)
+{
+    x += 0x9E3779B97F4A7C15ULL;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+// 0 to 65535 and back once per period
+static UInt16
+triangle(UInt64 time, UInt64 period)
+{
+    UInt64 phase = time % period;
+    UInt64 half = period / 2;
+    
+    if (!half)
+        return 0;
+    if (phase < half)
+        return (UInt16)(phase * 65535 / half);
+    return (UInt16)((period - phase) * 65535 / (period - half));
+}
+
+static void
+setAxis(UInt8 *lo, UInt8 *hi, SInt16 value)
+{
+    *lo = (UInt16)value & 0xFF;
+    *hi = (UInt16)value >> 8;
+}
+
+// -- devices -----------------------------------------------
+// ----------------------------------------------------------
+
+void
+XBInitSimDevice(XBSimDevice *device, XBSimDeviceType type, UInt64 interval, UInt64 seed)
+{
+    memset(device, 0, sizeof(XBSimDevice));
+    device->type = type;
+    device->interval = interval;
+    device->seed = seed;
+}
+
+bool
+XBAddSimStep(XBSimDevice *device, const XBSimStep *step)
+{
+    if (device->numSteps == kSimMaxSteps || !step->duration)
+        return false;
+    
+    device->steps[device->numSteps++] = *step;
+    return true;
+}
+
+bool
+XBAddSimFault(XBSimDevice *device, const XBSimFault *fault)
+{
+    if (device->numFaults == kSimMaxFaults)
+        return false;
+    if (device->numFaults && fault->time < device->faults[device->numFaults - 1].time)
+        return false;
+    
+    device->faults[device->numFaults++] = *fault;
+    return true;
+}
+
+// the step the script is in elapsed ns after the start, and how far into it
+static const XBSimStep *
+findStep(const XBSimDevice *device, UInt64 elapsed, UInt64 *stepTime)
+{
+    UInt64 length = 0;
+    
+    for (UInt32 i = 0; i < device->numSteps; i++)
+        length += device->steps[i].duration;
+    
+    if (!length || (!device->loop && elapsed >= length))
+        return NULL;
+    
+    elapsed %= length;
+    for (UInt32 i = 0; i < device->numSteps; i++) {
+        
+        if (elapsed < device->steps[i].duration) {
+            *stepTime = elapsed;
+            return &device->steps[i];
+        }
+        elapsed -= device->steps[i].duration;
+    }
+    
+    return NULL;
+}
+
+static void
+padReport(const XBSimDevice *device, const XBSimStep *step, UInt64 pollIndex, UInt64 stepTime, XBPadReport *report)
+{
+    memset(report, 0, sizeof(XBPadReport));
+    
+    switch (step ? step->pattern : (UInt8)kSimPatternIdle) {
+        
+        case kSimPatternHold:
+            report->buttons = step->buttons;
+            report->a = report->b = report->x = report->y = step->value;
+            report->black = report->white = step->value;
+            report->lt = report->rt = step->value;
+            break;
+        
+        case kSimPatternSweep: {
+            
+            // each axis a quarter period behind the last, all of them shifted per device
+            UInt64 period = step->period ? step->period : 1000000000ULL;
+            UInt64 time = stepTime + mix(device->seed) % period;
+            
+            setAxis(&report->lxlo, &report->lxhi, (SInt16)(triangle(time, period) - 32768));
+            setAxis(&report->lylo, &report->lyhi, (SInt16)(triangle(time + period / 4, period) - 32768));
+            setAxis(&report->rxlo, &report->rxhi, (SInt16)(triangle(time + period / 2, period) - 32768));
+            setAxis(&report->rylo, &report->ryhi, (SInt16)(triangle(time + 3 * period / 4, period) - 32768));
+            report->lt = triangle(time, period) >> 8;
+            report->rt = triangle(time + period / 2, period) >> 8;
+            break;
+        }
+        
+        case kSimPatternRandom: {
+            
+            UInt64 bits[3] = {
+                mix(device->seed ^ (pollIndex * 3)),
+                mix(device->seed ^ (pollIndex * 3 + 1)),
+                mix(device->seed ^ (pollIndex * 3 + 2))
+            };
+            
+            memcpy(report, bits, sizeof(XBPadReport));
+            report->r1 = 0;
+            report->r3 = 0;
+            break;
+        }
+        
+        default:
+            break;
+    }
+    
+    report->r2 = sizeof(XBPadReport);
+}
+
+bool
+XBSimReport(const XBSimDevice *device, UInt64 pollIndex, UInt64 elapsed, void *report, UInt32 *length)
+{
+    UInt64 stepTime = 0;
+    const XBSimStep *step = findStep(device, elapsed, &stepTime);
+    
+    if (device->type == kSimDevicePad) {
+        padReport(device, step, pollIndex, stepTime, (XBPadReport *)report);
+        *length = sizeof(XBPadReport);
+        return true;
+    }
+    
+    if (device->type == kSimDeviceRemote && step && step->pattern == kSimPatternRemoteButton) {
+        
+        XBActualRemoteReport *remote = (XBActualRemoteReport *)report;
+        
+        // at the first poll of the step, and at the first poll after each repeat
+        if (stepTime >= device->interval &&
+            stepTime / kSimRemoteRepeat == (stepTime - device->interval) / kSimRemoteRepeat)
+            return false;
+        
+        memset(remote, 0, sizeof(XBActualRemoteReport));
+        remote->r2 = sizeof(XBActualRemoteReport);
+        remote->scancode = step->scancode;
+        *length = sizeof(XBActualRemoteReport);
+        return true;
+    }
+    
+    return false;
+}
+
+// -- pipe --------------------------------------------------
+// ----------------------------------------------------------
+
+void
+XBInitSimPipe(XBSimPipe *pipe, const XBSimDevice *device, UInt64 start)
+{
+    memset(pipe, 0, sizeof(XBSimPipe));
+    pthread_mutex_init(&pipe->lock, NULL);
+    pipe->device = *device;
+    pipe->start = start;
+    pipe->now = start;
+    pipe->nextPoll = start + device->interval;
+}
+
+void
+XBFreeSimPipe(XBSimPipe *pipe)
+{
+    pthread_mutex_destroy(&pipe->lock);
+}
+
+// hand every queued read back with status, to complete at the next XBSimRun()
+static void
+returnReads(XBSimPipe *pipe, SInt32 status)
+{
+    while (pipe->count) {
+        
+        XBSimTransfer *read = &pipe->returned[pipe->numReturned++];
+        
+        *read = pipe->reads[pipe->head];
+        read->status = status;
+        pipe->head = (pipe->head + 1) % kSimMaxReads;
+        pipe->count--;
+        pipe->stats.returned++;
+    }
+}
+
+SInt32
+XBSimRead(XBSimPipe *pipe, void *buffer, UInt32 length, const XBSimCompletion *completion)
+{
+    SInt32 status = kSimStatusSuccess;
+    
+    pthread_mutex_lock(&pipe->lock);
+    
+    if (pipe->resetDone)
+        status = kSimStatusNotOpen;
+    else if (pipe->count + pipe->numReturned == kSimMaxReads)
+        status = kSimStatusNoResources;
+    else {
+        
+        XBSimTransfer *read = &pipe->reads[(pipe->head + pipe->count++) % kSimMaxReads];
+        
+        read->buffer = buffer;
+        read->length = length;
+        read->completion = *completion;
+        read->status = kSimStatusSuccess;
+    }
+    
+    pthread_mutex_unlock(&pipe->lock);
+    return status;
+}
+
+void
+XBSimClearStall(XBSimPipe *pipe)
+{
+    pthread_mutex_lock(&pipe->lock);
+    pipe->pipeHalted = false;
+    returnReads(pipe, kSimStatusTransactionReturned);
+    pthread_mutex_unlock(&pipe->lock);
+}
+
+void
+XBSimAbort(XBSimPipe *pipe)
+{
+    pthread_mutex_lock(&pipe->lock);
+    returnReads(pipe, kSimStatusAborted);
+    pthread_mutex_unlock(&pipe->lock);
+}
+
+SInt32
+XBSimClearEndpointHalt(XBSimPipe *pipe)
+{
+    SInt32 status = kSimStatusSuccess;
+    
+    pthread_mutex_lock(&pipe->lock);
+    if (pipe->unplugged || pipe->notResponding)
+        status = kSimStatusNotResponding;
+    else if (pipe->resetDone)
+        status = kSimStatusNotOpen;
+    else
+        pipe->endpointHalted = false;
+    pthread_mutex_unlock(&pipe->lock);
+    
+    return status;
+}
+
+bool
+XBSimDeviceConnected(XBSimPipe *pipe)
+{
+    bool connected;
+    
+    pthread_mutex_lock(&pipe->lock);
+    connected = !pipe->unplugged;
+    pthread_mutex_unlock(&pipe->lock);
+    
+    return connected;
+}
+
+// An unplugged device stays gone; any other comes back kSimResetTime later,
+// with its endpoint cleared and the reset handler called
+void
+XBSimResetDevice(XBSimPipe *pipe)
+{
+    pthread_mutex_lock(&pipe->lock);
+    returnReads(pipe, kSimStatusAborted);
+    if (!pipe->unplugged && !pipe->resetDone) {
+        pipe->resetDone = pipe->now + kSimResetTime;
+        pipe->stats.resets++;
+    }
+    pthread_mutex_unlock(&pipe->lock);
+}
+
+void
+XBSimSetResetHandler(XBSimPipe *pipe, void (*handler)(void *target), void *target)
+{
+    pthread_mutex_lock(&pipe->lock);
+    pipe->resetHandler = handler;
+    pipe->resetTarget = target;
+    pthread_mutex_unlock(&pipe->lock);
+}
+
+// Take the device's answer to one poll; true if it completes the read at the
+// head of the queue with *status and *copied report bytes
+static bool
+poll(XBSimPipe *pipe, SInt32 *status, UInt32 *copied)
+{
+    const XBSimDevice *device = &pipe->device;
+    UInt64 elapsed = pipe->now - pipe->start;
+    UInt64 index = pipe->pollIndex++;
+    XBSimTransfer *read = &pipe->reads[pipe->head];
+    UInt64 report[kTraceReportBytes / sizeof(UInt64)];
+    UInt32 length = 0;
+    bool hasReport;
+    
+    pipe->stats.polls++;
+    *copied = 0;
+    
+    // a halted pipe isn't scheduled at all
+    if (pipe->pipeHalted)
+        return false;
+    
+    // faults wait for a read to fail
+    if (pipe->count && pipe->nextFault < device->numFaults && device->faults[pipe->nextFault].time <= elapsed) {
+        
+        const XBSimFault *fault = &device->faults[pipe->nextFault++];
+        
+        switch (fault->status) {
+            
+            case kSimStatusNotResponding:
+                pipe->notResponding = fault->count ? fault->count : kSimNotRespondingUntilReset;
+                pipe->unplugged = fault->unplug;
+                break;
+            
+            case kSimStatusOverrun:
+                // the report arrives with more than was asked for, and the endpoint halts
+                XBSimReport(device, index, elapsed, report, &length);
+                *copied = length < read->length ? length : read->length;
+                memcpy(read->buffer, report, *copied);
+                pipe->pipeHalted = true;
+                pipe->endpointHalted = true;
+                *status = fault->status;
+                pipe->stats.errors++;
+                return true;
+            
+            case kSimStatusAborted:
+                *status = fault->status;
+                pipe->stats.errors++;
+                return true;
+            
+            default:
+                pipe->pipeHalted = true;
+                pipe->endpointHalted = true;
+                *status = fault->status;
+                pipe->stats.errors++;
+                return true;
+        }
+    }
+    
+    if (pipe->unplugged || pipe->notResponding) {
+        
+        if (!pipe->count)
+            return false;
+        if (pipe->notResponding && pipe->notResponding != kSimNotRespondingUntilReset)
+            pipe->notResponding--;
+        *status = kSimStatusNotResponding;
+        pipe->stats.errors++;
+        return true;
+    }
+    
+    // the device stalls every read until its endpoint is cleared
+    if (pipe->endpointHalted) {
+        
+        if (!pipe->count)
+            return false;
+        pipe->pipeHalted = true;
+        *status = kSimStatusPipeStalled;
+        pipe->stats.errors++;
+        return true;
+    }
+    
+    hasReport = XBSimReport(device, index, elapsed, report, &length);
+    if (!hasReport) {
+        pipe->stats.naks++;
+        return false;
+    }
+    if (!pipe->count) {
+        pipe->stats.missed++;
+        return false;
+    }
+    
+    *copied = length < read->length ? length : read->length;
+    memcpy(read->buffer, report, *copied);
+    *status = kSimStatusSuccess;
+    pipe->stats.reports++;
+    return true;
+}
+
+UInt32
+XBSimRun(XBSimPipe *pipe, UInt64 time)
+{
+    UInt32 completions = 0;
+    
+    for (;;) {
+        
+        XBSimTransfer read;
+        SInt32 status = kSimStatusSuccess;
+        UInt32 copied = 0;
+        UInt64 timeStamp;
+        
+        pthread_mutex_lock(&pipe->lock);
+        
+        if (pipe->numReturned) {
+            
+            read = pipe->returned[0];
+            status = read.status;
+            memmove(&pipe->returned[0], &pipe->returned[1], --pipe->numReturned * sizeof(XBSimTransfer));
+        
+        } else if (pipe->resetDone) {
+            
+            void (*handler)(void *target) = pipe->resetHandler;
+            void *target = pipe->resetTarget;
+            
+            if (pipe->resetDone > time) {
+                pipe->now = time;
+                pthread_mutex_unlock(&pipe->lock);
+                break;
+            }
+            
+            // the device is back, polled again from the end of the reset
+            pipe->now = pipe->resetDone;
+            pipe->nextPoll = pipe->resetDone + pipe->device.interval;
+            pipe->resetDone = 0;
+            pipe->pipeHalted = false;
+            pipe->endpointHalted = false;
+            pipe->notResponding = 0;
+            pthread_mutex_unlock(&pipe->lock);
+            
+            if (handler)
+                handler(target);
+            continue;
+        
+        } else {
+            
+            if (pipe->nextPoll > time) {
+                pipe->now = time;
+                pthread_mutex_unlock(&pipe->lock);
+                break;
+            }
+            
+            pipe->now = pipe->nextPoll;
+            pipe->nextPoll += pipe->device.interval;
+            
+            if (!poll(pipe, &status, &copied)) {
+                pthread_mutex_unlock(&pipe->lock);
+                continue;
+            }
+            
+            read = pipe->reads[pipe->head];
+            pipe->head = (pipe->head + 1) % kSimMaxReads;
+            pipe->count--;
+        }
+        
+        timeStamp = pipe->now;
+        pthread_mutex_unlock(&pipe->lock);
+        
+        read.completion.action(read.completion.target, read.completion.parameter, status,
+                               read.length - copied, timeStamp);
+        completions++;
+    }
+    
+    return completions;
+}
+
+UInt64
+XBSimNextEvent(XBSimPipe *pipe)
+{
+    UInt64 time;
+    
+    pthread_mutex_lock(&pipe->lock);
+    if (pipe->numReturned)
+        time = pipe->now;
+    else if (pipe->resetDone)
+        time = pipe->resetDone;
+    else
+        time = pipe->nextPoll;
+    pthread_mutex_unlock(&pipe->lock);
+    
+    return time;
+}
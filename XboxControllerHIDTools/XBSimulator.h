@@ -0,0 +1,190 @@
+//
+//  XBSimulator.h
+//  XboxControllerHIDTools
+//
+//  A virtual Xbox pad or IR receiver behind a simulated interrupt pipe, for
+//  running the read loop and its recovery without hardware. Reads are queued
+//  and completed one per polling interval, as the host controller would, with
+//  reports that follow a script of input patterns and the faults injected at
+//  given times. Time is virtual: XBSimRun() moves it forward and runs the
+//  completions due by then, so the same device and script always produce the
+//  same completions, in the same order, with the same time stamps.
+//
+//  The calls mirror the IOUSBPipe and IOUSBDevice calls the driver makes:
+//  XBSimRead() is Read(), XBSimClearStall() is ClearStall(), XBSimAbort() is
+//  Abort(), XBSimClearEndpointHalt() is the CLEAR_FEATURE(ENDPOINT_HALT)
+//  DeviceRequest(), XBSimDeviceConnected() is kIOUSBMessageHubIsDeviceConnected
+//  and XBSimResetDevice() is ResetDevice(). A pipe may be called from any
+//  thread; completions run on the thread in XBSimRun(), without the pipe's
+//  lock held, so they can queue the next read. Reads handed back by a clear,
+//  abort or reset complete there too, at the next XBSimRun(), as they come
+//  back asynchronously from the controller.
+//
+
+#ifndef XboxControllerHIDTools_XBSimulator_h
+#define XboxControllerHIDTools_XBSimulator_h
+
+#include <pthread.h>
+
+#include "XboxControllerHIDCore.h"
+
+// the IOReturn values the pipe completes with (IOReturn.h, USB.h)
+#define kSimStatusSuccess           0
+#define kSimStatusNoResources       ((SInt32)0xE00002BE)    // kIOReturnNoResources, too many reads queued
+#define kSimStatusNotOpen           ((SInt32)0xE00002CD)    // kIOReturnNotOpen, device reset or unplugged
+#define kSimStatusUnderrun          ((SInt32)0xE00002E7)    // kIOReturnUnderrun
+#define kSimStatusOverrun           ((SInt32)0xE00002E8)    // kIOReturnOverrun, comes with the report
+#define kSimStatusAborted           ((SInt32)0xE00002EB)    // kIOReturnAborted
+#define kSimStatusNotResponding     ((SInt32)0xE00002ED)    // kIOReturnNotResponding
+#define kSimStatusPipeStalled       ((SInt32)0xE000404F)    // kIOUSBPipeStalled
+#define kSimStatusTransactionReturned ((SInt32)0xE0004050)  // kIOUSBTransactionReturned, by ClearStall()
+#define kSimStatusCRCErr            ((SInt32)0xE0004001)    // kIOUSBCRCErr, one of the OHCI errors
+
+#define kSimMaxReads                32          // reads a pipe holds at once
+#define kSimMaxSteps                64
+#define kSimMaxFaults               64
+#define kSimRemoteRepeat            64000000ULL // ns between the reports of a held remote button
+#define kSimResetTime               10000000ULL // ns a port reset takes
+
+typedef enum {
+    
+    kSimDevicePad = 1,                  // reports every polling interval
+    kSimDeviceRemote                    // reports only while a button is held
+} XBSimDeviceType;
+
+// input patterns of a script step
+typedef enum {
+    
+    kSimPatternIdle = 0,                // sticks centered, nothing pressed (the remote is silent)
+    kSimPatternHold,                    // buttons and value held for the whole step
+    kSimPatternSweep,                   // sticks and triggers sweep their range once per period
+    kSimPatternRandom,                  // a new random report every interval
+    kSimPatternRemoteButton             // remote: scancode held, repeated every kSimRemoteRepeat
+} XBSimPattern;
+
+typedef struct {
+    
+    UInt64  duration;                   // ns
+    UInt8   pattern;                    // XBSimPattern
+    UInt8   buttons;                    // kSimPatternHold: the digital buttons byte
+    UInt8   value;                      // kSimPatternHold: analog buttons and triggers
+    UInt8   scancode;                   // kSimPatternRemoteButton
+    UInt64  period;                     // kSimPatternSweep, ns
+    
+} XBSimStep;
+
+// A fault is injected at the first poll with a read queued at or after time.
+// The stall and bus errors, and overrun, halt the endpoint until both sides
+// are cleared: further polls complete with kSimStatusPipeStalled until then.
+// Not responding fails count polls in a row, or every poll until the device
+// is reset if count is 0, and with unplug the hub no longer sees the device.
+typedef struct {
+    
+    UInt64  time;                       // ns after the start
+    SInt32  status;                     // kSimStatus*
+    UInt32  count;                      // kSimStatusNotResponding: polls, 0 = until reset
+    bool    unplug;
+    
+} XBSimFault;
+
+typedef struct {
+    
+    UInt8           type;               // XBSimDeviceType
+    UInt64          interval;           // polling interval, ns
+    UInt64          seed;               // of kSimPatternRandom, and of the per-device phase of the sweep
+    bool            loop;               // run the script again once it ends, otherwise stay idle
+    UInt32          numSteps;
+    XBSimStep       steps[kSimMaxSteps];
+    UInt32          numFaults;
+    XBSimFault      faults[kSimMaxFaults];  // in time order
+    
+} XBSimDevice;
+
+// the completion of a read, as IOUSBCompletionWithTimeStamp
+typedef void (*XBSimAction)(void *target, void *parameter, SInt32 status, UInt32 bufferSizeRemaining, UInt64 timeStamp);
+
+typedef struct {
+    
+    void *          target;
+    XBSimAction     action;
+    void *          parameter;
+    
+} XBSimCompletion;
+
+typedef struct {
+    
+    UInt64      polls;
+    UInt64      reports;                // completed with a report
+    UInt64      missed;                 // polls with a report and no read queued, the report is lost
+    UInt64      naks;                   // polls of an idle remote
+    UInt64      errors;                 // completed with an error, injected or from a halted endpoint
+    UInt64      returned;               // handed back by a clear, abort or reset
+    UInt64      resets;
+    
+} XBSimStats;
+
+typedef struct {
+    
+    void *          buffer;
+    UInt32          length;
+    XBSimCompletion completion;
+    SInt32          status;             // of a read handed back
+    
+} XBSimTransfer;
+
+typedef struct {
+    
+    pthread_mutex_t lock;
+    XBSimDevice     device;
+    
+    UInt64          start;
+    UInt64          now;                // virtual time, ns
+    UInt64          pollIndex;          // polls since the start
+    UInt64          nextPoll;
+    UInt32          nextFault;
+    
+    XBSimTransfer   reads[kSimMaxReads];    // queued, in order
+    UInt32          head, count;
+    XBSimTransfer   returned[kSimMaxReads]; // handed back, to complete at the next XBSimRun()
+    UInt32          numReturned;
+    
+    bool            pipeHalted;         // at the controller, until XBSimClearStall()
+    bool            endpointHalted;     // at the device, until XBSimClearEndpointHalt()
+    UInt32          notResponding;      // polls left to fail, ~0 until reset
+    bool            unplugged;
+    UInt64          resetDone;          // a reset in progress ends then, 0 if none
+    
+    void            (*resetHandler)(void *target);  // kIOUSBMessagePortHasBeenReset
+    void *          resetTarget;
+    
+    XBSimStats      stats;
+    
+} XBSimPipe;
+
+// a pad or remote with no script and no faults, polled every interval ns
+void XBInitSimDevice(XBSimDevice *device, XBSimDeviceType type, UInt64 interval, UInt64 seed);
+bool XBAddSimStep(XBSimDevice *device, const XBSimStep *step);
+bool XBAddSimFault(XBSimDevice *device, const XBSimFault *fault);
+
+// the pipe starts at virtual time start, its first poll one interval later
+void XBInitSimPipe(XBSimPipe *pipe, const XBSimDevice *device, UInt64 start);
+void XBFreeSimPipe(XBSimPipe *pipe);
+
+// The report a device sends at its pollIndex-th poll, elapsed ns after the
+// start; false if it has none to send (an idle remote)
+bool XBSimReport(const XBSimDevice *device, UInt64 pollIndex, UInt64 elapsed, void *report, UInt32 *length);
+
+SInt32 XBSimRead(XBSimPipe *pipe, void *buffer, UInt32 length, const XBSimCompletion *completion);
+void XBSimClearStall(XBSimPipe *pipe);
+void XBSimAbort(XBSimPipe *pipe);
+SInt32 XBSimClearEndpointHalt(XBSimPipe *pipe);
+bool XBSimDeviceConnected(XBSimPipe *pipe);
+void XBSimResetDevice(XBSimPipe *pipe);
+void XBSimSetResetHandler(XBSimPipe *pipe, void (*handler)(void *target), void *target);
+
+// Runs the polls up to time and returns the completions made. The time of
+// the next poll, or of the end of a reset, is when there is more to do
+UInt32 XBSimRun(XBSimPipe *pipe, UInt64 time);
+UInt64 XBSimNextEvent(XBSimPipe *pipe);
+
+#endif
@@ -0,0 +1,540 @@
+//
+//  XBTraceFile.cpp
+//  XboxControllerHIDTools
+//
+//  Capture files of the report trace, see XBTraceFile.h.
+//
+
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "XBTraceFile.h"
+
+// these are the file layout, any change is a new kTraceFileVersion
+typedef int _traceFileHeaderCheck[(sizeof(XBTraceFileHeader) == 32) * 2 - 1];
+typedef int _traceBlockHeaderCheck[(sizeof(XBTraceBlockHeader) == 32) * 2 - 1];
+typedef int _traceEntryCheck[(sizeof(XBTraceEntry) == 16) * 2 - 1];
+typedef int _traceIndexEntryCheck[(sizeof(XBTraceIndexEntry) == 32) * 2 - 1];
+typedef int _traceTrailerCheck[(sizeof(XBTraceFileTrailer) == 32) * 2 - 1];
+
+#define kTracePadEntryBytes     (sizeof(XBTraceEntry) + 2 * sizeof(XBPadReport))
+
+static inline UInt32
+alignEntry(UInt32 size)
+{
+    return (size + 7) & ~7U;
+}
+
+// -- CRC-32 ------------------------------------------------
+// ----------------------------------------------------------
+
+// the zlib polynomial, 8 bytes at a time (slicing by 8)
+static UInt32 gCRCTable[8][256];
+
+static class XBTraceCRCTableBuilder
+{
+public:
+    XBTraceCRCTableBuilder()
+    {
+        for (UInt32 i = 0; i < 256; i++) {
+            
+            UInt32 crc = i;
+            
+            for (int bit = 0; bit < 8; bit++)
+                crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+            gCRCTable[0][i] = crc;
+        }
+        
+        for (UInt32 i = 0; i < 256; i++)
+            for (int slice = 1; slice < 8; slice++)
+                gCRCTable[slice][i] = (gCRCTable[slice - 1][i] >> 8) ^ gCRCTable[0][gCRCTable[slice - 1][i] & 0xFF];
+    }
+} gCRCTableBuilder;
+
+UInt32
+XBTraceCRC32(UInt32 crc, const void *data, size_t length)
+{
+    const UInt8 *bytes = (const UInt8 *)data;
+    
+    crc = ~crc;
+    
+    while (length >= 8) {
+        
+        UInt32 low, high;
+        
+        memcpy(&low, bytes, 4);
+        memcpy(&high, bytes + 4, 4);
+        low ^= crc;
+        
+        crc = gCRCTable[7][low & 0xFF] ^ gCRCTable[6][(low >> 8) & 0xFF] ^
+              gCRCTable[5][(low >> 16) & 0xFF] ^ gCRCTable[4][low >> 24] ^
+              gCRCTable[3][high & 0xFF] ^ gCRCTable[2][(high >> 8) & 0xFF] ^
+              gCRCTable[1][(high >> 16) & 0xFF] ^ gCRCTable[0][high >> 24];
+        
+        bytes += 8;
+        length -= 8;
+    }
+    
+    while (length--)
+        crc = (crc >> 8) ^ gCRCTable[0][(crc ^ *bytes++) & 0xFF];
+    
+    return ~crc;
+}
+
+// -- writer ------------------------------------------------
+// ----------------------------------------------------------
+
+static bool
+writeBytes(XBTraceWriter *writer, const void *data, size_t length)
+{
+    if (!writer->failed && fwrite(data, 1, length, writer->file) != length)
+        writer->failed = true;
+    return !writer->failed;
+}
+
+static bool
+flushBlock(XBTraceWriter *writer)
+{
+    XBTraceBlockHeader header;
+    XBTraceIndexEntry *entry;
+    
+    if (!writer->count)
+        return !writer->failed;
+    
+    if (writer->blockCount == writer->indexCapacity) {
+        
+        UInt64 capacity = writer->indexCapacity ? writer->indexCapacity * 2 : 1024;
+        XBTraceIndexEntry *index = (XBTraceIndexEntry *)realloc(writer->index, capacity * sizeof(XBTraceIndexEntry));
+        
+        if (!index) {
+            writer->failed = true;
+            return false;
+        }
+        writer->index = index;
+        writer->indexCapacity = capacity;
+    }
+    
+    header.magic = kTraceBlockMagic;
+    header.payloadSize = writer->payloadSize;
+    header.count = writer->count;
+    header.crc = XBTraceCRC32(0, writer->payload, writer->payloadSize);
+    header.firstTime = writer->firstTime;
+    header.lastTime = writer->lastTime;
+    
+    entry = &writer->index[writer->blockCount++];
+    entry->offset = writer->offset;
+    entry->firstTime = writer->firstTime;
+    entry->lastTime = writer->lastTime;
+    entry->count = writer->count;
+    entry->payloadSize = writer->payloadSize;
+    
+    writeBytes(writer, &header, sizeof(header));
+    writeBytes(writer, writer->payload, writer->payloadSize);
+    
+    writer->offset += sizeof(header) + writer->payloadSize;
+    writer->payloadSize = 0;
+    writer->count = 0;
+    return !writer->failed;
+}
+
+bool
+XBOpenTraceWriter(XBTraceWriter *writer, const char *path)
+{
+    XBTraceFileHeader header;
+    
+    memset(writer, 0, sizeof(XBTraceWriter));
+    
+    writer->payload = (UInt8 *)malloc(kTraceBlockBytes);
+    if (!writer->payload)
+        return false;
+    
+    writer->file = fopen(path, "wb");
+    if (!writer->file) {
+        free(writer->payload);
+        writer->payload = NULL;
+        return false;
+    }
+    
+    memset(&header, 0, sizeof(header));
+    header.magic = kTraceFileMagic;
+    header.version = kTraceFileVersion;
+    header.recordVersion = kTraceFormatVersion;
+    header.blockBytes = kTraceBlockBytes;
+    
+    writer->offset = sizeof(header);
+    if (!writeBytes(writer, &header, sizeof(header))) {
+        fclose(writer->file);
+        free(writer->payload);
+        memset(writer, 0, sizeof(XBTraceWriter));
+        return false;
+    }
+    
+    return true;
+}
+
+bool
+XBTraceWrite(XBTraceWriter *writer, const XBTraceRecord *record)
+{
+    XBTraceEntry entry;
+    UInt32 length = record->length < kTraceReportBytes ? record->length : kTraceReportBytes;
+    UInt32 size;
+    UInt8 *out;
+    
+    if (writer->failed || (writer->recordCount && record->timeStamp < writer->lastTime))
+        return false;
+    
+    entry.locationID = record->locationID;
+    entry.status = record->status;
+    entry.flags = record->flags;
+    entry.length = length;
+    entry.reserved = 0;
+    
+    if (length == sizeof(XBPadReport) && !(record->flags & kTraceRecordOutput)) {
+        entry.kind = kTraceEntryPad;
+        size = kTracePadEntryBytes;
+    } else {
+        entry.kind = kTraceEntryReport;
+        size = alignEntry(sizeof(XBTraceEntry) + ((record->flags & kTraceRecordOutput) ? length : 2 * length));
+    }
+    
+    if (writer->count && (writer->payloadSize + size > kTraceBlockBytes ||
+                          record->timeStamp - writer->firstTime > kTraceBlockSpan))
+        if (!flushBlock(writer))
+            return false;
+    
+    if (!writer->count)
+        writer->firstTime = record->timeStamp;
+    
+    entry.timeOffset = (UInt32)(record->timeStamp - writer->firstTime);
+    
+    out = writer->payload + writer->payloadSize;
+    memset(out, 0, size);
+    memcpy(out, &entry, sizeof(entry));
+    memcpy(out + sizeof(entry), record->raw, length);
+    if (!(record->flags & kTraceRecordOutput))
+        memcpy(out + sizeof(entry) + length, record->transformed, length);
+    
+    writer->payloadSize += size;
+    writer->count++;
+    writer->lastTime = record->timeStamp;
+    writer->recordCount++;
+    return true;
+}
+
+bool
+XBCloseTraceWriter(XBTraceWriter *writer)
+{
+    XBTraceFileTrailer trailer;
+    bool written;
+    
+    if (!writer->file)
+        return false;
+    
+    flushBlock(writer);
+    
+    trailer.indexOffset = writer->offset;
+    trailer.blockCount = writer->blockCount;
+    trailer.recordCount = writer->recordCount;
+    trailer.crc = XBTraceCRC32(0, writer->index, writer->blockCount * sizeof(XBTraceIndexEntry));
+    trailer.magic = kTraceIndexMagic;
+    
+    writeBytes(writer, writer->index, writer->blockCount * sizeof(XBTraceIndexEntry));
+    writeBytes(writer, &trailer, sizeof(trailer));
+    
+    written = !writer->failed;
+    if (fclose(writer->file) != 0)
+        written = false;
+    
+    free(writer->payload);
+    free(writer->index);
+    memset(writer, 0, sizeof(XBTraceWriter));
+    return written;
+}
+
+// -- reader ------------------------------------------------
+// ----------------------------------------------------------
+
+static inline UInt32
+entrySize(const XBTraceEntry *entry)
+{
+    if (entry->kind == kTraceEntryPad)
+        return kTracePadEntryBytes;
+    return alignEntry(sizeof(XBTraceEntry) + ((entry->flags & kTraceRecordOutput) ? entry->length : 2 * entry->length));
+}
+
+// the index as the trailer describes it, or NULL if the file didn't get one
+static const XBTraceIndexEntry *
+trailerIndex(const XBTraceReader *reader, const XBTraceFileTrailer **trailerOut)
+{
+    const XBTraceFileTrailer *trailer;
+    UInt64 indexBytes;
+    
+    if (reader->size < sizeof(XBTraceFileHeader) + sizeof(XBTraceFileTrailer))
+        return NULL;
+    
+    trailer = (const XBTraceFileTrailer *)(reader->base + reader->size - sizeof(XBTraceFileTrailer));
+    if (trailer->magic != kTraceIndexMagic || trailer->blockCount > reader->size / sizeof(XBTraceIndexEntry))
+        return NULL;
+    
+    // the index ends at the trailer; compared without adding, so no indexOffset wraps around to it
+    indexBytes = trailer->blockCount * sizeof(XBTraceIndexEntry);
+    if (indexBytes > reader->size - sizeof(XBTraceFileTrailer) ||
+        trailer->indexOffset < sizeof(XBTraceFileHeader) || trailer->indexOffset % 8 != 0 ||
+        trailer->indexOffset != reader->size - sizeof(XBTraceFileTrailer) - indexBytes)
+        return NULL;
+    
+    if (XBTraceCRC32(0, reader->base + trailer->indexOffset, indexBytes) != trailer->crc)
+        return NULL;
+    
+    *trailerOut = trailer;
+    return (const XBTraceIndexEntry *)(reader->base + trailer->indexOffset);
+}
+
+// index the blocks one by one, up to the first that isn't all there
+static bool
+rebuildIndex(XBTraceReader *reader)
+{
+    UInt64 offset = sizeof(XBTraceFileHeader);
+    UInt64 capacity = 0;
+    
+    while (offset + sizeof(XBTraceBlockHeader) <= reader->size) {
+        
+        const XBTraceBlockHeader *header = (const XBTraceBlockHeader *)(reader->base + offset);
+        XBTraceIndexEntry *entry;
+        
+        if (header->magic != kTraceBlockMagic || header->payloadSize > kTraceBlockBytes ||
+            offset + sizeof(XBTraceBlockHeader) + header->payloadSize > reader->size)
+            break;
+        
+        if (reader->blockCount == capacity) {
+            
+            XBTraceIndexEntry *index;
+            
+            capacity = capacity ? capacity * 2 : 1024;
+            index = (XBTraceIndexEntry *)realloc(reader->rebuiltIndex, capacity * sizeof(XBTraceIndexEntry));
+            if (!index)
+                return false;
+            reader->rebuiltIndex = index;
+        }
+        
+        entry = &reader->rebuiltIndex[reader->blockCount++];
+        entry->offset = offset;
+        entry->firstTime = header->firstTime;
+        entry->lastTime = header->lastTime;
+        entry->count = header->count;
+        entry->payloadSize = header->payloadSize;
+        
+        reader->recordCount += header->count;
+        offset += sizeof(XBTraceBlockHeader) + header->payloadSize;
+    }
+    
+    reader->index = reader->rebuiltIndex;
+    reader->recovered = true;
+    return true;
+}
+
+bool
+XBOpenTraceReader(XBTraceReader *reader, const char *path)
+{
+    const XBTraceFileHeader *header;
+    const XBTraceFileTrailer *trailer;
+    struct stat status;
+    void *base;
+    int fd;
+    
+    memset(reader, 0, sizeof(XBTraceReader));
+    
+    fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    
+    if (fstat(fd, &status) != 0 || (UInt64)status.st_size < sizeof(XBTraceFileHeader)) {
+        close(fd);
+        return false;
+    }
+    
+    // the mapping keeps the file open
+    base = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (base == MAP_FAILED)
+        return false;
+    
+    reader->base = (const UInt8 *)base;
+    reader->size = status.st_size;
+    
+    header = (const XBTraceFileHeader *)reader->base;
+    if (header->magic != kTraceFileMagic || header->version != kTraceFileVersion) {
+        XBCloseTraceReader(reader);
+        return false;
+    }
+    reader->recordVersion = header->recordVersion;
+    
+    reader->index = trailerIndex(reader, &trailer);
+    if (reader->index) {
+        reader->blockCount = trailer->blockCount;
+        reader->recordCount = trailer->recordCount;
+    } else if (!rebuildIndex(reader)) {
+        XBCloseTraceReader(reader);
+        return false;
+    }
+    
+    madvise((void *)reader->base, reader->size, MADV_SEQUENTIAL);
+    return true;
+}
+
+void
+XBCloseTraceReader(XBTraceReader *reader)
+{
+    if (reader->base)
+        munmap((void *)reader->base, reader->size);
+    free(reader->rebuiltIndex);
+    memset(reader, 0, sizeof(XBTraceReader));
+}
+
+UInt64
+XBTraceFindBlock(const XBTraceReader *reader, UInt64 time)
+{
+    UInt64 low = 0, high = reader->blockCount;
+    
+    while (low < high) {
+        
+        UInt64 middle = low + (high - low) / 2;
+        
+        if (reader->index[middle].lastTime < time)
+            low = middle + 1;
+        else
+            high = middle;
+    }
+    
+    return low;
+}
+
+// checks the next block against the index and its CRC, and makes it current
+static bool
+loadBlock(XBTraceCursor *cursor)
+{
+    const XBTraceReader *reader = cursor->reader;
+    const XBTraceIndexEntry *entry = &reader->index[cursor->block++];
+    const XBTraceBlockHeader *header;
+    const UInt8 *payload;
+    
+    cursor->remaining = 0;
+    
+    // the index's CRC doesn't make its offsets sane; checked without adding, like the trailer's
+    if (entry->offset % 8 != 0 || entry->payloadSize > kTraceBlockBytes || entry->offset > reader->size ||
+        reader->size - entry->offset < sizeof(XBTraceBlockHeader) + entry->payloadSize)
+        return false;
+    
+    header = (const XBTraceBlockHeader *)(reader->base + entry->offset);
+    payload = (const UInt8 *)(header + 1);
+    
+    if (header->magic != kTraceBlockMagic || header->payloadSize != entry->payloadSize ||
+        header->count != entry->count || header->firstTime != entry->firstTime ||
+        XBTraceCRC32(0, payload, header->payloadSize) != header->crc)
+        return false;
+    
+    cursor->next = payload;
+    cursor->end = payload + header->payloadSize;
+    cursor->firstTime = header->firstTime;
+    cursor->remaining = header->count;
+    return true;
+}
+
+// the next entry, or NULL if it runs past the block
+static const XBTraceEntry *
+peekEntry(const XBTraceCursor *cursor)
+{
+    const XBTraceEntry *entry = (const XBTraceEntry *)cursor->next;
+    
+    if ((size_t)(cursor->end - cursor->next) < sizeof(XBTraceEntry) ||
+        (entry->kind != kTraceEntryPad && entry->kind != kTraceEntryReport) ||
+        entry->length > kTraceReportBytes ||
+        (entry->kind == kTraceEntryPad && entry->length != sizeof(XBPadReport)) ||
+        (size_t)(cursor->end - cursor->next) < entrySize(entry))
+        return NULL;
+    
+    return entry;
+}
+
+void
+XBTraceSeek(XBTraceCursor *cursor, const XBTraceReader *reader, UInt64 time)
+{
+    memset(cursor, 0, sizeof(XBTraceCursor));
+    cursor->reader = reader;
+    cursor->block = XBTraceFindBlock(reader, time);
+    
+    if (cursor->block == reader->blockCount)
+        return;
+    
+    if (!loadBlock(cursor)) {
+        cursor->corrupt = true;
+        return;
+    }
+    
+    // the block ends at or after time, so this stops inside it
+    while (cursor->remaining) {
+        
+        const XBTraceEntry *entry = peekEntry(cursor);
+        
+        if (!entry)
+            break;
+        if (cursor->firstTime + entry->timeOffset >= time)
+            return;
+        
+        cursor->next += entrySize(entry);
+        cursor->remaining--;
+    }
+}
+
+XBTraceReadResult
+XBTraceNext(XBTraceCursor *cursor, XBTraceRecord *record)
+{
+    const XBTraceReader *reader = cursor->reader;
+    
+    for (;;) {
+        
+        if (cursor->corrupt) {
+            cursor->corrupt = false;
+            return kTraceReadCorrupt;
+        }
+        
+        if (cursor->remaining) {
+            
+            const XBTraceEntry *entry = peekEntry(cursor);
+            const UInt8 *reports;
+            
+            // the CRC matched, so the writer got this wrong; skip the rest of the block
+            if (!entry) {
+                cursor->remaining = 0;
+                return kTraceReadCorrupt;
+            }
+            
+            reports = cursor->next + sizeof(XBTraceEntry);
+            
+            memset(record, 0, sizeof(XBTraceRecord));
+            record->timeStamp = cursor->firstTime + entry->timeOffset;
+            record->locationID = entry->locationID;
+            record->status = entry->status;
+            record->length = entry->length;
+            record->flags = entry->flags;
+            record->version = reader->recordVersion;
+            memcpy(record->raw, reports, entry->length);
+            if (!(entry->flags & kTraceRecordOutput))
+                memcpy(record->transformed, reports + entry->length, entry->length);
+            
+            cursor->next += entrySize(entry);
+            cursor->remaining--;
+            return kTraceReadRecord;
+        }
+        
+        if (cursor->block >= reader->blockCount)
+            return kTraceReadEnd;
+        
+        if (!loadBlock(cursor))
+            cursor->corrupt = true;
+    }
+}
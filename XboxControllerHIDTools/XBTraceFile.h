@@ -0,0 +1,172 @@
+//
+//  XBTraceFile.h
+//  XboxControllerHIDTools
+//
+//  Capture files of the report trace. Records are grouped into blocks of at
+//  most kTraceBlockBytes, each with its time range and a CRC, and an index of
+//  the blocks closes the file, so a reader can map a long capture and seek by
+//  time without scanning it. The layout is in README.md.
+//
+
+#ifndef XboxControllerHIDTools_XBTraceFile_h
+#define XboxControllerHIDTools_XBTraceFile_h
+
+#include <stdio.h>
+
+#include "XboxControllerHIDCore.h"
+
+#define kTraceFileMagic         0x46544258  // 'XBTF', first 4 bytes of the file
+#define kTraceBlockMagic        0x42544258  // 'XBTB'
+#define kTraceIndexMagic        0x49544258  // 'XBTI', last 4 bytes of a complete file
+#define kTraceFileVersion       1           // bump when the layout below changes (see README.md)
+
+#define kTraceBlockBytes        65536       // payload limit of a block
+#define kTraceBlockSpan         0xFFFFFFFFULL // ns a block can cover, entries store UInt32 offsets
+
+// entry kinds, pad reports have fixed-width entries
+enum {
+    
+    kTraceEntryPad      = 1,    // raw and transformed XBPadReport, 56 bytes in all
+    kTraceEntryReport   = 2     // raw, then transformed unless an output report, padded to 8
+};
+
+// All structures are little-endian and 8-byte aligned in the file
+
+typedef struct {
+    
+    UInt32  magic;              // kTraceFileMagic
+    UInt16  version;            // kTraceFileVersion
+    UInt16  recordVersion;      // kTraceFormatVersion of the records
+    UInt32  blockBytes;         // payload limit the writer used
+    UInt32  reserved[5];
+    
+} XBTraceFileHeader;
+
+typedef struct {
+    
+    UInt32  magic;              // kTraceBlockMagic
+    UInt32  payloadSize;        // bytes of entries after this header
+    UInt32  count;              // entries
+    UInt32  crc;                // CRC-32 of the entries
+    UInt64  firstTime;          // of the first entry, ns
+    UInt64  lastTime;           // of the last entry, ns
+    
+} XBTraceBlockHeader;
+
+typedef struct {
+    
+    UInt32  timeOffset;         // ns after the block's firstTime
+    UInt32  locationID;
+    SInt32  status;
+    UInt8   kind;               // kTraceEntry*
+    UInt8   flags;              // kTraceRecord*
+    UInt8   length;
+    UInt8   reserved;
+    
+} XBTraceEntry;
+
+typedef struct {
+    
+    UInt64  offset;             // of the block header
+    UInt64  firstTime;
+    UInt64  lastTime;
+    UInt32  count;
+    UInt32  payloadSize;
+    
+} XBTraceIndexEntry;
+
+// the last 32 bytes of a complete file, after the index
+typedef struct {
+    
+    UInt64  indexOffset;
+    UInt64  blockCount;
+    UInt64  recordCount;
+    UInt32  crc;                // CRC-32 of the index
+    UInt32  magic;              // kTraceIndexMagic
+    
+} XBTraceFileTrailer;
+
+UInt32 XBTraceCRC32(UInt32 crc, const void *data, size_t length);
+
+// -- writer ------------------------------------------------
+// ----------------------------------------------------------
+
+// Streams records out one block at a time. Memory is the open block plus the
+// index, 32 bytes per block written (about 1/2000 of the file).
+typedef struct {
+    
+    FILE *              file;
+    UInt8 *             payload;        // the open block
+    UInt32              payloadSize;
+    UInt32              count;
+    UInt64              firstTime;
+    UInt64              lastTime;       // of the last record taken
+    UInt64              offset;         // where the open block goes
+    XBTraceIndexEntry * index;
+    UInt64              blockCount;
+    UInt64              indexCapacity;
+    UInt64              recordCount;
+    bool                failed;         // an I/O error, nothing more gets written
+    
+} XBTraceWriter;
+
+bool XBOpenTraceWriter(XBTraceWriter *writer, const char *path);
+
+// Returns false if the record goes back in time, which the index can't
+// describe, or if the file can't be written. Merge several devices' drains
+// by time before writing them (each ring is in time order on its own).
+bool XBTraceWrite(XBTraceWriter *writer, const XBTraceRecord *record);
+
+// Writes the last block and the index; false if any of the file failed
+bool XBCloseTraceWriter(XBTraceWriter *writer);
+
+// -- reader ------------------------------------------------
+// ----------------------------------------------------------
+
+typedef struct {
+    
+    const UInt8 *               base;       // the file, mapped
+    UInt64                      size;
+    const XBTraceIndexEntry *   index;      // into the mapping, or rebuilt
+    XBTraceIndexEntry *         rebuiltIndex;
+    UInt64                      blockCount;
+    UInt64                      recordCount;
+    UInt16                      recordVersion;
+    bool                        recovered;  // no index, the blocks were scanned
+    
+} XBTraceReader;
+
+// Maps the file. A file without its index (the writer didn't get to close
+// it) is scanned instead, up to the first incomplete block.
+bool XBOpenTraceReader(XBTraceReader *reader, const char *path);
+void XBCloseTraceReader(XBTraceReader *reader);
+
+// The first block that ends at or after time, or blockCount if there is none
+UInt64 XBTraceFindBlock(const XBTraceReader *reader, UInt64 time);
+
+typedef enum {
+    
+    kTraceReadRecord = 0,
+    kTraceReadEnd,
+    kTraceReadCorrupt           // the block failed its checks and was skipped
+    
+} XBTraceReadResult;
+
+typedef struct {
+    
+    const XBTraceReader *   reader;
+    UInt64                  block;      // next block to load
+    const UInt8 *           next;       // next entry of the loaded block
+    const UInt8 *           end;
+    UInt64                  firstTime;
+    UInt32                  remaining;  // entries left in the loaded block
+    bool                    corrupt;    // the block at block - 1 failed to load
+    
+} XBTraceCursor;
+
+// Positions the cursor at the first record at or after time
+void XBTraceSeek(XBTraceCursor *cursor, const XBTraceReader *reader, UInt64 time);
+
+XBTraceReadResult XBTraceNext(XBTraceCursor *cursor, XBTraceRecord *record);
+
+#endif
@@ -0,0 +1,388 @@
+//
+//  XBTraceReplay.cpp
+//  XboxControllerHIDTools
+//
+//  Replays trace captures through the driver's report pipeline (XBReplay.h)
+//  with any set of pad options, to see what an option change does to
+//  recorded input, and to measure the pipeline on real traffic.
+//
+//  usage: XBTraceReplay [--realtime] [--speed X] [--parallel N]
+//                       [--option Key=Value]... [--button-map N,N,...]
+//                       [--output FILE | --output-dir DIR] [--diff] [--max-diffs N]
+//                       [--stats FILE] TRACE...
+//
+//  Options are the DeviceOptions keys (InvertYAxis=0, LeftTriggerThreshold=128,
+//  SuppressDuplicateReports=1, ...) on top of the driver's defaults. Traces are
+//  replayed as fast as possible, or at their recorded pace with --realtime;
+//  --parallel replays that many traces at once, each on its own thread. The
+//  output is a capture of the replayed reports, raw as recorded and transformed
+//  as replayed. --diff compares the replay with what was recorded and exits
+//  with 1 if anything was transformed or delivered differently. Throughput
+//  and the time spent reading, in the pipeline and writing go out as JSON.
+//
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "XBReplay.h"
+#include "XBTraceFile.h"
+
+#define kReplayBatch        1024
+
+typedef struct {
+    
+    const char *        input;
+    char                output[1024];
+    XBReplayStats       stats;
+    UInt64              differences;
+    UInt64              damagedBlocks;
+    UInt64              readTime;           // ns in each stage
+    UInt64              pipelineTime;
+    UInt64              writeTime;
+    UInt64              totalTime;
+    UInt64              maxLateness;        // --realtime: worst delay past a record's due time
+    bool                failed;
+    
+} ReplayJob;
+
+static XBReplayOptions  gOptions;
+static bool             gRealtime = false;
+static double           gSpeed = 1.0;
+static bool             gDiff = false;
+static UInt64           gMaxDiffs = 10;
+static UInt64           gDiffsPrinted = 0;
+static std::mutex       gPrintLock;
+
+static void
+usage()
+{
+    fprintf(stderr, "usage: XBTraceReplay [--realtime] [--speed X] [--parallel N]\n"
+            "                     [--option Key=Value]... [--button-map N,N,...]\n"
+            "                     [--output FILE | --output-dir DIR] [--diff] [--max-diffs N]\n"
+            "                     [--stats FILE] TRACE...\n");
+    exit(2);
+}
+
+static UInt64
+now()
+{
+    struct timespec ts;
+    
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (UInt64)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void
+sleepUntil(UInt64 time)
+{
+    struct timespec ts;
+    
+    ts.tv_sec = time / 1000000000ULL;
+    ts.tv_nsec = time % 1000000000ULL;
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+// -- options -----------------------------------------------
+// ----------------------------------------------------------
+
+static bool
+parseButtonMap(int *buttonMap, const char *list)
+{
+    for (int i = 0; i < kNumRemoteButtons; i++) {
+        
+        char *end;
+        
+        buttonMap[i] = (int)strtol(list, &end, 0);
+        if (end == list || (*end != ',' && *end != '\0') || (*end == '\0' && i != kNumRemoteButtons - 1))
+            return false;
+        list = end + 1;
+    }
+    
+    return true;
+}
+
+// -- replay ------------------------------------------------
+// ----------------------------------------------------------
+
+static void
+printDifference(const ReplayJob *job, const XBTraceRecord *recorded, const XBTraceRecord *replayed)
+{
+    std::lock_guard<std::mutex> lock(gPrintLock);
+    
+    if (gDiffsPrinted++ >= gMaxDiffs)
+        return;
+    
+    fprintf(stderr, "%s: %llu ns, location 0x%08x: flags %u -> %u\n  recorded", job->input,
+            (unsigned long long)recorded->timeStamp, recorded->locationID, recorded->flags, replayed->flags);
+    for (UInt32 i = 0; i < recorded->length; i++)
+        fprintf(stderr, " %02x", recorded->transformed[i]);
+    fprintf(stderr, "\n  replayed");
+    for (UInt32 i = 0; i < replayed->length; i++)
+        fprintf(stderr, " %02x", replayed->transformed[i]);
+    fprintf(stderr, "\n");
+}
+
+static void
+replayTrace(ReplayJob *job)
+{
+    std::vector<XBTraceRecord> recorded(kReplayBatch), replayed(kReplayBatch);
+    XBReplayer *replayer = (XBReplayer *)malloc(sizeof(XBReplayer));    // 3 KB, per thread
+    XBTraceReader reader;
+    XBTraceWriter writer;
+    XBTraceCursor cursor;
+    UInt64 start = now(), firstTime = 0;
+    bool writing = job->output[0] != '\0', more = true, first = true;
+    
+    if (!XBOpenTraceReader(&reader, job->input)) {
+        fprintf(stderr, "%s: not a trace\n", job->input);
+        job->failed = true;
+        free(replayer);
+        return;
+    }
+    
+    if (writing && !XBOpenTraceWriter(&writer, job->output)) {
+        perror(job->output);
+        job->failed = true;
+        writing = false;
+    }
+    
+    XBInitReplayer(replayer, &gOptions);
+    XBTraceSeek(&cursor, &reader, 0);
+    
+    while (more && !job->failed) {
+        
+        UInt32 count = 0;
+        UInt64 t0, t1, t2;
+        
+        // read a batch
+        t0 = now();
+        while (count < kReplayBatch) {
+            
+            XBTraceReadResult result = XBTraceNext(&cursor, &recorded[count]);
+            
+            if (result == kTraceReadEnd) {
+                more = false;
+                break;
+            }
+            if (result == kTraceReadCorrupt) {
+                job->damagedBlocks++;
+                continue;
+            }
+            count++;
+        }
+        
+        // run it through the pipeline
+        t1 = now();
+        for (UInt32 i = 0; i < count; i++) {
+            
+            if (gRealtime) {
+                
+                UInt64 due, time = now();
+                
+                if (first) {
+                    firstTime = recorded[i].timeStamp;
+                    first = false;
+                }
+                due = start + (UInt64)((recorded[i].timeStamp - firstTime) / gSpeed);
+                if (time < due)
+                    sleepUntil(due);
+                else if (time - due > job->maxLateness)
+                    job->maxLateness = time - due;
+            }
+            
+            XBReplayRecord(replayer, &recorded[i], &replayed[i]);
+            
+            if (gDiff && XBReplayDiffers(&recorded[i], &replayed[i])) {
+                job->differences++;
+                printDifference(job, &recorded[i], &replayed[i]);
+            }
+        }
+        
+        // and write it out
+        t2 = now();
+        if (writing)
+            for (UInt32 i = 0; i < count; i++)
+                XBTraceWrite(&writer, &replayed[i]);
+        
+        job->readTime += t1 - t0;
+        job->pipelineTime += t2 - t1;
+        job->writeTime += now() - t2;
+    }
+    
+    if (writing && !XBCloseTraceWriter(&writer)) {
+        fprintf(stderr, "%s: write failed\n", job->output);
+        job->failed = true;
+    }
+    
+    job->stats = replayer->stats;
+    job->totalTime = now() - start;
+    
+    XBCloseTraceReader(&reader);
+    free(replayer);
+}
+
+// -- results -----------------------------------------------
+// ----------------------------------------------------------
+
+static double
+perRecord(UInt64 time, UInt64 records)
+{
+    return records ? (double)time / records : 0;
+}
+
+static void
+printResults(FILE *out, const std::vector<ReplayJob> &jobs, int parallel, UInt64 wallTime)
+{
+    UInt64 records = 0;
+    
+    fprintf(out, "{\n  \"tool\": \"XBTraceReplay\",\n  \"mode\": \"%s\",\n  \"speed\": %.3f,\n  \"parallel\": %d,\n"
+            "  \"traces\": [", gRealtime ? "realtime" : "afap", gSpeed, parallel);
+    
+    for (size_t i = 0; i < jobs.size(); i++) {
+        
+        const ReplayJob *job = &jobs[i];
+        
+        records += job->stats.records;
+        fprintf(out, "%s\n    { \"input\": \"%s\", \"failed\": %s, \"records\": %llu, \"delivered\": %llu, "
+                "\"suppressed\": %llu, \"repeats\": %llu, \"releases\": %llu, \"passed\": %llu, "
+                "\"damagedBlocks\": %llu, \"differences\": %lld, \"seconds\": %.6f, \"recordsPerSec\": %.0f, "
+                "\"readNsPerRecord\": %.2f, \"pipelineNsPerRecord\": %.2f, \"writeNsPerRecord\": %.2f, "
+                "\"maxLatenessNs\": %llu }",
+                i ? "," : "", job->input, job->failed ? "true" : "false",
+                (unsigned long long)job->stats.records, (unsigned long long)job->stats.delivered,
+                (unsigned long long)job->stats.suppressed, (unsigned long long)job->stats.repeats,
+                (unsigned long long)job->stats.releases, (unsigned long long)job->stats.passed,
+                (unsigned long long)job->damagedBlocks, gDiff ? (long long)job->differences : -1LL,
+                job->totalTime / 1e9, job->totalTime ? job->stats.records * 1e9 / job->totalTime : 0,
+                perRecord(job->readTime, job->stats.records), perRecord(job->pipelineTime, job->stats.records),
+                perRecord(job->writeTime, job->stats.records), (unsigned long long)job->maxLateness);
+    }
+    
+    fprintf(out, "\n  ],\n  \"total\": { \"records\": %llu, \"seconds\": %.6f, \"recordsPerSec\": %.0f }\n}\n",
+            (unsigned long long)records, wallTime / 1e9, wallTime ? records * 1e9 / wallTime : 0);
+}
+
+int
+main(int argc, char **argv)
+{
+    const char *output = NULL, *outputDirectory = NULL, *statsPath = NULL;
+    std::vector<ReplayJob> jobs;
+    std::vector<std::thread> threads;
+    int parallel = 1;
+    size_t nextJob = 0;
+    std::mutex jobLock;
+    UInt64 start, differences = 0;
+    bool failed = false;
+    FILE *stats;
+    
+    XBDefaultReplayOptions(&gOptions);
+    
+    for (int i = 1; i < argc; i++) {
+        
+        const char *arg = argv[i];
+        
+        if (arg[0] != '-') {
+            ReplayJob job;
+            memset(&job, 0, sizeof(job));
+            job.input = arg;
+            jobs.push_back(job);
+            continue;
+        }
+        
+        if (!strcmp(arg, "--realtime")) {
+            gRealtime = true;
+            continue;
+        }
+        if (!strcmp(arg, "--diff")) {
+            gDiff = true;
+            continue;
+        }
+        
+        if (i + 1 == argc)
+            usage();
+        
+        if (!strcmp(arg, "--speed"))
+            gSpeed = atof(argv[++i]);
+        else if (!strcmp(arg, "--parallel"))
+            parallel = atoi(argv[++i]);
+        else if (!strcmp(arg, "--option")) {
+            if (!XBParsePadOption(&gOptions.padOptions, argv[++i])) {
+                fprintf(stderr, "unknown option %s\n", argv[i]);
+                usage();
+            }
+        }
+        else if (!strcmp(arg, "--button-map")) {
+            if (!parseButtonMap(gOptions.buttonMap, argv[++i])) {
+                fprintf(stderr, "the button map needs %d scancodes\n", kNumRemoteButtons);
+                usage();
+            }
+        }
+        else if (!strcmp(arg, "--output"))
+            output = argv[++i];
+        else if (!strcmp(arg, "--output-dir"))
+            outputDirectory = argv[++i];
+        else if (!strcmp(arg, "--max-diffs"))
+            gMaxDiffs = strtoull(argv[++i], NULL, 0);
+        else if (!strcmp(arg, "--stats"))
+            statsPath = argv[++i];
+        else
+            usage();
+    }
+    
+    if (jobs.empty() || parallel < 1 || gSpeed <= 0 || (output && (outputDirectory || jobs.size() > 1)))
+        usage();
+    
+    for (size_t i = 0; i < jobs.size(); i++) {
+        
+        const char *name = strrchr(jobs[i].input, '/');
+        
+        if (output)
+            snprintf(jobs[i].output, sizeof(jobs[i].output), "%s", output);
+        else if (outputDirectory)
+            snprintf(jobs[i].output, sizeof(jobs[i].output), "%s/%s", outputDirectory, name ? name + 1 : jobs[i].input);
+    }
+    
+    // each thread takes the next trace until there are none left
+    start = now();
+    for (int i = 0; i < parallel && i < (int)jobs.size(); i++)
+        threads.push_back(std::thread([&]() {
+            for (;;) {
+                ReplayJob *job;
+                {
+                    std::lock_guard<std::mutex> lock(jobLock);
+                    if (nextJob == jobs.size())
+                        return;
+                    job = &jobs[nextJob++];
+                }
+                replayTrace(job);
+            }
+        }));
+    for (size_t i = 0; i < threads.size(); i++)
+        threads[i].join();
+    
+    stats = statsPath ? fopen(statsPath, "w") : stdout;
+    if (!stats) {
+        perror(statsPath);
+        return 1;
+    }
+    printResults(stats, jobs, parallel, now() - start);
+    if (stats != stdout)
+        fclose(stats);
+    
+    for (size_t i = 0; i < jobs.size(); i++) {
+        differences += jobs[i].differences;
+        failed |= jobs[i].failed;
+    }
+    
+    if (gDiff)
+        fprintf(stderr, "%llu difference(s)\n", (unsigned long long)differences);
+    
+    return failed || differences ? 1 : 0;
+}